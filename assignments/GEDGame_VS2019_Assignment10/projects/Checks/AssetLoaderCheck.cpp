@@ -0,0 +1,127 @@
+#include "Checks.h"
+
+#include "AssetLoader.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	// Stands in for the D3D11 device, which may only be used by the thread calling AssetLoader::upload
+	struct FakeDevice
+	{
+		std::thread::id owner = std::this_thread::get_id();
+		std::atomic<int> resources{ 0 };
+		std::atomic<int> foreign_calls{ 0 };
+
+		bool create(std::chrono::milliseconds duration)
+		{
+			if (std::this_thread::get_id() != owner)
+				foreign_calls++;
+			std::this_thread::sleep_for(duration);
+			resources++;
+			return true;
+		}
+	};
+
+	// Calls upload once per frame until every job is done, returns the frames it took or -1 if a frame ran over
+	int run_frames(AssetLoader& loader, std::chrono::microseconds budget, std::chrono::microseconds longest_step)
+	{
+		int frames = 0;
+		while (loader.get_pending_count() > 0)
+		{
+			std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+			loader.upload(budget);
+			if (std::chrono::steady_clock::now() - begin > budget + longest_step + std::chrono::milliseconds(20))
+				return -1;
+			frames++;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return frames;
+	}
+}
+
+bool check_asset_loader(int argc, _TCHAR* argv[])
+{
+	bool result = true;
+	FakeDevice device;
+	const std::chrono::microseconds budget(4000);
+
+	// Every tenth load fails, the loads run on the workers and the uploads on this thread within the budget
+	{
+		AssetLoader loader;
+		loader.start(3);
+		std::atomic<int> loads(0);
+		for (int i = 0; i < 50; i++)
+			loader.enqueue(
+				[&loads, i] { std::this_thread::sleep_for(std::chrono::milliseconds(2)); loads++; return i % 10 != 3; },
+				[&device] { return device.create(std::chrono::milliseconds(3)); });
+
+		int frames = run_frames(loader, budget, std::chrono::milliseconds(3));
+		result &= expect(frames > 1, "The uploads have to keep within the budget of a frame");
+		result &= expect(loads == 50 && device.resources == 45, "Only the uploads of the successful loads may run");
+		result &= expect(loader.get_failed_count() == 5, "Every failed load has to be counted");
+		std::cout << "  50 jobs uploaded in " << frames << " frames" << std::endl;
+	}
+
+	// A job with several upload steps, like the terrain, runs them in order and over several frames
+	{
+		device.resources = 0;
+		AssetLoader loader;
+		loader.start(2);
+		std::vector<int> order;
+		std::vector<AssetLoader::Step> steps;
+		for (int i = 0; i < 4; i++)
+			steps.push_back([&device, &order, i] { order.push_back(i); return device.create(std::chrono::milliseconds(3)); });
+		loader.enqueue([] { return true; }, steps);
+
+		// The second step fails, which drops the remaining two
+		int attempts = 0;
+		loader.enqueue([] { return true; }, std::vector<AssetLoader::Step>{
+			[&attempts] { attempts++; return true; },
+			[&attempts] { attempts++; return false; },
+			[&attempts] { attempts++; return true; },
+			[&attempts] { attempts++; return true; } });
+
+		int frames = run_frames(loader, std::chrono::microseconds(1000), std::chrono::milliseconds(3));
+		result &= expect(frames >= 2, "The upload steps of a job have to be spread over several frames");
+		result &= expect(order == std::vector<int>({ 0, 1, 2, 3 }) && device.resources == 4, "The upload steps of a job have to run in order");
+		result &= expect(attempts == 2 && loader.get_failed_count() == 1, "A failed upload step has to drop the remaining steps of its job and count it once");
+		std::cout << "  4 upload steps of one job in " << frames << " frames" << std::endl;
+	}
+
+	// Stopping drops the queued jobs and the loaded ones which were not uploaded
+	{
+		device.resources = 0;
+		AssetLoader loader;
+		loader.start(2);
+		for (int i = 0; i < 100; i++)
+			loader.enqueue(
+				[] { std::this_thread::sleep_for(std::chrono::milliseconds(1)); return true; },
+				[&device] { return device.create(std::chrono::milliseconds(0)); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		loader.upload(std::chrono::microseconds(0));
+		loader.stop();
+		result &= expect(loader.get_pending_count() == 0, "Stopping has to drop the pending jobs");
+		result &= expect(loader.upload(budget) == 0 && device.resources < 100, "Nothing may be uploaded after stopping");
+
+		// A load throwing anything counts as failed and the loader keeps going
+		loader.start(1);
+		loader.enqueue([]() -> bool { throw std::runtime_error("fake load"); }, [] { return true; });
+		loader.enqueue([]() -> bool { throw 1; }, [] { return true; });
+		loader.enqueue([] { return true; }, [&device] { return device.create(std::chrono::milliseconds(0)); });
+		run_frames(loader, budget, std::chrono::milliseconds(0));
+		result &= expect(loader.get_failed_count() == 2, "A throwing load has to be counted as failed");
+	}
+
+	result &= expect(device.foreign_calls == 0, "The device may only be used by the thread calling upload");
+
+	// read_file reports missing files
+	std::vector<uint8_t> data;
+	result &= expect(!AssetLoader::read_file(L"does_not_exist.dds", data), "Reading a missing file has to fail");
+
+	return result;
+}
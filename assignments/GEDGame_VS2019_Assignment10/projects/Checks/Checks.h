@@ -0,0 +1,30 @@
+#pragma once
+
+#define NOMINMAX // prevents overlap of Windows.h with the std
+
+#include <Windows.h>
+#include <tchar.h>
+#include <iostream>
+
+// Headless checks of code which is otherwise only compiled or run inside the game
+// Every check prints what it found and returns false if anything did not hold
+
+// Prints "FAILED: " and the description if the condition does not hold, returns the condition
+bool expect(bool condition, const char* description);
+
+// AssetLoader with a fake device: loads on the workers, uploads on the calling thread within the budget, jobs with
+// several upload steps, failures and stopping
+bool check_asset_loader(int argc, _TCHAR* argv[]);
+
+// SimpleImage from ImageUtils.h: fill, pixel and row access, transform and saving a PNG
+bool check_image_utils(int argc, _TCHAR* argv[]);
+
+// Replays a camera path recorded in the game with 'P' through TerrainLod::cull with and without the horizon test
+// Arguments: [camera path, camera_path.txt by default] [heightmap the path was recorded on, made up by default]
+bool check_lod_replay(int argc, _TCHAR* argv[]);
+
+// The chunk indices TerrainLod shares between all chunks, expanded like TerrainVS for several resolutions and views: no cracks, full coverage, one winding
+bool check_terrain_lod(int argc, _TCHAR* argv[]);
+
+// TerrainQuery against the triangles TerrainLod draws at LOD 0: segment intersections by brute force and the heights
+bool check_terrain_query(int argc, _TCHAR* argv[]);
@@ -0,0 +1,130 @@
+#include "Checks.h"
+
+#include <ImageUtils.h>
+
+#include <cmath>
+#include <vector>
+
+namespace GEDUtils
+{
+	// ImageUtils.h only declares the WIC reference counter, GEDUtils.lib is not linked here
+	static int wic_references = 0;
+
+	void WICRef()
+	{
+		if (wic_references++ == 0)
+			CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	}
+
+	void WICUnref()
+	{
+		if (--wic_references == 0)
+			CoUninitialize();
+	}
+}
+
+using namespace GEDUtils;
+
+// Every stored value of a row survives readRow and writeRow, and a transform by the identity
+template<typename T>
+static bool check_round_trip(SimpleImage<T>& image, const char* name)
+{
+	typedef typename SimpleImage<T>::StorageType StorageType;
+
+	std::vector<StorageType> stored;
+	for (unsigned int y = 0; y < image.getHeight(); y++)
+		for (StorageType value : image.getRow(y))
+			stored.push_back(value);
+
+	std::vector<T> row(image.getWidth());
+	for (unsigned int y = 0; y < image.getHeight(); y++)
+	{
+		image.readRow(y, row.data());
+		image.writeRow(y, row.data());
+	}
+	image.transform([](const T& pixel) { return pixel; });
+
+	size_t changed = 0;
+	size_t i = 0;
+	for (unsigned int y = 0; y < image.getHeight(); y++)
+		for (StorageType value : image.getRow(y))
+			changed += value != stored[i++];
+
+	std::cout << name << ": " << changed << " of " << stored.size() << " pixels changed by the round trip" << std::endl;
+	return expect(changed == 0, "Reading and writing back a pixel has to keep its stored value");
+}
+
+bool check_image_utils(int argc, _TCHAR* argv[])
+{
+	bool result = true;
+
+	try
+	{
+		// Every combination of 8 bit RGBA values once, the alpha is the same as red
+		SimpleColorImage color(256, 256);
+		for (unsigned int y = 0; y < 256; y++)
+			for (unsigned int x = 0; x < 256; x++)
+				color.getRow(y)[x] = x | (y << 8) | ((x ^ y) << 16) | (x << 24);
+		result &= check_round_trip(color, "Color4f");
+
+		// Every 16 bit value once
+		SimpleFloatImage height(256, 256);
+		for (unsigned int y = 0; y < 256; y++)
+			for (unsigned int x = 0; x < 256; x++)
+				height.getRow(y)[x] = uint16_t(y * 256 + x);
+		result &= check_round_trip(height, "float");
+
+		// Normals are signed, so the same bytes read as [-1, 1]
+		SimpleNormalImage normal(256, 256);
+		for (unsigned int y = 0; y < 256; y++)
+			for (unsigned int x = 0; x < 256; x++)
+				normal.getRow(y)[x] = x | (y << 8) | ((x ^ y) << 16) | 0xFF000000u;
+		result &= check_round_trip(normal, "Vec3f");
+
+		normal.setPixel(0, 0, Vec3f(-1.0f, 0.0f, 1.0f));
+		result &= expect(normal.getRow(0)[0] == 0xFFFF8000u, "Vec3f(-1, 0, 1) has to be stored as (0, 128, 255, 255)");
+		Vec3f unit = normal.getPixel(0, 0);
+		result &= expect(unit.x == -1.0f && std::abs(unit.y) <= 1.0f / 127.5f && unit.z == 1.0f, "The stored (0, 128, 255) has to read as (-1, 0, 1)");
+
+		// A value set per pixel comes back from the nearest stored value
+		for (unsigned int x = 0; x < 256; x++)
+			color.setPixel(x, 0, Color4f(x / 255.0f, 1.0f - x / 255.0f, 0.5f, 1.0f));
+		for (unsigned int x = 0; x < 256; x++)
+			result &= expect(color.getRow(0)[x] == (x | ((255 - x) << 8) | (128 << 16) | 0xFF000000u), "setPixel has to round to the nearest stored value");
+
+		color.fill(Color4f(0.2f, 0.4f, 0.6f, 1.0f));
+		size_t filled = 0;
+		for (unsigned int y = 0; y < color.getHeight(); y++)
+			for (uint32_t value : color.getRow(y))
+				filled += value == 0xFF996633u;
+		result &= expect(filled == size_t(color.getWidth()) * color.getHeight(), "fill has to set every pixel to (51, 102, 153, 255)");
+
+		color.transform([](const Color4f& pixel) { return Color4f(pixel.b, pixel.g, pixel.r, pixel.a); });
+		Color4f swapped = color.getPixel(17, 42);
+		result &= expect(color.getRow(42)[17] == 0xFF336699u && std::abs(swapped.r - 0.6f) < 0.5f / 255.0f, "transform has to apply the function to every pixel");
+
+		// Saving and loading through WIC keeps every pixel
+		WCHAR temp_path[MAX_PATH];
+		GetTempPathW(MAX_PATH, temp_path);
+		std::wstring path = std::wstring(temp_path) + L"ImageUtilsCheck.png";
+		for (unsigned int x = 0; x < 256; x++)
+			color.setPixel(x, 1, Color4f(x / 255.0f, 0.0f, 1.0f, 1.0f));
+		color.saveToFile(path);
+		SimpleColorImage loaded(path);
+		DeleteFileW(path.c_str());
+		size_t different = 0;
+		for (unsigned int y = 0; y < color.getHeight(); y++)
+			for (unsigned int x = 0; x < color.getWidth(); x++)
+				different += loaded.getRow(y)[x] != color.getRow(y)[x];
+		result &= expect(loaded.getWidth() == color.getWidth() && loaded.getHeight() == color.getHeight() && different == 0,
+			"A saved PNG has to load with the same pixels");
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "ERROR: " << e.what() << std::endl;
+		return false;
+	}
+
+	std::cout << (result ? "passed" : "failed") << std::endl;
+	return result;
+}
@@ -0,0 +1,233 @@
+#include "Checks.h"
+
+#include "TerrainLod.h"
+
+#include <ImageUtils.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+	// Row major, transforms row vectors as in DirectXMath
+	struct Matrix
+	{
+		float m[4][4];
+	};
+
+	Matrix multiply(const Matrix& a, const Matrix& b)
+	{
+		Matrix result;
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++)
+				result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+		return result;
+	}
+
+	bool read_matrix(std::istream& line, Matrix& matrix)
+	{
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++)
+				line >> matrix.m[i][j];
+		return !line.fail();
+	}
+
+	// Object space position of a world space point, the world matrix being affine
+	void to_object(const Matrix& world, const float point[3], float object[3])
+	{
+		const float (*m)[4] = world.m;
+		float inverse[3][3] = {
+			{ m[1][1] * m[2][2] - m[1][2] * m[2][1], m[0][2] * m[2][1] - m[0][1] * m[2][2], m[0][1] * m[1][2] - m[0][2] * m[1][1] },
+			{ m[1][2] * m[2][0] - m[1][0] * m[2][2], m[0][0] * m[2][2] - m[0][2] * m[2][0], m[0][2] * m[1][0] - m[0][0] * m[1][2] },
+			{ m[1][0] * m[2][1] - m[1][1] * m[2][0], m[0][1] * m[2][0] - m[0][0] * m[2][1], m[0][0] * m[1][1] - m[0][1] * m[1][0] } };
+		float determinant = m[0][0] * inverse[0][0] + m[0][1] * inverse[1][0] + m[0][2] * inverse[2][0];
+
+		float relative[3] = { point[0] - m[3][0], point[1] - m[3][1], point[2] - m[3][2] };
+		for (int j = 0; j < 3; j++)
+			object[j] = (relative[0] * inverse[0][j] + relative[1] * inverse[1][j] + relative[2] * inverse[2][j]) / determinant;
+	}
+
+	struct CameraFrame
+	{
+		float eye[3];
+		Matrix world;
+		Matrix view;
+		Matrix projection;
+		float viewport_height;
+	};
+
+	// Reads the lines written by RecordCameraPath in Game.cpp, the matrices apply to the cameras after them
+	bool read_camera_path(const _TCHAR* path, float size[3], std::vector<CameraFrame>& frames)
+	{
+		FILE* file = _wfopen(path, L"r");
+		if (file == nullptr)
+			return false;
+
+		CameraFrame frame = {};
+		bool has_terrain = false;
+		bool has_projection = false;
+		bool has_world = false;
+		char buffer[1024];
+		int64_t line_number = 0;
+		while (fgets(buffer, sizeof(buffer), file) != nullptr)
+		{
+			line_number++;
+			std::istringstream line(buffer);
+			std::string name;
+			if (!(line >> name) || name[0] == '#')
+				continue;
+
+			bool valid = false;
+			if (name == "Terrain")
+				valid = has_terrain = !(line >> size[0] >> size[1] >> size[2]).fail();
+			else if (name == "Viewport")
+				valid = !(line >> frame.viewport_height).fail();
+			else if (name == "Projection")
+				valid = has_projection = read_matrix(line, frame.projection);
+			else if (name == "World")
+				valid = has_world = read_matrix(line, frame.world);
+			else if (name == "Camera")
+			{
+				valid = !(line >> frame.eye[0] >> frame.eye[1] >> frame.eye[2]).fail() && read_matrix(line, frame.view);
+				if (valid && has_terrain && has_projection && has_world)
+					frames.push_back(frame);
+			}
+
+			if (!valid)
+				std::cout << "WARNING: Skipping malformed line " << line_number << " of the camera path" << std::endl;
+		}
+		fclose(file);
+		return true;
+	}
+}
+
+bool check_lod_replay(int argc, _TCHAR* argv[])
+{
+	const _TCHAR* path = argc > 0 ? argv[0] : TEXT("camera_path.txt");
+	const _TCHAR* heightmap_path = argc > 1 ? argv[1] : nullptr;
+
+	float size[3] = {};
+	std::vector<CameraFrame> frames;
+	if (!read_camera_path(path, size, frames))
+	{
+		std::wcout << L"ERROR: Camera path could not be read: " << path << std::endl;
+		return false;
+	}
+	if (frames.empty())
+	{
+		std::cout << "ERROR: The camera path holds no camera after the Terrain, Viewport, Projection and World lines" << std::endl;
+		return false;
+	}
+
+	// The heightmap the path was recorded on, or a few overlapping waves
+	std::vector<float> heights;
+	int64_t resolution = 1025;
+	if (heightmap_path != nullptr)
+	{
+		try
+		{
+			GEDUtils::SimpleFloatImage heightmap(heightmap_path);
+			if (heightmap.getWidth() != heightmap.getHeight())
+			{
+				std::cout << "ERROR: The heightmap has to be square" << std::endl;
+				return false;
+			}
+			resolution = heightmap.getWidth();
+			heights.resize(resolution * resolution);
+			for (int64_t y = 0; y < resolution; y++)
+				heightmap.readRow(static_cast<unsigned int>(y), &heights[y * resolution]);
+		}
+		catch (const std::exception& e)
+		{
+			std::cout << "ERROR: " << e.what() << std::endl;
+			return false;
+		}
+	}
+	else
+	{
+		heights.resize(resolution * resolution);
+		for (int64_t y = 0; y < resolution; y++)
+			for (int64_t x = 0; x < resolution; x++)
+			{
+				float u = x / float(resolution - 1);
+				float v = y / float(resolution - 1);
+				heights[x + y * resolution] = 0.4f + 0.3f * std::sin(u * 17.0f) * std::cos(v * 13.0f) + 0.2f * std::sin(u * 5.0f + v * 7.0f);
+			}
+	}
+
+	TerrainPyramid pyramid;
+	TerrainLod lod;
+	std::vector<uint16_t> indices;
+	if (!pyramid.create(heights.data(), resolution) || !lod.create(pyramid, size[0], size[1], size[2], indices))
+	{
+		std::cout << "ERROR: The chunks of the terrain could not be created" << std::endl;
+		return false;
+	}
+
+	int64_t chunk_count = lod.get_chunk_count_x() * lod.get_chunk_count_y();
+	std::cout << frames.size() << " cameras over " << resolution << " x " << resolution << " heights, " << chunk_count << " chunks" << std::endl;
+	std::cout << "Camera   Frustum   Horizon   Draws" << std::endl;
+
+	bool result = true;
+	int64_t frustum_total = 0;
+	int64_t horizon_total = 0;
+	double frustum_seconds = 0.0;
+	double horizon_seconds = 0.0;
+	std::vector<TerrainDrawRange> draws;
+	std::vector<uint32_t> offsets;
+	std::vector<bool> in_frustum(chunk_count);
+	const Matrix to_object_scale = { { { 1.0f / size[0], 0, 0, 0 }, { 0, 1.0f / size[1], 0, 0 }, { 0, 0, 1.0f / size[2], 0 }, { 0, 0, 0, 1.0f } } };
+
+	for (size_t i = 0; i < frames.size(); i++)
+	{
+		// The same spaces as Terrain::update_lod
+		const CameraFrame& frame = frames[i];
+		float eye[3];
+		to_object(frame.world, frame.eye, eye);
+		for (int axis = 0; axis < 3; axis++)
+			eye[axis] *= size[axis];
+		Matrix terrain_to_clip = multiply(multiply(multiply(to_object_scale, frame.world), frame.view), frame.projection);
+		float planes[6][4];
+		TerrainLod::get_frustum_planes(terrain_to_clip.m, planes);
+
+		auto start = std::chrono::steady_clock::now();
+		int64_t frustum = lod.cull(planes, eye, nullptr);
+		auto frustum_end = std::chrono::steady_clock::now();
+		for (int64_t c = 0; c < chunk_count; c++)
+			in_frustum[c] = lod.is_visible(c % lod.get_chunk_count_x(), c / lod.get_chunk_count_x());
+
+		auto horizon_start = std::chrono::steady_clock::now();
+		int64_t horizon = lod.cull(planes, eye, &pyramid);
+		auto horizon_end = std::chrono::steady_clock::now();
+		frustum_seconds += std::chrono::duration<double>(frustum_end - start).count();
+		horizon_seconds += std::chrono::duration<double>(horizon_end - horizon_start).count();
+
+		// The horizon test only removes chunks
+		int64_t added = 0;
+		for (int64_t c = 0; c < chunk_count; c++)
+			added += lod.is_visible(c % lod.get_chunk_count_x(), c / lod.get_chunk_count_x()) && !in_frustum[c];
+		result &= expect(added == 0 && horizon <= frustum, "The horizon test must not draw chunks outside of the frustum");
+
+		// At most 2 pixels of error, as in Terrain::update_lod
+		lod.select(eye, frame.viewport_height * frame.projection.m[1][1] / (2.0f * 2.0f), draws, offsets);
+
+		frustum_total += frustum;
+		horizon_total += horizon;
+		std::cout << std::setw(6) << i << std::setw(10) << frustum << std::setw(10) << horizon << std::setw(8) << draws.size() << std::endl;
+	}
+
+	double count = static_cast<double>(frames.size());
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "Average" << std::setw(9) << frustum_total / count << std::setw(10) << horizon_total / count << " chunks, "
+		<< (frustum_total > 0 ? 100.0 * horizon_total / frustum_total : 100.0) << "% left by the horizon test" << std::endl;
+	std::cout << "Culling" << std::setw(9) << frustum_seconds / count * 1e6 << " us, with the horizon test " << horizon_seconds / count * 1e6 << " us" << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+	std::cout.precision(6);
+	std::cout << (result ? "passed" : "failed") << std::endl;
+	return result;
+}
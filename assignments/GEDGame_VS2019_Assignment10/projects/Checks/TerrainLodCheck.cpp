@@ -0,0 +1,133 @@
+#include "Checks.h"
+
+#include "TerrainLod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace
+{
+	// Expands the instanced draws of one selection the way TerrainVS does and checks that they tile the heightfield
+	bool check_selection(const TerrainLod& lod, int64_t resolution, const std::vector<uint16_t>& indices,
+		const std::vector<TerrainDrawRange>& draws, const std::vector<uint32_t>& offsets)
+	{
+		bool result = true;
+
+		for (int64_t y = 0; y < lod.get_chunk_count_y(); y++)
+			for (int64_t x = 0; x < lod.get_chunk_count_x(); x++)
+			{
+				bool balanced = (x + 1 == lod.get_chunk_count_x() || std::abs(lod.get_lod(x, y) - lod.get_lod(x + 1, y)) <= 1) &&
+					(y + 1 == lod.get_chunk_count_y() || std::abs(lod.get_lod(x, y) - lod.get_lod(x, y + 1)) <= 1);
+				if (!expect(balanced, "The LODs of neighbouring chunks may differ by at most 1"))
+					return false;
+			}
+
+		// Every edge inside the heightfield has to be shared by two triangles, every edge on its border belongs to one
+		std::map<std::pair<int64_t, int64_t>, int> edges;
+		int64_t instances = 0;
+		int64_t doubled_area = 0;
+		bool wound = true;
+		for (const TerrainDrawRange& draw : draws)
+		{
+			instances += draw.instance_count;
+			for (uint32_t instance = draw.first_instance; instance < draw.first_instance + draw.instance_count; instance++)
+			{
+				int64_t offset_x = offsets[instance] % resolution;
+				int64_t offset_y = offsets[instance] / resolution;
+				for (uint32_t i = draw.start; i < draw.start + draw.count; i += 3)
+				{
+					int64_t x[3], y[3];
+					for (int k = 0; k < 3; k++)
+					{
+						x[k] = std::min(offset_x + indices[i + k] % TerrainLod::chunk_vertices, resolution - 1);
+						y[k] = std::min(offset_y + indices[i + k] / TerrainLod::chunk_vertices, resolution - 1);
+					}
+
+					// Triangles of chunks past the border collapse onto it
+					int64_t cross = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+					wound &= cross >= 0;
+					if (cross <= 0)
+						continue;
+					doubled_area += cross;
+					for (int k = 0; k < 3; k++)
+					{
+						int64_t a = x[k] + y[k] * resolution;
+						int64_t b = x[(k + 1) % 3] + y[(k + 1) % 3] * resolution;
+						edges[std::make_pair(std::min(a, b), std::max(a, b))]++;
+					}
+				}
+			}
+		}
+		result &= expect(instances == lod.get_chunk_count_x() * lod.get_chunk_count_y(), "Every chunk has to be drawn exactly once");
+		result &= expect(wound, "All triangles have to be wound the same way");
+		result &= expect(doubled_area == 2 * (resolution - 1) * (resolution - 1), "The triangles have to cover the heightfield exactly");
+
+		int64_t cracks = 0;
+		for (const auto& edge : edges)
+		{
+			int64_t ax = edge.first.first % resolution, ay = edge.first.first / resolution;
+			int64_t bx = edge.first.second % resolution, by = edge.first.second / resolution;
+			bool border = (ax == bx && (ax == 0 || ax == resolution - 1)) || (ay == by && (ay == 0 || ay == resolution - 1));
+			if (edge.second != (border ? 1 : 2))
+				cracks++;
+		}
+		result &= expect(cracks == 0, "No edge may be open between the chunks or used more than twice");
+
+		return result;
+	}
+}
+
+bool check_terrain_lod(int argc, _TCHAR* argv[])
+{
+	const float size[3] = { 800.0f, 200.0f, 800.0f };
+	// A single quad, exactly one chunk, chunks reaching past the border and several levels of the pyramid
+	const int64_t resolutions[] = { 2, 65, 129, 300, 513, 1000 };
+
+	bool result = true;
+	for (int64_t resolution : resolutions)
+	{
+		std::mt19937 random(static_cast<unsigned>(resolution));
+		std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+		std::vector<float> heights(resolution * resolution);
+		for (int64_t y = 0; y < resolution; y++)
+			for (int64_t x = 0; x < resolution; x++)
+				heights[x + y * resolution] = 0.5f + 0.25f * std::sin(x * 0.05f) * std::cos(y * 0.03f) + 0.0005f * unit(random);
+
+		TerrainPyramid pyramid;
+		TerrainLod lod;
+		std::vector<uint16_t> indices;
+		if (!pyramid.create(heights.data(), resolution) || !lod.create(pyramid, size[0], size[1], size[2], indices))
+		{
+			std::cout << "ERROR: The chunks of a terrain of resolution " << resolution << " could not be created" << std::endl;
+			result = false;
+			continue;
+		}
+
+		// The shared buffer holds one chunk in every variant, so it does not grow with the terrain
+		bool fits = expect(*std::max_element(indices.begin(), indices.end()) < TerrainLod::chunk_vertices * TerrainLod::chunk_vertices,
+			"The shared indices have to address the vertices of a single chunk");
+
+		// Random eyes with the error of a 1080p view, a very strict error and none at all
+		std::vector<TerrainDrawRange> draws;
+		std::vector<uint32_t> offsets;
+		size_t most_draws = 0;
+		for (int view = 0; view < 6; view++)
+		{
+			float eye[3] = { (unit(random) - 0.5f) * 900.0f, unit(random) * 300.0f, (unit(random) - 0.5f) * 900.0f };
+			float distance_per_error = view == 5 ? 1e9f : 1080.0f / (4.0f * std::tan(0.3927f)) * (view == 4 ? 0.01f : 1.0f);
+			lod.select(eye, distance_per_error, draws, offsets);
+			most_draws = std::max(most_draws, draws.size());
+			fits &= check_selection(lod, resolution, indices, draws, offsets);
+		}
+
+		std::cout << "  resolution " << resolution << ": " << lod.get_chunk_count_x() * lod.get_chunk_count_y() << " chunks, "
+			<< indices.size() * sizeof(uint16_t) << " bytes of indices, at most " << most_draws << " draws "
+			<< (fits ? "passed" : "failed") << std::endl;
+		result &= fits;
+	}
+	return result;
+}
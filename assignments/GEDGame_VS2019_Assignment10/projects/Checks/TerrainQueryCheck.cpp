@@ -0,0 +1,200 @@
+#include "Checks.h"
+
+#include "TerrainLod.h"
+#include "TerrainQuery.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+
+namespace
+{
+	struct Triangle
+	{
+		float corners[3][3];
+	};
+
+	// First t in [0; 1] at which from + t direction meets the triangle, Möller-Trumbore
+	bool intersect_triangle(const float from[3], const float direction[3], const Triangle& triangle, float& t)
+	{
+		const float* a = triangle.corners[0];
+		float ab[3], ac[3], ao[3];
+		for (int k = 0; k < 3; k++)
+		{
+			ab[k] = triangle.corners[1][k] - a[k];
+			ac[k] = triangle.corners[2][k] - a[k];
+			ao[k] = from[k] - a[k];
+		}
+		float p[3] = { direction[1] * ac[2] - direction[2] * ac[1], direction[2] * ac[0] - direction[0] * ac[2], direction[0] * ac[1] - direction[1] * ac[0] };
+		float determinant = ab[0] * p[0] + ab[1] * p[1] + ab[2] * p[2];
+		if (determinant == 0.0f)
+			return false;
+		float u = (ao[0] * p[0] + ao[1] * p[1] + ao[2] * p[2]) / determinant;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		float q[3] = { ao[1] * ab[2] - ao[2] * ab[1], ao[2] * ab[0] - ao[0] * ab[2], ao[0] * ab[1] - ao[1] * ab[0] };
+		float v = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) / determinant;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		t = (ac[0] * q[0] + ac[1] * q[1] + ac[2] * q[2]) / determinant;
+		return t >= 0.0f && t <= 1.0f;
+	}
+}
+
+bool check_terrain_query(int argc, _TCHAR* argv[])
+{
+	// The last column and row of chunks reach past the border
+	const int64_t resolution = 161;
+	const float size[3] = { 800.0f, 200.0f, 800.0f };
+
+	std::mt19937 random(5);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::vector<float> heights(resolution * resolution);
+	for (int64_t y = 0; y < resolution; y++)
+		for (int64_t x = 0; x < resolution; x++)
+		{
+			float u = x / float(resolution - 1);
+			float v = y / float(resolution - 1);
+			heights[x + y * resolution] = 0.45f + 0.25f * std::sin(u * 17.0f) * std::cos(v * 13.0f) + 0.15f * std::sin(u * 5.0f + v * 7.0f) + 0.1f * unit(random);
+		}
+
+	TerrainPyramid pyramid;
+	TerrainLod lod;
+	TerrainQuery query;
+	std::vector<uint16_t> indices;
+	if (!pyramid.create(heights.data(), resolution) || !lod.create(pyramid, size[0], size[1], size[2], indices))
+	{
+		std::cout << "ERROR: The chunks of the terrain could not be created" << std::endl;
+		return false;
+	}
+	query.create(pyramid, size[0], size[1], size[2]);
+
+	bool result = true;
+
+	// Without a tolerated error every chunk is drawn at LOD 0 and none has a coarser neighbour
+	float eye[3] = { 0.0f, size[1], 0.0f };
+	std::vector<TerrainDrawRange> draws;
+	std::vector<uint32_t> offsets;
+	lod.select(eye, 1e30f, draws, offsets);
+	if (!expect(draws.size() == 1 && offsets.size() == size_t(lod.get_chunk_count_x() * lod.get_chunk_count_y()), "Every chunk has to be drawn at LOD 0 with one range"))
+		return false;
+
+	// The triangles the chunks are drawn with, clamped onto the border like TerrainVS does
+	const TerrainDrawRange& range = draws[0];
+	std::vector<Triangle> triangles;
+	std::vector<uint8_t> quad_halves((resolution - 1) * (resolution - 1), 0);
+	int64_t wrong_triangles = 0;
+	for (uint32_t offset : offsets)
+		for (uint32_t i = range.start; i < range.start + range.count; i += 3)
+		{
+			int64_t grid[3][2];
+			for (int64_t k = 0; k < 3; k++)
+			{
+				uint32_t id = indices[i + k];
+				grid[k][0] = std::min<int64_t>(offset % resolution + id % TerrainLod::chunk_vertices, resolution - 1);
+				grid[k][1] = std::min<int64_t>(offset / resolution + id / TerrainLod::chunk_vertices, resolution - 1);
+			}
+			int64_t cross = (grid[1][0] - grid[0][0]) * (grid[2][1] - grid[0][1]) - (grid[1][1] - grid[0][1]) * (grid[2][0] - grid[0][0]);
+			if (cross == 0)
+				continue;
+
+			// Has to be one of the halves of a quad split from (x + 1, y) to (x, y + 1)
+			int64_t x = std::min(std::min(grid[0][0], grid[1][0]), grid[2][0]);
+			int64_t y = std::min(std::min(grid[0][1], grid[1][1]), grid[2][1]);
+			int64_t sum = 0;
+			bool unit_quad = true;
+			for (int64_t k = 0; k < 3; k++)
+			{
+				unit_quad &= grid[k][0] - x <= 1 && grid[k][1] - y <= 1;
+				sum += grid[k][0] - x + grid[k][1] - y;
+			}
+			// The corners of the lower half sum up to 0 + 1 + 1, those of the upper half to 1 + 2 + 1
+			if (!unit_quad || (sum != 2 && sum != 4))
+				wrong_triangles++;
+			else
+				quad_halves[x + y * (resolution - 1)] += sum == 2 ? 1 : 16;
+
+			Triangle triangle;
+			for (int64_t k = 0; k < 3; k++)
+			{
+				triangle.corners[k][0] = (grid[k][0] / float(resolution - 1) - 0.5f) * size[0];
+				triangle.corners[k][1] = heights[grid[k][0] + grid[k][1] * resolution] * size[1];
+				triangle.corners[k][2] = (grid[k][1] / float(resolution - 1) - 0.5f) * size[2];
+			}
+			triangles.push_back(triangle);
+		}
+	int64_t covered = std::count(quad_halves.begin(), quad_halves.end(), uint8_t(17));
+	std::cout << triangles.size() << " triangles at LOD 0, " << wrong_triangles << " split along the other diagonal, " << covered << " of "
+		<< quad_halves.size() << " quads covered once" << std::endl;
+	result &= expect(wrong_triangles == 0 && covered == int64_t(quad_halves.size()), "LOD 0 has to split every quad like the full grid");
+
+	// Segments from above the terrain, some of them nearly vertical, against every triangle. They start above the grid,
+	// as a segment which enters the grid below the border hits where it enters, without a triangle there
+	const int64_t segment_count = 600;
+	int64_t hits = 0;
+	int64_t mismatches = 0;
+	for (int64_t s = 0; s < segment_count; s++)
+	{
+		float from[3] = { (unit(random) - 0.5f) * size[0], (1.0f + 0.5f * unit(random)) * size[1], (unit(random) - 0.5f) * size[2] };
+		float to[3] = { (unit(random) - 0.5f) * 1.2f * size[0], (1.2f * unit(random) - 0.1f) * size[1], (unit(random) - 0.5f) * 1.2f * size[2] };
+		if (s % 3 == 0)
+		{
+			to[0] = from[0] + (unit(random) - 0.5f) * 4.0f;
+			to[2] = from[2] + (unit(random) - 0.5f) * 4.0f;
+		}
+		float direction[3] = { to[0] - from[0], to[1] - from[1], to[2] - from[2] };
+		float length = std::sqrt(direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+
+		float expected = 2.0f;
+		for (const Triangle& triangle : triangles)
+		{
+			float t;
+			if (intersect_triangle(from, direction, triangle, t))
+				expected = std::min(expected, t);
+		}
+		bool expected_hit = expected <= 1.0f;
+
+		float t = 2.0f;
+		bool hit = query.intersect_segment(from, to, t);
+		hits += hit;
+		if (hit != expected_hit || (hit && std::abs(t - expected) * length > 0.01f))
+		{
+			mismatches++;
+			if (mismatches <= 3)
+				std::cout << "Segment " << s << ": query " << (hit ? t : -1.0f) << ", triangles " << (expected_hit ? expected : -1.0f) << std::endl;
+		}
+	}
+	std::cout << hits << " of " << segment_count << " segments hit, " << mismatches << " differ from the triangles" << std::endl;
+	result &= expect(mismatches == 0, "intersect_segment has to find the first triangle the segment meets");
+
+	// The batch gives exactly the single heights, also for the positions after the last 4 and beyond the border
+	const size_t count = 1003;
+	std::vector<float> x(count), z(count), batch(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		x[i] = (unit(random) - 0.5f) * 1.1f * size[0];
+		z[i] = (unit(random) - 0.5f) * 1.1f * size[2];
+	}
+	query.get_heights_bilinear(x.data(), z.data(), batch.data(), count);
+	int64_t batch_mismatches = 0;
+	for (size_t i = 0; i < count; i++)
+		if (batch[i] != query.get_height_bilinear(x[i], z[i]))
+			batch_mismatches++;
+	// At the grid points both interpolations give the height itself
+	float grid_error = 0.0f;
+	for (int64_t y = 0; y < resolution; y += 7)
+		for (int64_t x = 0; x < resolution; x += 5)
+		{
+			float px = (x / float(resolution - 1) - 0.5f) * size[0];
+			float pz = (y / float(resolution - 1) - 0.5f) * size[2];
+			float height = heights[x + y * resolution] * size[1];
+			grid_error = std::max(grid_error, std::max(std::abs(query.get_height_bilinear(px, pz) - height), std::abs(query.get_height_bicubic(px, pz) - height)));
+		}
+	std::cout << "Batch heights differing from the single ones " << batch_mismatches << ", largest difference at the grid points " << grid_error << std::endl;
+	result &= expect(batch_mismatches == 0, "get_heights_bilinear has to give exactly the heights of get_height_bilinear");
+	result &= expect(grid_error <= 1e-4f * size[1], "The interpolated heights have to pass through the grid points");
+
+	std::cout << (result ? "passed" : "failed") << std::endl;
+	return result;
+}
@@ -0,0 +1,60 @@
+#include "Checks.h"
+
+#include <cstdlib>
+
+struct Check
+{
+	const char* name;
+	bool (*run)(int argc, _TCHAR* argv[]);
+	const char* arguments;
+};
+
+static const Check checks[] = {
+	{ "asset_loader", check_asset_loader, "" },
+	{ "image_utils", check_image_utils, "" },
+	{ "lod_replay", check_lod_replay, "[<camera path>] [<heightmap>]" },
+	{ "terrain_lod", check_terrain_lod, "" },
+	{ "terrain_query", check_terrain_query, "" },
+};
+
+bool expect(bool condition, const char* description)
+{
+	if (!condition)
+		std::cout << "FAILED: " << description << std::endl;
+	return condition;
+}
+
+// Compares a command line argument with an ASCII name
+static bool is_name(const _TCHAR* argument, const char* name)
+{
+	for (; *name != 0; argument++, name++)
+		if (*argument != _TCHAR(*name))
+			return false;
+	return *argument == 0;
+}
+
+// Without arguments every check runs with its defaults, otherwise only the named one with the remaining arguments
+int _tmain(int argc, _TCHAR* argv[])
+{
+	if (argc > 1)
+	{
+		for (const Check& check : checks)
+			if (is_name(argv[1], check.name))
+				return check.run(argc - 2, argv + 2) ? EXIT_SUCCESS : EXIT_FAILURE;
+
+		std::cout << "Usage: Checks.exe [<check> <arguments>]" << std::endl;
+		for (const Check& check : checks)
+			std::cout << "  " << check.name << " " << check.arguments << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	int failed = 0;
+	for (const Check& check : checks)
+	{
+		std::cout << check.name << ":" << std::endl;
+		if (!check.run(0, argv + argc))
+			failed++;
+	}
+	std::cout << failed << " of " << sizeof(checks) / sizeof(checks[0]) << " checks failed" << std::endl;
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -5,6 +5,7 @@
 static const float3 light = float3(1.000000, 0.948336, 0.880797); // Sun color
 static const float3 ambient = float3(0.025525, 0.045511, 0.088005); // Sky color
 static const float mesh_specularity = 0.2;
+static const uint chunk_vertices = 65; // TerrainLod::chunk_vertices
 
 //--------------------------------------------------------------------------------------
 // Shader resources
@@ -184,17 +185,20 @@ float4 SimplePS(PosTexLi Input) : SV_Target0
 	//return float4(Input.normal, 1);
 }
 
-PosTex TerrainVS(uint VertexID : SV_VertexID)
+// VertexID indexes the vertices of one chunk, ChunkOffset is the vertex id of the chunk's first vertex
+// Chunks reaching past the border are clamped onto it
+PosTex TerrainVS(uint VertexID : SV_VertexID, uint ChunkOffset : CHUNK_OFFSET)
 {
     PosTex output = (PosTex) 0;
 	
-    output.Tex.x = VertexID % g_TerrainRes;
-    output.Tex.y = (uint) (VertexID / g_TerrainRes);
+    uint res = (uint) g_TerrainRes;
+    uint x = min(ChunkOffset % res + VertexID % chunk_vertices, res - 1);
+    uint y = min(ChunkOffset / res + VertexID / chunk_vertices, res - 1);
 	
-    output.Tex /= g_TerrainRes - 1;
+    output.Tex = float2(x, y) / (g_TerrainRes - 1);
 	
     output.Pos.x = output.Tex.x - 0.5f;
-    output.Pos.y = g_HeightMap[VertexID];
+    output.Pos.y = g_HeightMap[x + y * res];
     output.Pos.z = output.Tex.y - 0.5f;
     output.Pos.w = 1;
     output.Pos = mul(output.Pos, g_WorldViewProjection);
@@ -0,0 +1,184 @@
+#include "AssetLoader.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <exception>
+#include <iostream>
+#include <iterator>
+
+// The workers take the jobs from the front of jobs, run their load step without holding the lock and append the
+// job to completions. upload() runs one upload step at a time from the job at the front of completions, so a single
+// slow upload, such as a large texture, only delays the frame it runs in and the uploads of the following frames keep
+// within their budget
+
+AssetLoader::AssetLoader()
+{
+}
+
+AssetLoader::~AssetLoader()
+{
+	stop();
+}
+
+void AssetLoader::start(unsigned int thread_count)
+{
+	stop();
+
+	if (thread_count == 0)
+		thread_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	stopping = false;
+	for (unsigned int i = 0; i < thread_count; i++)
+		workers.emplace_back(&AssetLoader::work, this);
+}
+
+void AssetLoader::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		jobs.clear();
+	}
+	job_added.notify_all();
+
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	completions.clear();
+	pending = 0;
+}
+
+void AssetLoader::enqueue(Step load, Step upload)
+{
+	std::vector<Step> uploads;
+	uploads.push_back(std::move(upload));
+	enqueue(std::move(load), std::move(uploads));
+}
+
+void AssetLoader::enqueue(Step load, std::vector<Step> uploads)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back({ std::move(load), std::deque<Step>(std::make_move_iterator(uploads.begin()), std::make_move_iterator(uploads.end())) });
+		pending++;
+	}
+	job_added.notify_one();
+}
+
+size_t AssetLoader::upload(std::chrono::microseconds budget)
+{
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	size_t uploaded = 0;
+	while (uploaded == 0 || std::chrono::steady_clock::now() - begin < budget)
+	{
+		// Only this thread removes jobs from completions, so the job stays at the front while its step runs
+		Step step;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (completions.empty())
+				break;
+			std::deque<Step>& uploads = completions.front().uploads;
+			if (!uploads.empty())
+			{
+				step = std::move(uploads.front());
+				uploads.pop_front();
+			}
+		}
+
+		bool succeeded = !step || step();
+		if (step)
+			uploaded++;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		// The step may have stopped the loader, which drops the job
+		if (completions.empty())
+			break;
+		if (!succeeded || completions.front().uploads.empty())
+		{
+			completions.pop_front();
+			pending--;
+			if (!succeeded)
+				failed++;
+		}
+	}
+	return uploaded;
+}
+
+size_t AssetLoader::get_pending_count() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return pending;
+}
+
+size_t AssetLoader::get_failed_count() const
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return failed;
+}
+
+bool AssetLoader::read_file(const std::wstring& filename, std::vector<uint8_t>& data)
+{
+	FILE* file = nullptr;
+	if (_wfopen_s(&file, filename.c_str(), L"rb") != 0 || file == nullptr)
+	{
+		std::wcerr << L"ERROR: Could not open " << filename << std::endl;
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	data.resize(size > 0 ? size : 0);
+	bool complete = fread(data.data(), 1, data.size(), file) == data.size();
+	fclose(file);
+
+	if (!complete)
+		std::wcerr << L"ERROR: Could not read " << filename << std::endl;
+	return complete;
+}
+
+void AssetLoader::work()
+{
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true)
+	{
+		job_added.wait(lock, [this] { return stopping || !jobs.empty(); });
+		if (stopping)
+			return;
+
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+
+		lock.unlock();
+		bool succeeded = false;
+		try
+		{
+			succeeded = job.load();
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << "ERROR: Loading an asset failed: " << e.what() << std::endl;
+		}
+		catch (...)
+		{
+			std::cerr << "ERROR: Loading an asset failed with an unknown exception" << std::endl;
+		}
+		lock.lock();
+
+		// stop() already reset the counters of the jobs in flight
+		if (stopping)
+			return;
+		if (succeeded)
+		{
+			completions.push_back(std::move(job));
+		}
+		else
+		{
+			pending--;
+			failed++;
+		}
+	}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Loads assets in the background, see AssetLoader.cpp
+// Every job is split into a load step, which reads and decodes the files on one of the worker threads, and upload
+// steps, which create the resources on the thread calling upload(), the one owning the device context
+// A large asset brings several upload steps, which may run in different frames
+// Nothing in here touches Direct3D, the upload steps bring their own device, so a fake one is enough to run the loader
+class AssetLoader
+{
+public:
+	// All steps return whether they succeeded, the upload steps of a failed load are dropped, and so are the
+	// remaining upload steps of a job once one of them failed
+	typedef std::function<bool()> Step;
+
+	AssetLoader();
+	~AssetLoader();
+
+	// Starts thread_count workers, by default one less than the hardware threads, as the main thread keeps rendering
+	void start(unsigned int thread_count = 0);
+	// Drops the jobs which did not start loading and the loaded ones which were not uploaded, then waits for the
+	// loads in progress and stops the workers. Call before the resources the steps refer to go away
+	void stop();
+
+	// Queues a job, the jobs are loaded in the order they were queued
+	void enqueue(Step load, Step upload);
+	// Queues a job whose upload steps run one after the other, in the given order
+	void enqueue(Step load, std::vector<Step> uploads);
+
+	// Runs the upload steps of the finished loads, in the order the loads finished, until budget is spent
+	// A job whose upload steps do not fit into the budget continues in the next call
+	// At least one upload step runs if there is any, so loading always makes progress. Returns how many ran
+	size_t upload(std::chrono::microseconds budget);
+
+	// Jobs queued but not uploaded yet, and jobs whose load or one of whose upload steps failed
+	size_t get_pending_count() const;
+	size_t get_failed_count() const;
+
+	// Reads the complete file into data, for load steps which leave the decoding to the upload step
+	static bool read_file(const std::wstring& filename, std::vector<uint8_t>& data);
+
+private:
+	AssetLoader(const AssetLoader&);
+	void operator=(const AssetLoader&);
+
+	struct Job
+	{
+		Step load;
+		std::deque<Step> uploads;
+	};
+
+	void work();
+
+	mutable std::mutex mutex;
+	std::condition_variable job_added;
+	std::deque<Job> jobs;          // Waiting for a worker
+	std::deque<Job> completions;   // Loaded, waiting for upload()
+	std::vector<std::thread> workers;
+	size_t pending = 0;
+	size_t failed = 0;
+	bool stopping = false;
+};
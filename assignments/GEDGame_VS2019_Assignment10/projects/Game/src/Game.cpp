@@ -26,6 +26,7 @@
 
 #include "d3dx11effect.h"
 
+#include "AssetLoader.h"
 #include "Terrain.h"
 #include "Mesh.h"
 #include "GameEffect.h"
@@ -87,11 +88,22 @@ std::list<EnemyObject>                          g_enemyObjects;
 std::vector<SpriteVertex>                       g_sprites;
 std::vector<SpriteVertex>                       g_projectiles;
 
+// Loads the terrain and the meshes while the first frames are rendered
+AssetLoader                             g_assetLoader;
+// Time per frame for creating the D3D11 resources of the loaded assets
+const std::chrono::microseconds         g_assetUploadBudget(4000);
+
 float                                   g_timeSinceLastEnemy = 5.0f;
 bool                                    g_PlasmaGunIsReady = true;
 float                                   g_PlasmaGunTimer = 0.0f;
 bool                                    g_GatlingGunIsReady = true;
 float                                   g_GatlingGunTimer = 0.0f;
+
+// Camera path for "Checks.exe lod_replay", recorded to camera_path.txt while 'P' is toggled on
+std::ofstream                           g_cameraPath;
+// Matrices last written to the camera path, which are written again only when they change
+XMFLOAT4X4                              g_cameraPathProjection;
+XMFLOAT4X4                              g_cameraPathWorld;
 //--------------------------------------------------------------------------------------
 // UI control IDs
 //--------------------------------------------------------------------------------------
@@ -123,11 +135,13 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
                                  float fElapsedTime, void* pUserContext );
 
 bool compare(SpriteVertex& a, SpriteVertex& b, const CFirstPersonCamera& camera);
+void RecordCameraPath(CXMMATRIX view, CXMMATRIX proj, float viewportHeight);
 
 
 void InitApp();
 void DeinitApp();
 void RenderText();
+void PlaceOnTerrain();
 
 void ReleaseShader();
 HRESULT ReloadShader(ID3D11Device* pd3dDevice);
@@ -326,6 +340,9 @@ void RenderText()
     g_txtHelper->SetForegroundColor(XMVectorSet(1.0f, 1.0f, 0.0f, 1.0f));
     g_txtHelper->DrawTextLine( DXUTGetFrameStats(true)); //DXUTIsVsyncEnabled() ) );
     g_txtHelper->DrawTextLine( DXUTGetDeviceStats() );
+    g_txtHelper->DrawFormattedTextLine( L"Terrain chunks: %lld of %lld drawn", g_terrain.get_visible_chunk_count(), g_terrain.get_chunk_count() );
+    if (g_assetLoader.get_pending_count() > 0)
+        g_txtHelper->DrawFormattedTextLine( L"Loading assets: %zu left", g_assetLoader.get_pending_count() );
     g_txtHelper->End();
 }
 
@@ -382,29 +399,41 @@ HRESULT CALLBACK OnD3D11CreateDevice( ID3D11Device* pd3dDevice,
 
     V_RETURN( ReloadShader(pd3dDevice) );
     
-	// Create the terrain
-	V_RETURN(g_terrain.create(pd3dDevice));
-    
-    // Update height values
-    for (auto& g : g_gameObjects)
-        if (g.parent == g_terrainObject)
-            g.position.y += g_terrain.get_height_at(g.position.x, g.position.z);
-    
-    // Create all meshes
+    // Create the mesh input layout and the sprite renderer
     V_RETURN(Mesh::createInputLayout(pd3dDevice, g_gameEffect.meshPass1));
-    for (auto& m : g_meshes)
-        V_RETURN(m.second->create(pd3dDevice));
-
-    // Create the sprite renderer
     V_RETURN(g_spriteRenderer->create(pd3dDevice));
-    
-    // Initialize the camera
-    float center_height = g_terrain.get_height_at(0.0f, 0.0f) + 20.0f;
-	XMVECTOR vEye = XMVectorSet(0.0f, center_height, 0.0f, 0.0f);   // Camera eye is here
-    XMVECTOR vAt = XMVectorSet(1.0f, center_height, 0.0f, 1.0f);               // ... facing at this position
+
+    // Initialize the camera, PlaceOnTerrain lifts it once the terrain is there unless it was flown above the surface
+	XMVECTOR vEye = XMVectorSet(0.0f, 20.0f, 0.0f, 0.0f);   // Camera eye is here
+    XMVECTOR vAt = XMVectorSet(1.0f, 20.0f, 0.0f, 1.0f);               // ... facing at this position
     g_camera.SetViewParams(vEye, vAt); // http://msdn.microsoft.com/en-us/library/windows/desktop/bb206342%28v=vs.85%29.aspx
 	g_camera.SetScalers(g_cameraRotateScaler, g_cameraMoveScaler);
 
+    // Load the terrain and all meshes in the background, OnD3D11FrameRender creates their resources
+    // OnD3D11DestroyDevice stops the loader before the device goes away, so the upload steps may hold on to it
+    g_assetLoader.start();
+    // The terrain is uploaded in several steps, so its textures do not have to fit into the same frame as its buffers
+    auto terrain = std::make_shared<TerrainData>();
+    g_assetLoader.enqueue(
+        [terrain] { return Terrain::load(*terrain); },
+        std::vector<AssetLoader::Step>{
+            [terrain, pd3dDevice] {
+                if (FAILED(g_terrain.upload_heightfield(pd3dDevice, *terrain)))
+                    return false;
+                PlaceOnTerrain();
+                return true; },
+            [terrain, pd3dDevice] { return SUCCEEDED(g_terrain.upload_indices(pd3dDevice, g_gameEffect.pass0, *terrain)); },
+            [terrain, pd3dDevice] { return SUCCEEDED(g_terrain.upload_color_texture(pd3dDevice, *terrain)); },
+            [terrain, pd3dDevice] { return SUCCEEDED(g_terrain.upload_normal_texture(pd3dDevice, *terrain)); } });
+    for (auto& m : g_meshes)
+    {
+        std::shared_ptr<Mesh> mesh = m.second;
+        auto data = std::make_shared<MeshData>();
+        g_assetLoader.enqueue(
+            [mesh, data] { return SUCCEEDED(mesh->load(*data)); },
+            [mesh, data, pd3dDevice] { return SUCCEEDED(mesh->upload(pd3dDevice, *data)); });
+    }
+
     return S_OK;
 }
 
@@ -419,6 +448,9 @@ void CALLBACK OnD3D11DestroyDevice( void* pUserContext )
     g_dialogResourceManager.OnD3D11DestroyDevice();
     g_settingsDlg.OnD3D11DestroyDevice();
     DXUTGetGlobalResourceCache().OnDestroyDevice();
+
+    // Wait for the loads in progress and drop the others
+    g_assetLoader.stop();
     
 	// Destroy the terrain
 	g_terrain.destroy();
@@ -435,6 +467,30 @@ void CALLBACK OnD3D11DestroyDevice( void* pUserContext )
     ReleaseShader();
 }
 
+//--------------------------------------------------------------------------------------
+// Move the objects standing on the terrain onto its surface and the camera above it, once it is loaded
+//--------------------------------------------------------------------------------------
+void PlaceOnTerrain()
+{
+    // Update height values
+    for (auto& g : g_gameObjects)
+        if (g.parent == g_terrainObject)
+            g.position.y += g_terrain.get_height_at(g.position.x, g.position.z);
+
+    // The camera may have been moved while the terrain was loading, so it keeps its position and orientation
+    // and is only lifted above the surface if it ended up below it
+    const float clearance = 20.0f;
+    XMFLOAT3 eye;
+    XMStoreFloat3(&eye, g_camera.GetEyePt());
+    float surface_height = g_terrain.get_height_at(eye.x, eye.z);
+    if (eye.y < surface_height)
+    {
+        eye.y = surface_height + clearance;
+        XMVECTOR vEye = XMLoadFloat3(&eye);
+        g_camera.SetViewParams(vEye, vEye + g_camera.GetWorldAhead()); // http://msdn.microsoft.com/en-us/library/windows/desktop/bb206342%28v=vs.85%29.aspx
+    }
+}
+
 //--------------------------------------------------------------------------------------
 // Create any D3D11 resources that depend on the back buffer
 //--------------------------------------------------------------------------------------
@@ -566,6 +622,26 @@ void CALLBACK OnKeyboard( UINT nChar, bool bKeyDown, bool bAltDown, void* pUserC
         g_cameraMovement = !g_cameraMovement;
         g_camera.SetEnablePositionMovement(g_cameraMovement);
     }
+
+    if (nChar == 'P' && bKeyDown)
+    {
+        if (g_cameraPath.is_open())
+        {
+            g_cameraPath.close();
+            std::cout << "Stopped recording the camera path" << endl;
+        }
+        else
+        {
+            g_cameraPath.open("camera_path.txt");
+            g_cameraPath.precision(9);
+            g_cameraPath << "Terrain " << g_ConfigParser.get_TerrainWidth() << " " << g_ConfigParser.get_TerrainHeight() << " "
+                << g_ConfigParser.get_TerrainDepth() << "\n";
+            // The first frame writes both matrices
+            g_cameraPathProjection = XMFLOAT4X4();
+            g_cameraPathWorld = XMFLOAT4X4();
+            std::cout << "Recording the camera path to camera_path.txt" << endl;
+        }
+    }
 	
 	if(nChar == 'A' && g_PlasmaGunIsReady)
 	{
@@ -799,6 +875,9 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 
     HRESULT hr;
 
+    // Create the resources of the assets loaded in the meantime, within the time budget of the frame
+    g_assetLoader.upload(g_assetUploadBudget);
+
     // If the settings dialog is being shown, then render it instead of rendering the app's scene
     if( g_settingsDlg.IsActive() )
     {
@@ -830,9 +909,10 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 	V(g_gameEffect.lightDirEV->SetFloatVector( ( float* )&g_lightDir ));
     V(g_gameEffect.cameraPosWorldEV->SetFloatVector((float*)&g_camera.GetEyePt()));
     
-    // Render objects
+    // Render objects, those standing on the terrain once it is there
     for (const auto& o : g_gameObjects)
-        o.render(pd3dImmediateContext, view * proj);
+        if (o.parent != g_terrainObject || g_terrain.is_ready())
+            o.render(pd3dImmediateContext, view * proj);
     for (const auto& e : g_enemyObjects)
         e.render(pd3dImmediateContext, view * proj);
     
@@ -841,7 +921,10 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
 	V(g_gameEffect.worldEV->SetMatrix( ( float* )&g_terrainWorld ));
 	V(g_gameEffect.worldViewProjectionEV->SetMatrix( ( float* )&worldViewProj ));
     V(g_gameEffect.worldNormalsEV->SetMatrix( ( float* )&XMMatrixTranspose(XMMatrixInverse(nullptr, g_terrainWorld))));
+	g_terrain.update_lod(g_camera.GetEyePt(), g_terrainWorld, view * proj, g_cameraParams.fovy, static_cast<float>(DXUTGetDXGIBackBufferSurfaceDesc()->Height));
 	g_terrain.render(pd3dImmediateContext, g_gameEffect.pass0);
+    if (g_cameraPath.is_open())
+        RecordCameraPath(view, proj, static_cast<float>(DXUTGetDXGIBackBufferSurfaceDesc()->Height));
 
     // Render Sprites
 	//todo: change g_sprites to g_projectiles and make some adjustment should work
@@ -875,3 +958,45 @@ void CALLBACK OnD3D11FrameRender( ID3D11Device* pd3dDevice, ID3D11DeviceContext*
         dwTimefirst = GetTickCount();
     }
 }
+
+//--------------------------------------------------------------------------------------
+// Append the camera of this frame to the camera path, in the format read by Checks.exe lod_replay:
+// "Projection", "World" and "Camera" lines with the rows of the matrices one after another
+//--------------------------------------------------------------------------------------
+void RecordCameraPath(CXMMATRIX view, CXMMATRIX proj, float viewportHeight)
+{
+    auto write_matrix = [](const XMFLOAT4X4& m) {
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                g_cameraPath << " " << m.m[i][j];
+    };
+
+    XMFLOAT4X4 projection;
+    XMStoreFloat4x4(&projection, proj);
+    if (memcmp(&projection, &g_cameraPathProjection, sizeof(projection)) != 0)
+    {
+        g_cameraPath << "Viewport " << viewportHeight << "\n";
+        g_cameraPath << "Projection";
+        write_matrix(projection);
+        g_cameraPath << "\n";
+        g_cameraPathProjection = projection;
+    }
+
+    XMFLOAT4X4 world;
+    XMStoreFloat4x4(&world, g_terrainWorld);
+    if (memcmp(&world, &g_cameraPathWorld, sizeof(world)) != 0)
+    {
+        g_cameraPath << "World";
+        write_matrix(world);
+        g_cameraPath << "\n";
+        g_cameraPathWorld = world;
+    }
+
+    XMFLOAT3 eye;
+    XMStoreFloat3(&eye, g_camera.GetEyePt());
+    XMFLOAT4X4 viewMatrix;
+    XMStoreFloat4x4(&viewMatrix, view);
+    g_cameraPath << "Camera " << eye.x << " " << eye.y << " " << eye.z;
+    write_matrix(viewMatrix);
+    g_cameraPath << "\n";
+}
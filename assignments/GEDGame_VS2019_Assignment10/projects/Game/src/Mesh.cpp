@@ -1,5 +1,6 @@
 #include "Mesh.h"
 
+#include "AssetLoader.h"
 #include "T3d.h"
 #include <DDSTextureLoader.h>
 
@@ -46,7 +47,22 @@ Mesh::~Mesh(void)
 	destroy();
 }
 
-HRESULT Mesh::create(ID3D11Device* device)
+HRESULT Mesh::load(MeshData& data) const
+{
+	HRESULT hr;
+
+	//Read mesh
+	V_RETURN(T3d::readFromFile(filenameT3d.c_str(), data.vertexBufferData, data.indexBufferData));
+
+	//Read textures
+	V_RETURN(loadTexture(filenameDDSDiffuse, data.diffuseDDS));
+	V_RETURN(loadTexture(filenameDDSSpecular, data.specularDDS));
+	V_RETURN(loadTexture(filenameDDSGlow, data.glowDDS));
+
+	return S_OK;
+}
+
+HRESULT Mesh::upload(ID3D11Device* device, MeshData& data)
 {	
 	HRESULT hr;
 
@@ -54,47 +70,52 @@ HRESULT Mesh::create(ID3D11Device* device)
 	D3D11_SUBRESOURCE_DATA id = {0};
 	D3D11_BUFFER_DESC bd = {0};
 
-	//Read mesh
-	std::vector<T3dVertex> vertexBufferData;
-	std::vector<uint32_t> indexBufferData;
-
-	V(T3d::readFromFile(filenameT3d.c_str(), vertexBufferData, indexBufferData));
-
-	id.pSysMem = &vertexBufferData[0];
+	id.pSysMem = &data.vertexBufferData[0];
 	id.SysMemPitch = sizeof(T3dVertex); // Stride
     id.SysMemSlicePitch = 0;
 
     bd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-	bd.ByteWidth = vertexBufferData.size() * sizeof(T3dVertex);
+	bd.ByteWidth = data.vertexBufferData.size() * sizeof(T3dVertex);
     bd.CPUAccessFlags = 0;
     bd.MiscFlags = 0;
     bd.Usage = D3D11_USAGE_DEFAULT;
 
-	V(device->CreateBuffer(&bd, &id, &vertexBuffer));
+	V_RETURN(device->CreateBuffer(&bd, &id, &vertexBuffer));
 
 
-	indexCount = indexBufferData.size();
-
 	ZeroMemory(&bd, sizeof(bd));
 	bd.Usage = D3D11_USAGE_DEFAULT;
-	bd.ByteWidth = sizeof(unsigned int) * indexCount;
+	bd.ByteWidth = sizeof(unsigned int) * data.indexBufferData.size();
 	bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
 	bd.CPUAccessFlags = 0;
 	bd.MiscFlags = 0;
 	// Define initial data
 
 	ZeroMemory(&id, sizeof(id));
-	id.pSysMem = &indexBufferData[0];
+	id.pSysMem = &data.indexBufferData[0];
 	// Create Buffer
-	V(device->CreateBuffer( &bd, &id, &indexBuffer ));
+	V_RETURN(device->CreateBuffer( &bd, &id, &indexBuffer ));
 
 
 
 	// Create textures
-	V(createTexture(device, filenameDDSDiffuse, &diffuseTex, &diffuseSRV)	);
-	V(createTexture(device, filenameDDSSpecular, &specularTex, &specularSRV));
-	V(createTexture(device, filenameDDSGlow, &glowTex, &glowSRV)			);
+	V_RETURN(createTexture(device, data.diffuseDDS, &diffuseTex, &diffuseSRV)	);
+	V_RETURN(createTexture(device, data.specularDDS, &specularTex, &specularSRV));
+	V_RETURN(createTexture(device, data.glowDDS, &glowTex, &glowSRV)			);
 
+	//Set last, render() draws nothing while it is 0
+	indexCount = data.indexBufferData.size();
+
+	return S_OK;
+}
+
+HRESULT Mesh::create(ID3D11Device* device)
+{
+	HRESULT hr;
+
+	MeshData data;
+	V_RETURN(load(data));
+	V_RETURN(upload(device, data));
 
 	return S_OK;
 }
@@ -109,6 +130,7 @@ void Mesh::destroy()
 	SAFE_RELEASE(specularSRV );
 	SAFE_RELEASE(glowTex	 );
 	SAFE_RELEASE(glowSRV	 );
+	indexCount = 0;
 }
 
 HRESULT Mesh::createInputLayout(ID3D11Device* device, ID3DX11EffectPass* pass)
@@ -130,6 +152,9 @@ HRESULT Mesh::render(ID3D11DeviceContext* context, ID3DX11EffectPass* pass,
 {
 	HRESULT hr;
 
+	if (indexCount == 0)
+		return S_OK;
+
     if ((diffuseEffectVariable == nullptr) || !diffuseEffectVariable->IsValid())
     {
         throw std::exception("Diffuse EV is null or invalid");
@@ -179,14 +204,25 @@ HRESULT Mesh::loadFile(const char * filename, std::vector<uint8_t>& data)
 	return S_OK;
 }
 
-HRESULT Mesh::createTexture(ID3D11Device* device, const std::wstring& filename, ID3D11Texture2D** tex, 
-					  ID3D11ShaderResourceView** srv)
+HRESULT Mesh::loadTexture(const std::wstring& filename, std::vector<uint8_t>& data)
 {
 	if (filename == L"" || filename == L"-")
 		return S_OK;
 
+	if (!AssetLoader::read_file(filename, data))
+		return E_FAIL;
+
+	return S_OK;
+}
+
+HRESULT Mesh::createTexture(ID3D11Device* device, const std::vector<uint8_t>& data, ID3D11Texture2D** tex, 
+					  ID3D11ShaderResourceView** srv)
+{
+	if (data.empty())
+		return S_OK;
+
 	HRESULT hr;
-    V_RETURN(DirectX::CreateDDSTextureFromFile(device, filename.c_str(), (ID3D11Resource**)tex, srv));
+    V_RETURN(DirectX::CreateDDSTextureFromMemory(device, data.data(), data.size(), (ID3D11Resource**)tex, srv));
 
 	return S_OK;
 
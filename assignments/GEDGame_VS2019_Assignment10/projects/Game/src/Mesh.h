@@ -7,6 +7,17 @@
 #include <cstdint>
 #include <string>
 
+#include "T3d.h"
+
+//What Mesh::load reads from the input files, before there is anything to upload
+struct MeshData
+{
+	std::vector<T3dVertex>      vertexBufferData;
+	std::vector<uint32_t>       indexBufferData;
+	std::vector<uint8_t>        diffuseDDS; //empty if there is no such texture
+	std::vector<uint8_t>        specularDDS;
+	std::vector<uint8_t>        glowDDS;
+};
 
 //This class ecapsulates the D3D11 resources needed for a mesh
 class Mesh
@@ -28,7 +39,15 @@ public:
 	//This destructor should be called from within DeinitApp().
 	~Mesh(void);
 
-	//Creates the required D3D11 resources from the given input files.
+	//Reads the given input files into "data", without touching the mesh or the device.
+	//This function may be called from any thread, e.g. by an AssetLoader.
+	HRESULT load(MeshData& data) const;
+
+	//Creates the required D3D11 resources from "data".
+	//This function should be called from the thread rendering the mesh.
+	HRESULT upload(ID3D11Device* device, MeshData& data);
+
+	//Creates the required D3D11 resources from the given input files (load and upload at once).
 	//This function should be called from within OnD3D11CreateDevice().
 	HRESULT create(ID3D11Device* device);
 
@@ -43,7 +62,7 @@ public:
 	// Releases the input layout
 	static void destroyInputLayout();
 
-	// Render the mesh
+	// Render the mesh, does nothing until it was uploaded
 	HRESULT render(ID3D11DeviceContext* context, ID3DX11EffectPass* pass,
         ID3DX11EffectShaderResourceVariable* diffuseEffectVariable,
         ID3DX11EffectShaderResourceVariable* specularEffectVariable,
@@ -53,8 +72,11 @@ private:
 	//Reads the complete file given by "path" byte-wise into "data".
 	static HRESULT loadFile(const char * filename, std::vector<uint8_t>& data);
 
-	// Creates DX Texture Resources from File
-	static HRESULT createTexture(ID3D11Device* device, const std::wstring& filename, 
+	// Reads a DDS file, leaves "data" empty if there is no file name
+	static HRESULT loadTexture(const std::wstring& filename, std::vector<uint8_t>& data);
+
+	// Creates DX Texture Resources from the contents of a DDS file
+	static HRESULT createTexture(ID3D11Device* device, const std::vector<uint8_t>& data, 
 		ID3D11Texture2D** tex, ID3D11ShaderResourceView** srv);
 	
 private:
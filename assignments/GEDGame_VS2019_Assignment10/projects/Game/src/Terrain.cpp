@@ -1,11 +1,14 @@
 #include "Terrain.h"
 
+#include "AssetLoader.h"
 #include "GameEffect.h"
 #include "ConfigParser.h"
 #include <DDSTextureLoader.h>
 #include "DirectXTex.h"
 #include <SimpleImage.h>
 #include "debug.h"
+#include <algorithm>
+#include <cmath>
 
 // You can use this macro to access your height field
 #define IDX(X,Y,WIDTH) ((X) + (Y) * (WIDTH))
@@ -19,20 +22,45 @@ Terrain::~Terrain(void)
 {
 }
 
-HRESULT Terrain::create(ID3D11Device* device)
+bool Terrain::load(TerrainData& data)
 {
-	HRESULT hr;
-
 	// Load the heightmap
 	GEDUtils::SimpleImage heightmap(g_ConfigParser.get_terrainPathHeight().c_str());
 
-	terrain_vertex_width = heightmap.getWidth();
+	data.vertex_width = heightmap.getWidth();
 	uint64_t terrain_vertex_height = heightmap.getHeight();
 	// Create the height buffer data
-	raw_height_field.resize(terrain_vertex_width * terrain_vertex_height);
+	data.height_field.resize(data.vertex_width * terrain_vertex_height);
 	for (uint64_t y = 0; y < terrain_vertex_height; y++)
-		for (uint64_t x = 0; x < terrain_vertex_width; x++)
-			raw_height_field[IDX(x, y, terrain_vertex_width)] = heightmap.getPixel(x, y);
+		for (uint64_t x = 0; x < data.vertex_width; x++)
+			data.height_field[IDX(x, y, data.vertex_width)] = heightmap.getPixel(x, y);
+
+	// Build the chunks and the index buffer data with one chunk in every LOD
+	data.size[0] = g_ConfigParser.get_TerrainWidth();
+	data.size[1] = g_ConfigParser.get_TerrainHeight();
+	data.size[2] = g_ConfigParser.get_TerrainDepth();
+	if (!data.pyramid.create(data.height_field.data(), data.vertex_width) ||
+		!data.lod.create(data.pyramid, data.size[0], data.size[1], data.size[2], data.indices))
+		return false;
+
+	// Read the color texture (color map) and the normal map, Direct3D decodes them in their upload steps
+	std::wstring color_path(g_ConfigParser.get_terrainPathColor().begin(), g_ConfigParser.get_terrainPathColor().end());
+	std::wstring normal_path(g_ConfigParser.get_terrainPathNormal().begin(), g_ConfigParser.get_terrainPathNormal().end());
+	return AssetLoader::read_file(color_path, data.color_dds) && AssetLoader::read_file(normal_path, data.normal_dds);
+}
+
+
+HRESULT Terrain::upload_heightfield(ID3D11Device* device, TerrainData& data)
+{
+	HRESULT hr;
+
+	// Moving the heights keeps their storage, which the pyramid points to
+	raw_height_field = std::move(data.height_field);
+	terrain_vertex_width = data.vertex_width;
+	std::copy(data.size, data.size + 3, terrain_size);
+	pyramid = std::move(data.pyramid);
+	lod = std::move(data.lod);
+	query.create(pyramid, terrain_size[0], terrain_size[1], terrain_size[2]);
 
 	D3D11_SUBRESOURCE_DATA hid;
 	hid.pSysMem = static_cast<void*>(raw_height_field.data());
@@ -46,7 +74,7 @@ HRESULT Terrain::create(ID3D11Device* device)
 	hbd.MiscFlags = 0;
 	hbd.Usage = D3D11_USAGE_DEFAULT;
 
-	V(device->CreateBuffer(&hbd, &hid, &heightfield)); // http://msdn.microsoft.com/en-us/library/ff476899%28v=vs.85%29.aspx
+	V_RETURN(device->CreateBuffer(&hbd, &hid, &heightfield)); // http://msdn.microsoft.com/en-us/library/ff476899%28v=vs.85%29.aspx
 	
 	// Create the SRV for the height field
 	D3D11_SHADER_RESOURCE_VIEW_DESC hsrvd;
@@ -55,57 +83,112 @@ HRESULT Terrain::create(ID3D11Device* device)
 	hsrvd.Format = DXGI_FORMAT_R32_FLOAT;
 	hsrvd.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
 	
-	V(device->CreateShaderResourceView(heightfield, &hsrvd, &heightfieldSRV));
-
-	// Create index buffer
-	raw_index_buffer.resize((terrain_vertex_width - 1) * (terrain_vertex_height - 1) * 2);
-	// Iterate through every square
-	uint64_t i = 0;
-	for (uint64_t y = 0; y < terrain_vertex_height - 1; y++)
-		for (uint64_t x = 0; x < terrain_vertex_width - 1; x++)
-		{
-			// Upper Left
-			raw_index_buffer[i].f = IDX(x, y, terrain_vertex_width);
-			raw_index_buffer[i].s = IDX(x + 1, y, terrain_vertex_width);
-			raw_index_buffer[i].t = IDX(x, y + 1, terrain_vertex_width);
-			i++;
-			// Lower Right
-			raw_index_buffer[i].f = IDX(x + 1, y, terrain_vertex_width);
-			raw_index_buffer[i].s = IDX(x + 1, y + 1, terrain_vertex_width);
-			raw_index_buffer[i].t = IDX(x, y + 1, terrain_vertex_width);
-			i++;
-		}
+	V_RETURN(device->CreateShaderResourceView(heightfield, &hsrvd, &heightfieldSRV));
 
+	return S_OK;
+}
+
+
+HRESULT Terrain::upload_indices(ID3D11Device* device, ID3DX11EffectPass* pass, TerrainData& data)
+{
+	HRESULT hr;
+
+	// Create the index buffer with one chunk in every LOD
 	D3D11_SUBRESOURCE_DATA iid;
-	iid.pSysMem = static_cast<void*>(raw_index_buffer.data());
+	iid.pSysMem = static_cast<void*>(data.indices.data());
 	iid.SysMemPitch = 0;
 	iid.SysMemSlicePitch = 0;
 
 	D3D11_BUFFER_DESC ibd;
 	ibd.BindFlags = D3D11_BIND_INDEX_BUFFER;
-	ibd.ByteWidth = sizeof(TerrainTriangleIndex) * raw_index_buffer.size();
+	ibd.ByteWidth = sizeof(uint16_t) * data.indices.size();
 	ibd.CPUAccessFlags = 0;
 	ibd.MiscFlags = 0;
 	ibd.Usage = D3D11_USAGE_DEFAULT;
 
-	V(device->CreateBuffer(&ibd, &iid, &indexBuffer)); // http://msdn.microsoft.com/en-us/library/ff476899%28v=vs.85%29.aspx
+	V_RETURN(device->CreateBuffer(&ibd, &iid, &indexBuffer)); // http://msdn.microsoft.com/en-us/library/ff476899%28v=vs.85%29.aspx
 
+	// Create the buffer for the offsets of the chunks drawn in a frame, one instance per chunk
+	D3D11_BUFFER_DESC obd;
+	obd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+	obd.ByteWidth = sizeof(uint32_t) * get_chunk_count();
+	obd.CPUAccessFlags = 0;
+	obd.MiscFlags = 0;
+	obd.Usage = D3D11_USAGE_DEFAULT;
 
-	// Load the color texture (color map)
-	std::wstring color_path(g_ConfigParser.get_terrainPathColor().begin(), g_ConfigParser.get_terrainPathColor().end());
-	DirectX::CreateDDSTextureFromFile(device, color_path.c_str(), nullptr, &diffuseTextureSRV);
-	// Load the normal map
-	std::wstring normal_path(g_ConfigParser.get_terrainPathNormal().begin(), g_ConfigParser.get_terrainPathNormal().end());
-	DirectX::CreateDDSTextureFromFile(device, normal_path.c_str(), nullptr, &normalTextureSRV);
+	V_RETURN(device->CreateBuffer(&obd, nullptr, &chunkOffsetBuffer));
+
+	// Define the input layout, the vertex positions come from SV_VertexID
+	// It is created last, as is_ready() looks for it
+	const D3D11_INPUT_ELEMENT_DESC layout[] = // http://msdn.microsoft.com/en-us/library/bb205117%28v=vs.85%29.aspx
+	{
+		{ "CHUNK_OFFSET", 0, DXGI_FORMAT_R32_UINT, 0, 0, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+	};
+	UINT numElements = sizeof(layout) / sizeof(layout[0]);
+
+	D3DX11_PASS_DESC pd;
+	V_RETURN(pass->GetDesc(&pd));
+	V_RETURN(device->CreateInputLayout(layout, numElements, pd.pIAInputSignature, pd.IAInputSignatureSize, &inputLayout));
+
+	// The indices are on the GPU now, free their copy
+	std::vector<uint16_t>().swap(data.indices);
+
+	return S_OK;
+}
 
 
-	return hr;
+HRESULT Terrain::upload_color_texture(ID3D11Device* device, TerrainData& data)
+{
+	return upload_texture(device, data.color_dds, &diffuseTexture, &diffuseTextureSRV);
+}
+
+
+HRESULT Terrain::upload_normal_texture(ID3D11Device* device, TerrainData& data)
+{
+	return upload_texture(device, data.normal_dds, &normalTexture, &normalTextureSRV);
+}
+
+
+HRESULT Terrain::upload_texture(ID3D11Device* device, std::vector<uint8_t>& dds, ID3D11Texture2D** texture, ID3D11ShaderResourceView** srv)
+{
+	HRESULT hr;
+
+	V_RETURN(DirectX::CreateDDSTextureFromMemory(device, dds.data(), dds.size(), reinterpret_cast<ID3D11Resource**>(texture), srv));
+
+	// The texture is on the GPU now, free its copy
+	std::vector<uint8_t>().swap(dds);
+
+	return S_OK;
+}
+
+
+HRESULT Terrain::upload(ID3D11Device* device, ID3DX11EffectPass* pass, TerrainData& data)
+{
+	HRESULT hr;
+
+	V_RETURN(upload_heightfield(device, data));
+	V_RETURN(upload_indices(device, pass, data));
+	V_RETURN(upload_color_texture(device, data));
+	V_RETURN(upload_normal_texture(device, data));
+
+	return S_OK;
+}
+
+
+HRESULT Terrain::create(ID3D11Device* device, ID3DX11EffectPass* pass)
+{
+	TerrainData data;
+	if (!load(data))
+		return E_FAIL;
+	return upload(device, pass, data);
 }
 
 
 void Terrain::destroy()
 {
 	SAFE_RELEASE(indexBuffer);
+	SAFE_RELEASE(chunkOffsetBuffer);
+	SAFE_RELEASE(inputLayout);
 
 	SAFE_RELEASE(heightfield);
 	SAFE_RELEASE(heightfieldSRV);
@@ -113,6 +196,34 @@ void Terrain::destroy()
 	SAFE_RELEASE(diffuseTextureSRV);
 	SAFE_RELEASE(normalTexture);
 	SAFE_RELEASE(normalTextureSRV);
+	draws.clear();
+	chunk_offsets.clear();
+	visible_chunks = 0;
+}
+
+
+void Terrain::update_lod(DirectX::FXMVECTOR eye, DirectX::CXMMATRIX world, DirectX::CXMMATRIX view_projection, float fovy, float viewport_height)
+{
+	if (!is_ready())
+		return;
+
+	// The chunks live in the object space scaled by the terrain size, which undoes the scaling part of world
+	DirectX::XMVECTOR object_eye = DirectX::XMVector3Transform(eye, DirectX::XMMatrixInverse(nullptr, world));
+	float terrain_eye[3] = {
+		DirectX::XMVectorGetX(object_eye) * terrain_size[0],
+		DirectX::XMVectorGetY(object_eye) * terrain_size[1],
+		DirectX::XMVectorGetZ(object_eye) * terrain_size[2] };
+
+	DirectX::XMMATRIX terrain_to_clip = DirectX::XMMatrixScaling(1.0f / terrain_size[0], 1.0f / terrain_size[1], 1.0f / terrain_size[2]) * world * view_projection;
+	DirectX::XMFLOAT4X4 matrix;
+	DirectX::XMStoreFloat4x4(&matrix, terrain_to_clip);
+	float planes[6][4];
+	TerrainLod::get_frustum_planes(matrix.m, planes);
+	visible_chunks = lod.cull(planes, terrain_eye, horizon_culling ? &pyramid : nullptr);
+
+	// An error may cover at most 2 pixels on the screen
+	const float tolerated_pixels = 2.0f;
+	lod.select(terrain_eye, viewport_height / (2.0f * std::tan(fovy * 0.5f) * tolerated_pixels), draws, chunk_offsets);
 }
 
 
@@ -120,13 +231,30 @@ void Terrain::render(ID3D11DeviceContext* context, ID3DX11EffectPass* pass)
 {
 	HRESULT hr;
 
-	// Bind the terrain vertex buffer to the input assembler stage 
-	ID3D11Buffer* vbs[] = { nullptr, };
-	unsigned int strides[] = { 0, }, offsets[] = { 0, };
+	if (!is_ready())
+		return;
+
+	// Upload the offsets of the chunks picked by update_lod
+	if (!chunk_offsets.empty())
+	{
+		D3D11_BOX box;
+		box.left = 0;
+		box.right = static_cast<UINT>(sizeof(uint32_t) * chunk_offsets.size());
+		box.top = 0;
+		box.bottom = 1;
+		box.front = 0;
+		box.back = 1;
+		context->UpdateSubresource(chunkOffsetBuffer, 0, &box, chunk_offsets.data(), 0, 0);
+	}
+
+	// Bind the chunk offsets as per instance vertex buffer to the input assembler stage
+	ID3D11Buffer* vbs[] = { chunkOffsetBuffer, };
+	unsigned int strides[] = { sizeof(uint32_t), }, offsets[] = { 0, };
 	context->IASetVertexBuffers(0, 1, vbs, strides, offsets);
+	context->IASetInputLayout(inputLayout);
 
 	// Bind the index Buffer
-	context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+	context->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R16_UINT, 0);
 
 	// Tell the input assembler stage which primitive topology to use
 	context->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
@@ -140,8 +268,9 @@ void Terrain::render(ID3D11DeviceContext* context, ID3DX11EffectPass* pass)
 	// Apply the rendering pass in order to submit the necessary render state changes to the device
 	V(pass->Apply(0, context));
 
-	// Draw
-	context->DrawIndexed(raw_index_buffer.size() * 3, 0, 0);
+	// Draw the chunks of each LOD and combination of seams at once
+	for (const TerrainDrawRange& range : draws)
+		context->DrawIndexedInstanced(range.count, range.instance_count, range.start, 0, range.first_instance);
 }
 
 float Terrain::get_height_at(float x, float z) const
@@ -152,11 +281,33 @@ float Terrain::get_height_at(float x, float z) const
 		return 0.0f;
 	}
 
-	double u = x / g_ConfigParser.get_TerrainWidth() + 0.5;
-	u = std::min(static_cast<uint64_t>(u * terrain_vertex_width), terrain_vertex_width - 1);
-	double v = z / g_ConfigParser.get_TerrainDepth() + 0.5;
-	v = std::min(static_cast<uint64_t>(v * terrain_vertex_width), terrain_vertex_width - 1);
+	return query.get_height_bilinear(x, z);
+}
 
-	// Without interpolation
-  	return raw_height_field.at(IDX(u, v, terrain_vertex_width)) * g_ConfigParser.get_TerrainHeight();
+float Terrain::get_height_bicubic_at(float x, float z) const
+{
+	if (raw_height_field.size() == 0)
+	{
+		std::cerr << "ERROR: Terrain was not loaded when accessing its height values" << std::endl;
+		return 0.0f;
+	}
+
+	return query.get_height_bicubic(x, z);
+}
+
+void Terrain::get_heights_at(const float* x, const float* z, float* heights, size_t count) const
+{
+	if (raw_height_field.size() == 0)
+	{
+		std::cerr << "ERROR: Terrain was not loaded when accessing its height values" << std::endl;
+		std::fill(heights, heights + count, 0.0f);
+		return;
+	}
+
+	query.get_heights_bilinear(x, z, heights, count);
+}
+
+bool Terrain::intersect_segment(const float from[3], const float to[3], float& t) const
+{
+	return raw_height_field.size() != 0 && query.intersect_segment(from, to, t);
 }
@@ -2,32 +2,81 @@
 #include "DXUT.h"
 #include "d3dx11effect.h"
 #include <memory>
+#include <vector>
+
+#include "TerrainLod.h"
+#include "TerrainPyramid.h"
+#include "TerrainQuery.h"
+
+// What Terrain::load reads and builds from the files of the config, before there is anything to upload
+struct TerrainData
+{
+	std::vector<float>						height_field;
+	uint64_t								vertex_width = 0;
+	float									size[3] = { 1.0f, 1.0f, 1.0f };
+	TerrainPyramid							pyramid;
+	TerrainLod								lod;
+	std::vector<uint16_t>					indices;
+	std::vector<uint8_t>					color_dds;
+	std::vector<uint8_t>					normal_dds;
+};
 
 class Terrain
 {
 public:
-	struct TerrainTriangleIndex
-	{
-		UINT f, s, t;
-	};
-
 	Terrain(void);
 	~Terrain(void);
 
-	HRESULT create(ID3D11Device* device);
+	// Reads the heightmap and the textures and builds the chunks, touches neither the terrain nor the device
+	// and can run on any thread
+	static bool load(TerrainData& data);
+	// The upload steps take over their part of data and create the D3D11 resources from it, call them in this order
+	// The heights and the chunks, the height queries work from here on
+	HRESULT upload_heightfield(ID3D11Device* device, TerrainData& data);
+	// The shared indices and the input layout, afterwards the terrain is drawn
+	// pass is the terrain pass, whose input signature the per chunk offsets are bound to
+	HRESULT upload_indices(ID3D11Device* device, ID3DX11EffectPass* pass, TerrainData& data);
+	// The color texture and the normal map, which are left unbound until then
+	HRESULT upload_color_texture(ID3D11Device* device, TerrainData& data);
+	HRESULT upload_normal_texture(ID3D11Device* device, TerrainData& data);
+	// All upload steps at once
+	HRESULT upload(ID3D11Device* device, ID3DX11EffectPass* pass, TerrainData& data);
+	// load and upload at once
+	HRESULT create(ID3D11Device* device, ID3DX11EffectPass* pass);
 	void destroy();
+	// Whether upload_indices was called, until then update_lod and render do nothing
+	bool is_ready() const { return inputLayout != nullptr; }
 
+	// Culls the chunks and picks the level of detail of the others for a camera at eye (world space), call before render
+	// world is the world matrix of the terrain, view_projection, fovy and viewport_height those of the camera
+	void update_lod(DirectX::FXMVECTOR eye, DirectX::CXMMATRIX world, DirectX::CXMMATRIX view_projection, float fovy, float viewport_height);
 	void render(ID3D11DeviceContext* context, ID3DX11EffectPass* pass);
 
+	// Height of the surface at (x, z) of the terrain without its rotation, bilinear or bicubic between the heights
 	float get_height_at(float x, float z) const;
+	float get_height_bicubic_at(float x, float z) const;
+	// get_height_at of count positions at once, for many objects per frame
+	void get_heights_at(const float* x, const float* z, float* heights, size_t count) const;
+	// Whether the segment from from to to, in the same space, hits the terrain, at the fraction t of the way
+	bool intersect_segment(const float from[3], const float to[3], float& t) const;
+
+	// Also hide chunks behind the terrain, not only those outside of the view frustum
+	void set_horizon_culling(bool enabled) { horizon_culling = enabled; }
+	int64_t get_chunk_count() const { return lod.get_chunk_count_x() * lod.get_chunk_count_y(); }
+	// Chunks left by the culling of the last update_lod
+	int64_t get_visible_chunk_count() const { return visible_chunks; }
 
 private:
+	static HRESULT upload_texture(ID3D11Device* device, std::vector<uint8_t>& dds, ID3D11Texture2D** texture, ID3D11ShaderResourceView** srv);
+
 	Terrain(const Terrain&);
 	Terrain(const Terrain&&);
 	void operator=(const Terrain&);
 
 	// Terrain rendering resources
-	ID3D11Buffer*                           indexBuffer = nullptr;	// The terrain's triangulation
+	ID3D11Buffer*                           indexBuffer = nullptr;	// The triangulations of a chunk, shared by all chunks
+	ID3D11Buffer*							chunkOffsetBuffer = nullptr; // Per instance vertex id of the corner of the chunk
+	ID3D11InputLayout*						inputLayout = nullptr;
 	ID3D11Buffer*							heightfield = nullptr;
 	ID3D11ShaderResourceView*				heightfieldSRV = nullptr;
 	ID3D11Texture2D*                        diffuseTexture = nullptr; // The terrain's material color for diffuse lighting
@@ -36,7 +85,16 @@ private:
 	ID3D11ShaderResourceView*				normalTextureSRV = nullptr;
 
 	std::vector<float>						raw_height_field;
-	std::vector<TerrainTriangleIndex>		raw_index_buffer;
 	uint64_t								terrain_vertex_width = 0;
+	float									terrain_size[3] = { 1.0f, 1.0f, 1.0f }; // Width, height and depth
+
+	// Chunks and their LODs, draws and chunk_offsets hold the instanced index ranges picked by the last update_lod
+	TerrainPyramid							pyramid;
+	TerrainLod								lod;
+	TerrainQuery							query;
+	std::vector<TerrainDrawRange>			draws;
+	std::vector<uint32_t>					chunk_offsets;
+	bool									horizon_culling = true;
+	int64_t									visible_chunks = 0;
 };
 
@@ -0,0 +1,501 @@
+#include "TerrainLod.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <emmintrin.h>
+
+// The grid is split into square chunks of chunk_size quads, the last row and column of chunks may reach past the
+// border of the heightfield; TerrainVS clamps their vertices onto the border, which squashes the quads beyond it to
+// nothing. Every chunk has lod_count triangulations, LOD l uses every 2^l-th vertex of the grid.
+//
+// A chunk is drawn as its interior plus four seams, which fill the outer ring of quads. The seams meet at the
+// diagonals from the corners of the chunk to the corners of the interior, so every seam can be exchanged on its
+// own: towards a neighbour of the next coarser LOD, the seam leaves out every other border vertex and the border
+// matches the neighbour without cracks or T-junctions. select() keeps neighbours within one LOD of each other.
+// Where no neighbour is coarser the triangles are those of the full grid at the step of the LOD, every quad split
+// along the diagonal from (x + 1, y) to (x, y + 1), which TerrainQuery intersects at LOD 0. The two corner quads whose
+// seams would meet along the other diagonal are then drawn whole instead of as halves of two seams.
+//
+// All chunks share one index buffer of vertex ids within a chunk, i + j * chunk_vertices, which TerrainVS offsets by
+// the vertex id of the chunk corner. It holds every LOD with each of the 16 combinations of coarser neighbours, as
+// [interior][4 seams], so select() draws all chunks of one LOD and combination with a single instanced range.
+
+namespace
+{
+	struct GridBuilder
+	{
+		std::vector<uint16_t>& indices;
+
+		// Appends the triangle of chunk vertices with the winding of the full grid
+		void add_triangle(int64_t ax, int64_t ay, int64_t bx, int64_t by, int64_t cx, int64_t cy)
+		{
+			int64_t cross = (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+			if (cross < 0)
+			{
+				std::swap(bx, cx);
+				std::swap(by, cy);
+			}
+			indices.push_back(static_cast<uint16_t>(ax + ay * TerrainLod::chunk_vertices));
+			indices.push_back(static_cast<uint16_t>(bx + by * TerrainLod::chunk_vertices));
+			indices.push_back(static_cast<uint16_t>(cx + cy * TerrainLod::chunk_vertices));
+		}
+
+		// Quad (i, j) of size step, split along the diagonal from its corner (i + 1, j) to (i, j + 1) like the full grid
+		void add_quad(int64_t i, int64_t j, int64_t step)
+		{
+			int64_t x = i * step;
+			int64_t y = j * step;
+			add_triangle(x, y, x + step, y, x, y + step);
+			add_triangle(x + step, y, x + step, y + step, x, y + step);
+		}
+
+		// Quads [1; n - 1)² of a chunk with n x n quads of size step
+		void add_interior(int64_t n, int64_t step)
+		{
+			for (int64_t j = 1; j < n - 1; j++)
+				for (int64_t i = 1; i < n - 1; i++)
+					add_quad(i, j, step);
+		}
+
+		// Grid position of the point t along the side at the given depth (0 = border, 1 = interior)
+		static void side_point(int64_t side, int64_t n, int64_t t, int64_t depth, int64_t& i, int64_t& j)
+		{
+			switch (side)
+			{
+			case 0: i = t; j = depth; break;
+			case 1: i = n - depth; j = t; break;
+			case 2: i = t; j = n - depth; break;
+			default: i = depth; j = t; break;
+			}
+		}
+
+		// Triangulates the trapezoid between the border points 0, border_step, ..., n and the interior points 1, ..., n - 1
+		// of one side by walking along both rows, a single interior point for n = 2 makes it a fan
+		// With every border point the quads along the side are split like the full grid, which connects the interior
+		// point before a quad with the border point after it on sides 0 and 3 and the other way round on sides 1 and 2.
+		// The first or last triangle, the half of a corner quad, can be left out for add_quad to fill the whole quad
+		void add_seam(int64_t n, int64_t step, int64_t side, int64_t border_step, bool skip_first, bool skip_last)
+		{
+			int64_t lag = border_step == 1 && (side == 0 || side == 3) ? 1 : 0;
+			int64_t outer = 0;
+			int64_t inner = 1;
+			bool first = true;
+			while (outer < n || inner < n - 1)
+			{
+				int64_t ai, aj, bi, bj, ci, cj;
+				side_point(side, n, outer, 0, ai, aj);
+				if (inner < n - 1 && (outer >= n || inner + 1 + lag <= outer + border_step))
+				{
+					side_point(side, n, inner, 1, bi, bj);
+					side_point(side, n, inner + 1, 1, ci, cj);
+					inner++;
+				}
+				else
+				{
+					side_point(side, n, outer + border_step, 0, bi, bj);
+					side_point(side, n, inner, 1, ci, cj);
+					outer += border_step;
+				}
+				bool last = outer >= n && inner >= n - 1;
+				if (!(first && skip_first) && !(last && skip_last))
+					add_triangle(ai * step, aj * step, bi * step, bj * step, ci * step, cj * step);
+				first = false;
+			}
+		}
+	};
+}
+
+// Height at (x, y) of the grid with quads of size step, interpolated in the triangle of the quad containing it
+static float interpolate(const float* heights, int64_t resolution, int64_t step, int64_t x, int64_t y)
+{
+	int64_t x0 = x - x % step;
+	int64_t y0 = y - y % step;
+	int64_t x1 = std::min(x0 + step, resolution - 1);
+	int64_t y1 = std::min(y0 + step, resolution - 1);
+	float u = x == x0 ? 0.0f : static_cast<float>(x - x0) / (x1 - x0);
+	float v = y == y0 ? 0.0f : static_cast<float>(y - y0) / (y1 - y0);
+
+	float h00 = heights[x0 + y0 * resolution];
+	float h10 = heights[x1 + y0 * resolution];
+	float h01 = heights[x0 + y1 * resolution];
+	float h11 = heights[x1 + y1 * resolution];
+	// Split along the diagonal from (x1, y0) to (x0, y1) like the full grid
+	if (u + v <= 1.0f)
+		return h00 + u * (h10 - h00) + v * (h01 - h00);
+	return h11 + (1.0f - u) * (h01 - h11) + (1.0f - v) * (h10 - h11);
+}
+
+bool TerrainLod::create(const TerrainPyramid& pyramid, float width, float height, float depth, std::vector<uint16_t>& indices)
+{
+	const float* heights = pyramid.get_heights();
+	int64_t resolution = pyramid.get_resolution();
+	if (resolution < 2)
+	{
+		std::cerr << "ERROR: The terrain needs at least 2 x 2 heights for its level of detail" << std::endl;
+		return false;
+	}
+
+	this->resolution = resolution;
+	size[0] = width;
+	size[1] = height;
+	size[2] = depth;
+	chunk_count = (resolution - 1 + chunk_size - 1) / chunk_size;
+	// Room for a batch past the last chunk and for the padding between the rows of LODs
+	row_stride = (chunk_count + lod_count + box_batch - 1) / box_batch * box_batch;
+	int64_t cells = row_stride * chunk_count;
+	for (int64_t axis = 0; axis < 3; axis++)
+	{
+		box_min[axis].assign(cells, 0.0f);
+		box_max[axis].assign(cells, 0.0f);
+	}
+	for (int64_t lod = 0; lod < lod_count; lod++)
+		squared_error[lod].assign(cells, 0.0f);
+	keys.assign(cells + 16, 0);
+	wanted_lods.assign(cells, 0);
+	row_lods.assign(cells, 0);
+	// A row of zeros above and below the chunks, and room for a vector load past the last chunk
+	lods.assign(row_stride + cells + row_stride + 16, 0);
+	// Everything is visible until the first cull(), with room for a vector load past the last chunk
+	visible.assign(cells + 16, 0);
+	for (int64_t chunk_y = 0; chunk_y < chunk_count; chunk_y++)
+		memset(&visible[chunk_y * row_stride], 0xFF, chunk_count);
+
+	float scale = 1.0f / (resolution - 1);
+	for (int64_t chunk_y = 0; chunk_y < chunk_count; chunk_y++)
+		for (int64_t chunk_x = 0; chunk_x < chunk_count; chunk_x++)
+		{
+			int64_t c = chunk_x + chunk_y * row_stride;
+			int64_t x0 = chunk_x * chunk_size;
+			int64_t y0 = chunk_y * chunk_size;
+			int64_t x1 = std::min(x0 + chunk_size, resolution - 1);
+			int64_t y1 = std::min(y0 + chunk_size, resolution - 1);
+
+			// Box, in the object space of TerrainVS scaled by the terrain size
+			float low, high;
+			pyramid.get_block(chunk_level, chunk_x, chunk_y, low, high);
+			box_min[0][c] = (x0 * scale - 0.5f) * width;
+			box_max[0][c] = (x1 * scale - 0.5f) * width;
+			box_min[1][c] = low * height;
+			box_max[1][c] = high * height;
+			box_min[2][c] = (y0 * scale - 0.5f) * depth;
+			box_max[2][c] = (y1 * scale - 0.5f) * depth;
+
+			// Error of every LOD against the vertices it leaves out, which are those of the next finer LOD
+			// The seams are triangulated differently, so this is an estimate near the chunk border
+			float error = 0.0f;
+			for (int64_t lod = 1; lod < lod_count; lod++)
+			{
+				int64_t step = int64_t(1) << lod;
+				int64_t half = step / 2;
+				for (int64_t y = y0; y <= y1; y += half)
+					for (int64_t x = x0; x <= x1; x += half)
+					{
+						if (x % step == 0 && y % step == 0)
+							continue;
+						error = std::max(error, std::abs(heights[x + y * resolution] - interpolate(heights, resolution, step, x, y)) * height);
+					}
+				squared_error[lod][c] = error * error;
+			}
+		}
+
+	indices.clear();
+	GridBuilder builder{ indices };
+	for (int64_t lod = 0; lod < lod_count; lod++)
+	{
+		int64_t step = int64_t(1) << lod;
+		int64_t n = chunk_size / step;
+		// The coarsest LOD has no coarser neighbour
+		for (int64_t coarser = 0; coarser < (lod + 1 < lod_count ? 16 : 1); coarser++)
+		{
+			Variant& variant = variants[lod][coarser];
+			variant.start = static_cast<uint32_t>(indices.size());
+			builder.add_interior(n, step);
+			// The seams meet along the diagonal (0, 0) to (1, 1) and (n - 1, n - 1) to (n, n) of the corner quads,
+			// which are split like the grid instead if both seams keep every border point
+			bool low_corner = (coarser & 9) == 0;
+			bool high_corner = (coarser & 6) == 0;
+			for (int64_t side = 0; side < 4; side++)
+				builder.add_seam(n, step, side, (coarser >> side & 1) != 0 ? 2 : 1, low_corner && (side == 0 || side == 3),
+					high_corner && (side == 1 || side == 2));
+			if (low_corner)
+				builder.add_quad(0, 0, step);
+			if (high_corner)
+				builder.add_quad(n - 1, n - 1, step);
+			variant.count = static_cast<uint32_t>(indices.size()) - variant.start;
+		}
+	}
+
+	return true;
+}
+
+TerrainBox TerrainLod::get_box(int64_t chunk_x, int64_t chunk_y) const
+{
+	int64_t c = chunk_x + chunk_y * row_stride;
+	TerrainBox box;
+	for (int64_t axis = 0; axis < 3; axis++)
+	{
+		box.min[axis] = box_min[axis][c];
+		box.max[axis] = box_max[axis][c];
+	}
+	return box;
+}
+
+void TerrainLod::get_frustum_planes(const float terrain_to_clip[4][4], float planes[6][4])
+{
+	// The planes are sums of the columns of the matrix, http://www.cs.otago.ac.nz/postgrads/alexis/planeExtraction.pdf
+	for (int i = 0; i < 4; i++)
+	{
+		const float* row = terrain_to_clip[i];
+		planes[0][i] = row[3] + row[0]; // Left
+		planes[1][i] = row[3] - row[0]; // Right
+		planes[2][i] = row[3] + row[1]; // Bottom
+		planes[3][i] = row[3] - row[1]; // Top
+		planes[4][i] = row[2];          // Near
+		planes[5][i] = row[3] - row[2]; // Far
+	}
+}
+
+int64_t TerrainLod::cull(const float planes[6][4], const float eye[3], const TerrainPyramid* horizon)
+{
+	__m128 normals[6][3];
+	__m128 offsets[6];
+	for (int64_t p = 0; p < 6; p++)
+	{
+		normals[p][0] = _mm_set1_ps(planes[p][0]);
+		normals[p][1] = _mm_set1_ps(planes[p][1]);
+		normals[p][2] = _mm_set1_ps(planes[p][2]);
+		offsets[p] = _mm_set1_ps(planes[p][3]);
+	}
+
+	// A box is outside of a plane if its corner farthest along the normal is, the distance of that corner is the sum
+	// of the larger distance of the two sides of the box on every axis. A batch is tested as two halves of 4 boxes
+	const __m128 zero = _mm_setzero_ps();
+	int64_t survivors = 0;
+	for (int64_t chunk_y = 0; chunk_y < chunk_count; chunk_y++)
+	{
+		for (int64_t c = chunk_y * row_stride; c < chunk_y * row_stride + chunk_count; c += box_batch)
+		{
+			__m128i inside[2];
+			for (int64_t half = 0; half < 2; half++)
+			{
+				int64_t at = c + 4 * half;
+				__m128 low_x = _mm_loadu_ps(&box_min[0][at]);
+				__m128 low_y = _mm_loadu_ps(&box_min[1][at]);
+				__m128 low_z = _mm_loadu_ps(&box_min[2][at]);
+				__m128 high_x = _mm_loadu_ps(&box_max[0][at]);
+				__m128 high_y = _mm_loadu_ps(&box_max[1][at]);
+				__m128 high_z = _mm_loadu_ps(&box_max[2][at]);
+				__m128 outside = _mm_setzero_ps();
+				for (int64_t p = 0; p < 6; p++)
+				{
+					__m128 distance = _mm_add_ps(offsets[p], _mm_max_ps(_mm_mul_ps(normals[p][0], low_x), _mm_mul_ps(normals[p][0], high_x)));
+					distance = _mm_add_ps(distance, _mm_max_ps(_mm_mul_ps(normals[p][1], low_y), _mm_mul_ps(normals[p][1], high_y)));
+					distance = _mm_add_ps(distance, _mm_max_ps(_mm_mul_ps(normals[p][2], low_z), _mm_mul_ps(normals[p][2], high_z)));
+					outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, zero));
+				}
+				inside[half] = _mm_castps_si128(_mm_cmpeq_ps(outside, zero));
+			}
+
+			// The all ones and zeros lanes saturate to 0xFF and 0 bytes
+			__m128i bytes = _mm_packs_epi16(_mm_packs_epi32(inside[0], inside[1]), _mm_setzero_si128());
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(&visible[c]), bytes);
+		}
+		memset(&visible[chunk_y * row_stride + chunk_count], 0, row_stride - chunk_count);
+
+		for (int64_t chunk_x = 0; chunk_x < chunk_count; chunk_x++)
+		{
+			uint8_t& chunk = visible[chunk_x + chunk_y * row_stride];
+			if (chunk != 0 && horizon != nullptr && is_below_horizon(chunk_x, chunk_y, eye, *horizon))
+				chunk = 0;
+			survivors += chunk & 1;
+		}
+	}
+	return survivors;
+}
+
+// Every ray from the eye to a point of the chunk box crosses the strips of chunks between them along the axis on which
+// the chunk is farther from the eye. If the ray is below the lowest height of a strip where it crosses it, it has passed
+// below the terrain, whatever LOD the strip is drawn in. The strips are 1, 2, 4, ... chunks wide, from the chunk back
+// to the eye, and their lowest heights come from the pyramid
+bool TerrainLod::is_below_horizon(int64_t chunk_x, int64_t chunk_y, const float eye[3], const TerrainPyramid& pyramid) const
+{
+	int64_t c = chunk_x + chunk_y * row_stride;
+	float gap_x = std::max(box_min[0][c] - eye[0], eye[0] - box_max[0][c]);
+	float gap_z = std::max(box_min[2][c] - eye[2], eye[2] - box_max[2][c]);
+	if (gap_x <= 0.0f && gap_z <= 0.0f)
+		return false;
+
+	int64_t along = gap_x >= gap_z ? 0 : 2;
+	int64_t across = 2 - along;
+	bool forward = box_min[along][c] > eye[along];
+	// Distances along the axis from the eye to the near and the far side of the chunk, and the extent of the chunk
+	// across and above, relative to the eye
+	float near_distance = forward ? box_min[along][c] - eye[along] : eye[along] - box_max[along][c];
+	float far_distance = forward ? box_max[along][c] - eye[along] : eye[along] - box_min[along][c];
+	float across_low = box_min[across][c] - eye[across];
+	float across_high = box_max[across][c] - eye[across];
+	float top = box_max[1][c] - eye[1];
+	float inverse_near = 1.0f / near_distance;
+	float inverse_far = 1.0f / far_distance;
+
+	float scale = static_cast<float>(resolution - 1);
+	int64_t step = forward ? -1 : 1;
+	int64_t first = (along == 0 ? chunk_x : chunk_y) + step;
+	for (int64_t width = 1; first >= 0 && first < chunk_count; width *= 2)
+	{
+		int64_t last = std::min(std::max<int64_t>(first + step * (width - 1), 0), chunk_count - 1);
+		int64_t strip_begin = std::min(first, last) * chunk_size;
+		int64_t strip_end = std::min((std::max(first, last) + 1) * chunk_size, resolution - 1);
+		float strip_low = (strip_begin / scale - 0.5f) * size[along] - eye[along];
+		float strip_high = (strip_end / scale - 0.5f) * size[along] - eye[along];
+		// Distances along the axis to the near and the far side of the strip, the eye must not be inside of it
+		float enter = forward ? strip_low : -strip_high;
+		float leave = forward ? strip_high : -strip_low;
+		if (enter <= 0.0f)
+			return false;
+		first = last + step;
+
+		// The rays cross the strip at these fractions of their way to the chunk, and within these bounds across
+		float u0 = enter * inverse_far;
+		float u1 = leave * inverse_near;
+		float across_min = eye[across] + std::min(across_low * u0, across_low * u1);
+		float across_max = eye[across] + std::max(across_high * u0, across_high * u1);
+		float quad_min = (across_min / size[across] + 0.5f) * scale;
+		float quad_max = (across_max / size[across] + 0.5f) * scale;
+		// A ray leaving the terrain is not hidden there
+		if (quad_min < 0.0f || quad_max >= scale)
+			continue;
+
+		// The highest a ray is when it enters the strip, if the rays rise, or when it leaves it, if they fall
+		float ray_top = eye[1] + (top > 0.0f ? top * enter * inverse_near : top * leave * inverse_far);
+		int64_t quad_begin = static_cast<int64_t>(quad_min);
+		int64_t quad_end = static_cast<int64_t>(quad_max) + 1;
+		float low, high;
+		bool found = along == 0
+			? pyramid.get_range(strip_begin, quad_begin, strip_end, quad_end, chunk_level, low, high)
+			: pyramid.get_range(quad_begin, strip_begin, quad_end, strip_end, chunk_level, low, high);
+		if (found && ray_top < low * size[1])
+			return true;
+	}
+	return false;
+}
+
+// out[i] = min(out[i], in[i] + add) for count bytes, 16 at once
+static void min_plus(const uint8_t* in, uint8_t* out, int64_t count, uint8_t add)
+{
+	__m128i added = _mm_set1_epi8(static_cast<char>(add));
+	int64_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(out + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_min_epu8(b, _mm_adds_epu8(a, added)));
+	}
+	// Saturating like _mm_adds_epu8
+	for (; i < count; i++)
+		out[i] = static_cast<uint8_t>(std::min<int>(out[i], in[i] + add));
+}
+
+void TerrainLod::select(const float eye[3], float distance_per_error, std::vector<TerrainDrawRange>& draws, std::vector<uint32_t>& offsets)
+{
+	draws.clear();
+	offsets.clear();
+	int64_t cells = row_stride * chunk_count;
+
+	// Coarsest LOD whose error is small enough at the distance of the closest point of the box, compared squared
+	// The errors never decrease with the LOD, so counting the LODs which are good enough finds it without branches
+	const __m128 eye_x = _mm_set1_ps(eye[0]);
+	const __m128 eye_y = _mm_set1_ps(eye[1]);
+	const __m128 eye_z = _mm_set1_ps(eye[2]);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 error_scale = _mm_set1_ps(1.0f / (distance_per_error * distance_per_error));
+	for (int64_t chunk_y = 0; chunk_y < chunk_count; chunk_y++)
+	{
+		// Whole batches, the rows are padded
+		for (int64_t c = chunk_y * row_stride; c < chunk_y * row_stride + chunk_count; c += 4)
+		{
+			__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&box_min[0][c]), eye_x), _mm_sub_ps(eye_x, _mm_loadu_ps(&box_max[0][c]))), zero);
+			__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&box_min[1][c]), eye_y), _mm_sub_ps(eye_y, _mm_loadu_ps(&box_max[1][c]))), zero);
+			__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&box_min[2][c]), eye_z), _mm_sub_ps(eye_z, _mm_loadu_ps(&box_max[2][c]))), zero);
+			__m128 distance = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)), error_scale);
+
+			// A true comparison is -1 in every lane, subtracting it counts
+			__m128i lod = _mm_setzero_si128();
+			for (int64_t l = 1; l < lod_count; l++)
+				lod = _mm_sub_epi32(lod, _mm_castps_si128(_mm_cmple_ps(_mm_loadu_ps(&squared_error[l][c]), distance)));
+			lod = _mm_packs_epi32(lod, lod);
+			lod = _mm_packus_epi16(lod, lod);
+			int32_t packed = _mm_cvtsi128_si32(lod);
+			memcpy(&wanted_lods[c], &packed, 4);
+		}
+		// The padding never lowers a LOD
+		memset(&wanted_lods[chunk_y * row_stride + chunk_count], 0xFF, row_stride - chunk_count);
+	}
+
+	// Refines chunks more than one LOD coarser than a neighbour: the LOD becomes the minimum over all chunks of their
+	// LOD plus the city block distance to them. This is separable into the rows and the columns, and only chunks
+	// closer than lod_count can lower a LOD. The padding keeps the rows apart, so each direction runs over all rows at once
+	row_lods = wanted_lods;
+	for (int64_t k = 1; k < lod_count; k++)
+	{
+		min_plus(&wanted_lods[0], &row_lods[k], cells - k, static_cast<uint8_t>(k));
+		min_plus(&wanted_lods[k], &row_lods[0], cells - k, static_cast<uint8_t>(k));
+	}
+	uint8_t* grid = &lods[row_stride];
+	memcpy(grid, row_lods.data(), cells);
+	for (int64_t k = 1; k < std::min(int64_t(lod_count), chunk_count); k++)
+	{
+		int64_t offset = k * row_stride;
+		min_plus(&row_lods[0], grid + offset, cells - offset, static_cast<uint8_t>(k));
+		min_plus(&row_lods[offset], grid, cells - offset, static_cast<uint8_t>(k));
+	}
+	// From here on the padding is a neighbour which is never coarser
+	for (int64_t chunk_y = 0; chunk_y < chunk_count; chunk_y++)
+		memset(grid + chunk_y * row_stride + chunk_count, 0, row_stride - chunk_count);
+
+	// The key of a chunk is its LOD times 16 plus a bit for each side (-y, +x, +y, -x) with a coarser neighbour,
+	// found for 16 chunks at once. The LODs stay below 16, so shifting them in 16 bit lanes keeps the bytes apart
+	const __m128i bits[4] = { _mm_set1_epi8(1), _mm_set1_epi8(2), _mm_set1_epi8(4), _mm_set1_epi8(8) };
+	for (int64_t chunk_y = 0; chunk_y < chunk_count; chunk_y++)
+		for (int64_t x0 = 0; x0 < chunk_count; x0 += 16)
+		{
+			const uint8_t* at = grid + chunk_y * row_stride + x0;
+			__m128i lod = _mm_loadu_si128(reinterpret_cast<const __m128i*>(at));
+			__m128i key = _mm_slli_epi16(lod, 4);
+			const uint8_t* neighbours[4] = { at - row_stride, at + 1, at + row_stride, at - 1 };
+			for (int64_t side = 0; side < 4; side++)
+			{
+				__m128i neighbour = _mm_loadu_si128(reinterpret_cast<const __m128i*>(neighbours[side]));
+				key = _mm_or_si128(key, _mm_and_si128(_mm_cmpgt_epi8(neighbour, lod), bits[side]));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&keys[chunk_y * row_stride + x0]), key);
+		}
+
+	// Sorts the offsets of the visible chunks by their keys and draws each key with one instanced range
+	uint32_t counts[lod_count * 16] = {};
+	for (int64_t chunk_y = 0; chunk_y < chunk_count; chunk_y++)
+		for (int64_t c = chunk_y * row_stride; c < chunk_y * row_stride + chunk_count; c++)
+			counts[keys[c]] += visible[c] & 1;
+	uint32_t next[lod_count * 16];
+	uint32_t total = 0;
+	for (int64_t key = 0; key < lod_count * 16; key++)
+	{
+		next[key] = total;
+		if (counts[key] != 0)
+		{
+			const Variant& variant = variants[key / 16][key % 16];
+			draws.push_back({ variant.start, variant.count, total, counts[key] });
+		}
+		total += counts[key];
+	}
+	offsets.resize(total);
+	for (int64_t chunk_y = 0; chunk_y < chunk_count; chunk_y++)
+		for (int64_t chunk_x = 0; chunk_x < chunk_count; chunk_x++)
+		{
+			int64_t c = chunk_x + chunk_y * row_stride;
+			if (visible[c] != 0)
+				offsets[next[keys[c]]++] = static_cast<uint32_t>((chunk_x + chunk_y * resolution) * chunk_size);
+		}
+}
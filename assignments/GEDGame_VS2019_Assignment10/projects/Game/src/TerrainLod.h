@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "TerrainPyramid.h"
+
+// Chunked level of detail of the terrain grid, see TerrainLod.cpp
+// Nothing in here touches Direct3D, so the selection can be run and checked without a device
+
+// Axis aligned box in terrain space: the object space of the terrain scaled by its width, height and depth
+struct TerrainBox
+{
+	float min[3];
+	float max[3];
+};
+
+// Indices [start; start + count) of the index buffer built by TerrainLod::create, drawn as a triangle list for each
+// of the chunk offsets [first_instance; first_instance + instance_count) written by TerrainLod::select
+struct TerrainDrawRange
+{
+	uint32_t start;
+	uint32_t count;
+	uint32_t first_instance;
+	uint32_t instance_count;
+};
+
+class TerrainLod
+{
+public:
+	// Quads along one side of a chunk at LOD 0, a chunk is a block of this level of the TerrainPyramid
+	static const int64_t chunk_level = 6;
+	static const int64_t chunk_size = int64_t(1) << chunk_level;
+	// Vertices along one side of a chunk, the index buffer holds the vertex i + j * chunk_vertices of a chunk
+	static const int64_t chunk_vertices = chunk_size + 1;
+	// LOD l uses every 2^l-th vertex, the coarsest LOD has 2 x 2 quads per chunk
+	static const int64_t lod_count = 6;
+
+	// Splits the heightfield of the pyramid into chunks and writes the indices of a chunk in every LOD and with
+	// every combination of seams into indices, which all chunks share
+	// width, height and depth are the size of the terrain, boxes and errors are measured in these units
+	bool create(const TerrainPyramid& pyramid, float width, float height, float depth, std::vector<uint16_t>& indices);
+
+	// Marks the chunks to draw by the following select() calls and returns how many there are
+	// A chunk is drawn if its box is on the inner side (a x + b y + c z + d >= 0) of all the planes, in terrain space,
+	// and, if a pyramid is given, the terrain between the chunk and the eye does not hide it
+	int64_t cull(const float planes[6][4], const float eye[3], const TerrainPyramid* horizon);
+	// The planes for cull() of the frustum of the matrix from terrain space to clip space, which transforms row
+	// vectors as in DirectXMath
+	static void get_frustum_planes(const float terrain_to_clip[4][4], float planes[6][4]);
+
+	// Picks the coarsest LOD of every chunk whose error, seen from eye (in terrain space), stays below the tolerance,
+	// then refines chunks until neighbours differ by at most one LOD and writes the ranges to draw for the chunks
+	// left by the last cull(), all of them if there was none. offsets receives the vertex id of the first vertex of
+	// every chunk drawn, which TerrainVS adds to the vertex ids of the index buffer
+	// distance_per_error is the distance at which an error of 1 covers the tolerated number of pixels,
+	// viewport height / (2 tan(fovy / 2) * tolerated pixels)
+	void select(const float eye[3], float distance_per_error, std::vector<TerrainDrawRange>& draws, std::vector<uint32_t>& offsets);
+
+	int64_t get_chunk_count_x() const { return chunk_count; }
+	int64_t get_chunk_count_y() const { return chunk_count; }
+	TerrainBox get_box(int64_t chunk_x, int64_t chunk_y) const;
+	bool is_visible(int64_t chunk_x, int64_t chunk_y) const { return visible[chunk_x + chunk_y * row_stride] != 0; }
+	// LOD of the chunk from the last select()
+	int64_t get_lod(int64_t chunk_x, int64_t chunk_y) const { return lods[row_stride + chunk_x + chunk_y * row_stride]; }
+
+private:
+	struct Variant
+	{
+		uint32_t start;
+		uint32_t count;
+	};
+
+	// Boxes which cull() tests against the frustum at once, select() picks the LODs of half as many
+	static const int64_t box_batch = 8;
+	static_assert(chunk_vertices * chunk_vertices <= 65536, "The vertices of a chunk need 16 bit indices");
+
+	// Whether every ray from the eye to the chunk passes below the terrain in between
+	bool is_below_horizon(int64_t chunk_x, int64_t chunk_y, const float eye[3], const TerrainPyramid& pyramid) const;
+
+	// The per chunk arrays hold the rows of chunks row_stride apart, the padding after every row lets select() run
+	// over whole batches and keeps the rows apart when it spreads the LODs to the neighbours
+	// Boxes of the chunks, one array per coordinate so select() can load the coordinate of several boxes at once
+	std::vector<float> box_min[3];
+	std::vector<float> box_max[3];
+	// Per LOD the square of the largest height difference of every chunk to the full grid, never decreasing with the LOD
+	std::vector<float> squared_error[lod_count];
+	// Index ranges of the chunks per LOD and set of sides with a coarser neighbour, bit 0 for -y up to bit 3 for -x
+	Variant variants[lod_count][16] = {};
+	// The LODs picked by the distance, after the refinement along the rows and after the refinement along the columns
+	std::vector<uint8_t> wanted_lods;
+	std::vector<uint8_t> row_lods;
+	std::vector<uint8_t> lods;
+	// LOD * 16 + sides with a coarser neighbour, which select() sorts the chunks by
+	std::vector<uint8_t> keys;
+	// 0xFF for the chunks left by cull(), 0 for the others and the padding
+	std::vector<uint8_t> visible;
+	// Width, height and depth of the terrain
+	float size[3] = { 1.0f, 1.0f, 1.0f };
+	int64_t chunk_count = 0;
+	int64_t row_stride = 0;
+	int64_t resolution = 0;
+};
@@ -0,0 +1,72 @@
+#include "TerrainPyramid.h"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+bool TerrainPyramid::create(const float* heights, int64_t resolution)
+{
+	if (resolution < 2)
+	{
+		std::cerr << "ERROR: The terrain needs at least 2 x 2 heights for its height pyramid" << std::endl;
+		return false;
+	}
+
+	this->heights = heights;
+	this->resolution = resolution;
+	levels.clear();
+
+	// Level 1 straight from the heights, the levels above from the 2 x 2 blocks below them
+	for (int64_t level = 1; get_block_count(level - 1) > 1; level++)
+	{
+		Level next;
+		next.block_count = get_block_count(level);
+		next.low.resize(next.block_count * next.block_count);
+		next.high.resize(next.block_count * next.block_count);
+		for (int64_t y = 0; y < next.block_count; y++)
+			for (int64_t x = 0; x < next.block_count; x++)
+			{
+				float low, high;
+				get_block(level - 1, 2 * x, 2 * y, low, high);
+				for (int64_t child = 1; child < 4; child++)
+				{
+					int64_t child_x = std::min(2 * x + (child & 1), get_block_count(level - 1) - 1);
+					int64_t child_y = std::min(2 * y + (child >> 1), get_block_count(level - 1) - 1);
+					float child_low, child_high;
+					get_block(level - 1, child_x, child_y, child_low, child_high);
+					low = std::min(low, child_low);
+					high = std::max(high, child_high);
+				}
+				next.low[x + y * next.block_count] = low;
+				next.high[x + y * next.block_count] = high;
+			}
+		levels.push_back(std::move(next));
+	}
+
+	return true;
+}
+
+bool TerrainPyramid::get_range(int64_t x0, int64_t y0, int64_t x1, int64_t y1, int64_t min_level, float& low, float& high) const
+{
+	x0 = std::max<int64_t>(x0, 0);
+	y0 = std::max<int64_t>(y0, 0);
+	x1 = std::min(x1, resolution - 1);
+	y1 = std::min(y1, resolution - 1);
+	if (x0 >= x1 || y0 >= y1)
+		return false;
+
+	int64_t level = std::max<int64_t>(min_level, 0);
+	while (((x1 - 1) >> level) - (x0 >> level) > 1 || ((y1 - 1) >> level) - (y0 >> level) > 1)
+		level++;
+
+	get_block(level, x0 >> level, y0 >> level, low, high);
+	for (int64_t y = y0 >> level; y <= (y1 - 1) >> level; y++)
+		for (int64_t x = x0 >> level; x <= (x1 - 1) >> level; x++)
+		{
+			float block_low, block_high;
+			get_block(level, x, y, block_low, block_high);
+			low = std::min(low, block_low);
+			high = std::max(high, block_high);
+		}
+	return true;
+}
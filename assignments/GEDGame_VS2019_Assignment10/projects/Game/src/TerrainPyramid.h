@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Minimum and maximum heights over square blocks of quads of the heightfield, coarser by a factor of 2 per level
+// Block (x, y) of level l covers the quads [x 2^l; (x + 1) 2^l) x [y 2^l; (y + 1) 2^l), clamped to the grid,
+// level 0 are the single quads and the last level is a single block
+class TerrainPyramid
+{
+public:
+	// The pyramid reads level 0 from heights, which have to stay alive and unchanged while it is used
+	bool create(const float* heights, int64_t resolution);
+
+	const float* get_heights() const { return heights; }
+	int64_t get_resolution() const { return resolution; }
+	int64_t get_level_count() const { return static_cast<int64_t>(levels.size()) + 1; }
+	// Blocks along each side of the level
+	int64_t get_block_count(int64_t level) const { return (resolution - 2 + (int64_t(1) << level)) >> level; }
+	void get_block(int64_t level, int64_t x, int64_t y, float& low, float& high) const
+	{
+		// Above the last level the single block stays the same
+		level = std::min(level, get_level_count() - 1);
+		if (level > 0)
+		{
+			const Level& blocks = levels[level - 1];
+			low = blocks.low[x + y * blocks.block_count];
+			high = blocks.high[x + y * blocks.block_count];
+			return;
+		}
+
+		const float* quad = heights + x + y * resolution;
+		low = std::min(std::min(quad[0], quad[1]), std::min(quad[resolution], quad[resolution + 1]));
+		high = std::max(std::max(quad[0], quad[1]), std::max(quad[resolution], quad[resolution + 1]));
+	}
+
+	// Bounds of the heights of the quads [x0; x1) x [y0; y1), clamped to the grid, from the at most 2 x 2 blocks of
+	// the finest level not below min_level that cover them. Returns false if no quad is left after the clamping
+	bool get_range(int64_t x0, int64_t y0, int64_t x1, int64_t y1, int64_t min_level, float& low, float& high) const;
+
+private:
+	struct Level
+	{
+		int64_t block_count;
+		std::vector<float> low;
+		std::vector<float> high;
+	};
+
+	// levels[l - 1] holds level l
+	std::vector<Level> levels;
+	const float* heights = nullptr;
+	int64_t resolution = 0;
+};
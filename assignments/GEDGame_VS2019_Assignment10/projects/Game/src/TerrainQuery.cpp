@@ -0,0 +1,261 @@
+#include "TerrainQuery.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <emmintrin.h>
+
+void TerrainQuery::create(const TerrainPyramid& pyramid, float width, float height, float depth)
+{
+	this->pyramid = &pyramid;
+	heights = pyramid.get_heights();
+	resolution = pyramid.get_resolution();
+	size[0] = width;
+	size[1] = height;
+	size[2] = depth;
+}
+
+float TerrainQuery::get_height_bilinear(float x, float z) const
+{
+	float last = static_cast<float>(resolution - 1);
+	float grid_x = std::min(std::max(to_grid_x(x), 0.0f), last);
+	float grid_z = std::min(std::max(to_grid_z(z), 0.0f), last);
+	int64_t x0 = std::min(static_cast<int64_t>(grid_x), resolution - 2);
+	int64_t y0 = std::min(static_cast<int64_t>(grid_z), resolution - 2);
+	float u = grid_x - x0;
+	float v = grid_z - y0;
+
+	float top = get(x0, y0) + u * (get(x0 + 1, y0) - get(x0, y0));
+	float bottom = get(x0, y0 + 1) + u * (get(x0 + 1, y0 + 1) - get(x0, y0 + 1));
+	return (top + v * (bottom - top)) * size[1];
+}
+
+// Catmull-Rom weights of the 4 heights around t in [0; 1]
+static void catmull_rom(float t, float weights[4])
+{
+	float t2 = t * t;
+	float t3 = t2 * t;
+	weights[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+	weights[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+	weights[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+	weights[3] = 0.5f * (t3 - t2);
+}
+
+float TerrainQuery::get_height_bicubic(float x, float z) const
+{
+	float last = static_cast<float>(resolution - 1);
+	float grid_x = std::min(std::max(to_grid_x(x), 0.0f), last);
+	float grid_z = std::min(std::max(to_grid_z(z), 0.0f), last);
+	int64_t x0 = std::min(static_cast<int64_t>(grid_x), resolution - 2);
+	int64_t y0 = std::min(static_cast<int64_t>(grid_z), resolution - 2);
+
+	float weights_x[4];
+	float weights_z[4];
+	catmull_rom(grid_x - x0, weights_x);
+	catmull_rom(grid_z - y0, weights_z);
+
+	// The heights beyond the border repeat the border
+	float height = 0.0f;
+	for (int64_t j = 0; j < 4; j++)
+	{
+		int64_t y = std::min(std::max<int64_t>(y0 + j - 1, 0), resolution - 1);
+		float row = 0.0f;
+		for (int64_t i = 0; i < 4; i++)
+			row += weights_x[i] * get(std::min(std::max<int64_t>(x0 + i - 1, 0), resolution - 1), y);
+		height += weights_z[j] * row;
+	}
+	return height * size[1];
+}
+
+void TerrainQuery::get_heights_bilinear(const float* x, const float* z, float* heights, size_t count) const
+{
+	const __m128 size_x = _mm_set1_ps(size[0]);
+	const __m128 size_z = _mm_set1_ps(size[2]);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 last = _mm_set1_ps(static_cast<float>(resolution - 1));
+	const __m128 last_quad = _mm_set1_ps(static_cast<float>(resolution - 2));
+	const __m128 height_scale = _mm_set1_ps(size[1]);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		// The same operations in the same order as to_grid_x and to_grid_z, so the batch gives the bits of get_height_bilinear
+		__m128 grid_x = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(_mm_div_ps(_mm_loadu_ps(x + i), size_x), half), last), zero), last);
+		__m128 grid_z = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_add_ps(_mm_div_ps(_mm_loadu_ps(z + i), size_z), half), last), zero), last);
+		// Truncation is the floor of the clamped positions
+		__m128 x0 = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(grid_x)), last_quad);
+		__m128 y0 = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(grid_z)), last_quad);
+		__m128 u = _mm_sub_ps(grid_x, x0);
+		__m128 v = _mm_sub_ps(grid_z, y0);
+
+		// SSE2 has no gather, the corners are loaded one by one
+		alignas(16) int32_t cell_x[4];
+		alignas(16) int32_t cell_y[4];
+		_mm_store_si128(reinterpret_cast<__m128i*>(cell_x), _mm_cvttps_epi32(x0));
+		_mm_store_si128(reinterpret_cast<__m128i*>(cell_y), _mm_cvttps_epi32(y0));
+		alignas(16) float corners[4][4];
+		for (int64_t k = 0; k < 4; k++)
+		{
+			const float* quad = this->heights + cell_x[k] + cell_y[k] * resolution;
+			corners[0][k] = quad[0];
+			corners[1][k] = quad[1];
+			corners[2][k] = quad[resolution];
+			corners[3][k] = quad[resolution + 1];
+		}
+		__m128 h00 = _mm_load_ps(corners[0]);
+		__m128 h10 = _mm_load_ps(corners[1]);
+		__m128 h01 = _mm_load_ps(corners[2]);
+		__m128 h11 = _mm_load_ps(corners[3]);
+
+		__m128 top = _mm_add_ps(h00, _mm_mul_ps(u, _mm_sub_ps(h10, h00)));
+		__m128 bottom = _mm_add_ps(h01, _mm_mul_ps(u, _mm_sub_ps(h11, h01)));
+		__m128 height = _mm_add_ps(top, _mm_mul_ps(v, _mm_sub_ps(bottom, top)));
+		_mm_storeu_ps(heights + i, _mm_mul_ps(height, height_scale));
+	}
+	for (; i < count; i++)
+		heights[i] = get_height_bilinear(x[i], z[i]);
+}
+
+bool TerrainQuery::intersect_quad(int64_t x, int64_t y, const float origin[3], const float direction[3], float t0, float t1, float& t) const
+{
+	float h00 = get(x, y) * size[1];
+	float h10 = get(x + 1, y) * size[1];
+	float h01 = get(x, y + 1) * size[1];
+	float h11 = get(x + 1, y + 1) * size[1];
+
+	// Height of the segment above the triangle, split along the diagonal u + v = 1 like the grid
+	auto above = [&](float at, bool lower) {
+		float u = origin[0] + direction[0] * at - x;
+		float v = origin[2] + direction[2] * at - y;
+		float surface = lower
+			? h00 + u * (h10 - h00) + v * (h01 - h00)
+			: h11 + (1.0f - u) * (h01 - h11) + (1.0f - v) * (h10 - h11);
+		return origin[1] + direction[1] * at - surface;
+	};
+	auto diagonal = [&](float at) {
+		return origin[0] + direction[0] * at - x + origin[2] + direction[2] * at - y - 1.0f;
+	};
+
+	// Within one triangle the difference is linear in t, so a change of sign is found by interpolation
+	float bounds[3] = { t0, t1, t1 };
+	int64_t pieces = 1;
+	float d0 = diagonal(t0);
+	float d1 = diagonal(t1);
+	if ((d0 < 0.0f) != (d1 < 0.0f))
+	{
+		bounds[1] = t0 + (t1 - t0) * d0 / (d0 - d1);
+		pieces = 2;
+	}
+	for (int64_t piece = 0; piece < pieces; piece++)
+	{
+		float begin = bounds[piece];
+		float end = bounds[piece + 1];
+		bool lower = diagonal(0.5f * (begin + end)) <= 0.0f;
+		float a = above(begin, lower);
+		float b = above(end, lower);
+		if (a <= 0.0f)
+		{
+			t = begin;
+			return true;
+		}
+		if (b <= 0.0f)
+		{
+			t = begin + (end - begin) * a / (a - b);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Cell of the position p along an axis, a position on the border of two cells belongs to the one the segment enters
+static int64_t cell_at(float p, float direction, int64_t last_cell)
+{
+	float cell = std::floor(p);
+	if (direction < 0.0f && cell == p)
+		cell -= 1.0f;
+	return std::min(std::max(static_cast<int64_t>(cell), int64_t(0)), last_cell);
+}
+
+bool TerrainQuery::intersect_segment(const float from[3], const float to[3], float& t) const
+{
+	if (resolution < 2)
+		return false;
+
+	// In grid coordinates along x and z, terrain space along y
+	float origin[3] = { to_grid_x(from[0]), from[1], to_grid_z(from[2]) };
+	float direction[3] = { to_grid_x(to[0]) - origin[0], to[1] - from[1], to_grid_z(to[2]) - origin[2] };
+
+	// Clip the segment to the grid
+	float last = static_cast<float>(resolution - 1);
+	float t_begin = 0.0f;
+	float t_end = 1.0f;
+	for (int64_t axis = 0; axis < 3; axis += 2)
+	{
+		if (direction[axis] == 0.0f)
+		{
+			if (origin[axis] < 0.0f || origin[axis] > last)
+				return false;
+			continue;
+		}
+		float enter = -origin[axis] / direction[axis];
+		float leave = (last - origin[axis]) / direction[axis];
+		if (enter > leave)
+			std::swap(enter, leave);
+		t_begin = std::max(t_begin, enter);
+		t_end = std::min(t_end, leave);
+	}
+	if (t_begin > t_end)
+		return false;
+
+	// Walks the quads along the segment from the top of the pyramid down. A block whose highest height is below the
+	// segment is skipped as a whole, after leaving a block the walk goes up a level again
+	const int64_t top_level = pyramid->get_level_count() - 1;
+	const float infinity = std::numeric_limits<float>::infinity();
+	int64_t cell_x = cell_at(origin[0] + direction[0] * t_begin, direction[0], resolution - 2);
+	int64_t cell_y = cell_at(origin[2] + direction[2] * t_begin, direction[2], resolution - 2);
+	int64_t level = top_level;
+	float at = t_begin;
+	for (;;)
+	{
+		int64_t block_x = cell_x >> level;
+		int64_t block_y = cell_y >> level;
+		int64_t x0 = block_x << level;
+		int64_t y0 = block_y << level;
+		int64_t x1 = std::min((block_x + 1) << level, resolution - 1);
+		int64_t y1 = std::min((block_y + 1) << level, resolution - 1);
+		float leave_x = direction[0] > 0.0f ? (x1 - origin[0]) / direction[0] : direction[0] < 0.0f ? (x0 - origin[0]) / direction[0] : infinity;
+		float leave_y = direction[2] > 0.0f ? (y1 - origin[2]) / direction[2] : direction[2] < 0.0f ? (y0 - origin[2]) / direction[2] : infinity;
+		float leave = std::max(std::min(std::min(leave_x, leave_y), t_end), at);
+
+		float low, high;
+		pyramid->get_block(level, block_x, block_y, low, high);
+		float segment_low = origin[1] + direction[1] * (direction[1] < 0.0f ? leave : at);
+		if (segment_low <= high * size[1])
+		{
+			if (level > 0)
+			{
+				level--;
+				continue;
+			}
+			if (intersect_quad(cell_x, cell_y, origin, direction, at, leave, t))
+				return true;
+		}
+		if (leave >= t_end)
+			return false;
+
+		// Step into the neighbouring block, keeping the other coordinate inside of the block left
+		if (leave_x <= leave_y)
+			cell_x = direction[0] > 0.0f ? x1 : x0 - 1;
+		else
+			cell_x = std::min(std::max(cell_at(origin[0] + direction[0] * leave, direction[0], resolution - 2), x0), x1 - 1);
+		if (leave_y <= leave_x)
+			cell_y = direction[2] > 0.0f ? y1 : y0 - 1;
+		else
+			cell_y = std::min(std::max(cell_at(origin[2] + direction[2] * leave, direction[2], resolution - 2), y0), y1 - 1);
+		if (cell_x < 0 || cell_x > resolution - 2 || cell_y < 0 || cell_y > resolution - 2)
+			return false;
+		at = leave;
+		level = std::min(level + 1, top_level);
+	}
+}
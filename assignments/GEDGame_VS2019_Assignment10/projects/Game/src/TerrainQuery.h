@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "TerrainPyramid.h"
+
+// Height and collision queries against the heightfield of a TerrainPyramid, without a device
+// Positions are in terrain space like the boxes of TerrainLod: the object space of TerrainVS scaled by the terrain
+// size, so the grid spans [-width / 2; width / 2] x [-depth / 2; depth / 2] and the heights [0; height]
+class TerrainQuery
+{
+public:
+	// The pyramid has to outlive the queries
+	void create(const TerrainPyramid& pyramid, float width, float height, float depth);
+
+	// Height at (x, z), interpolated between the 2 x 2 or, with Catmull-Rom splines, the 4 x 4 nearest heights
+	// Positions beyond the border get the height at the border
+	float get_height_bilinear(float x, float z) const;
+	float get_height_bicubic(float x, float z) const;
+	// get_height_bilinear of count positions, 4 at once
+	void get_heights_bilinear(const float* x, const float* z, float* heights, size_t count) const;
+
+	// Finds the first point at which the segment from + t (to - from), t in [0; 1], touches the triangles drawn at
+	// the finest LOD without coarser neighbours, see TerrainLod.cpp. A segment which enters the grid below its border
+	// or starts below the terrain hits at once. Skips the blocks of the pyramid which the segment passes above
+	bool intersect_segment(const float from[3], const float to[3], float& t) const;
+
+private:
+	// Grid position of x or z, in quads
+	float to_grid_x(float x) const { return (x / size[0] + 0.5f) * (resolution - 1); }
+	float to_grid_z(float z) const { return (z / size[2] + 0.5f) * (resolution - 1); }
+	float get(int64_t x, int64_t y) const { return heights[x + y * resolution]; }
+
+	// Whether the segment meets the triangles of quad (x, y) for t in [t0; t1], which has to be within the quad
+	bool intersect_quad(int64_t x, int64_t y, const float origin[3], const float direction[3], float t0, float t1, float& t) const;
+
+	const TerrainPyramid* pyramid = nullptr;
+	const float* heights = nullptr;
+	int64_t resolution = 0;
+	float size[3] = { 1.0f, 1.0f, 1.0f };
+};
@@ -0,0 +1,670 @@
+#include "TerrainGenerator.h"
+#include "Simd.h"
+#include "MipPyramid.h"
+#include "HeightfieldSource.h"
+#include "Erosion.h"
+#include "PackedField.h"
+
+#include <iostream>
+#include <iomanip>
+#include <cmath>
+#include <chrono>
+#include <sstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+typedef void (*NormalKernel)(const float* above, const float* below, float y_scale, const float* height, int64_t resolution, GEDUtils::Vec3f* out);
+
+// Best time of a few runs in milliseconds, the first run also warms up the caches
+static double time_normals(NormalKernel kernel, const std::vector<float>& height, int64_t resolution, int64_t rows, std::vector<GEDUtils::Vec3f>& normal)
+{
+	const int runs = 5;
+	double best = 0.0;
+
+	for (int run = 0; run < runs; run++)
+	{
+		auto start_time = std::chrono::high_resolution_clock::now();
+		for (int64_t y = 1; y <= rows; y++)
+			kernel(&height[idx(0, y - 1, resolution)], &height[idx(0, y + 1, resolution)], 0.5f,
+				&height[idx(0, y, resolution)], resolution, &normal[idx(0, y - 1, resolution)]);
+		auto end_time = std::chrono::high_resolution_clock::now();
+
+		double ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+		if (run == 0 || ms < best)
+			best = ms;
+	}
+
+	return best;
+}
+
+void benchmark_normals()
+{
+	// Rows are independent, so a band of rows gives the same per pixel cost as the full map
+	// and keeps the 16k case within the 32 bit address space
+	const int64_t resolutions[] = { 1024, 4096, 16384 };
+	const int64_t max_pixels = 16 * 1024 * 1024;
+
+	struct Variant
+	{
+		SimdLevel level;
+		NormalKernel kernel;
+	};
+	const Variant variants[] = {
+		{ SimdLevel::Scalar, normal_row_scalar },
+		{ SimdLevel::SSE2, normal_row_sse2 },
+		{ SimdLevel::AVX2, normal_row_avx2 } };
+
+	std::cout << "Benchmarking normal_row on a single thread" << std::endl;
+	std::cout << std::fixed;
+
+	for (int64_t resolution : resolutions)
+	{
+		int64_t rows = std::min(resolution, max_pixels / resolution);
+
+		// Terrain-like input, the slopes do not change the cost but keep the values realistic
+		std::vector<float> height(resolution * (rows + 2));
+		for (int64_t y = 0; y < rows + 2; y++)
+			for (int64_t x = 0; x < resolution; x++)
+				height[idx(x, y, resolution)] = 0.5f + 0.01f * random_normal(g_terrain_seed, x, y, 0);
+
+		// The scalar kernel comes first and is the reference for the others
+		std::vector<GEDUtils::Vec3f> reference(resolution * rows);
+		std::vector<GEDUtils::Vec3f> normal(resolution * rows);
+		double scalar_ms = 0.0;
+
+		for (const Variant& variant : variants)
+		{
+			if (variant.level > g_simd_level)
+				continue;
+
+			double ms = time_normals(variant.kernel, height, resolution, rows, normal);
+			if (variant.level == SimdLevel::Scalar)
+			{
+				scalar_ms = ms;
+				reference = normal;
+			}
+
+			// Largest deviation from the scalar kernel
+			float error = 0.0f;
+			for (size_t i = 0; i < normal.size(); i++)
+			{
+				error = std::max(error, std::abs(normal[i].x - reference[i].x));
+				error = std::max(error, std::abs(normal[i].y - reference[i].y));
+				error = std::max(error, std::abs(normal[i].z - reference[i].z));
+			}
+
+			std::cout << std::setw(6) << resolution << " x " << std::setw(4) << rows << " " << std::setw(6) << simd_level_name(variant.level) << ": "
+				<< std::setprecision(2) << std::setw(8) << ms << " ms, "
+				<< std::setw(8) << static_cast<double>(resolution * rows) / (ms * 1000.0) << " MPixel/s, "
+				<< std::setw(5) << scalar_ms / ms << "x, "
+				<< "max error " << std::scientific << std::setprecision(1) << error << std::fixed << std::endl;
+		}
+	}
+}
+
+// Best time of a few runs in milliseconds to generate the first rows of the field
+static double time_source(const HeightfieldSource& source, int64_t resolution, int64_t rows, std::vector<float*>& row_table)
+{
+	const int runs = 3;
+	double best = 0.0;
+
+	for (int run = 0; run < runs; run++)
+	{
+		auto start_time = std::chrono::high_resolution_clock::now();
+		source.generate_rows(resolution, 0, rows, row_table.data());
+		auto end_time = std::chrono::high_resolution_clock::now();
+
+		double ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+		if (run == 0 || ms < best)
+			best = ms;
+	}
+
+	return best;
+}
+
+void benchmark_sources()
+{
+	// Rows of the noise sources are independent and Diamond-Square tiles are 256 rows high,
+	// so a band of 1024 rows gives the per sample cost of the full field
+	const int64_t resolutions[] = { 1024, 4096 };
+	const int64_t max_rows = 1024;
+
+	struct Entry
+	{
+		const wchar_t* name;
+		bool simd; // Diamond-Square has no SIMD kernels
+	};
+	const Entry entries[] = {
+		{ L"diamond_square", false },
+		{ L"fbm_perlin", true },
+		{ L"fbm_simplex", true },
+		{ L"ridged_perlin", true },
+		{ L"ridged_simplex", true } };
+	const SimdLevel levels[] = { SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2 };
+
+	// A single thread, so the throughput is per core
+	unsigned int thread_count = g_thread_count;
+	SimdLevel simd_level = g_simd_level;
+	g_thread_count = 1;
+
+	std::cout << "Benchmarking the heightfield sources on a single thread" << std::endl;
+	std::cout << std::fixed;
+
+	for (int64_t resolution : resolutions)
+	{
+		int64_t rows = std::min(resolution, max_rows);
+		std::vector<float> field(resolution * rows);
+		std::vector<float*> row_table(rows);
+		for (int64_t y = 0; y < rows; y++)
+			row_table[y] = &field[idx(0, y, resolution)];
+
+		for (const Entry& entry : entries)
+		{
+			std::unique_ptr<HeightfieldSource> source = create_heightfield_source(entry.name, g_terrain_seed);
+
+			// The scalar kernel comes first and is the reference for the others
+			std::vector<float> reference;
+			double scalar_ms = 0.0;
+
+			for (SimdLevel level : levels)
+			{
+				if (level > simd_level || (level != SimdLevel::Scalar && !entry.simd))
+					continue;
+
+				g_simd_level = level;
+				double ms = time_source(*source, resolution, rows, row_table);
+				if (level == SimdLevel::Scalar)
+				{
+					scalar_ms = ms;
+					reference = field;
+				}
+
+				// Largest deviation from the scalar kernel
+				float error = 0.0f;
+				for (size_t i = 0; i < field.size(); i++)
+					error = std::max(error, std::abs(field[i] - reference[i]));
+
+				std::cout << std::left << std::setw(15) << source->get_name() << std::right
+					<< std::setw(6) << resolution << " x " << std::setw(4) << rows << " " << std::setw(6) << simd_level_name(level) << ": "
+					<< std::setprecision(2) << std::setw(8) << ms << " ms, "
+					<< std::setw(8) << static_cast<double>(resolution * rows) / (ms * 1000.0) << " MSamples/s/core, "
+					<< std::setw(5) << scalar_ms / ms << "x, "
+					<< "max error " << std::scientific << std::setprecision(1) << error << std::fixed << std::endl;
+			}
+		}
+	}
+
+	g_thread_count = thread_count;
+	g_simd_level = simd_level;
+}
+
+// The pack and unpack kernel of a storage format for one instruction set
+template <typename Value, typename Packed>
+struct PackingVariant
+{
+	SimdLevel level;
+	void (*pack)(const Value* in, int64_t count, Packed* out);
+	void (*unpack)(const Packed* in, int64_t count, Value* out);
+};
+
+// Best time of a few runs in milliseconds, the first run also warms up the caches
+static double time_best(const std::function<void()>& run)
+{
+	const int runs = 5;
+	double best = 0.0;
+
+	for (int i = 0; i < runs; i++)
+	{
+		auto start_time = std::chrono::high_resolution_clock::now();
+		run();
+		auto end_time = std::chrono::high_resolution_clock::now();
+
+		double ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+		if (i == 0 || ms < best)
+			best = ms;
+	}
+
+	return best;
+}
+
+static float value_error(float a, float b)
+{
+	return std::abs(a - b);
+}
+
+static float value_error(const GEDUtils::Vec3f& a, const GEDUtils::Vec3f& b)
+{
+	return std::max(std::max(std::abs(a.x - b.x), std::abs(a.y - b.y)), std::abs(a.z - b.z));
+}
+
+template <typename Value, typename Packed>
+static void benchmark_format(const char* name, const PackingVariant<Value, Packed> (&variants)[3], const std::vector<Value>& values)
+{
+	int64_t count = static_cast<int64_t>(values.size());
+	std::vector<Packed> packed(count);
+	std::vector<Value> unpacked(count);
+
+	// The scalar kernels come first and are the reference for the others
+	std::vector<Packed> reference_packed;
+	std::vector<Value> reference_unpacked;
+	double scalar_ms = 0.0;
+
+	for (const auto& variant : variants)
+	{
+		if (variant.level > g_simd_level)
+			continue;
+
+		double pack_ms = time_best([&]() { variant.pack(values.data(), count, packed.data()); });
+		double unpack_ms = time_best([&]() { variant.unpack(packed.data(), count, unpacked.data()); });
+		if (variant.level == SimdLevel::Scalar)
+		{
+			scalar_ms = pack_ms + unpack_ms;
+			reference_packed = packed;
+			reference_unpacked = unpacked;
+		}
+
+		// Values whose bits differ from the scalar kernels and the largest error of the round trip
+		int64_t mismatches = 0;
+		float error = 0.0f;
+		for (int64_t i = 0; i < count; i++)
+		{
+			if (packed[i] != reference_packed[i] || memcmp(&unpacked[i], &reference_unpacked[i], sizeof(Value)) != 0)
+				mismatches++;
+			error = std::max(error, value_error(unpacked[i], values[i]));
+		}
+
+		std::cout << std::left << std::setw(11) << name << std::right << std::setw(6) << simd_level_name(variant.level) << ": "
+			<< "pack " << std::setprecision(0) << std::setw(6) << count / (pack_ms * 1000.0) << " MPixel/s, "
+			<< "unpack " << std::setw(6) << count / (unpack_ms * 1000.0) << " MPixel/s, "
+			<< std::setprecision(2) << std::setw(5) << scalar_ms / (pack_ms + unpack_ms) << "x, "
+			<< mismatches << " mismatches, "
+			<< "max error " << std::scientific << std::setprecision(1) << error << std::fixed << std::endl;
+	}
+}
+
+void benchmark_packing()
+{
+	const int64_t resolution = 2048;
+
+	// A slope over the whole range with some noise, so every exponent of the half floats is used
+	std::vector<float> height(resolution * resolution);
+	for (int64_t y = 0; y < resolution; y++)
+		for (int64_t x = 0; x < resolution; x++)
+			height[idx(x, y, resolution)] = clamp(static_cast<float>(x + y) / (2 * resolution) + 0.002f * random_normal(g_terrain_seed, x, y, 0));
+
+	std::vector<GEDUtils::Vec3f> normal(resolution * resolution);
+	for (int64_t y = 0; y < resolution; y++)
+		normal_row_scalar(&height[idx(0, std::max(y - 1, 0ll), resolution)], &height[idx(0, std::min(y + 1, resolution - 1), resolution)],
+			y == 0 || y == resolution - 1 ? 1.0f : 0.5f, &height[idx(0, y, resolution)], resolution, &normal[idx(0, y, resolution)]);
+
+	const PackingVariant<float, uint16_t> unorm16[] = {
+		{ SimdLevel::Scalar, pack_unorm16_row_scalar, unpack_unorm16_row_scalar },
+		{ SimdLevel::SSE2, pack_unorm16_row_sse2, unpack_unorm16_row_sse2 },
+		{ SimdLevel::AVX2, pack_unorm16_row_avx2, unpack_unorm16_row_avx2 } };
+	const PackingVariant<float, uint16_t> half[] = {
+		{ SimdLevel::Scalar, pack_half_row_scalar, unpack_half_row_scalar },
+		{ SimdLevel::SSE2, pack_half_row_sse2, unpack_half_row_sse2 },
+		{ SimdLevel::AVX2, pack_half_row_avx2, unpack_half_row_avx2 } };
+	const PackingVariant<GEDUtils::Vec3f, uint32_t> octahedral[] = {
+		{ SimdLevel::Scalar, pack_octahedral_row_scalar, unpack_octahedral_row_scalar },
+		{ SimdLevel::SSE2, pack_octahedral_row_sse2, unpack_octahedral_row_sse2 },
+		{ SimdLevel::AVX2, pack_octahedral_row_avx2, unpack_octahedral_row_avx2 } };
+
+	std::cout << "Benchmarking the packing kernels on a single thread, " << resolution << " x " << resolution << " pixels" << std::endl;
+	std::cout << std::fixed;
+	benchmark_format("unorm16", unorm16, height);
+	benchmark_format("half", half, height);
+	benchmark_format("octahedral", octahedral, normal);
+}
+
+bool benchmark_colors()
+{
+	const int64_t resolution = 2048;
+	const int64_t rows = 256;
+
+	// Heights around the blend between the low and the high materials and slopes around the steep ones
+	std::vector<float> height(resolution * (rows + 2));
+	for (int64_t y = 0; y < rows + 2; y++)
+		for (int64_t x = 0; x < resolution; x++)
+			height[idx(x, y, resolution)] = clamp(0.31f + 0.02f * std::sin(x * 0.01f) + 0.002f * random_normal(g_terrain_seed, x, y, 0));
+	std::vector<GEDUtils::Vec3f> normal(resolution * rows);
+	for (int64_t y = 1; y <= rows; y++)
+		normal_row_scalar(&height[idx(0, y - 1, resolution)], &height[idx(0, y + 1, resolution)], 0.5f,
+			&height[idx(0, y, resolution)], resolution, &normal[idx(0, y - 1, resolution)]);
+
+	TerrainTextures textures;
+	typedef void (*FloatKernel)(const float*, const GEDUtils::Vec3f*, int64_t, int64_t, const TerrainTextures&, GEDUtils::Vec3f*);
+	typedef void (*Unorm8Kernel)(const float*, const GEDUtils::Vec3f*, int64_t, int64_t, const TerrainTextures&, uint32_t*);
+	struct Variant
+	{
+		SimdLevel level;
+		FloatKernel float_kernel;
+		Unorm8Kernel unorm8_kernel;
+	};
+	const Variant variants[] = {
+		{ SimdLevel::Scalar, color_row_scalar, color_row_unorm8_scalar },
+		{ SimdLevel::SSE2, color_row_sse2, color_row_unorm8_sse2 },
+		{ SimdLevel::AVX2, color_row_avx2, color_row_unorm8_avx2 } };
+
+	std::cout << "Benchmarking color_row and color_row_unorm8 on a single thread, " << resolution << " x " << rows << " pixels" << std::endl;
+	std::cout << std::fixed;
+
+	// The scalar kernels come first and are the reference for the others
+	std::vector<GEDUtils::Vec3f> colors(resolution * rows);
+	std::vector<uint32_t> bytes(resolution * rows);
+	std::vector<GEDUtils::Vec3f> reference_colors;
+	std::vector<uint32_t> reference_bytes;
+	double scalar_ms = 0.0;
+	bool identical = true;
+
+	for (const Variant& variant : variants)
+	{
+		if (variant.level > g_simd_level)
+			continue;
+
+		double float_ms = time_best([&]()
+		{
+			for (int64_t y = 0; y < rows; y++)
+				variant.float_kernel(&height[idx(0, y + 1, resolution)], &normal[idx(0, y, resolution)], y, resolution, textures, &colors[idx(0, y, resolution)]);
+		});
+		double unorm8_ms = time_best([&]()
+		{
+			for (int64_t y = 0; y < rows; y++)
+				variant.unorm8_kernel(&height[idx(0, y + 1, resolution)], &normal[idx(0, y, resolution)], y, resolution, textures, &bytes[idx(0, y, resolution)]);
+		});
+		if (variant.level == SimdLevel::Scalar)
+		{
+			scalar_ms = float_ms;
+			reference_colors = colors;
+			reference_bytes = bytes;
+		}
+
+		// Pixels whose bits differ from the scalar kernels and the largest difference of the 8 bit colors to the float ones
+		int64_t mismatches = 0;
+		float error = 0.0f;
+		for (size_t i = 0; i < bytes.size(); i++)
+		{
+			if (bytes[i] != reference_bytes[i] || memcmp(&colors[i], &reference_colors[i], sizeof(GEDUtils::Vec3f)) != 0)
+				mismatches++;
+			GEDUtils::Vec3f unorm8((bytes[i] & 0xFF) / 255.0f, ((bytes[i] >> 8) & 0xFF) / 255.0f, ((bytes[i] >> 16) & 0xFF) / 255.0f);
+			error = std::max(error, value_error(unorm8, reference_colors[i]) * 255.0f);
+		}
+		identical &= mismatches == 0;
+
+		std::cout << std::setw(6) << simd_level_name(variant.level) << ": "
+			<< "float " << std::setprecision(0) << std::setw(6) << bytes.size() / (float_ms * 1000.0) << " MPixel/s, "
+			<< "unorm8 " << std::setw(6) << bytes.size() / (unorm8_ms * 1000.0) << " MPixel/s, "
+			<< std::setprecision(2) << std::setw(5) << scalar_ms / unorm8_ms << "x, "
+			<< mismatches << " mismatches, "
+			<< "max unorm8 error " << error << " / 255" << std::endl;
+	}
+
+	if (!identical)
+		std::cout << "ERROR: The color kernels do not give the same bits as the scalar ones" << std::endl;
+	return identical;
+}
+
+// Timings of one stage at one resolution
+struct StageResult
+{
+	std::string stage;
+	int64_t resolution;
+	double median_ms;
+	double p95_ms;
+	double pixels_per_second;
+	double bytes_per_second;
+};
+
+// Runs prepare and stage for the warmup and the measured runs, only stage is timed
+// Returns the times of the measured runs in milliseconds, sorted
+static std::vector<double> time_stage(const BenchmarkOptions& options, const std::function<void()>& prepare, const std::function<void()>& stage)
+{
+	std::vector<double> times;
+	for (int64_t run = 0; run < options.warmup_runs + options.runs; run++)
+	{
+		prepare();
+		auto start_time = std::chrono::high_resolution_clock::now();
+		stage();
+		auto end_time = std::chrono::high_resolution_clock::now();
+
+		if (run >= options.warmup_runs)
+			times.push_back(std::chrono::duration<double, std::milli>(end_time - start_time).count());
+	}
+
+	std::sort(times.begin(), times.end());
+	return times;
+}
+
+// Nearest rank percentile of sorted times, p in (0;1]
+static double percentile(const std::vector<double>& sorted, double p)
+{
+	int64_t rank = static_cast<int64_t>(std::ceil(p * sorted.size()));
+	return sorted[std::min(std::max(rank, 1ll), static_cast<int64_t>(sorted.size())) - 1];
+}
+
+// bytes is the size of the arrays the stage reads and writes
+static StageResult make_result(const char* stage, int64_t resolution, const std::vector<double>& times, double bytes)
+{
+	StageResult result;
+	result.stage = stage;
+	result.resolution = resolution;
+	result.median_ms = percentile(times, 0.5);
+	result.p95_ms = percentile(times, 0.95);
+	result.pixels_per_second = static_cast<double>(resolution * resolution) / (std::max(result.median_ms, 1e-6) / 1000.0);
+	result.bytes_per_second = bytes / (std::max(result.median_ms, 1e-6) / 1000.0);
+	return result;
+}
+
+// Every result is written on its own line, which keeps the baseline parser simple
+static std::string to_json(const BenchmarkOptions& options, const std::vector<StageResult>& results)
+{
+	std::ostringstream json;
+	json << std::setprecision(6);
+	json << "{\n";
+	json << "  \"threads\": " << g_thread_count << ",\n";
+	json << "  \"simd\": \"" << simd_level_name(g_simd_level) << "\",\n";
+	json << "  \"warmup_runs\": " << options.warmup_runs << ",\n";
+	json << "  \"runs\": " << options.runs << ",\n";
+	json << "  \"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const StageResult& result = results[i];
+		json << "    { \"stage\": \"" << result.stage << "\", \"resolution\": " << result.resolution
+			<< ", \"median_ms\": " << result.median_ms << ", \"p95_ms\": " << result.p95_ms
+			<< ", \"pixels_per_s\": " << result.pixels_per_second << ", \"bytes_per_s\": " << result.bytes_per_second << " }"
+			<< (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	json << "  ]\n";
+	json << "}\n";
+	return json.str();
+}
+
+// Finds "key": in the line and parses the value after it
+static bool find_value(const std::string& line, const char* key, std::string& value)
+{
+	std::string pattern = std::string("\"") + key + "\": ";
+	size_t begin = line.find(pattern);
+	if (begin == std::string::npos)
+		return false;
+	begin += pattern.size();
+
+	if (line[begin] == '"')
+	{
+		size_t end = line.find('"', begin + 1);
+		if (end == std::string::npos)
+			return false;
+		value = line.substr(begin + 1, end - begin - 1);
+	}
+	else
+		value = line.substr(begin, line.find_first_of(",}", begin) - begin);
+	return true;
+}
+
+// Reads the medians of a file written by -benchmark_json, keyed by stage and resolution
+static bool read_baseline(const _TCHAR* path, std::map<std::pair<std::string, int64_t>, double>& medians)
+{
+	FILE* file = _wfopen(path, L"r");
+	if (file == nullptr)
+		return false;
+
+	char buffer[1024];
+	int64_t line_number = 0;
+	while (fgets(buffer, sizeof(buffer), file) != nullptr)
+	{
+		line_number++;
+		std::string line = buffer;
+		std::string stage, resolution, median;
+		if (!find_value(line, "stage", stage) || !find_value(line, "resolution", resolution) || !find_value(line, "median_ms", median))
+			continue;
+
+		// A line which was edited by hand or cut off is skipped, the other stages can still be compared
+		char* resolution_end = nullptr;
+		char* median_end = nullptr;
+		errno = 0;
+		long long resolution_value = strtoll(resolution.c_str(), &resolution_end, 10);
+		double median_value = strtod(median.c_str(), &median_end);
+		resolution_end += strspn(resolution_end, " \t\r\n");
+		median_end += strspn(median_end, " \t\r\n");
+		if (resolution.empty() || median.empty() || *resolution_end != '\0' || *median_end != '\0' || errno != 0)
+		{
+			std::cout << "WARNING: Skipping malformed line " << line_number << " of the baseline" << std::endl;
+			continue;
+		}
+		medians[std::make_pair(stage, static_cast<int64_t>(resolution_value))] = median_value;
+	}
+
+	fclose(file);
+	return true;
+}
+
+bool benchmark_pipeline(const HeightfieldSource& source, const BenchmarkOptions& options)
+{
+	std::map<std::pair<std::string, int64_t>, double> baseline;
+	if (options.baseline_path != nullptr && !read_baseline(options.baseline_path, baseline))
+	{
+		std::wcout << "ERROR: Baseline could not be read from: " << options.baseline_path << std::endl;
+		return false;
+	}
+
+	std::wstring height_path = options.scratch_directory + L"benchmark_height.png";
+	std::wstring color_path = options.scratch_directory + L"benchmark_color.png";
+	std::wstring normal_path = options.scratch_directory + L"benchmark_normal.png";
+
+	std::cout << "Benchmarking the pipeline stages with " << source.get_name() << ", " << options.warmup_runs << " warmup and " << options.runs << " measured runs" << std::endl;
+	std::cout << std::fixed;
+	std::cout << "Stage                  Resolution   Median (ms)   p95 (ms)   MPixel/s   GB/s   Baseline" << std::endl;
+
+	std::vector<StageResult> results;
+	bool regressed = false;
+	bool saved = true;
+
+	for (int64_t resolution = std::min(256ll, options.max_resolution); resolution <= options.max_resolution; resolution *= 2)
+	{
+		double pixels = static_cast<double>(resolution * resolution);
+		std::vector<StageResult> stage_results;
+
+		// Every stage works on the output of the previous one, like the unfused pipeline
+		// Stages which change their input in place get a fresh copy before every run, outside of the timing
+		std::vector<float> height;
+		stage_results.push_back(make_result("generate_heightfield", resolution,
+			time_stage(options, []() {}, [&]() { height = generate_heightfield(source, resolution); }),
+			pixels * sizeof(float)));
+
+		std::vector<float> pretty;
+		stage_results.push_back(make_result("make_pretty", resolution,
+			time_stage(options, [&]() { pretty = height; }, [&]() { make_pretty(pretty, resolution); }),
+			pixels * sizeof(float) * 2));
+
+		// A fixed number of iterations, so the result does not depend on the machine
+		ErosionSettings erosion;
+		erosion.iterations = 10;
+		std::vector<float> eroded;
+		stage_results.push_back(make_result("erode_heightfield", resolution,
+			time_stage(options, [&]() { eroded = pretty; }, [&]() { erode_heightfield(eroded, resolution, erosion); }),
+			pixels * sizeof(float) * 6 * erosion.iterations));
+
+		// The remaining stages read the heights through a float store, which keeps the vector as it is
+		HeightStore pretty_store(FieldStorage::Float, std::vector<float>(pretty), resolution);
+
+		NormalStore normal(FieldStorage::Float, resolution, resolution);
+		stage_results.push_back(make_result("generate_normals", resolution,
+			time_stage(options, []() {}, [&]() { normal = generate_normals(pretty_store, resolution); }),
+			pixels * (sizeof(float) + sizeof(GEDUtils::Vec3f))));
+
+		std::vector<GEDUtils::Vec3f> color;
+		stage_results.push_back(make_result("generate_colors", resolution,
+			time_stage(options, []() {}, [&]() { color = generate_colors(pretty_store, normal, resolution); }),
+			pixels * (sizeof(float) + sizeof(GEDUtils::Vec3f) * 2)));
+
+		std::vector<float> height_small;
+		stage_results.push_back(make_result("resize_heightfield", resolution,
+			time_stage(options, []() {}, [&]() { height_small = resize_heightfield(pretty_store, resolution); }),
+			pixels * sizeof(float) * 17 / 16));
+
+		// The pyramid of the full resolution heightfield, the outputs are the heights and both bounds of every level
+		stage_results.push_back(make_result("build_mip_pyramid", resolution,
+			time_stage(options, []() {}, [&]() { build_mip_pyramid(pretty, resolution, MipFilter::Box); }),
+			pixels * sizeof(float) * (1 + 3 * 4 / 3.0)));
+
+		// Writes all three maps like the unfused pipeline
+		stage_results.push_back(make_result("save_image", resolution,
+			time_stage(options, []() {}, [&]()
+			{
+				saved &= save_image(height_small, resolution / 4, &height_path[0]);
+				saved &= save_image(color, resolution, &color_path[0]);
+				saved &= save_image(normal, &normal_path[0]);
+			}),
+			pixels * (sizeof(float) / 16 + sizeof(GEDUtils::Vec3f) * 2)));
+
+		for (const StageResult& result : stage_results)
+		{
+			std::cout << std::left << std::setw(20) << result.stage << std::right << std::setw(13) << result.resolution
+				<< std::setprecision(3) << std::setw(14) << result.median_ms << std::setw(11) << result.p95_ms
+				<< std::setprecision(1) << std::setw(11) << result.pixels_per_second / 1e6
+				<< std::setprecision(2) << std::setw(7) << result.bytes_per_second / 1e9;
+
+			// Stages below the timer noise are reported but cannot regress
+			const double noise_ms = 0.1;
+			auto entry = baseline.find(std::make_pair(result.stage, result.resolution));
+			if (entry != baseline.end())
+			{
+				double ratio = result.median_ms / std::max(entry->second, 1e-6);
+				std::cout << std::setw(10) << ratio << "x";
+				if (result.median_ms > entry->second * (1.0 + options.tolerance) && result.median_ms - entry->second > noise_ms)
+				{
+					std::cout << " REGRESSION";
+					regressed = true;
+				}
+			}
+			std::cout << std::endl;
+		}
+		results.insert(results.end(), stage_results.begin(), stage_results.end());
+	}
+
+	DeleteFileW(height_path.c_str());
+	DeleteFileW(color_path.c_str());
+	DeleteFileW(normal_path.c_str());
+	if (!saved)
+		std::wcout << "ERROR: save_image could not write to: " << options.scratch_directory << std::endl;
+
+	if (options.json_path != nullptr)
+	{
+		FILE* file = _wfopen(options.json_path, L"w");
+		std::string json = to_json(options, results);
+		if (file == nullptr || fputs(json.c_str(), file) < 0)
+		{
+			std::wcout << "ERROR: Benchmark results could not be saved to: " << options.json_path << std::endl;
+			saved = false;
+		}
+		if (file != nullptr)
+			fclose(file);
+	}
+
+	if (regressed)
+		std::cout << "ERROR: At least one stage is slower than the baseline by more than " << options.tolerance * 100.0 << "%" << std::endl;
+
+	return saved && !regressed;
+}
@@ -0,0 +1,449 @@
+#include "DdsWriter.h"
+
+#include <cmath>
+#include <cstring>
+
+// Encoders of 4x4 blocks, see the Direct3D 11 block compression formats:
+// https://docs.microsoft.com/en-us/windows/win32/direct3d11/texture-block-compression-in-direct3d-11
+// Every encoder fits the endpoints along the principal axis of the block, picks the index of every pixel by projecting it onto them
+// and then refines the endpoints by least squares once, keeping whichever of the two has the smaller error
+
+// Channel values of a block scaled to [0;255]
+struct BlockPixel
+{
+	float c[3];
+};
+
+static void scale_block(const GEDUtils::Vec3f* pixels, BlockPixel* out)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		out[i].c[0] = clamp(pixels[i].x) * 255.0f;
+		out[i].c[1] = clamp(pixels[i].y) * 255.0f;
+		out[i].c[2] = clamp(pixels[i].z) * 255.0f;
+	}
+}
+
+// Ends of the segment along the principal axis of the pixels which covers all of them
+static void fit_principal_axis(const BlockPixel* pixels, float* low, float* high)
+{
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			mean[c] += pixels[i].c[c] / 16.0f;
+
+	float covariance[6] = {}; // xx xy xz yy yz zz
+	for (int i = 0; i < 16; i++)
+	{
+		float d[3] = { pixels[i].c[0] - mean[0], pixels[i].c[1] - mean[1], pixels[i].c[2] - mean[2] };
+		covariance[0] += d[0] * d[0];
+		covariance[1] += d[0] * d[1];
+		covariance[2] += d[0] * d[2];
+		covariance[3] += d[1] * d[1];
+		covariance[4] += d[1] * d[2];
+		covariance[5] += d[2] * d[2];
+	}
+
+	// Power iteration, starting from the grey axis which is close for most terrain colors
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[3] =
+		{
+			covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+			covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+			covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2]
+		};
+		float length = std::max(std::max(std::abs(next[0]), std::abs(next[1])), std::abs(next[2]));
+		if (length < 1e-6f)
+			break; // Flat block, any axis works
+		for (int c = 0; c < 3; c++)
+			axis[c] = next[c] / length;
+	}
+	float length_squared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+	float t_min = 0.0f;
+	float t_max = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = ((pixels[i].c[0] - mean[0]) * axis[0] + (pixels[i].c[1] - mean[1]) * axis[1] + (pixels[i].c[2] - mean[2]) * axis[2]) / length_squared;
+		t_min = std::min(t_min, t);
+		t_max = std::max(t_max, t);
+	}
+	for (int c = 0; c < 3; c++)
+	{
+		low[c] = mean[c] + axis[c] * t_min;
+		high[c] = mean[c] + axis[c] * t_max;
+	}
+}
+
+// Endpoints which minimize the squared error for the given interpolation weights of the pixels (0 = first, 1 = second endpoint)
+// Returns false if all weights are the same and the system has no unique solution
+static bool fit_least_squares(const BlockPixel* pixels, const float* weights, int channels, float* first, float* second)
+{
+	float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+	float ax[3] = {}, bx[3] = {};
+	for (int i = 0; i < 16; i++)
+	{
+		float a = 1.0f - weights[i];
+		float b = weights[i];
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < channels; c++)
+		{
+			ax[c] += a * pixels[i].c[c];
+			bx[c] += b * pixels[i].c[c];
+		}
+	}
+
+	float determinant = aa * bb - ab * ab;
+	if (std::abs(determinant) < 1e-6f)
+		return false;
+	for (int c = 0; c < channels; c++)
+	{
+		first[c] = clamp((ax[c] * bb - bx[c] * ab) / determinant, 0.0f, 255.0f);
+		second[c] = clamp((bx[c] * aa - ax[c] * ab) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+inline float squared_distance(const BlockPixel& pixel, const float* color, int channels)
+{
+	float sum = 0.0f;
+	for (int c = 0; c < channels; c++)
+		sum += (pixel.c[c] - color[c]) * (pixel.c[c] - color[c]);
+	return sum;
+}
+
+// Projects every pixel onto the line from palette[order[0]] to palette[order[steps]] and picks the entry
+// closest to the projection, order[k] is the palette entry at k / steps of the way. Returns the total squared error
+static float choose_indices(const BlockPixel* pixels, const float (*palette)[3], const int* order, int steps, int channels, int* indices)
+{
+	const float* start = palette[order[0]];
+	const float* end = palette[order[steps]];
+	float direction[3] = {};
+	float length_squared = 0.0f;
+	for (int c = 0; c < channels; c++)
+	{
+		direction[c] = end[c] - start[c];
+		length_squared += direction[c] * direction[c];
+	}
+	float scale = length_squared > 0.0f ? steps / length_squared : 0.0f;
+
+	float error = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < channels; c++)
+			t += (pixels[i].c[c] - start[c]) * direction[c];
+		int step = static_cast<int>(clamp(t * scale, 0.0f, static_cast<float>(steps)) + 0.5f);
+		indices[i] = order[step];
+		error += squared_distance(pixels[i], palette[indices[i]], channels);
+	}
+	return error;
+}
+
+// Little endian bit stream of one block of up to 128 bits
+struct BlockBits
+{
+	uint64_t words[2] = {};
+	int position = 0;
+
+	void put(uint64_t value, int bits)
+	{
+		words[position / 64] |= value << (position % 64);
+		if (position % 64 + bits > 64)
+			words[1] |= value >> (64 - position % 64);
+		position += bits;
+	}
+
+	void store(uint8_t* out, int bytes) const
+	{
+		memcpy(out, words, bytes);
+	}
+};
+
+// BC1
+
+inline uint16_t to_rgb565(const float* color)
+{
+	int r = static_cast<int>(color[0] * (31.0f / 255.0f) + 0.5f);
+	int g = static_cast<int>(color[1] * (63.0f / 255.0f) + 0.5f);
+	int b = static_cast<int>(color[2] * (31.0f / 255.0f) + 0.5f);
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+// Expands like the hardware by replicating the high bits
+inline void from_rgb565(uint16_t packed, float* color)
+{
+	int r = (packed >> 11) & 31;
+	int g = (packed >> 5) & 63;
+	int b = packed & 31;
+	color[0] = static_cast<float>((r << 3) | (r >> 2));
+	color[1] = static_cast<float>((g << 2) | (g >> 4));
+	color[2] = static_cast<float>((b << 3) | (b >> 2));
+}
+
+// Quantizes the endpoints and chooses the indices, first > second selects the four color mode
+static float encode_bc1_endpoints(const BlockPixel* pixels, const float* low, const float* high, uint16_t& first, uint16_t& second, int* indices)
+{
+	first = to_rgb565(high);
+	second = to_rgb565(low);
+	if (first < second)
+		std::swap(first, second);
+
+	float palette[4][3];
+	from_rgb565(first, palette[0]);
+	from_rgb565(second, palette[1]);
+	for (int c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+		palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+	}
+	// With equal endpoints every pixel gets index 0
+	static const int order[4] = { 0, 2, 3, 1 };
+	return choose_indices(pixels, palette, order, 3, 3, indices);
+}
+
+void encode_bc1_block(const GEDUtils::Vec3f* pixels, uint8_t* out)
+{
+	BlockPixel scaled[16];
+	scale_block(pixels, scaled);
+
+	float low[3], high[3];
+	fit_principal_axis(scaled, low, high);
+	uint16_t first, second;
+	int indices[16];
+	float error = encode_bc1_endpoints(scaled, low, high, first, second, indices);
+
+	const float index_weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	float weights[16];
+	for (int i = 0; i < 16; i++)
+		weights[i] = index_weights[indices[i]];
+	if (fit_least_squares(scaled, weights, 3, high, low))
+	{
+		uint16_t refined_first, refined_second;
+		int refined_indices[16];
+		float refined_error = encode_bc1_endpoints(scaled, low, high, refined_first, refined_second, refined_indices);
+		if (refined_error < error)
+		{
+			first = refined_first;
+			second = refined_second;
+			std::copy(refined_indices, refined_indices + 16, indices);
+		}
+	}
+
+	BlockBits bits;
+	bits.put(first, 16);
+	bits.put(second, 16);
+	for (int i = 0; i < 16; i++)
+		bits.put(indices[i], 2);
+	bits.store(out, 8);
+}
+
+// BC4 and BC5
+
+// Eight value mode (first > second) with six interpolated values, first == second stores a constant block
+static float encode_bc4_endpoints(const BlockPixel* pixels, float low, float high, uint8_t& first, uint8_t& second, int* indices)
+{
+	first = static_cast<uint8_t>(high + 0.5f);
+	second = static_cast<uint8_t>(low + 0.5f);
+	if (first < second)
+		std::swap(first, second);
+
+	float palette[8][3];
+	palette[0][0] = first;
+	palette[1][0] = second;
+	for (int p = 2; p < 8; p++)
+		palette[p][0] = ((8 - p) * palette[0][0] + (p - 1) * palette[1][0]) / 7.0f;
+	static const int order[8] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+	return choose_indices(pixels, palette, order, 7, 1, indices);
+}
+
+void encode_bc4_block(const float* values, uint8_t* out)
+{
+	BlockPixel scaled[16];
+	float low = 255.0f;
+	float high = 0.0f;
+	for (int i = 0; i < 16; i++)
+	{
+		scaled[i].c[0] = clamp(values[i]) * 255.0f;
+		low = std::min(low, scaled[i].c[0]);
+		high = std::max(high, scaled[i].c[0]);
+	}
+
+	uint8_t first, second;
+	int indices[16];
+	float error = encode_bc4_endpoints(scaled, low, high, first, second, indices);
+
+	// Index p > 1 lies at (p - 1) / 7 from the first to the second endpoint
+	float weights[16];
+	for (int i = 0; i < 16; i++)
+		weights[i] = indices[i] == 0 ? 0.0f : indices[i] == 1 ? 1.0f : (indices[i] - 1) / 7.0f;
+	if (fit_least_squares(scaled, weights, 1, &high, &low))
+	{
+		uint8_t refined_first, refined_second;
+		int refined_indices[16];
+		float refined_error = encode_bc4_endpoints(scaled, low, high, refined_first, refined_second, refined_indices);
+		if (refined_error < error)
+		{
+			first = refined_first;
+			second = refined_second;
+			std::copy(refined_indices, refined_indices + 16, indices);
+		}
+	}
+
+	BlockBits bits;
+	bits.put(first, 8);
+	bits.put(second, 8);
+	for (int i = 0; i < 16; i++)
+		bits.put(indices[i], 3);
+	bits.store(out, 8);
+}
+
+void encode_bc5_block(const GEDUtils::Vec3f* pixels, uint8_t* out)
+{
+	float x[16], y[16];
+	for (int i = 0; i < 16; i++)
+	{
+		x[i] = pixels[i].x;
+		y[i] = pixels[i].y;
+	}
+	encode_bc4_block(x, out);
+	encode_bc4_block(y, out + 8);
+}
+
+// BC7
+
+// Interpolation weights of the 4 bit indices, out of 64
+static const int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// Index with the closest weight for every position 0 to 64 along the endpoints
+static const std::vector<int>& bc7_order()
+{
+	static const std::vector<int> order = []()
+	{
+		std::vector<int> result(65);
+		for (int position = 0; position <= 64; position++)
+			for (int i = 1; i < 16; i++)
+				if (std::abs(bc7_weights[i] - position) < std::abs(bc7_weights[result[position]] - position))
+					result[position] = i;
+		return result;
+	}();
+	return order;
+}
+
+// Endpoint of mode 6: 7 bits per channel and a p-bit shared by the channels, which becomes the lowest bit
+struct Bc7Endpoint
+{
+	int q[3];
+	int p;
+
+	void expand(float* color) const
+	{
+		for (int c = 0; c < 3; c++)
+			color[c] = static_cast<float>((q[c] << 1) | p);
+	}
+};
+
+// Rounds to the closest 8 bit value with the p-bit set
+// The p-bit is shared with alpha, whose 7 bits of 127 only decode to an opaque 255 with it, 254 without
+static Bc7Endpoint quantize_bc7_endpoint(const float* color)
+{
+	Bc7Endpoint endpoint = {};
+	endpoint.p = 1;
+	for (int c = 0; c < 3; c++)
+		endpoint.q[c] = std::min(std::max(static_cast<int>((color[c] - 1.0f) * 0.5f + 0.5f), 0), 127);
+	return endpoint;
+}
+
+static float encode_bc7_endpoints(const BlockPixel* pixels, const float* low, const float* high, Bc7Endpoint& first, Bc7Endpoint& second, int* indices)
+{
+	first = quantize_bc7_endpoint(low);
+	second = quantize_bc7_endpoint(high);
+
+	// Integer interpolation of the decoder
+	float a[3], b[3];
+	first.expand(a);
+	second.expand(b);
+	float palette[16][3];
+	for (int p = 0; p < 16; p++)
+		for (int c = 0; c < 3; c++)
+			palette[p][c] = static_cast<float>(((64 - bc7_weights[p]) * static_cast<int>(a[c]) + bc7_weights[p] * static_cast<int>(b[c]) + 32) >> 6);
+	return choose_indices(pixels, palette, bc7_order().data(), 64, 3, indices);
+}
+
+void encode_bc7_block(const GEDUtils::Vec3f* pixels, uint8_t* out)
+{
+	BlockPixel scaled[16];
+	scale_block(pixels, scaled);
+
+	float low[3], high[3];
+	fit_principal_axis(scaled, low, high);
+	Bc7Endpoint first, second;
+	int indices[16];
+	float error = encode_bc7_endpoints(scaled, low, high, first, second, indices);
+
+	float weights[16];
+	for (int i = 0; i < 16; i++)
+		weights[i] = bc7_weights[indices[i]] / 64.0f;
+	if (fit_least_squares(scaled, weights, 3, low, high))
+	{
+		Bc7Endpoint refined_first, refined_second;
+		int refined_indices[16];
+		float refined_error = encode_bc7_endpoints(scaled, low, high, refined_first, refined_second, refined_indices);
+		if (refined_error < error)
+		{
+			first = refined_first;
+			second = refined_second;
+			std::copy(refined_indices, refined_indices + 16, indices);
+		}
+	}
+
+	// The highest bit of the first index is implicitly 0, otherwise the endpoints are swapped
+	if (indices[0] >= 8)
+	{
+		std::swap(first, second);
+		for (int i = 0; i < 16; i++)
+			indices[i] = 15 - indices[i];
+	}
+
+	// Mode 6 is selected by 6 zero bits and a one, alpha is opaque as both p-bits are set
+	BlockBits bits;
+	bits.put(1u << 6, 7);
+	for (int c = 0; c < 3; c++)
+	{
+		bits.put(first.q[c], 7);
+		bits.put(second.q[c], 7);
+	}
+	bits.put(127, 7);
+	bits.put(127, 7);
+	bits.put(first.p, 1);
+	bits.put(second.p, 1);
+	bits.put(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		bits.put(indices[i], 4);
+	bits.store(out, 16);
+}
+
+int64_t block_bytes(BlockFormat format)
+{
+	return format == BlockFormat::BC1 ? 8 : 16;
+}
+
+void encode_block(BlockFormat format, const GEDUtils::Vec3f* pixels, uint8_t* out)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1:
+		encode_bc1_block(pixels, out);
+		break;
+	case BlockFormat::BC5:
+		encode_bc5_block(pixels, out);
+		break;
+	default:
+		encode_bc7_block(pixels, out);
+		break;
+	}
+}
@@ -0,0 +1,416 @@
+#include "TerrainGenerator.h"
+#include "Simd.h"
+#include "ImageReader.h"
+
+#include <iostream>
+
+TextureAtlas::TextureAtlas(const wchar_t* path)
+{
+	Image<Rgb48> image;
+	if (!read_image(path, image))
+	{
+		// A grey texture keeps the colormap usable
+		std::wcout << "ERROR: Texture could not be loaded: " << path << std::endl;
+		image = Image<Rgb48>(1, 1);
+		image.row(0)[0] = Rgb48{ 32768, 32768, 32768 };
+	}
+	width = image.get_width();
+	height = image.get_height();
+	stride = width + padding;
+	texels.resize(3 * height * stride);
+	bytes.resize(3 * height * stride);
+
+	// The rows are split into the planar channels in parallel
+	const Image<Rgb48>& pixels = image;
+	parallel_for(0, height, [&](int64_t row_begin, int64_t row_end)
+	{
+		for (int64_t v = row_begin; v < row_end; v++)
+		{
+			RowSpan<const Rgb48> row = pixels.row(v);
+			float* r = &texels[(0 * height + v) * stride];
+			float* g = &texels[(1 * height + v) * stride];
+			float* b = &texels[(2 * height + v) * stride];
+			uint8_t* r8 = &bytes[(0 * height + v) * stride];
+			uint8_t* g8 = &bytes[(1 * height + v) * stride];
+			uint8_t* b8 = &bytes[(2 * height + v) * stride];
+			for (int64_t i = 0; i < stride; i++)
+			{
+				const Rgb48& texel = row[i % width];
+				r[i] = texel.r / 65535.0f;
+				g[i] = texel.g / 65535.0f;
+				b[i] = texel.b / 65535.0f;
+				r8[i] = static_cast<uint8_t>((texel.r * 255 + 32767) / 65535);
+				g8[i] = static_cast<uint8_t>((texel.g * 255 + 32767) / 65535);
+				b8[i] = static_cast<uint8_t>((texel.b * 255 + 32767) / 65535);
+			}
+		}
+	});
+}
+
+const wchar_t* const TerrainTextures::paths[4] = {
+	L"../../../../external/textures/mud02.jpg",
+	L"../../../../external/textures/rock3.jpg",
+	L"../../../../external/textures/gras15.jpg",
+	L"../../../../external/textures/rock3.jpg" };
+
+TerrainTextures::TerrainTextures()
+	: low_flat(paths[0]), low_steep(paths[1]), high_flat(paths[2]), high_steep(paths[3])
+{
+}
+
+// The four materials in the order low flat, low steep, high flat, high steep
+// For the row y of the colormap, channel[m][c] points to the texture row which repeats there
+struct MaterialRows
+{
+	const float* channel[4][3];
+	const uint8_t* byte_channel[4][3];
+	int64_t width[4];
+
+	MaterialRows(const TerrainTextures& textures, int64_t y)
+	{
+		const TextureAtlas* atlases[4] = { &textures.low_flat, &textures.low_steep, &textures.high_flat, &textures.high_steep };
+		for (int m = 0; m < 4; m++)
+		{
+			width[m] = atlases[m]->width;
+			for (int c = 0; c < 3; c++)
+			{
+				channel[m][c] = atlases[m]->row(c, y % atlases[m]->height);
+				byte_channel[m][c] = atlases[m]->byte_row(c, y % atlases[m]->height);
+			}
+		}
+	}
+};
+
+// Colors of the pixels [begin; end) of the row
+static void color_pixels(const float* height, const GEDUtils::Vec3f* normal, const MaterialRows& rows, int64_t begin, int64_t end, GEDUtils::Vec3f* out)
+{
+	for (int64_t x = begin; x < end; x++)
+	{
+		// Compute alpha
+		float alpha_slope = smoothstep(clamp(map_range(1.0f - normal[x].z, 0.1f, 0.2f)));
+		float alpha_height = smoothstep(clamp(map_range(height[x], 0.3f, 0.32f)));
+
+		// Sample textures
+		GEDUtils::Vec3f texel[4];
+		for (int m = 0; m < 4; m++)
+		{
+			int64_t u = x % rows.width[m];
+			texel[m] = GEDUtils::Vec3f(rows.channel[m][0][u], rows.channel[m][1][u], rows.channel[m][2][u]);
+		}
+
+		// Blend
+		GEDUtils::Vec3f low = blend(texel[0], texel[1], alpha_slope);
+		GEDUtils::Vec3f high = blend(texel[2], texel[3], alpha_slope);
+
+		out[x] = blend(low, high, alpha_height);
+	}
+}
+
+void color_row_scalar(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, GEDUtils::Vec3f* out)
+{
+	color_pixels(height, normal, MaterialRows(textures, y), 0, resolution, out);
+}
+
+// smoothstep(clamp(map_range(x, low, low + range))) for four values
+inline __m128 blend_factor(__m128 x, __m128 low, __m128 range)
+{
+	__m128 t = _mm_div_ps(_mm_sub_ps(x, low), range);
+	t = _mm_min_ps(_mm_max_ps(_mm_setzero_ps(), t), _mm_set1_ps(1.0f));
+	return _mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), t)));
+}
+
+inline __m256 blend_factor(__m256 x, __m256 low, __m256 range)
+{
+	__m256 t = _mm256_div_ps(_mm256_sub_ps(x, low), range);
+	t = _mm256_min_ps(_mm256_max_ps(_mm256_setzero_ps(), t), _mm256_set1_ps(1.0f));
+	return _mm256_mul_ps(_mm256_mul_ps(t, t), _mm256_sub_ps(_mm256_set1_ps(3.0f), _mm256_mul_ps(_mm256_set1_ps(2.0f), t)));
+}
+
+void color_row_sse2(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, GEDUtils::Vec3f* out)
+{
+	MaterialRows rows(textures, y);
+	int64_t u[4] = {};
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 slope_low = _mm_set1_ps(0.1f);
+	const __m128 slope_range = _mm_set1_ps(0.2f - 0.1f);
+	const __m128 height_low = _mm_set1_ps(0.3f);
+	const __m128 height_range = _mm_set1_ps(0.32f - 0.3f);
+
+	int64_t x = 0;
+	for (; x + 4 <= resolution; x += 4)
+	{
+		__m128 normal_z = _mm_setr_ps(normal[x].z, normal[x + 1].z, normal[x + 2].z, normal[x + 3].z);
+		__m128 alpha_slope = blend_factor(_mm_sub_ps(one, normal_z), slope_low, slope_range);
+		__m128 alpha_height = blend_factor(_mm_loadu_ps(height + x), height_low, height_range);
+		__m128 inverse_slope = _mm_sub_ps(one, alpha_slope);
+		__m128 inverse_height = _mm_sub_ps(one, alpha_height);
+
+		__m128 result[3];
+		for (int c = 0; c < 3; c++)
+		{
+			__m128 low = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(rows.channel[0][c] + u[0]), inverse_slope),
+				_mm_mul_ps(_mm_loadu_ps(rows.channel[1][c] + u[1]), alpha_slope));
+			__m128 high = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(rows.channel[2][c] + u[2]), inverse_slope),
+				_mm_mul_ps(_mm_loadu_ps(rows.channel[3][c] + u[3]), alpha_slope));
+			result[c] = _mm_add_ps(_mm_mul_ps(low, inverse_height), _mm_mul_ps(high, alpha_height));
+		}
+		store_vec3(reinterpret_cast<float*>(out + x), result[0], result[1], result[2]);
+
+		// The loads may run into the padding, so the texture coordinates only wrap once per step
+		for (int m = 0; m < 4; m++)
+			u[m] = (u[m] + 4) % rows.width[m];
+	}
+
+	color_pixels(height, normal, rows, x, resolution, out);
+}
+
+void color_row_avx2(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, GEDUtils::Vec3f* out)
+{
+	MaterialRows rows(textures, y);
+	int64_t u[4] = {};
+
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 slope_low = _mm256_set1_ps(0.1f);
+	const __m256 slope_range = _mm256_set1_ps(0.2f - 0.1f);
+	const __m256 height_low = _mm256_set1_ps(0.3f);
+	const __m256 height_range = _mm256_set1_ps(0.32f - 0.3f);
+	// Offsets of the z components of eight Vec3f
+	const __m256i z_offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+	int64_t x = 0;
+	for (; x + 8 <= resolution; x += 8)
+	{
+		__m256 normal_z = _mm256_i32gather_ps(&normal[x].z, z_offsets, 4);
+		__m256 alpha_slope = blend_factor(_mm256_sub_ps(one, normal_z), slope_low, slope_range);
+		__m256 alpha_height = blend_factor(_mm256_loadu_ps(height + x), height_low, height_range);
+		__m256 inverse_slope = _mm256_sub_ps(one, alpha_slope);
+		__m256 inverse_height = _mm256_sub_ps(one, alpha_height);
+
+		__m256 result[3];
+		for (int c = 0; c < 3; c++)
+		{
+			__m256 low = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(rows.channel[0][c] + u[0]), inverse_slope),
+				_mm256_mul_ps(_mm256_loadu_ps(rows.channel[1][c] + u[1]), alpha_slope));
+			__m256 high = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(rows.channel[2][c] + u[2]), inverse_slope),
+				_mm256_mul_ps(_mm256_loadu_ps(rows.channel[3][c] + u[3]), alpha_slope));
+			result[c] = _mm256_add_ps(_mm256_mul_ps(low, inverse_height), _mm256_mul_ps(high, alpha_height));
+		}
+
+		// The interleaving works on 128 bit lanes, so both halves are stored separately
+		float* target = reinterpret_cast<float*>(out + x);
+		store_vec3(target, _mm256_castps256_ps128(result[0]), _mm256_castps256_ps128(result[1]), _mm256_castps256_ps128(result[2]));
+		store_vec3(target + 12, _mm256_extractf128_ps(result[0], 1), _mm256_extractf128_ps(result[1], 1), _mm256_extractf128_ps(result[2], 1));
+
+		for (int m = 0; m < 4; m++)
+			u[m] = (u[m] + 8) % rows.width[m];
+	}
+
+	color_pixels(height, normal, rows, x, resolution, out);
+}
+
+void color_row(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, GEDUtils::Vec3f* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		color_row_avx2(height, normal, y, resolution, textures, out);
+		break;
+	case SimdLevel::SSE2:
+		color_row_sse2(height, normal, y, resolution, textures, out);
+		break;
+	default:
+		color_row_scalar(height, normal, y, resolution, textures, out);
+		break;
+	}
+}
+
+// The 8 bit kernels blend a and b with a weight w in [0; 256] as (a * (256 - w) + b * w + 128) >> 8
+// The sum stays below 65536, so the SIMD variants blend in unsigned 16 bit lanes
+
+// Blend factor of the float kernels rounded to 1/256
+inline int32_t to_weight(float alpha)
+{
+	return static_cast<int32_t>(alpha * 256.0f + 0.5f);
+}
+
+inline int32_t blend_unorm8(int32_t a, int32_t b, int32_t weight)
+{
+	return (a * (256 - weight) + b * weight + 128) >> 8;
+}
+
+static void color_pixels_unorm8(const float* height, const GEDUtils::Vec3f* normal, const MaterialRows& rows, int64_t begin, int64_t end, uint32_t* out)
+{
+	for (int64_t x = begin; x < end; x++)
+	{
+		int32_t weight_slope = to_weight(smoothstep(clamp(map_range(1.0f - normal[x].z, 0.1f, 0.2f))));
+		int32_t weight_height = to_weight(smoothstep(clamp(map_range(height[x], 0.3f, 0.32f))));
+
+		uint32_t pixel = 0xFF000000u;
+		for (int c = 0; c < 3; c++)
+		{
+			int32_t texel[4];
+			for (int m = 0; m < 4; m++)
+				texel[m] = rows.byte_channel[m][c][x % rows.width[m]];
+
+			int32_t low = blend_unorm8(texel[0], texel[1], weight_slope);
+			int32_t high = blend_unorm8(texel[2], texel[3], weight_slope);
+			pixel |= static_cast<uint32_t>(blend_unorm8(low, high, weight_height)) << (8 * c);
+		}
+		out[x] = pixel;
+	}
+}
+
+void color_row_unorm8_scalar(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, uint32_t* out)
+{
+	color_pixels_unorm8(height, normal, MaterialRows(textures, y), 0, resolution, out);
+}
+
+// blend_unorm8 of eight 16 bit lanes, inverse is 256 - weight
+inline __m128i blend_unorm8(__m128i a, __m128i b, __m128i weight, __m128i inverse)
+{
+	__m128i sum = _mm_add_epi16(_mm_mullo_epi16(a, inverse), _mm_mullo_epi16(b, weight));
+	return _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(128)), 8);
+}
+
+inline __m256i blend_unorm8(__m256i a, __m256i b, __m256i weight, __m256i inverse)
+{
+	__m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(a, inverse), _mm256_mullo_epi16(b, weight));
+	return _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(128)), 8);
+}
+
+// Writes eight pixels given as 16 bit lanes of red, green and blue as R8G8B8A8
+inline void store_rgba8(uint32_t* out, __m128i r, __m128i g, __m128i b)
+{
+	__m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r, r), _mm_packus_epi16(g, g)); // r0 g0 r1 g1 ...
+	__m128i ba = _mm_unpacklo_epi8(_mm_packus_epi16(b, b), _mm_set1_epi8(-1)); // b0 ff b1 ff ...
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi16(rg, ba));
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), _mm_unpackhi_epi16(rg, ba));
+}
+
+void color_row_unorm8_sse2(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, uint32_t* out)
+{
+	MaterialRows rows(textures, y);
+	int64_t u[4] = {};
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 slope_low = _mm_set1_ps(0.1f);
+	const __m128 slope_range = _mm_set1_ps(0.2f - 0.1f);
+	const __m128 height_low = _mm_set1_ps(0.3f);
+	const __m128 height_range = _mm_set1_ps(0.32f - 0.3f);
+	const __m128 scale = _mm_set1_ps(256.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128i full = _mm_set1_epi16(256);
+
+	// Weights of four pixels, converted like to_weight
+	auto weights = [&](__m128 alpha) { return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(alpha, scale), half)); };
+
+	int64_t x = 0;
+	for (; x + 8 <= resolution; x += 8)
+	{
+		__m128i slope_halves[2], height_halves[2];
+		for (int h = 0; h < 2; h++)
+		{
+			int64_t i = x + 4 * h;
+			__m128 normal_z = _mm_setr_ps(normal[i].z, normal[i + 1].z, normal[i + 2].z, normal[i + 3].z);
+			slope_halves[h] = weights(blend_factor(_mm_sub_ps(one, normal_z), slope_low, slope_range));
+			height_halves[h] = weights(blend_factor(_mm_loadu_ps(height + i), height_low, height_range));
+		}
+		// The weights are at most 256, so the signed saturation keeps them
+		__m128i weight_slope = _mm_packs_epi32(slope_halves[0], slope_halves[1]);
+		__m128i weight_height = _mm_packs_epi32(height_halves[0], height_halves[1]);
+		__m128i inverse_slope = _mm_sub_epi16(full, weight_slope);
+		__m128i inverse_height = _mm_sub_epi16(full, weight_height);
+
+		__m128i result[3];
+		for (int c = 0; c < 3; c++)
+		{
+			__m128i texel[4];
+			for (int m = 0; m < 4; m++)
+				texel[m] = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows.byte_channel[m][c] + u[m])), _mm_setzero_si128());
+
+			__m128i low = blend_unorm8(texel[0], texel[1], weight_slope, inverse_slope);
+			__m128i high = blend_unorm8(texel[2], texel[3], weight_slope, inverse_slope);
+			result[c] = blend_unorm8(low, high, weight_height, inverse_height);
+		}
+		store_rgba8(out + x, result[0], result[1], result[2]);
+
+		// The loads may run into the padding, so the texture coordinates only wrap once per step
+		for (int m = 0; m < 4; m++)
+			u[m] = (u[m] + 8) % rows.width[m];
+	}
+
+	color_pixels_unorm8(height, normal, rows, x, resolution, out);
+}
+
+void color_row_unorm8_avx2(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, uint32_t* out)
+{
+	MaterialRows rows(textures, y);
+	int64_t u[4] = {};
+
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 slope_low = _mm256_set1_ps(0.1f);
+	const __m256 slope_range = _mm256_set1_ps(0.2f - 0.1f);
+	const __m256 height_low = _mm256_set1_ps(0.3f);
+	const __m256 height_range = _mm256_set1_ps(0.32f - 0.3f);
+	const __m256 scale = _mm256_set1_ps(256.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256i full = _mm256_set1_epi16(256);
+	const __m256i z_offsets = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+
+	auto weights = [&](__m256 alpha) { return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(alpha, scale), half)); };
+
+	// 16 pixels per step, which the padding of the textures still covers
+	int64_t x = 0;
+	for (; x + 16 <= resolution; x += 16)
+	{
+		__m256i slope_halves[2], height_halves[2];
+		for (int h = 0; h < 2; h++)
+		{
+			int64_t i = x + 8 * h;
+			__m256 normal_z = _mm256_i32gather_ps(&normal[i].z, z_offsets, 4);
+			slope_halves[h] = weights(blend_factor(_mm256_sub_ps(one, normal_z), slope_low, slope_range));
+			height_halves[h] = weights(blend_factor(_mm256_loadu_ps(height + i), height_low, height_range));
+		}
+		// The packing works within 128 bit lanes, the permutation puts the 16 weights back in order
+		__m256i weight_slope = _mm256_permute4x64_epi64(_mm256_packs_epi32(slope_halves[0], slope_halves[1]), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i weight_height = _mm256_permute4x64_epi64(_mm256_packs_epi32(height_halves[0], height_halves[1]), _MM_SHUFFLE(3, 1, 2, 0));
+		__m256i inverse_slope = _mm256_sub_epi16(full, weight_slope);
+		__m256i inverse_height = _mm256_sub_epi16(full, weight_height);
+
+		__m256i result[3];
+		for (int c = 0; c < 3; c++)
+		{
+			__m256i texel[4];
+			for (int m = 0; m < 4; m++)
+				texel[m] = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rows.byte_channel[m][c] + u[m])));
+
+			__m256i low = blend_unorm8(texel[0], texel[1], weight_slope, inverse_slope);
+			__m256i high = blend_unorm8(texel[2], texel[3], weight_slope, inverse_slope);
+			result[c] = blend_unorm8(low, high, weight_height, inverse_height);
+		}
+		store_rgba8(out + x, _mm256_castsi256_si128(result[0]), _mm256_castsi256_si128(result[1]), _mm256_castsi256_si128(result[2]));
+		store_rgba8(out + x + 8, _mm256_extracti128_si256(result[0], 1), _mm256_extracti128_si256(result[1], 1), _mm256_extracti128_si256(result[2], 1));
+
+		for (int m = 0; m < 4; m++)
+			u[m] = (u[m] + 16) % rows.width[m];
+	}
+
+	color_pixels_unorm8(height, normal, rows, x, resolution, out);
+}
+
+void color_row_unorm8(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, uint32_t* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		color_row_unorm8_avx2(height, normal, y, resolution, textures, out);
+		break;
+	case SimdLevel::SSE2:
+		color_row_unorm8_sse2(height, normal, y, resolution, textures, out);
+		break;
+	default:
+		color_row_unorm8_scalar(height, normal, y, resolution, textures, out);
+		break;
+	}
+}
@@ -0,0 +1,261 @@
+#include "DdsWriter.h"
+#include "ImageWriter.h"
+
+#include <cmath>
+#include <cwchar>
+
+BlockFormat g_dds_color_format = BlockFormat::BC7;
+
+bool parse_color_block_format(const wchar_t* name, BlockFormat& format)
+{
+	if (_wcsicmp(name, L"bc1") == 0)
+		format = BlockFormat::BC1;
+	else if (_wcsicmp(name, L"bc7") == 0)
+		format = BlockFormat::BC7;
+	else
+		return false;
+	return true;
+}
+
+const char* block_format_name(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1:
+		return "BC1";
+	case BlockFormat::BC5:
+		return "BC5";
+	default:
+		return "BC7";
+	}
+}
+
+// Flags and formats of the DDS header, see https://docs.microsoft.com/en-us/windows/win32/direct3ddds/dds-header
+const DWORD dds_magic = 0x20534444; // "DDS "
+const DWORD ddsd_caps = 0x1;
+const DWORD ddsd_height = 0x2;
+const DWORD ddsd_width = 0x4;
+const DWORD ddsd_pixel_format = 0x1000;
+const DWORD ddsd_mip_map_count = 0x20000;
+const DWORD ddsd_linear_size = 0x80000;
+const DWORD ddpf_four_cc = 0x4;
+const DWORD ddscaps_complex = 0x8;
+const DWORD ddscaps_texture = 0x1000;
+const DWORD ddscaps_mip_map = 0x400000;
+const DWORD dxgi_format_bc1_unorm_srgb = 72;
+const DWORD dxgi_format_bc7_unorm_srgb = 99;
+const DWORD d3d10_resource_dimension_texture2d = 3;
+
+inline DWORD four_cc(char a, char b, char c, char d)
+{
+	return static_cast<DWORD>(a) | (static_cast<DWORD>(b) << 8) | (static_cast<DWORD>(c) << 16) | (static_cast<DWORD>(d) << 24);
+}
+
+// Magic number, header and for the colormap the DX10 extension, since the FourCCs cannot mark a format as sRGB
+static std::vector<BYTE> dds_header(int64_t width, int64_t height, int64_t level_count, int64_t level0_bytes, BlockFormat format)
+{
+	bool dx10 = format != BlockFormat::BC5;
+	std::vector<BYTE> header(4 + 124 + (dx10 ? 20 : 0), 0);
+	auto put32 = [&](int64_t offset, int64_t value)
+	{
+		for (int64_t b = 0; b < 4; b++)
+			header[offset + b] = static_cast<BYTE>(value >> (b * 8));
+	};
+
+	put32(0, dds_magic);
+	put32(4, 124);
+	put32(8, ddsd_caps | ddsd_height | ddsd_width | ddsd_pixel_format | ddsd_mip_map_count | ddsd_linear_size);
+	put32(12, height);
+	put32(16, width);
+	put32(20, level0_bytes);
+	put32(28, level_count);
+
+	// Pixel format
+	put32(76, 32);
+	put32(80, ddpf_four_cc);
+	put32(84, dx10 ? four_cc('D', 'X', '1', '0') : four_cc('A', 'T', 'I', '2'));
+
+	put32(108, ddscaps_complex | ddscaps_texture | ddscaps_mip_map);
+
+	if (dx10)
+	{
+		put32(128, format == BlockFormat::BC1 ? dxgi_format_bc1_unorm_srgb : dxgi_format_bc7_unorm_srgb);
+		put32(132, d3d10_resource_dimension_texture2d);
+		put32(140, 1); // Array size
+	}
+	return header;
+}
+
+// The colors are sRGB encoded like the source textures, so they are averaged in linear space
+// Every pixel is decoded once per level, so this looks the value up at the 16 bit precision of the saved maps
+static float srgb_to_linear(float value)
+{
+	static const std::vector<float> table = []()
+	{
+		std::vector<float> result(65536);
+		for (size_t i = 0; i < result.size(); i++)
+		{
+			float x = i / 65535.0f;
+			result[i] = x <= 0.04045f ? x / 12.92f : std::pow((x + 0.055f) / 1.055f, 2.4f);
+		}
+		return result;
+	}();
+	return table[to_word(value)];
+}
+
+static float linear_to_srgb(float value)
+{
+	return value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+}
+
+// Averages 2x2 pixels, the colors in linear space and the BC5 normals are renormalized
+static GEDUtils::Vec3f average(const GEDUtils::Vec3f& a, const GEDUtils::Vec3f& b, const GEDUtils::Vec3f& c, const GEDUtils::Vec3f& d, BlockFormat format)
+{
+	GEDUtils::Vec3f result;
+	if (format != BlockFormat::BC5)
+	{
+		result.x = linear_to_srgb((srgb_to_linear(a.x) + srgb_to_linear(b.x) + srgb_to_linear(c.x) + srgb_to_linear(d.x)) * 0.25f);
+		result.y = linear_to_srgb((srgb_to_linear(a.y) + srgb_to_linear(b.y) + srgb_to_linear(c.y) + srgb_to_linear(d.y)) * 0.25f);
+		result.z = linear_to_srgb((srgb_to_linear(a.z) + srgb_to_linear(b.z) + srgb_to_linear(c.z) + srgb_to_linear(d.z)) * 0.25f);
+		return result;
+	}
+
+	float x = (a.x + b.x + c.x + d.x) * 0.5f - 1.0f;
+	float y = (a.y + b.y + c.y + d.y) * 0.5f - 1.0f;
+	float z = (a.z + b.z + c.z + d.z) * 0.5f - 1.0f;
+	float length = std::sqrt(x * x + y * y + z * z);
+	if (length < 1e-6f)
+	{
+		// The normals cancelled out, straight up is as good as any
+		result.x = 0.5f;
+		result.y = 0.5f;
+		result.z = 1.0f;
+		return result;
+	}
+	result.x = x / length * 0.5f + 0.5f;
+	result.y = y / length * 0.5f + 0.5f;
+	result.z = z / length * 0.5f + 0.5f;
+	return result;
+}
+
+// Compresses the block row block_y of a level of width x height pixels into blocks and box filters it into next,
+// unless next is empty. source points to the first of its count rows
+// Blocks at the right and bottom border of levels smaller than 4 pixels repeat the last column or row
+static void compress_block_row(const GEDUtils::Vec3f* source, int64_t count, int64_t block_y, int64_t width, int64_t height,
+	BlockFormat format, std::vector<BYTE>& blocks, std::vector<GEDUtils::Vec3f>& next)
+{
+	int64_t blocks_x = (width + 3) / 4;
+	int64_t bytes = block_bytes(format);
+	int64_t next_width = std::max(width / 2, 1ll);
+	int64_t next_height = std::max(height / 2, 1ll);
+	int64_t y = block_y * 4;
+	auto pixel = [&](int64_t x, int64_t row) -> const GEDUtils::Vec3f&
+	{
+		return source[idx(std::min(x, width - 1), std::min(row, count - 1), width)];
+	};
+
+	GEDUtils::Vec3f pixels[16];
+	for (int64_t block_x = 0; block_x < blocks_x; block_x++)
+	{
+		for (int64_t i = 0; i < 16; i++)
+			pixels[i] = pixel(block_x * 4 + i % 4, i / 4);
+		encode_block(format, pixels, &blocks[idx(block_x, block_y, blocks_x) * bytes]);
+	}
+
+	// The rows of the next level which lie within this block row
+	if (next.empty())
+		return;
+	for (int64_t next_y = block_y * 2; next_y < std::min(block_y * 2 + 2, next_height); next_y++)
+		for (int64_t next_x = 0; next_x < next_width; next_x++)
+		{
+			int64_t row = next_y * 2 - y;
+			next[idx(next_x, next_y, next_width)] = average(pixel(next_x * 2, row), pixel(next_x * 2 + 1, row),
+				pixel(next_x * 2, row + 1), pixel(next_x * 2 + 1, row + 1), format);
+		}
+}
+
+static int64_t mip_level_count(int64_t width, int64_t height)
+{
+	int64_t level_count = 1;
+	while ((std::max(width, height) >> level_count) > 0)
+		level_count++;
+	return level_count;
+}
+
+// Blocks of level 0 and the pixels of level 1, the rest of the chain follows in finish()
+DdsStripWriter::DdsStripWriter(const wchar_t* path, int64_t width, int64_t height, BlockFormat format)
+	: width(width), height(height), format(format), levels(mip_level_count(width, height))
+{
+	levels[0].resize(((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format));
+	if (levels.size() > 1)
+		next.resize(std::max(width / 2, 1ll) * std::max(height / 2, 1ll));
+	file = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+}
+
+DdsStripWriter::~DdsStripWriter()
+{
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+}
+
+void DdsStripWriter::write_block_row(int64_t block_row, const GEDUtils::Vec3f* rows)
+{
+	compress_block_row(rows, std::min(4ll, height - block_row * 4), block_row, width, height, format, levels[0], next);
+	block_rows_written++;
+}
+
+bool DdsStripWriter::finish()
+{
+	if (!is_valid())
+		return false;
+	bool written = block_rows_written == get_block_row_count();
+
+	// Every following level from the pixels filtered while compressing the one above
+	std::vector<GEDUtils::Vec3f> pixels = std::move(next);
+	for (size_t level = 1; written && level < levels.size(); level++)
+	{
+		int64_t level_width = std::max(width >> level, 1ll);
+		int64_t level_height = std::max(height >> level, 1ll);
+		std::vector<GEDUtils::Vec3f> level_next(level + 1 < levels.size() ? std::max(level_width / 2, 1ll) * std::max(level_height / 2, 1ll) : 0);
+		levels[level].resize(((level_width + 3) / 4) * ((level_height + 3) / 4) * block_bytes(format));
+
+		parallel_for(0, (level_height + 3) / 4, [&](int64_t block_begin, int64_t block_end)
+		{
+			for (int64_t block_y = block_begin; block_y < block_end; block_y++)
+				compress_block_row(&pixels[idx(0, block_y * 4, level_width)], std::min(4ll, level_height - block_y * 4), block_y,
+					level_width, level_height, format, levels[level], level_next);
+		});
+		pixels = std::move(level_next);
+	}
+
+	auto write = [&](const std::vector<BYTE>& data)
+	{
+		DWORD size = 0;
+		written &= WriteFile(file, data.data(), static_cast<DWORD>(data.size()), &size, nullptr) && size == data.size();
+	};
+	if (written)
+	{
+		write(dds_header(width, height, levels.size(), levels[0].size(), format));
+		for (const auto& level : levels)
+			write(level);
+	}
+
+	CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+	return written;
+}
+
+bool write_dds(const DdsRows& rows, int64_t width, int64_t height, BlockFormat format, const wchar_t* path)
+{
+	DdsStripWriter writer(path, width, height, format);
+	if (!writer.is_valid())
+		return false;
+
+	parallel_for(0, writer.get_block_row_count(), [&](int64_t block_begin, int64_t block_end)
+	{
+		std::vector<GEDUtils::Vec3f> scratch;
+		for (int64_t block_y = block_begin; block_y < block_end; block_y++)
+			writer.write_block_row(block_y, rows(block_y * 4, std::min(4ll, height - block_y * 4), scratch));
+	});
+	return writer.finish();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+
+#include <atomic>
+
+// Block compressed formats of the DDS output, every block encodes 4x4 pixels
+// The colormap is stored as sRGB like the textures it is blended from
+enum class BlockFormat
+{
+	BC1, // sRGB in 8 bytes, two 5:6:5 endpoints and 2 bit indices
+	BC5, // Two channels in 16 bytes, the x and y of the normal map, the game reconstructs z
+	BC7  // sRGB in 16 bytes, mode 6 only: two 7:7:7:7 + p-bit endpoints and 4 bit indices
+};
+
+// Parses "bc1" or "bc7", returns false for anything else
+bool parse_color_block_format(const wchar_t* name, BlockFormat& format);
+const char* block_format_name(BlockFormat format);
+
+// Format of colormaps saved as .dds, can be changed with -dds_color
+extern BlockFormat g_dds_color_format;
+
+// rows(y, count, scratch) returns count rows starting at row y, either in place or converted into scratch
+typedef std::function<const GEDUtils::Vec3f*(int64_t y, int64_t count, std::vector<GEDUtils::Vec3f>& scratch)> DdsRows;
+
+// Writes a DDS with the full mip chain down to 1x1, every level is compressed by all threads in parallel bands of blocks
+// The levels are box filtered from the one above, the colors in linear space and the normals of BC5 are renormalized
+// Values must lie in [0;1], normals mapped like the normal map
+bool write_dds(const DdsRows& rows, int64_t width, int64_t height, BlockFormat format, const wchar_t* path);
+
+// Compresses the first level of a DDS block row by block row while the image is still being generated, like TiffWriter
+// The block rows can be written in any order and from any thread, each of them also filters its part of the second level
+// The smaller levels are compressed and the file is written in finish()
+class DdsStripWriter
+{
+public:
+	// Check is_valid() afterwards
+	DdsStripWriter(const wchar_t* path, int64_t width, int64_t height, BlockFormat format);
+	~DdsStripWriter();
+
+	bool is_valid() const { return file != INVALID_HANDLE_VALUE; }
+	int64_t get_block_row_count() const { return (height + 3) / 4; }
+
+	// Compresses the rows [block_row * 4; block_row * 4 + 4), rows points to the first of them, thread safe
+	void write_block_row(int64_t block_row, const GEDUtils::Vec3f* rows);
+
+	// Returns false if a block row is missing or the file could not be written
+	bool finish();
+
+private:
+	DdsStripWriter(const DdsStripWriter&);
+	void operator=(const DdsStripWriter&);
+
+	HANDLE file = INVALID_HANDLE_VALUE;
+	int64_t width = 0;
+	int64_t height = 0;
+	BlockFormat format;
+	std::vector<std::vector<BYTE>> levels; // Compressed blocks of every level
+	std::vector<GEDUtils::Vec3f> next; // Pixels of the second level
+	std::atomic<int64_t> block_rows_written{ 0 };
+};
+
+// Kernels, pixels holds the 4x4 block row by row with values in [0;1]
+// Bytes of one encoded block
+int64_t block_bytes(BlockFormat format);
+void encode_block(BlockFormat format, const GEDUtils::Vec3f* pixels, uint8_t* out);
+void encode_bc1_block(const GEDUtils::Vec3f* pixels, uint8_t* out);
+// One channel, BC5 is two of these blocks for x and y
+void encode_bc4_block(const float* values, uint8_t* out);
+void encode_bc5_block(const GEDUtils::Vec3f* pixels, uint8_t* out);
+void encode_bc7_block(const GEDUtils::Vec3f* pixels, uint8_t* out);
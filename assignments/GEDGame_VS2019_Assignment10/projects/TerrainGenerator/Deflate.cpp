@@ -0,0 +1,472 @@
+#include "Deflate.h"
+
+#include <algorithm>
+#include <queue>
+#include <utility>
+
+// Limits of the format
+const int64_t window_size = 32768;
+const int64_t min_match = 3;
+const int64_t max_match = 258;
+const int end_of_block = 256;
+const int litlen_codes = 286;
+const int distance_codes = 30;
+const int length_codes = 19; // Alphabet of the code lengths of the other two codes
+
+// Search effort: matches at least this long are taken without looking further or one byte ahead
+const int64_t max_chain = 32;
+const int64_t nice_match = 128;
+// Tokens per block, every block gets its own Huffman codes
+const size_t block_tokens = 32768;
+
+const int hash_bits = 15;
+
+const int length_base[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const int length_extra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const int distance_base[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+	4097, 6145, 8193, 12289, 16385, 24577 };
+const int distance_extra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+// Order in which the lengths of the code length code are sent
+const int length_order[length_codes] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+static int highest_bit(uint32_t value)
+{
+	int bit = 0;
+	while (value >>= 1)
+		bit++;
+	return bit;
+}
+
+// Symbol 257..285 of a match length in [3; 258]
+static int length_code(int64_t length)
+{
+	if (length == max_match)
+		return 285;
+	int value = static_cast<int>(length - min_match);
+	if (value < 8)
+		return 257 + value;
+	int bit = highest_bit(value);
+	return 257 + 4 * (bit - 1) + ((value >> (bit - 2)) & 3);
+}
+
+// Code 0..29 of a distance in [1; 32768]
+static int distance_code(int64_t distance)
+{
+	int value = static_cast<int>(distance - 1);
+	if (value < 4)
+		return value;
+	int bit = highest_bit(value);
+	return 2 * bit + ((value >> (bit - 1)) & 1);
+}
+
+// Deflate packs the bits starting with the least significant one, Huffman codes starting with their first bit
+class BitWriter
+{
+public:
+	explicit BitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+	void put(uint32_t value, int count)
+	{
+		bits |= static_cast<uint64_t>(value) << bit_count;
+		bit_count += count;
+		while (bit_count >= 8)
+		{
+			out.push_back(static_cast<uint8_t>(bits));
+			bits >>= 8;
+			bit_count -= 8;
+		}
+	}
+
+	// Pads with zeros to the next byte boundary
+	void align()
+	{
+		if (bit_count > 0)
+			put(0, 8 - bit_count);
+	}
+
+private:
+	std::vector<uint8_t>& out;
+	uint64_t bits = 0;
+	int bit_count = 0;
+};
+
+// Lengths of a Huffman code for the frequencies, no longer than limit
+// Too long codes are avoided by halving the frequencies and starting over, which evens out the tree
+// At least two symbols get a code, so every code is complete
+static void huffman_lengths(const uint32_t* frequencies, int count, int limit, uint8_t* lengths)
+{
+	std::vector<uint32_t> weights(frequencies, frequencies + count);
+	int used = 0;
+	for (int i = 0; i < count; i++)
+		used += weights[i] > 0;
+	for (int i = 0; used < 2 && i < count; i++)
+		if (weights[i] == 0)
+		{
+			weights[i] = 1;
+			used++;
+		}
+
+	while (true)
+	{
+		// Leaves first, then the inner nodes in the order they are merged
+		std::vector<int> symbols;
+		std::vector<int> parents;
+		typedef std::pair<uint64_t, int> Node; // Weight and node, the node breaks ties so the code does not depend on the queue
+		std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+		for (int i = 0; i < count; i++)
+			if (weights[i] > 0)
+			{
+				queue.push(Node(weights[i], static_cast<int>(symbols.size())));
+				symbols.push_back(i);
+				parents.push_back(-1);
+			}
+		while (queue.size() > 1)
+		{
+			Node a = queue.top();
+			queue.pop();
+			Node b = queue.top();
+			queue.pop();
+			int parent = static_cast<int>(parents.size());
+			parents.push_back(-1);
+			parents[a.second] = parent;
+			parents[b.second] = parent;
+			queue.push(Node(a.first + b.first, parent));
+		}
+
+		// The inner nodes are merged after their children, so walking backwards gives every node the depth of its parent first
+		std::vector<int> depths(parents.size(), 0);
+		for (int node = static_cast<int>(parents.size()) - 2; node >= 0; node--)
+			depths[node] = depths[parents[node]] + 1;
+
+		bool fits = true;
+		std::fill(lengths, lengths + count, static_cast<uint8_t>(0));
+		for (size_t leaf = 0; leaf < symbols.size(); leaf++)
+		{
+			lengths[symbols[leaf]] = static_cast<uint8_t>(depths[leaf]);
+			fits &= depths[leaf] <= limit;
+		}
+		if (fits)
+			return;
+
+		for (uint32_t& weight : weights)
+			weight = (weight + 1) / 2;
+	}
+}
+
+// Canonical codes of the lengths, bit reversed for the BitWriter
+static void canonical_codes(const uint8_t* lengths, int count, uint16_t* codes)
+{
+	int length_counts[16] = {};
+	for (int i = 0; i < count; i++)
+		length_counts[lengths[i]]++;
+	length_counts[0] = 0;
+
+	int next_code[16] = {};
+	int code = 0;
+	for (int bits = 1; bits < 16; bits++)
+	{
+		code = (code + length_counts[bits - 1]) << 1;
+		next_code[bits] = code;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		codes[i] = 0;
+		if (lengths[i] == 0)
+			continue;
+		int value = next_code[lengths[i]]++;
+		for (int bit = 0; bit < lengths[i]; bit++)
+			codes[i] |= ((value >> bit) & 1) << (lengths[i] - 1 - bit);
+	}
+}
+
+// A literal byte, or a match of length << 16 | distance
+typedef uint32_t Token;
+
+static void write_stored(BitWriter& writer, const uint8_t* data, int64_t size, bool last, std::vector<uint8_t>& out)
+{
+	do
+	{
+		int64_t chunk = std::min(size, 65535ll);
+		writer.put(last && chunk == size ? 1 : 0, 1);
+		writer.put(0, 2);
+		writer.align();
+		writer.put(static_cast<uint32_t>(chunk), 16);
+		writer.put(static_cast<uint32_t>(~chunk & 0xFFFF), 16);
+		out.insert(out.end(), data, data + chunk);
+		data += chunk;
+		size -= chunk;
+	} while (size > 0);
+}
+
+// Writes the tokens, which encode the bytes [0; size) of data, as one block with dynamic codes, or stored if that is smaller
+static void write_block(BitWriter& writer, const std::vector<Token>& tokens, const uint8_t* data, int64_t size, bool last,
+	std::vector<uint8_t>& out)
+{
+	uint32_t litlen_frequencies[litlen_codes] = {};
+	uint32_t distance_frequencies[distance_codes] = {};
+	for (Token token : tokens)
+	{
+		if (token < 256)
+		{
+			litlen_frequencies[token]++;
+			continue;
+		}
+		litlen_frequencies[length_code(token >> 16)]++;
+		distance_frequencies[distance_code(token & 0xFFFF)]++;
+	}
+	litlen_frequencies[end_of_block]++;
+
+	uint8_t lengths[litlen_codes + distance_codes];
+	uint8_t* litlen_lengths = lengths;
+	uint8_t* distance_lengths = lengths + litlen_codes;
+	huffman_lengths(litlen_frequencies, litlen_codes, 15, litlen_lengths);
+	huffman_lengths(distance_frequencies, distance_codes, 15, distance_lengths);
+
+	int litlen_count = litlen_codes;
+	while (litlen_count > 257 && litlen_lengths[litlen_count - 1] == 0)
+		litlen_count--;
+	int distance_count = distance_codes;
+	while (distance_count > 1 && distance_lengths[distance_count - 1] == 0)
+		distance_count--;
+
+	// Run length encoding of both code lengths as one sequence, a symbol in the low byte and its extra bits above
+	std::vector<uint8_t> sequence(lengths, lengths + litlen_count);
+	sequence.insert(sequence.end(), distance_lengths, distance_lengths + distance_count);
+	std::vector<uint32_t> runs;
+	uint32_t length_frequencies[length_codes] = {};
+	for (size_t i = 0; i < sequence.size();)
+	{
+		size_t run = 1;
+		while (i + run < sequence.size() && sequence[i + run] == sequence[i])
+			run++;
+
+		if (sequence[i] == 0 && run >= 3)
+		{
+			run = std::min(run, static_cast<size_t>(138));
+			runs.push_back(run >= 11 ? 18 | static_cast<uint32_t>(run - 11) << 8 : 17 | static_cast<uint32_t>(run - 3) << 8);
+		}
+		else if (run >= 4)
+		{
+			// The length itself, then repeats of it
+			runs.push_back(sequence[i]);
+			length_frequencies[sequence[i]]++;
+			run = std::min(run - 1, static_cast<size_t>(6)) + 1;
+			runs.push_back(16 | static_cast<uint32_t>(run - 1 - 3) << 8);
+		}
+		else
+		{
+			run = 1;
+			runs.push_back(sequence[i]);
+		}
+		length_frequencies[runs.back() & 0xFF]++;
+		i += run;
+	}
+
+	uint8_t length_lengths[length_codes];
+	huffman_lengths(length_frequencies, length_codes, 7, length_lengths);
+	int length_count = length_codes;
+	while (length_count > 4 && length_lengths[length_order[length_count - 1]] == 0)
+		length_count--;
+
+	uint16_t litlen_bits[litlen_codes];
+	uint16_t distance_bits[distance_codes];
+	uint16_t length_bits[length_codes];
+	canonical_codes(litlen_lengths, litlen_codes, litlen_bits);
+	canonical_codes(distance_lengths, distance_codes, distance_bits);
+	canonical_codes(length_lengths, length_codes, length_bits);
+
+	// Size of the block in bits, stored blocks are at most 65535 bytes with 5 bytes of header and up to 7 bits of padding
+	int64_t dynamic_size = 3 + 5 + 5 + 4 + length_count * 3;
+	for (uint32_t run : runs)
+	{
+		int symbol = run & 0xFF;
+		dynamic_size += length_lengths[symbol] + (symbol == 16 ? 2 : symbol == 17 ? 3 : symbol == 18 ? 7 : 0);
+	}
+	for (int i = 0; i < litlen_codes; i++)
+		dynamic_size += static_cast<int64_t>(litlen_frequencies[i]) * (litlen_lengths[i] + (i > 256 ? length_extra[i - 257] : 0));
+	for (int i = 0; i < distance_codes; i++)
+		dynamic_size += static_cast<int64_t>(distance_frequencies[i]) * (distance_lengths[i] + distance_extra[i]);
+	int64_t stored_size = (size + 65534) / 65535 * (5 * 8 + 7) + size * 8;
+	if (stored_size < dynamic_size)
+	{
+		write_stored(writer, data, size, last, out);
+		return;
+	}
+
+	writer.put(last ? 1 : 0, 1);
+	writer.put(2, 2); // Dynamic Huffman codes
+	writer.put(litlen_count - 257, 5);
+	writer.put(distance_count - 1, 5);
+	writer.put(length_count - 4, 4);
+	for (int i = 0; i < length_count; i++)
+		writer.put(length_lengths[length_order[i]], 3);
+	for (uint32_t run : runs)
+	{
+		int symbol = run & 0xFF;
+		writer.put(length_bits[symbol], length_lengths[symbol]);
+		if (symbol >= 16)
+			writer.put(run >> 8, symbol == 16 ? 2 : symbol == 17 ? 3 : 7);
+	}
+
+	for (Token token : tokens)
+	{
+		if (token < 256)
+		{
+			writer.put(litlen_bits[token], litlen_lengths[token]);
+			continue;
+		}
+		int64_t length = token >> 16;
+		int64_t distance = token & 0xFFFF;
+		int code = length_code(length);
+		writer.put(litlen_bits[code], litlen_lengths[code]);
+		writer.put(static_cast<uint32_t>(length - length_base[code - 257]), length_extra[code - 257]);
+		code = distance_code(distance);
+		writer.put(distance_bits[code], distance_lengths[code]);
+		writer.put(static_cast<uint32_t>(distance - distance_base[code]), distance_extra[code]);
+	}
+	writer.put(litlen_bits[end_of_block], litlen_lengths[end_of_block]);
+}
+
+void deflate_raw(const uint8_t* data, int64_t size, bool last, std::vector<uint8_t>& out)
+{
+	BitWriter writer(out);
+
+	// Most recent position of every hash of three bytes, and the one before it with the same hash, within the window
+	std::vector<int32_t> head(int64_t(1) << hash_bits, -1);
+	std::vector<int32_t> previous(window_size, -1);
+	auto hash = [&](int64_t position)
+	{
+		return ((data[position] << 10) ^ (data[position + 1] << 5) ^ data[position + 2]) & ((1 << hash_bits) - 1);
+	};
+	auto insert = [&](int64_t position)
+	{
+		if (position + min_match > size)
+			return;
+		int h = hash(position);
+		previous[position % window_size] = head[h];
+		head[h] = static_cast<int32_t>(position);
+	};
+	// Longest earlier match of the bytes at position, its length is below min_match if there is none
+	auto longest_match = [&](int64_t position, int64_t& distance)
+	{
+		int64_t best = 0;
+		if (position + min_match > size)
+			return best;
+		int64_t limit = std::min(max_match, size - position);
+		int64_t candidate = head[hash(position)];
+		for (int64_t chain = 0; chain < max_chain && candidate >= 0 && position - candidate <= window_size; chain++)
+		{
+			if (data[candidate + best] == data[position + best])
+			{
+				int64_t length = 0;
+				while (length < limit && data[candidate + length] == data[position + length])
+					length++;
+				if (length > best)
+				{
+					best = length;
+					distance = position - candidate;
+					if (length >= std::min(nice_match, limit))
+						break;
+				}
+			}
+			int64_t next = previous[candidate % window_size];
+			if (next >= candidate)
+				break;
+			candidate = next;
+		}
+		return best;
+	};
+
+	std::vector<Token> tokens;
+	tokens.reserve(block_tokens);
+	int64_t block_begin = 0;
+	int64_t position = 0;
+	while (position < size)
+	{
+		int64_t distance = 0;
+		int64_t length = longest_match(position, distance);
+		insert(position);
+
+		// Lazy matching: a literal is better if the match starting at the next byte is longer
+		int64_t next_distance = 0;
+		if (length >= min_match && length < nice_match && longest_match(position + 1, next_distance) > length)
+			length = 0;
+
+		if (length >= min_match)
+		{
+			tokens.push_back(static_cast<Token>(length << 16 | distance));
+			for (int64_t i = 1; i < length; i++)
+				insert(position + i);
+			position += length;
+		}
+		else
+		{
+			tokens.push_back(data[position]);
+			position++;
+		}
+
+		if (tokens.size() == block_tokens)
+		{
+			write_block(writer, tokens, data + block_begin, position - block_begin, last && position == size, out);
+			tokens.clear();
+			block_begin = position;
+		}
+	}
+
+	if (!tokens.empty())
+		write_block(writer, tokens, data + block_begin, position - block_begin, last, out);
+	else if (last)
+		write_stored(writer, data, 0, true, out);
+	if (!last)
+		write_stored(writer, data, 0, false, out);
+	writer.align();
+}
+
+void deflate_zlib(const uint8_t* data, int64_t size, std::vector<uint8_t>& out)
+{
+	// Deflate with a 32 KB window and the default level, the check bits make the header a multiple of 31
+	out.push_back(0x78);
+	out.push_back(0x9C);
+	deflate_raw(data, size, true, out);
+
+	uint32_t checksum = adler32(data, size);
+	for (int shift = 24; shift >= 0; shift -= 8)
+		out.push_back(static_cast<uint8_t>(checksum >> shift));
+}
+
+const uint32_t adler_base = 65521;
+
+uint32_t adler32(const uint8_t* data, int64_t size, uint32_t adler)
+{
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	while (size > 0)
+	{
+		// The sums can not overflow within 5552 bytes
+		int64_t chunk = std::min(size, 5552ll);
+		for (int64_t i = 0; i < chunk; i++)
+		{
+			a += data[i];
+			b += a;
+		}
+		a %= adler_base;
+		b %= adler_base;
+		data += chunk;
+		size -= chunk;
+	}
+	return a | b << 16;
+}
+
+uint32_t adler32_combine(uint32_t first, uint32_t second, int64_t second_size)
+{
+	// a = a1 + a2 - 1 and b = b1 + b2 + size2 (a1 - 1), see zlib's adler32_combine
+	uint64_t remainder = static_cast<uint64_t>(second_size % adler_base);
+	uint64_t a1 = first & 0xFFFF;
+	uint64_t b1 = first >> 16;
+	uint64_t a2 = second & 0xFFFF;
+	uint64_t b2 = second >> 16;
+	uint64_t a = (a1 + a2 + adler_base - 1) % adler_base;
+	uint64_t b = (b1 + b2 + remainder * (a1 + adler_base - 1)) % adler_base;
+	return static_cast<uint32_t>(a | b << 16);
+}
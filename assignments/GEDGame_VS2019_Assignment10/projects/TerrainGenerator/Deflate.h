@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Deflate compression (RFC 1951) for the TIFF and PNG writers, there is no zlib in the tree
+// Every call compresses its data on its own, so the strips of an image can be compressed on all threads at once
+// LZ77 over a 32 KB window with hash chains and one step of lazy matching, then a dynamic Huffman code per block,
+// blocks which would not get smaller are stored
+
+// Appends the deflate blocks of data to out
+// If last is false, the blocks are followed by an empty stored block (a sync flush), so out ends on a byte boundary
+// and the blocks of the next strip can be appended to form a single stream, as in a PNG
+void deflate_raw(const uint8_t* data, int64_t size, bool last, std::vector<uint8_t>& out);
+
+// Appends a complete zlib stream (RFC 1950) of data to out, as TIFF stores every strip with Adobe Deflate compression
+void deflate_zlib(const uint8_t* data, int64_t size, std::vector<uint8_t>& out);
+
+// Checksum of the zlib stream, adler32_combine() gives the checksum of two concatenated parts from theirs
+uint32_t adler32(const uint8_t* data, int64_t size, uint32_t adler = 1);
+uint32_t adler32_combine(uint32_t first, uint32_t second, int64_t second_size);
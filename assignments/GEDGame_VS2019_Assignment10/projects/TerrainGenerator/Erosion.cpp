@@ -0,0 +1,190 @@
+#include "Erosion.h"
+#include "TaskScheduler.h"
+
+#include <chrono>
+#include <limits>
+
+// A tile with its halo of outflows stays in the cache while it is eroded
+static const int64_t tile_size = 64;
+// Share of the difference in water level which flows to a lower neighbour per iteration
+// Like an explicit diffusion step, more than 1/8 lets the water levels overshoot and oscillate between neighbours
+static const float flow_rate = 0.1f;
+// Water on flat ground still carries a little sediment
+static const float min_slope = 0.05f;
+
+// Neighbours in the order left, right, up, down, so direction ^ 1 is the opposite direction
+static const int64_t neighbour_x[4] = { -1, 1, 0, 0 };
+static const int64_t neighbour_y[4] = { 0, 0, -1, 1 };
+
+// Water, sediment and terrain of every cell, the iterations alternate between two states
+struct ErosionState
+{
+	explicit ErosionState(int64_t cells) : height(cells), water(cells, 0.0f), sediment(cells, 0.0f) {}
+
+	std::vector<float> height;
+	std::vector<float> water;
+	std::vector<float> sediment;
+};
+
+// Fractions of its water which a cell sends to its neighbours in one iteration
+struct Outflow
+{
+	float fraction[4];
+
+	float total() const { return fraction[0] + fraction[1] + fraction[2] + fraction[3]; }
+};
+
+// Water flows towards lower water levels, at most the water on the cell (including this iteration's rain)
+static Outflow compute_outflow(const ErosionState& state, int64_t x, int64_t y, int64_t resolution, float rain)
+{
+	int64_t i = idx(x, y, resolution);
+	float level = state.height[i] + state.water[i];
+
+	Outflow outflow;
+	float total = 0.0f;
+	for (int64_t direction = 0; direction < 4; direction++)
+	{
+		int64_t nx = x + neighbour_x[direction];
+		int64_t ny = y + neighbour_y[direction];
+		// The border of the map is a wall
+		float flow = 0.0f;
+		if (nx >= 0 && nx < resolution && ny >= 0 && ny < resolution)
+		{
+			int64_t n = idx(nx, ny, resolution);
+			flow = std::max(level - state.height[n] - state.water[n], 0.0f) * flow_rate;
+		}
+		outflow.fraction[direction] = flow;
+		total += flow;
+	}
+
+	float water = state.water[i] + rain;
+	float scale = (total > 0.0f && water > 0.0f) ? std::min(total, water) / (total * water) : 0.0f;
+	for (int64_t direction = 0; direction < 4; direction++)
+		outflow.fraction[direction] *= scale;
+	return outflow;
+}
+
+// One iteration of the cells [x_begin; x_end) x [y_begin; y_end), reading only from in and writing only these cells of out
+// outflows has room for the tile and a halo of one cell
+static void erode_tile(const ErosionState& in, ErosionState& out, int64_t resolution, const ErosionSettings& settings,
+	int64_t x_begin, int64_t y_begin, int64_t x_end, int64_t y_end, std::vector<Outflow>& outflows)
+{
+	// Every cell gathers what its neighbours send to it, so the outflows of the halo are computed as well
+	int64_t halo_x_begin = std::max(x_begin - 1, 0ll);
+	int64_t halo_y_begin = std::max(y_begin - 1, 0ll);
+	int64_t halo_x_end = std::min(x_end + 1, resolution);
+	int64_t halo_y_end = std::min(y_end + 1, resolution);
+	int64_t halo_width = halo_x_end - halo_x_begin;
+	for (int64_t y = halo_y_begin; y < halo_y_end; y++)
+		for (int64_t x = halo_x_begin; x < halo_x_end; x++)
+			outflows[idx(x - halo_x_begin, y - halo_y_begin, halo_width)] = compute_outflow(in, x, y, resolution, settings.rain);
+
+	// Height differences between neighbours times the resolution are slopes over the whole map
+	float slope_scale = static_cast<float>(resolution);
+	float talus = settings.talus / slope_scale;
+	// Each of the four neighbours moves at most an eighth of the difference, so no pair can swap its order
+	float thermal_rate = settings.thermal_rate * 0.125f;
+
+	for (int64_t y = y_begin; y < y_end; y++)
+		for (int64_t x = x_begin; x < x_end; x++)
+		{
+			int64_t i = idx(x, y, resolution);
+			const Outflow& own = outflows[idx(x - halo_x_begin, y - halo_y_begin, halo_width)];
+			float height = in.height[i];
+			float water = in.water[i] + settings.rain;
+			float keep = 1.0f - own.total();
+			float new_water = water * keep;
+			float new_sediment = in.sediment[i] * keep;
+
+			float inflow = 0.0f;
+			float max_drop = 0.0f;
+			float thermal = 0.0f;
+			for (int64_t direction = 0; direction < 4; direction++)
+			{
+				int64_t nx = x + neighbour_x[direction];
+				int64_t ny = y + neighbour_y[direction];
+				if (nx < 0 || nx >= resolution || ny < 0 || ny >= resolution)
+					continue;
+
+				// The neighbour sends to this cell in the opposite direction, the sediment moves with the water
+				int64_t n = idx(nx, ny, resolution);
+				float fraction = outflows[idx(nx - halo_x_begin, ny - halo_y_begin, halo_width)].fraction[direction ^ 1];
+				inflow += (in.water[n] + settings.rain) * fraction;
+				new_sediment += in.sediment[n] * fraction;
+
+				// Thermal exchange with the neighbour, the same amount the neighbour computes with the opposite sign
+				float difference = height - in.height[n];
+				max_drop = std::max(max_drop, difference);
+				thermal += std::max(-difference - talus, 0.0f) - std::max(difference - talus, 0.0f);
+			}
+
+			new_water += inflow;
+
+			// The more water flows through the cell and the steeper it falls off, the more sediment the water can carry
+			float flow = 0.5f * (water * own.total() + inflow);
+			float capacity = settings.capacity * flow * std::max(max_drop * slope_scale, min_slope);
+			if (new_sediment > capacity)
+			{
+				float deposit = settings.deposit_rate * (new_sediment - capacity);
+				height += deposit;
+				new_sediment -= deposit;
+			}
+			else
+			{
+				// Never dig deeper than halfway down to the lowest neighbour
+				float dissolve = std::min(settings.dissolve_rate * (capacity - new_sediment), max_drop * 0.5f);
+				height -= dissolve;
+				new_sediment += dissolve;
+			}
+
+			out.height[i] = height + thermal_rate * thermal;
+			out.water[i] = new_water * (1.0f - settings.evaporation);
+			out.sediment[i] = new_sediment;
+		}
+}
+
+int64_t erode_heightfield(std::vector<float>& height, int64_t resolution, const ErosionSettings& settings)
+{
+	if (!settings.enabled())
+		return 0;
+
+	auto start_time = std::chrono::high_resolution_clock::now();
+	// Without an iteration count the simulation runs until the time budget is used up
+	int64_t iterations = settings.iterations > 0 ? settings.iterations : std::numeric_limits<int64_t>::max();
+
+	ErosionState first(resolution * resolution);
+	ErosionState second(resolution * resolution);
+	first.height = height;
+	ErosionState* current = &first;
+	ErosionState* next = &second;
+
+	// Outflows of the tile a thread is working on, slot 0 for a caller outside of the pool
+	TaskScheduler& scheduler = TaskScheduler::get();
+	std::vector<std::vector<Outflow>> outflows(scheduler.get_thread_count() + 1,
+		std::vector<Outflow>((tile_size + 2) * (tile_size + 2)));
+
+	int64_t iteration = 0;
+	while (iteration < iterations)
+	{
+		// The tiles read their halo from the previous state, so they do not depend on each other
+		parallel_for_2d(resolution, resolution, tile_size, [&](int64_t x_begin, int64_t y_begin, int64_t x_end, int64_t y_end)
+		{
+			erode_tile(*current, *next, resolution, settings, x_begin, y_begin, x_end, y_end, outflows[scheduler.get_worker_index() + 1]);
+		});
+		std::swap(current, next);
+		iteration++;
+
+		auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start_time).count();
+		if (settings.time_budget_ms > 0.0 && elapsed >= settings.time_budget_ms)
+			break;
+	}
+
+	// The remaining sediment settles where it is
+	parallel_for(0, resolution * resolution, [&](int64_t begin, int64_t end)
+	{
+		for (int64_t i = begin; i < end; i++)
+			height[i] = clamp(current->height[i] + current->sediment[i]);
+	});
+
+	return iteration;
+}
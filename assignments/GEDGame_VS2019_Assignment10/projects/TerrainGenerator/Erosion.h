@@ -0,0 +1,28 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+
+// Grid based erosion of the heightfield after make_pretty
+// Hydraulic: rain collects as water on every cell, flows to the lower neighbours, dissolves material where
+// a lot of water flows down a slope and deposits it again where the flow slows down.
+// Thermal: material slides to the lower neighbours wherever the slope is steeper than the talus slope.
+// Slopes are measured in heightfield units over the whole map, so the settings work at any resolution.
+struct ErosionSettings
+{
+	int64_t iterations = 0; // 0 disables erosion, unless there is a time budget
+	double time_budget_ms = 0.0; // Stops after the iteration which exceeds the budget, 0 means no limit
+	float rain = 0.0005f; // Water added to every cell per iteration
+	float evaporation = 0.02f; // Fraction of the water which evaporates per iteration
+	float capacity = 8.0f; // Sediment which the outflowing water of a cell can carry on a slope of 1
+	float dissolve_rate = 0.1f; // Fraction of the free capacity which is dissolved per iteration
+	float deposit_rate = 0.1f; // Fraction of the excess sediment which is deposited per iteration
+	float talus = 2.0f; // Steepest slope which does not slide
+	float thermal_rate = 0.5f; // Fraction of the material above the talus slope which slides per iteration
+
+	bool enabled() const { return iterations > 0 || time_budget_ms > 0.0; }
+};
+
+// Erodes the resolution² heightfield in place, the heights stay within [0;1]
+// The iterations are double-buffered stencil passes over tiles, so any number of threads gives the same terrain
+// Returns the number of iterations which ran within the time budget
+int64_t erode_heightfield(std::vector<float>& height, int64_t resolution, const ErosionSettings& settings);
@@ -0,0 +1,129 @@
+#include "HeightfieldSource.h"
+#include "TerrainTile.h"
+
+#include <cmath>
+
+bool DiamondSquareSource::supports_resolution(int64_t resolution) const
+{
+	return resolution > 0 && (resolution & (resolution - 1)) == 0;
+}
+
+void DiamondSquareSource::generate_rows(int64_t resolution, int64_t row_begin, int64_t row_end, float* const* rows) const
+{
+	if (row_begin >= row_end)
+		return;
+
+	// The rows are stitched from the tiles which intersect them, see TerrainTile.h
+	const int64_t tile_size = get_tile_size(resolution);
+	int64_t tiles = tile_count(resolution, tile_size, 0);
+	int64_t tile_row_begin = row_begin / tile_size;
+	int64_t tile_row_end = (row_end - 1) / tile_size + 1;
+
+	// One task per tile, the grid is counted in tiles
+	parallel_for_2d(tiles, tile_row_end - tile_row_begin, 1, [&](int64_t tile_x, int64_t tile_y, int64_t, int64_t)
+	{
+		TileKey key;
+		key.seed = seed;
+		key.tile_x = tile_x;
+		key.tile_y = tile_row_begin + tile_y;
+		std::vector<float> tile = generate_tile(key, resolution, tile_size);
+
+		// The last row and column of a tile are the first ones of its neighbours or lie outside of the field
+		int64_t y_begin = std::max(row_begin - key.tile_y * tile_size, 0ll);
+		int64_t y_end = std::min(row_end - key.tile_y * tile_size, tile_size);
+		for (int64_t y = y_begin; y < y_end; y++)
+			std::copy(&tile[idx(0, y, tile_size + 1)], &tile[idx(0, y, tile_size + 1)] + tile_size,
+				rows[key.tile_y * tile_size + y] + key.tile_x * tile_size);
+	});
+}
+
+NoiseSource::NoiseSource(NoiseBasis basis, NoiseFractal fractal, uint64_t seed)
+{
+	settings.basis = basis;
+	settings.fractal = fractal;
+	settings.seed = static_cast<uint32_t>(seed ^ (seed >> 32));
+}
+
+const char* NoiseSource::get_name() const
+{
+	if (settings.fractal == NoiseFractal::Fbm)
+		return settings.basis == NoiseBasis::Perlin ? "fbm_perlin" : "fbm_simplex";
+	return settings.basis == NoiseBasis::Perlin ? "ridged_perlin" : "ridged_simplex";
+}
+
+std::string NoiseSource::get_parameters() const
+{
+	// The rest of the settings follows from the resolution
+	return "seed " + std::to_string(settings.seed) + " cells " + std::to_string(settings.cells);
+}
+
+NoiseSettings NoiseSource::get_settings(int64_t resolution) const
+{
+	NoiseSettings result = settings;
+	result.scale = result.cells / static_cast<float>(resolution);
+
+	// Octave k has cells of resolution / (cells * 2^k) pixels
+	double finest = log2(static_cast<double>(resolution) / (2.0 * result.cells));
+	result.octaves = std::min(std::max(static_cast<int64_t>(floor(finest)) + 1, 1ll), 16ll);
+	return result;
+}
+
+void NoiseSource::generate_rows(int64_t resolution, int64_t row_begin, int64_t row_end, float* const* rows) const
+{
+	NoiseSettings row_settings = get_settings(resolution);
+
+	parallel_for(row_begin, row_end, [&](int64_t band_begin, int64_t band_end)
+	{
+		for (int64_t y = band_begin; y < band_end; y++)
+			noise_row(row_settings, y, resolution, rows[y]);
+	});
+}
+
+std::unique_ptr<HeightfieldSource> create_heightfield_source(const wchar_t* name, uint64_t seed)
+{
+	std::wstring source_name = name;
+	if (source_name == L"diamond_square")
+		return std::unique_ptr<HeightfieldSource>(new DiamondSquareSource(seed));
+	if (source_name == L"fbm_perlin")
+		return std::unique_ptr<HeightfieldSource>(new NoiseSource(NoiseBasis::Perlin, NoiseFractal::Fbm, seed));
+	if (source_name == L"fbm_simplex")
+		return std::unique_ptr<HeightfieldSource>(new NoiseSource(NoiseBasis::Simplex, NoiseFractal::Fbm, seed));
+	if (source_name == L"ridged_perlin")
+		return std::unique_ptr<HeightfieldSource>(new NoiseSource(NoiseBasis::Perlin, NoiseFractal::Ridged, seed));
+	if (source_name == L"ridged_simplex")
+		return std::unique_ptr<HeightfieldSource>(new NoiseSource(NoiseBasis::Simplex, NoiseFractal::Ridged, seed));
+	return nullptr;
+}
+
+std::vector<float> generate_source_field(const HeightfieldSource& source, int64_t resolution)
+{
+	std::vector<float> field(resolution * resolution);
+	generate_source_field(source, resolution, field.data(), nullptr);
+	return field;
+}
+
+bool generate_source_field(const HeightfieldSource& source, int64_t resolution, float* out, const ProgressCallback& progress)
+{
+	std::vector<float*> rows(resolution);
+	for (int64_t y = 0; y < resolution; y++)
+		rows[y] = out + y * resolution;
+
+	// Without a callback in one go, which gives the threads the most work at once
+	if (!progress)
+	{
+		source.generate_rows(resolution, 0, resolution, rows.data());
+		return true;
+	}
+
+	// About 16 bands, aligned so that no band generates more than its rows
+	int64_t alignment = source.get_band_alignment(resolution);
+	int64_t band_rows = std::max((resolution / 16 + alignment - 1) / alignment * alignment, alignment);
+	for (int64_t band_begin = 0; band_begin < resolution; band_begin += band_rows)
+	{
+		int64_t band_end = std::min(band_begin + band_rows, resolution);
+		source.generate_rows(resolution, band_begin, band_end, rows.data());
+		if (!progress(static_cast<double>(band_end) / resolution))
+			return false;
+	}
+	return true;
+}
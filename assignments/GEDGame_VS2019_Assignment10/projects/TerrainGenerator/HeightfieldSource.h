@@ -0,0 +1,108 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+
+#include <memory>
+
+// Produces the unnormalized heights the post-processing starts from
+// All generators (in-memory, fused, streaming) fill their heightfield through this interface
+class HeightfieldSource
+{
+public:
+	virtual ~HeightfieldSource() {}
+
+	virtual const char* get_name() const = 0;
+
+	// Every setting besides the name and the resolution which changes the heights, keys the stage cache
+	virtual std::string get_parameters() const = 0;
+
+	// False if the source cannot generate a field of this resolution
+	virtual bool supports_resolution(int64_t resolution) const = 0;
+
+	// Fills the rows [row_begin; row_end) of the resolution² field, rows[y] points to row y
+	// Splits the work over the threads itself, a band of any size gives the same values as the whole field
+	virtual void generate_rows(int64_t resolution, int64_t row_begin, int64_t row_end, float* const* rows) const = 0;
+
+	// Bands which start and end at a multiple of this number of rows are generated without extra work
+	virtual int64_t get_band_alignment(int64_t resolution) const { return 1; }
+};
+
+// Diamond-Square, stitched from tiles (see TerrainTile.h), the resolution has to be a power of two
+class DiamondSquareSource : public HeightfieldSource
+{
+public:
+	explicit DiamondSquareSource(uint64_t seed) : seed(seed) {}
+
+	const char* get_name() const override { return "diamond_square"; }
+	std::string get_parameters() const override { return "seed " + std::to_string(seed); }
+	bool supports_resolution(int64_t resolution) const override;
+	void generate_rows(int64_t resolution, int64_t row_begin, int64_t row_end, float* const* rows) const override;
+	int64_t get_band_alignment(int64_t resolution) const override { return get_tile_size(resolution); }
+
+	static int64_t get_tile_size(int64_t resolution) { return std::min(resolution, 256ll); }
+
+private:
+	uint64_t seed;
+};
+
+// Gradient noise which is summed over octaves of doubling frequency
+enum class NoiseBasis
+{
+	Perlin,
+	Simplex
+};
+
+enum class NoiseFractal
+{
+	Fbm, // Fractal Brownian motion, the octaves are added with halving amplitude
+	Ridged // Ridged multifractal after Musgrave, sharp ridges at the zero crossings and smooth valleys
+};
+
+struct NoiseSettings
+{
+	NoiseBasis basis = NoiseBasis::Simplex;
+	NoiseFractal fractal = NoiseFractal::Fbm;
+	uint32_t seed = 0;
+	// Noise cells along one side of the field in the first octave, so the terrain looks the same at any resolution
+	float cells = 4.0f;
+	// Octaves until the finest one has cells of about two pixels
+	int64_t octaves = 1;
+	// Sample spacing in noise coordinates of the first octave, cells / resolution
+	float scale = 1.0f;
+};
+
+// Noise terrain of any resolution, evaluated row by row with the SIMD kernels in NoiseKernels.cpp
+class NoiseSource : public HeightfieldSource
+{
+public:
+	NoiseSource(NoiseBasis basis, NoiseFractal fractal, uint64_t seed);
+
+	const char* get_name() const override;
+	std::string get_parameters() const override;
+	bool supports_resolution(int64_t resolution) const override { return resolution > 0; }
+	void generate_rows(int64_t resolution, int64_t row_begin, int64_t row_end, float* const* rows) const override;
+
+	// Settings used for the given resolution
+	NoiseSettings get_settings(int64_t resolution) const;
+
+private:
+	NoiseSettings settings;
+};
+
+// Creates the source for "diamond_square", "fbm_perlin", "fbm_simplex", "ridged_perlin" or "ridged_simplex"
+// Returns nullptr for anything else
+std::unique_ptr<HeightfieldSource> create_heightfield_source(const wchar_t* name, uint64_t seed);
+
+// Generates the whole unnormalized resolution² field
+std::vector<float> generate_source_field(const HeightfieldSource& source, int64_t resolution);
+// Generates it into the caller's memory, row y starts at out + y * resolution
+// With a callback the field is generated in bands and progress is reported after each of them
+// Returns false if progress cancelled it, the rows after the last band are not written then
+bool generate_source_field(const HeightfieldSource& source, int64_t resolution, float* out, const ProgressCallback& progress);
+
+// Kernels
+// Noise of the pixels [0; resolution) of row y, dispatches to the variant for g_simd_level
+void noise_row(const NoiseSettings& settings, int64_t y, int64_t resolution, float* out);
+void noise_row_scalar(const NoiseSettings& settings, int64_t y, int64_t resolution, float* out);
+void noise_row_sse2(const NoiseSettings& settings, int64_t y, int64_t resolution, float* out);
+void noise_row_avx2(const NoiseSettings& settings, int64_t y, int64_t resolution, float* out);
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Pixels of one row, width pixels starting at data
+// RowSpan<const T> only reads them
+template <typename T>
+class RowSpan
+{
+public:
+	RowSpan(T* data, int64_t width) : pixels(data), width(width) {}
+
+	T* data() const { return pixels; }
+	int64_t size() const { return width; }
+	T& operator[](int64_t x) const { return pixels[x]; }
+	T* begin() const { return pixels; }
+	T* end() const { return pixels + width; }
+
+private:
+	T* pixels;
+	int64_t width;
+};
+
+// Move-only image of width x height pixels, replacing GEDUtils::SimpleImage where whole rows are read or written
+// Every row starts at a multiple of 64 bytes, so rows can be filled by different threads and with aligned vector stores
+// share() returns a second image of the same pixels, whose reference count is atomic: the images may be passed to
+// other threads and the first write through any of them copies the pixels (copy on write)
+// Writing an image from several threads while it is shared is a race like any other write, call detach() first
+template <typename T>
+class Image
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Pixels are copied with memcpy");
+
+public:
+	static const int64_t alignment = 64;
+
+	Image() {}
+
+	// The pixels start out zeroed
+	Image(int64_t width, int64_t height)
+		: width(width), height(height), stride((width * static_cast<int64_t>(sizeof(T)) + alignment - 1) / alignment * alignment)
+	{
+		allocate();
+		memset(pixels, 0, static_cast<size_t>(stride * height));
+	}
+
+	Image(Image&& other) noexcept { swap(other); }
+	Image& operator=(Image&& other) noexcept
+	{
+		Image moved(std::move(other));
+		swap(moved);
+		return *this;
+	}
+
+	// Copies are explicit, see clone() and share()
+	Image(const Image&) = delete;
+	Image& operator=(const Image&) = delete;
+
+	~Image() { release(); }
+
+	int64_t get_width() const { return width; }
+	int64_t get_height() const { return height; }
+	// Bytes from the start of one row to the next
+	int64_t get_stride() const { return stride; }
+	bool empty() const { return buffer == nullptr; }
+	bool is_shared() const { return buffer != nullptr && buffer->references.load(std::memory_order_acquire) > 1; }
+
+	RowSpan<const T> row(int64_t y) const { return RowSpan<const T>(reinterpret_cast<const T*>(pixels + y * stride), width); }
+	// Copies the pixels first if they are shared
+	RowSpan<T> row(int64_t y)
+	{
+		detach();
+		return RowSpan<T>(reinterpret_cast<T*>(pixels + y * stride), width);
+	}
+
+	// First byte of row 0, rows follow every get_stride() bytes
+	const uint8_t* get_data() const { return pixels; }
+	uint8_t* get_data()
+	{
+		detach();
+		return pixels;
+	}
+
+	// Another image of the same pixels, nothing is copied until one of them is written
+	Image share() const
+	{
+		Image result;
+		if (buffer != nullptr)
+		{
+			buffer->references.fetch_add(1, std::memory_order_relaxed);
+			result.buffer = buffer;
+			result.pixels = pixels;
+			result.width = width;
+			result.height = height;
+			result.stride = stride;
+		}
+		return result;
+	}
+
+	Image clone() const
+	{
+		Image result;
+		if (buffer != nullptr)
+		{
+			result.width = width;
+			result.height = height;
+			result.stride = stride;
+			result.allocate();
+			memcpy(result.pixels, pixels, static_cast<size_t>(stride * height));
+		}
+		return result;
+	}
+
+	// Makes this image the only owner of its pixels
+	void detach()
+	{
+		if (is_shared())
+			*this = clone();
+	}
+
+private:
+	// Lives in front of the pixels in the same allocation
+	struct Buffer
+	{
+		std::atomic<int64_t> references;
+	};
+
+	void allocate()
+	{
+		char* memory = new char[sizeof(Buffer) + alignment + stride * height];
+		buffer = new (memory) Buffer();
+		buffer->references.store(1, std::memory_order_relaxed);
+		uintptr_t first = reinterpret_cast<uintptr_t>(memory + sizeof(Buffer));
+		pixels = reinterpret_cast<uint8_t*>((first + alignment - 1) / alignment * alignment);
+	}
+
+	void release()
+	{
+		// The last owner frees the pixels, acq_rel orders the writes of the other owners before it
+		if (buffer != nullptr && buffer->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			buffer->~Buffer();
+			delete[] reinterpret_cast<char*>(buffer);
+		}
+		buffer = nullptr;
+		pixels = nullptr;
+	}
+
+	void swap(Image& other)
+	{
+		std::swap(buffer, other.buffer);
+		std::swap(pixels, other.pixels);
+		std::swap(width, other.width);
+		std::swap(height, other.height);
+		std::swap(stride, other.stride);
+	}
+
+	Buffer* buffer = nullptr;
+	uint8_t* pixels = nullptr;
+	int64_t width = 0;
+	int64_t height = 0;
+	int64_t stride = 0;
+};
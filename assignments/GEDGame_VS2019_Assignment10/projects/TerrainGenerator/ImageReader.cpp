@@ -0,0 +1,39 @@
+#include "ImageReader.h"
+
+bool read_image(const wchar_t* path, Image<Rgb48>& image)
+{
+	// WIC needs COM, RPC_E_CHANGED_MODE means it is already initialized on this thread
+	HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	bool com_initialized = SUCCEEDED(hr);
+	if (FAILED(hr) && hr != RPC_E_CHANGED_MODE)
+		return false;
+
+	bool decoded = false;
+	{
+		ComPtr<IWICImagingFactory> factory;
+		ComPtr<IWICBitmapDecoder> decoder;
+		ComPtr<IWICBitmapFrameDecode> frame;
+		ComPtr<IWICFormatConverter> converter;
+		UINT width = 0;
+		UINT height = 0;
+		if (SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory)))
+			&& SUCCEEDED(factory->CreateDecoderFromFilename(path, nullptr, GENERIC_READ, WICDecodeMetadataCacheOnDemand, &decoder))
+			&& SUCCEEDED(decoder->GetFrame(0, &frame))
+			&& SUCCEEDED(factory->CreateFormatConverter(&converter))
+			&& SUCCEEDED(converter->Initialize(frame, GUID_WICPixelFormat48bppRGB, WICBitmapDitherTypeNone, nullptr, 0.0, WICBitmapPaletteTypeCustom))
+			&& SUCCEEDED(converter->GetSize(&width, &height)))
+		{
+			// The converter writes the rows with the stride of the image, so the pixels are not copied again
+			Image<Rgb48> result(width, height);
+			decoded = SUCCEEDED(converter->CopyPixels(nullptr, static_cast<UINT>(result.get_stride()),
+				static_cast<UINT>(result.get_stride() * height), result.get_data()));
+			if (decoded)
+				image = std::move(result);
+		}
+		// The COM objects are released here, before COM is deinitialized
+	}
+
+	if (com_initialized)
+		CoUninitialize();
+	return decoded;
+}
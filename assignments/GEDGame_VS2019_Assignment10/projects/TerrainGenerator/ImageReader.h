@@ -0,0 +1,14 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+#include "Image.h"
+
+// 16 bit per channel RGB, the layout of GUID_WICPixelFormat48bppRGB
+struct Rgb48
+{
+	WORD r, g, b;
+};
+
+// Decodes an image file through WIC straight into the rows of image, whatever its format on disk
+// Returns false if the file cannot be decoded
+bool read_image(const wchar_t* path, Image<Rgb48>& image);
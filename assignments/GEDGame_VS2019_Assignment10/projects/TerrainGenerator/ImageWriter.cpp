@@ -0,0 +1,516 @@
+#include "ImageWriter.h"
+#include "StripImageWriter.h"
+#include "PackedField.h"
+#include "DdsWriter.h"
+#include "Deflate.h"
+
+#include <cstring>
+#include <cwchar>
+
+// Checks the file extension, ignoring the case
+static bool has_extension(const wchar_t* path, const wchar_t* extension)
+{
+	size_t path_length = wcslen(path);
+	size_t extension_length = wcslen(extension);
+	return path_length >= extension_length && _wcsicmp(path + path_length - extension_length, extension) == 0;
+}
+
+bool is_tiff_path(const wchar_t* path)
+{
+	return has_extension(path, L".tif") || has_extension(path, L".tiff");
+}
+
+bool is_png_path(const wchar_t* path)
+{
+	return has_extension(path, L".png");
+}
+
+bool is_dds_path(const wchar_t* path)
+{
+	return has_extension(path, L".dds");
+}
+
+// Field types and tags of the TIFF 6.0 specification, see https://www.itu.int/itudoc/itu-t/com16/tiff-fx/docs/tiff6.pdf
+// LONG8 and the 64 bit layout of the header and directory are BigTIFF, see https://www.awaresystems.be/imaging/tiff/bigtiff.html
+const WORD tiff_short = 3;
+const WORD tiff_long = 4;
+const WORD tiff_long8 = 16;
+
+const WORD tag_image_width = 256;
+const WORD tag_image_length = 257;
+const WORD tag_bits_per_sample = 258;
+const WORD tag_compression = 259;
+const WORD tag_photometric = 262;
+const WORD tag_strip_offsets = 273;
+const WORD tag_samples_per_pixel = 277;
+const WORD tag_rows_per_strip = 278;
+const WORD tag_strip_byte_counts = 279;
+const WORD tag_planar_configuration = 284;
+const WORD tag_predictor = 317;
+const int tiff_entry_count = 11;
+
+// Upper bound of the compressed size of size bytes, deflate stores the blocks which do not get smaller
+static int64_t deflate_bound(int64_t size)
+{
+	return size + size / 4096 + 64;
+}
+
+TiffWriter::TiffWriter(const wchar_t* path, int64_t width, int64_t height, int64_t channels, int64_t rows_per_strip)
+	: width(width), height(height), channels(channels), rows_per_strip(std::max(rows_per_strip, 1ll)), end_offset(0),
+	strips_written(0), failed(false)
+{
+	strip_count = (height + this->rows_per_strip - 1) / this->rows_per_strip;
+	strip_offsets.resize(strip_count);
+	strip_sizes.resize(strip_count);
+
+	// Classic TIFF uses 32 bit offsets, so only files which could end beyond 4 GB become BigTIFF,
+	// which is not as widely supported
+	int64_t strip_bound = deflate_bound(this->rows_per_strip * width * channels * sizeof(WORD));
+	int64_t offset_size = 4;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		// Header and image file directory, the arrays which do not fit into an entry follow the directory
+		int64_t directory_end = big ? 16 + 8 + tiff_entry_count * 20 + 8 : 8 + 2 + tiff_entry_count * 12 + 4;
+		int64_t bits_size = (channels * 2 > offset_size) ? channels * 2 : 0;
+		int64_t strips_size = (strip_count > 1) ? strip_count * offset_size * 2 : 0;
+		header_size = (directory_end + bits_size + strips_size + 15) / 16 * 16;
+		if (big || header_size + strip_bound * strip_count <= 0xFFFFFFFFll)
+			break;
+		big = true;
+		offset_size = 8;
+	}
+	end_offset = header_size;
+
+	// The header is written by finish(), once the strip offsets are known
+	file = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+}
+
+TiffWriter::~TiffWriter()
+{
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+}
+
+bool TiffWriter::write_strip(int64_t strip, const float* rows)
+{
+	if (!is_valid() || channels != 1 || strip < 0 || strip >= strip_count)
+		return false;
+
+	std::vector<WORD> words(width * std::min(rows_per_strip, height - strip * rows_per_strip));
+	for (size_t i = 0; i < words.size(); i++)
+		words[i] = to_word(rows[i]);
+
+	return write_converted(strip, words);
+}
+
+bool TiffWriter::write_strip(int64_t strip, const GEDUtils::Vec3f* rows)
+{
+	if (!is_valid() || channels != 3 || strip < 0 || strip >= strip_count)
+		return false;
+
+	std::vector<WORD> words(width * std::min(rows_per_strip, height - strip * rows_per_strip) * 3);
+	for (size_t i = 0; i < words.size() / 3; i++)
+	{
+		words[i * 3 + 0] = to_word(rows[i].x);
+		words[i * 3 + 1] = to_word(rows[i].y);
+		words[i * 3 + 2] = to_word(rows[i].z);
+	}
+
+	return write_converted(strip, words);
+}
+
+bool TiffWriter::write_converted(int64_t strip, std::vector<WORD>& words)
+{
+	// Horizontal predictor, every sample is replaced by its difference to the same channel of the pixel before,
+	// which turns the smooth heights and colors into small numbers deflate compresses much better
+	int64_t row_words = width * channels;
+	for (int64_t row = 0; row < static_cast<int64_t>(words.size()) / row_words; row++)
+	{
+		WORD* samples = &words[row * row_words];
+		for (int64_t i = row_words - 1; i >= channels; i--)
+			samples[i] -= samples[i - channels];
+	}
+
+	// The file is little endian like the words
+	std::vector<uint8_t> compressed;
+	deflate_zlib(reinterpret_cast<const uint8_t*>(words.data()), words.size() * sizeof(WORD), compressed);
+
+	int64_t size = compressed.size();
+	int64_t offset = end_offset.fetch_add(size);
+	if ((!big && offset + size > 0xFFFFFFFFll) || !write_at(offset, compressed.data(), size))
+	{
+		failed = true;
+		return false;
+	}
+
+	strip_offsets[strip] = offset;
+	strip_sizes[strip] = size;
+	strips_written++;
+	return true;
+}
+
+bool TiffWriter::write_at(int64_t offset, const void* data, int64_t size)
+{
+	// With an offset in OVERLAPPED, WriteFile does not use the shared file pointer,
+	// so the threads can write their strips at the same time
+	OVERLAPPED position = {};
+	position.Offset = static_cast<DWORD>(offset);
+	position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+	DWORD written = 0;
+	return WriteFile(file, data, static_cast<DWORD>(size), &written, &position) && written == size;
+}
+
+bool TiffWriter::finish()
+{
+	if (!is_valid())
+		return false;
+
+	bool complete = !failed && strips_written == strip_count;
+	if (complete)
+	{
+		std::vector<BYTE> header(header_size, 0);
+		auto put = [&](int64_t offset, int64_t size, int64_t value)
+		{
+			for (int64_t i = 0; i < size; i++)
+				header[offset + i] = static_cast<BYTE>(value >> (i * 8));
+		};
+
+		// Little endian, magic number and offset of the first directory
+		int64_t offset_size = big ? 8 : 4;
+		int64_t directory = big ? 16 : 8;
+		header[0] = 'I';
+		header[1] = 'I';
+		put(2, 2, big ? 43 : 42);
+		if (big)
+		{
+			put(4, 2, 8); // Size of the offsets
+			put(6, 2, 0);
+		}
+		put(4 + (big ? 4 : 0), offset_size, directory);
+
+		// The entries have to be sorted by tag, values which do not fit into the entry go behind the directory
+		int64_t entry = directory + (big ? 8 : 2);
+		int64_t entry_size = big ? 20 : 12;
+		int64_t array = entry + tiff_entry_count * entry_size + offset_size;
+		auto put_entry = [&](WORD tag, WORD type, const std::vector<int64_t>& values)
+		{
+			int64_t value_size = (type == tiff_short) ? 2 : (type == tiff_long) ? 4 : 8;
+			int64_t count = values.size();
+			int64_t position = entry + 4 + offset_size;
+			put(entry, 2, tag);
+			put(entry + 2, 2, type);
+			put(entry + 4, offset_size, count);
+			if (count * value_size > offset_size)
+			{
+				put(position, offset_size, array);
+				position = array;
+				array += count * value_size;
+			}
+			for (int64_t i = 0; i < count; i++)
+				put(position + i * value_size, value_size, values[i]);
+			entry += entry_size;
+		};
+		WORD offset_type = big ? tiff_long8 : tiff_long;
+		put(directory, big ? 8 : 2, tiff_entry_count);
+		put_entry(tag_image_width, tiff_long, { width });
+		put_entry(tag_image_length, tiff_long, { height });
+		put_entry(tag_bits_per_sample, tiff_short, std::vector<int64_t>(channels, 16));
+		put_entry(tag_compression, tiff_short, { 8 }); // Adobe Deflate
+		put_entry(tag_photometric, tiff_short, { channels == 1 ? 1 : 2 }); // BlackIsZero or RGB
+		put_entry(tag_strip_offsets, offset_type, strip_offsets);
+		put_entry(tag_samples_per_pixel, tiff_short, { channels });
+		put_entry(tag_rows_per_strip, tiff_long, { rows_per_strip });
+		put_entry(tag_strip_byte_counts, offset_type, strip_sizes);
+		put_entry(tag_planar_configuration, tiff_short, { 1 }); // Chunky
+		put_entry(tag_predictor, tiff_short, { 2 }); // Horizontal differencing
+		put(entry, offset_size, 0); // No further directories
+
+		complete = write_at(0, header.data(), header.size());
+	}
+
+	CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+	return complete;
+}
+
+// CRC of the PNG chunks, see https://www.w3.org/TR/png/#D-CRCAppendix
+static uint32_t crc32(const BYTE* data, int64_t size, uint32_t crc = 0)
+{
+	static const std::vector<uint32_t> table = []()
+	{
+		std::vector<uint32_t> table(256);
+		for (uint32_t n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			table[n] = c;
+		}
+		return table;
+	}();
+
+	crc = ~crc;
+	for (int64_t i = 0; i < size; i++)
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+// PNG stores its numbers big endian
+static void put_big_endian(BYTE* out, uint32_t value)
+{
+	out[0] = static_cast<BYTE>(value >> 24);
+	out[1] = static_cast<BYTE>(value >> 16);
+	out[2] = static_cast<BYTE>(value >> 8);
+	out[3] = static_cast<BYTE>(value);
+}
+
+PngWriter::PngWriter(const wchar_t* path, int64_t width, int64_t height, int64_t channels)
+	: width(width), height(height), channels(channels)
+{
+	// The size is limited to 31 bits
+	if (width <= 0 || height <= 0 || width > 0x7FFFFFFF || height > 0x7FFFFFFF)
+		return;
+
+	file = CreateFileW(path, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	// Signature, then the header with 16 bits per sample, greyscale or RGB, deflate, adaptive filters and no interlacing
+	const BYTE signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	BYTE header[13] = { 0, 0, 0, 0, 0, 0, 0, 0, 16, static_cast<BYTE>(channels == 1 ? 0 : 2), 0, 0, 0 };
+	put_big_endian(header, static_cast<uint32_t>(width));
+	put_big_endian(header + 4, static_cast<uint32_t>(height));
+
+	// The image data is a single zlib stream, which may be split over any number of chunks.
+	// Its header gets a chunk of its own, so the parts from compress_rows() can be written as they are
+	const BYTE zlib_header[] = { 0x78, 0x9C };
+	DWORD written = 0;
+	if (!WriteFile(file, signature, sizeof(signature), &written, nullptr) || written != sizeof(signature) ||
+		!write_chunk("IHDR", header, sizeof(header)) || !write_chunk("IDAT", zlib_header, sizeof(zlib_header)))
+	{
+		CloseHandle(file);
+		file = INVALID_HANDLE_VALUE;
+	}
+}
+
+PngWriter::~PngWriter()
+{
+	if (file != INVALID_HANDLE_VALUE)
+		CloseHandle(file);
+}
+
+uint32_t PngWriter::compress_rows(int64_t y, int64_t count, const float* rows, std::vector<BYTE>& part) const
+{
+	std::vector<WORD> words(width * count);
+	for (size_t i = 0; i < words.size(); i++)
+		words[i] = to_word(rows[i]);
+
+	return compress_converted(y, count, words, part);
+}
+
+uint32_t PngWriter::compress_rows(int64_t y, int64_t count, const GEDUtils::Vec3f* rows, std::vector<BYTE>& part) const
+{
+	std::vector<WORD> words(width * count * 3);
+	for (size_t i = 0; i < words.size() / 3; i++)
+	{
+		words[i * 3 + 0] = to_word(rows[i].x);
+		words[i * 3 + 1] = to_word(rows[i].y);
+		words[i * 3 + 2] = to_word(rows[i].z);
+	}
+
+	return compress_converted(y, count, words, part);
+}
+
+uint32_t PngWriter::compress_converted(int64_t y, int64_t count, const std::vector<WORD>& words, std::vector<BYTE>& part) const
+{
+	// Every row starts with its filter type, Sub stores the difference of each byte to the one of the pixel before,
+	// like the predictor of the TIFF files. The samples are big endian
+	int64_t row_words = width * channels;
+	int64_t row_bytes = 1 + row_words * 2;
+	std::vector<BYTE> filtered(count * row_bytes);
+	for (int64_t row = 0; row < count; row++)
+	{
+		const WORD* samples = &words[row * row_words];
+		BYTE* out = &filtered[row * row_bytes];
+		out[0] = 1;
+		for (int64_t i = 0; i < row_words; i++)
+		{
+			// The filter works on bytes, so the high and low bytes are subtracted separately
+			WORD before = (i >= channels) ? samples[i - channels] : 0;
+			out[1 + i * 2] = static_cast<BYTE>((samples[i] >> 8) - (before >> 8));
+			out[2 + i * 2] = static_cast<BYTE>((samples[i] & 0xFF) - (before & 0xFF));
+		}
+	}
+
+	part.clear();
+	deflate_raw(filtered.data(), filtered.size(), y + count == height, part);
+	return adler32(filtered.data(), filtered.size());
+}
+
+bool PngWriter::write_part(const std::vector<BYTE>& part, uint32_t part_adler, int64_t part_rows)
+{
+	if (!is_valid() || failed)
+		return false;
+
+	// A chunk holds at most 2^31 - 1 bytes
+	const int64_t chunk_size = 0x40000000;
+	for (int64_t begin = 0; begin < static_cast<int64_t>(part.size()); begin += chunk_size)
+		if (!write_chunk("IDAT", part.data() + begin, std::min(chunk_size, static_cast<int64_t>(part.size()) - begin)))
+		{
+			failed = true;
+			return false;
+		}
+
+	adler = adler32_combine(adler, part_adler, part_rows * (1 + width * channels * 2));
+	rows_written += part_rows;
+	return true;
+}
+
+bool PngWriter::finish()
+{
+	if (!is_valid())
+		return false;
+
+	// The checksum of the filtered rows ends the zlib stream
+	BYTE checksum[4];
+	put_big_endian(checksum, adler);
+	bool complete = !failed && rows_written == height && write_chunk("IDAT", checksum, sizeof(checksum)) &&
+		write_chunk("IEND", nullptr, 0);
+
+	CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+	return complete;
+}
+
+bool PngWriter::write_chunk(const char* type, const BYTE* data, int64_t size)
+{
+	// Length, type, data and the CRC of type and data
+	BYTE head[8];
+	put_big_endian(head, static_cast<uint32_t>(size));
+	memcpy(head + 4, type, 4);
+	BYTE tail[4];
+	put_big_endian(tail, crc32(data, size, crc32(head + 4, 4)));
+
+	DWORD written = 0;
+	return WriteFile(file, head, sizeof(head), &written, nullptr) && written == sizeof(head) &&
+		(size == 0 || (WriteFile(file, data, static_cast<DWORD>(size), &written, nullptr) && written == size)) &&
+		WriteFile(file, tail, sizeof(tail), &written, nullptr) && written == sizeof(tail);
+}
+
+// Rows per strip for strips of about 256 KB
+static int64_t strip_rows(int64_t width, int64_t channels)
+{
+	return std::max(256 * 1024 / (width * channels * static_cast<int64_t>(sizeof(WORD))), 1ll);
+}
+
+// rows(y, count, scratch) returns count rows starting at row y, either in place or converted into scratch
+template <typename T, typename Rows>
+static bool write_image_strips(const Rows& rows, int64_t width, int64_t height, int64_t channels, const wchar_t* path)
+{
+	if (is_tiff_path(path))
+	{
+		TiffWriter writer(path, width, height, channels, strip_rows(width, channels));
+		if (!writer.is_valid())
+			return false;
+
+		parallel_for(0, writer.get_strip_count(), [&](int64_t strip_begin, int64_t strip_end)
+		{
+			std::vector<T> scratch;
+			for (int64_t strip = strip_begin; strip < strip_end; strip++)
+			{
+				int64_t y = strip * writer.get_rows_per_strip();
+				writer.write_strip(strip, rows(y, std::min(writer.get_rows_per_strip(), height - y), scratch));
+			}
+		});
+		return writer.finish();
+	}
+
+	if (is_png_path(path))
+	{
+		PngWriter writer(path, width, height, channels);
+		if (!writer.is_valid())
+			return false;
+
+		// The parts of the stream have to be written in order, so the strips are compressed a group at a time
+		// and the group is written before the next one starts, which bounds the compressed data held in memory
+		int64_t strip = strip_rows(width, channels);
+		int64_t strip_count = (height + strip - 1) / strip;
+		int64_t group = std::max(static_cast<int64_t>(g_thread_count) * 4, 1ll);
+		std::vector<std::vector<BYTE>> parts(group);
+		std::vector<uint32_t> checksums(group);
+		for (int64_t group_begin = 0; group_begin < strip_count; group_begin += group)
+		{
+			int64_t group_end = std::min(group_begin + group, strip_count);
+			parallel_for(group_begin, group_end, [&](int64_t strip_begin, int64_t strip_end)
+			{
+				std::vector<T> scratch;
+				for (int64_t s = strip_begin; s < strip_end; s++)
+				{
+					int64_t y = s * strip;
+					int64_t count = std::min(strip, height - y);
+					checksums[s - group_begin] = writer.compress_rows(y, count, rows(y, count, scratch), parts[s - group_begin]);
+				}
+			});
+			for (int64_t s = group_begin; s < group_end; s++)
+				if (!writer.write_part(parts[s - group_begin], checksums[s - group_begin], std::min(strip, height - s * strip)))
+					return false;
+		}
+		return writer.finish();
+	}
+
+	// WIC encodes the other formats sequentially, but still without a copy of the whole image
+	StripImageWriter writer(path, width, height, channels == 1 ? StripImageWriter::Format::Gray16 : StripImageWriter::Format::RGB48);
+	int64_t strip = strip_rows(width, channels);
+	std::vector<T> scratch;
+	for (int64_t y = 0; y < height; y += strip)
+		if (!writer.write_rows(rows(y, std::min(strip, height - y), scratch), std::min(strip, height - y)))
+			return false;
+	return writer.finish();
+}
+
+bool write_image(const float* data, int64_t width, int64_t height, const wchar_t* path)
+{
+	// Only the color and normal map are block compressed
+	if (is_dds_path(path))
+		return false;
+
+	auto rows = [&](int64_t y, int64_t, std::vector<float>&) { return data + y * width; };
+	return write_image_strips<float>(rows, width, height, 1, path);
+}
+
+bool write_image(const GEDUtils::Vec3f* data, int64_t width, int64_t height, const wchar_t* path)
+{
+	auto rows = [&](int64_t y, int64_t, std::vector<GEDUtils::Vec3f>&) { return data + y * width; };
+	if (is_dds_path(path))
+		return write_dds(rows, width, height, g_dds_color_format, path);
+	return write_image_strips<GEDUtils::Vec3f>(rows, width, height, 3, path);
+}
+
+bool write_image(const NormalStore& normals, const wchar_t* path)
+{
+	// Packed normals are unpacked strip by strip
+	int64_t width = normals.get_width();
+	auto rows = [&](int64_t y, int64_t count, std::vector<GEDUtils::Vec3f>& scratch)
+	{
+		scratch.resize(count * width);
+		return normals.load_rows(y, count, scratch.data());
+	};
+	if (is_dds_path(path))
+		return write_dds(rows, width, normals.get_height(), BlockFormat::BC5, path);
+	return write_image_strips<GEDUtils::Vec3f>(rows, width, normals.get_height(), 3, path);
+}
+
+bool write_image(const ColorStore& colors, const wchar_t* path)
+{
+	// Packed colors are unpacked strip by strip
+	int64_t width = colors.get_width();
+	auto rows = [&](int64_t y, int64_t count, std::vector<GEDUtils::Vec3f>& scratch)
+	{
+		scratch.resize(count * width);
+		return colors.load_rows(y, count, scratch.data());
+	};
+	if (is_dds_path(path))
+		return write_dds(rows, width, colors.get_height(), g_dds_color_format, path);
+	return write_image_strips<GEDUtils::Vec3f>(rows, width, colors.get_height(), 3, path);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+
+#include <atomic>
+
+// Converts a value in [0;1] to a 16 bit channel
+inline WORD to_word(float value)
+{
+	return static_cast<WORD>(clamp(value) * 65535.0f + 0.5f);
+}
+
+// True for .tif and .tiff paths, ignoring the case
+bool is_tiff_path(const wchar_t* path);
+// True for .png paths, ignoring the case
+bool is_png_path(const wchar_t* path);
+// True for .dds paths, ignoring the case
+bool is_dds_path(const wchar_t* path);
+
+// Writes a 16 bit TIFF whose strips can be written in any order and from any thread.
+// Every strip is compressed on the thread writing it, Adobe Deflate with the horizontal predictor, and appended
+// to the file, the directory with the strip offsets and sizes is written by finish().
+// Files which could grow beyond 4 GB are written as BigTIFF, with 64 bit offsets.
+class TiffWriter
+{
+public:
+	// channels is 1 (greyscale) or 3 (RGB), check is_valid() afterwards
+	TiffWriter(const wchar_t* path, int64_t width, int64_t height, int64_t channels, int64_t rows_per_strip);
+	~TiffWriter();
+
+	bool is_valid() const { return file != INVALID_HANDLE_VALUE; }
+	bool is_big() const { return big; }
+	int64_t get_rows_per_strip() const { return rows_per_strip; }
+	int64_t get_strip_count() const { return strip_count; }
+
+	// Converts, compresses and writes strip number strip, rows points to its first row
+	// Values must lie in [0;1], thread safe
+	bool write_strip(int64_t strip, const float* rows);
+	bool write_strip(int64_t strip, const GEDUtils::Vec3f* rows);
+
+	// Writes the header and directory and closes the file, returns false if a strip is missing or could not be written
+	bool finish();
+
+private:
+	TiffWriter(const TiffWriter&);
+	void operator=(const TiffWriter&);
+
+	bool write_converted(int64_t strip, std::vector<WORD>& words);
+	bool write_at(int64_t offset, const void* data, int64_t size);
+
+	HANDLE file = INVALID_HANDLE_VALUE;
+	bool big = false;
+	int64_t width = 0;
+	int64_t height = 0;
+	int64_t channels = 0;
+	int64_t rows_per_strip = 0;
+	int64_t strip_count = 0;
+	int64_t header_size = 0; // The strips follow the space reserved for the header and directory
+	std::vector<int64_t> strip_offsets;
+	std::vector<int64_t> strip_sizes;
+	std::atomic<int64_t> end_offset; // Where the next strip goes
+	std::atomic<int64_t> strips_written;
+	std::atomic<bool> failed;
+};
+
+// Writes a 16 bit PNG whose rows are compressed by all threads, a group of strips at a time, and then written in order
+class PngWriter
+{
+public:
+	// channels is 1 (greyscale) or 3 (RGB), check is_valid() afterwards
+	PngWriter(const wchar_t* path, int64_t width, int64_t height, int64_t channels);
+	~PngWriter();
+
+	bool is_valid() const { return file != INVALID_HANDLE_VALUE; }
+
+	// Compresses count rows starting at row y into a part of the stream and returns the checksum of the rows
+	// Values must lie in [0;1], thread safe
+	uint32_t compress_rows(int64_t y, int64_t count, const float* rows, std::vector<BYTE>& part) const;
+	uint32_t compress_rows(int64_t y, int64_t count, const GEDUtils::Vec3f* rows, std::vector<BYTE>& part) const;
+
+	// Appends the next part of the stream, the parts have to be written in the order of their rows
+	bool write_part(const std::vector<BYTE>& part, uint32_t part_adler, int64_t part_rows);
+
+	// Writes the end of the stream and closes the file, returns false if a row is missing or could not be written
+	bool finish();
+
+private:
+	PngWriter(const PngWriter&);
+	void operator=(const PngWriter&);
+
+	uint32_t compress_converted(int64_t y, int64_t count, const std::vector<WORD>& words, std::vector<BYTE>& part) const;
+	bool write_chunk(const char* type, const BYTE* data, int64_t size);
+
+	HANDLE file = INVALID_HANDLE_VALUE;
+	int64_t width = 0;
+	int64_t height = 0;
+	int64_t channels = 0;
+	int64_t rows_written = 0;
+	uint32_t adler = 1;
+	bool failed = false;
+};
+
+// Writes a 16 bit image straight from the buffer
+// TIFF and PNG files are compressed by all threads in parallel strips, other formats are written strip by strip through WIC
+// DDS colormaps use g_dds_color_format and DDS normal maps BC5, see DdsWriter.h, heightmaps can not be saved as DDS
+bool write_image(const float* data, int64_t width, int64_t height, const wchar_t* path);
+bool write_image(const GEDUtils::Vec3f* data, int64_t width, int64_t height, const wchar_t* path);
+bool write_image(const NormalStore& normals, const wchar_t* path);
+bool write_image(const ColorStore& colors, const wchar_t* path);
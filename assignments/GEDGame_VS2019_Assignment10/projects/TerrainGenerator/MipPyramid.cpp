@@ -0,0 +1,326 @@
+#include "MipPyramid.h"
+#include "Simd.h"
+#include "ImageWriter.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cwchar>
+#include <iostream>
+
+bool parse_mip_filter(const wchar_t* name, MipFilter& filter)
+{
+	if (wcscmp(name, L"box") == 0)
+		filter = MipFilter::Box;
+	else if (wcscmp(name, L"triangle") == 0)
+		filter = MipFilter::Triangle;
+	else if (wcscmp(name, L"kaiser") == 0)
+		filter = MipFilter::Kaiser;
+	else
+		return false;
+	return true;
+}
+
+const char* mip_filter_name(MipFilter filter)
+{
+	switch (filter)
+	{
+	case MipFilter::Triangle:
+		return "triangle";
+	case MipFilter::Kaiser:
+		return "kaiser";
+	default:
+		return "box";
+	}
+}
+
+// Modified Bessel function of the first kind and order 0, the series converges quickly for the used range
+static double bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for (int k = 1; k < 32; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+std::vector<float> mip_filter_weights(MipFilter filter)
+{
+	// Support radius in pixels of the smaller level
+	const double radius = filter == MipFilter::Box ? 0.5 : (filter == MipFilter::Triangle ? 1.0 : 3.0);
+	const double pi = 3.14159265358979323846;
+	const double kaiser_alpha = 4.0;
+
+	// The source pixels lie at ±0.5, ±1.5, ... around the center of the output pixel, halved in output pixels
+	std::vector<double> half;
+	for (double d = 0.5; d / 2.0 < radius; d += 1.0)
+	{
+		double u = d / 2.0;
+		double weight;
+		if (filter == MipFilter::Box)
+			weight = 1.0;
+		else if (filter == MipFilter::Triangle)
+			weight = 1.0 - u / radius;
+		else
+		{
+			double sinc = sin(pi * u) / (pi * u);
+			double window = bessel_i0(kaiser_alpha * sqrt(1.0 - (u / radius) * (u / radius))) / bessel_i0(kaiser_alpha);
+			weight = sinc * window;
+		}
+		half.push_back(weight);
+	}
+
+	// Mirror the weights and normalize them to a sum of 1
+	int64_t taps = static_cast<int64_t>(half.size()) * 2;
+	std::vector<float> weights(taps);
+	double sum = 0.0;
+	for (double weight : half)
+		sum += 2.0 * weight;
+	for (int64_t t = 0; t < taps / 2; t++)
+	{
+		weights[taps / 2 + t] = static_cast<float>(half[t] / sum);
+		weights[taps / 2 - 1 - t] = static_cast<float>(half[t] / sum);
+	}
+	return weights;
+}
+
+// Horizontal filter of the pixels [begin; end) of the output row with clamped borders
+static void mip_pixels(const float* column_sums, const float* weights, int64_t taps, int64_t width, int64_t begin, int64_t end, float* out)
+{
+	for (int64_t x = begin; x < end; x++)
+	{
+		float sum = 0.0f;
+		for (int64_t t = 0; t < taps; t++)
+			sum += weights[t] * column_sums[std::min(std::max(2 * x + 1 - taps / 2 + t, 0ll), width - 1)];
+		out[x] = sum;
+	}
+}
+
+void mip_row_scalar(const float* const* rows, const float* weights, int64_t taps, int64_t width, float* column_sums, float* out)
+{
+	// Vertical
+	for (int64_t x = 0; x < width; x++)
+	{
+		float sum = weights[0] * rows[0][x];
+		for (int64_t t = 1; t < taps; t++)
+			sum += weights[t] * rows[t][x];
+		column_sums[x] = sum;
+	}
+
+	// Horizontal
+	mip_pixels(column_sums, weights, taps, width, 0, width / 2, out);
+}
+
+// First output pixel whose taps do not reach over the left border, 2x + 1 - taps / 2 >= 0
+inline int64_t first_interior_pixel(int64_t taps)
+{
+	return taps / 4;
+}
+
+void mip_row_sse2(const float* const* rows, const float* weights, int64_t taps, int64_t width, float* column_sums, float* out)
+{
+	// Vertical
+	int64_t x = 0;
+	for (; x + 4 <= width; x += 4)
+	{
+		__m128 sum = _mm_mul_ps(_mm_set1_ps(weights[0]), _mm_loadu_ps(rows[0] + x));
+		for (int64_t t = 1; t < taps; t++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(rows[t] + x)));
+		_mm_storeu_ps(column_sums + x, sum);
+	}
+	for (; x < width; x++)
+	{
+		float sum = weights[0] * rows[0][x];
+		for (int64_t t = 1; t < taps; t++)
+			sum += weights[t] * rows[t][x];
+		column_sums[x] = sum;
+	}
+
+	// Horizontal, the even and odd source pixels of four outputs are split by one shuffle per tap
+	int64_t begin = std::min(first_interior_pixel(taps), width / 2);
+	mip_pixels(column_sums, weights, taps, width, 0, begin, out);
+	x = begin;
+	for (; 2 * x + 7 + taps / 2 < width; x += 4)
+	{
+		const float* source = column_sums + 2 * x + 1 - taps / 2;
+		__m128 sum = _mm_setzero_ps();
+		for (int64_t t = 0; t < taps; t++)
+		{
+			__m128 even = _mm_shuffle_ps(_mm_loadu_ps(source + t), _mm_loadu_ps(source + t + 4), _MM_SHUFFLE(2, 0, 2, 0));
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), even));
+		}
+		_mm_storeu_ps(out + x, sum);
+	}
+	mip_pixels(column_sums, weights, taps, width, x, width / 2, out);
+}
+
+void mip_row_avx2(const float* const* rows, const float* weights, int64_t taps, int64_t width, float* column_sums, float* out)
+{
+	// Vertical
+	int64_t x = 0;
+	for (; x + 8 <= width; x += 8)
+	{
+		__m256 sum = _mm256_mul_ps(_mm256_set1_ps(weights[0]), _mm256_loadu_ps(rows[0] + x));
+		for (int64_t t = 1; t < taps; t++)
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[t]), _mm256_loadu_ps(rows[t] + x)));
+		_mm256_storeu_ps(column_sums + x, sum);
+	}
+	for (; x < width; x++)
+	{
+		float sum = weights[0] * rows[0][x];
+		for (int64_t t = 1; t < taps; t++)
+			sum += weights[t] * rows[t][x];
+		column_sums[x] = sum;
+	}
+
+	// Horizontal, the shuffle works on 128 bit lanes, so the 64 bit blocks are put back in order afterwards
+	int64_t begin = std::min(first_interior_pixel(taps), width / 2);
+	mip_pixels(column_sums, weights, taps, width, 0, begin, out);
+	x = begin;
+	for (; 2 * x + 15 + taps / 2 < width; x += 8)
+	{
+		const float* source = column_sums + 2 * x + 1 - taps / 2;
+		__m256 sum = _mm256_setzero_ps();
+		for (int64_t t = 0; t < taps; t++)
+		{
+			__m256 even = _mm256_shuffle_ps(_mm256_loadu_ps(source + t), _mm256_loadu_ps(source + t + 8), _MM_SHUFFLE(2, 0, 2, 0));
+			even = _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(even), _MM_SHUFFLE(3, 1, 2, 0)));
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[t]), even));
+		}
+		_mm256_storeu_ps(out + x, sum);
+	}
+	mip_pixels(column_sums, weights, taps, width, x, width / 2, out);
+}
+
+void mip_row(const float* const* rows, const float* weights, int64_t taps, int64_t width, float* column_sums, float* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		mip_row_avx2(rows, weights, taps, width, column_sums, out);
+		break;
+	case SimdLevel::SSE2:
+		mip_row_sse2(rows, weights, taps, width, column_sums, out);
+		break;
+	default:
+		mip_row_scalar(rows, weights, taps, width, column_sums, out);
+		break;
+	}
+}
+
+void min_max_row(const float* min_above, const float* min_below, const float* max_above, const float* max_below,
+	int64_t width, float* out_min, float* out_max)
+{
+	// Only loads and compares, so SSE2 is as fast as AVX2 here
+	int64_t x = 0;
+	if (g_simd_level >= SimdLevel::SSE2)
+		for (; 2 * x + 8 <= width; x += 4)
+		{
+			__m128 low_0 = _mm_min_ps(_mm_loadu_ps(min_above + 2 * x), _mm_loadu_ps(min_below + 2 * x));
+			__m128 low_1 = _mm_min_ps(_mm_loadu_ps(min_above + 2 * x + 4), _mm_loadu_ps(min_below + 2 * x + 4));
+			__m128 high_0 = _mm_max_ps(_mm_loadu_ps(max_above + 2 * x), _mm_loadu_ps(max_below + 2 * x));
+			__m128 high_1 = _mm_max_ps(_mm_loadu_ps(max_above + 2 * x + 4), _mm_loadu_ps(max_below + 2 * x + 4));
+			_mm_storeu_ps(out_min + x, _mm_min_ps(_mm_shuffle_ps(low_0, low_1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(low_0, low_1, _MM_SHUFFLE(3, 1, 3, 1))));
+			_mm_storeu_ps(out_max + x, _mm_max_ps(_mm_shuffle_ps(high_0, high_1, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(high_0, high_1, _MM_SHUFFLE(3, 1, 3, 1))));
+		}
+
+	for (; x < width / 2; x++)
+	{
+		out_min[x] = std::min(std::min(min_above[2 * x], min_above[2 * x + 1]), std::min(min_below[2 * x], min_below[2 * x + 1]));
+		out_max[x] = std::max(std::max(max_above[2 * x], max_above[2 * x + 1]), std::max(max_below[2 * x], max_below[2 * x + 1]));
+	}
+}
+
+std::vector<MipLevel> build_mip_pyramid(const std::vector<float>& height, int64_t resolution, MipFilter filter)
+{
+	std::vector<MipLevel> levels;
+	if (resolution <= 0)
+		return levels;
+
+	// Level 0 bounds itself
+	levels.emplace_back();
+	levels[0].resolution = resolution;
+	levels[0].height = height;
+	levels[0].min = height;
+	levels[0].max = height;
+
+	std::vector<float> weights = mip_filter_weights(filter);
+	int64_t taps = static_cast<int64_t>(weights.size());
+
+	for (int64_t size = resolution / 2; size >= 1; size /= 2)
+	{
+		levels.emplace_back();
+		const MipLevel& source = levels[levels.size() - 2];
+		MipLevel& level = levels.back();
+		int64_t width = source.resolution;
+
+		level.resolution = size;
+		level.height.resize(size * size);
+		level.min.resize(size * size);
+		level.max.resize(size * size);
+
+		parallel_for(0, size, [&](int64_t row_begin, int64_t row_end)
+		{
+			std::vector<float> column_sums(width);
+			std::vector<const float*> rows(taps);
+			for (int64_t y = row_begin; y < row_end; y++)
+			{
+				// Rows above and below the level repeat the border rows
+				for (int64_t t = 0; t < taps; t++)
+					rows[t] = &source.height[idx(0, std::min(std::max(2 * y + 1 - taps / 2 + t, 0ll), width - 1), width)];
+				mip_row(rows.data(), weights.data(), taps, width, column_sums.data(), &level.height[idx(0, y, size)]);
+
+				min_max_row(&source.min[idx(0, 2 * y, width)], &source.min[idx(0, 2 * y + 1, width)],
+					&source.max[idx(0, 2 * y, width)], &source.max[idx(0, 2 * y + 1, width)],
+					width, &level.min[idx(0, y, size)], &level.max[idx(0, y, size)]);
+			}
+		});
+	}
+
+	for (MipLevel& level : levels)
+	{
+		auto extremes = std::minmax_element(level.height.begin(), level.height.end());
+		level.level_min = *extremes.first;
+		level.level_max = *extremes.second;
+	}
+
+	return levels;
+}
+
+bool save_mip_pyramid(const std::vector<MipLevel>& levels, const _TCHAR* heightmap_path)
+{
+	// Split the path before the extension, a dot in a directory name does not count
+	std::wstring path = heightmap_path;
+	size_t separator = path.find_last_of(L"\\/");
+	size_t dot = path.find_last_of(L'.');
+	if (dot == std::wstring::npos || (separator != std::wstring::npos && dot < separator))
+		dot = path.size();
+	std::wstring name = path.substr(0, dot);
+	std::wstring extension = path.substr(dot);
+
+	for (size_t k = 1; k < levels.size(); k++)
+	{
+		std::wstring level_path = name + L"_mip" + std::to_wstring(k) + extension;
+		if (!write_image(levels[k].height.data(), levels[k].resolution, levels[k].resolution, level_path.c_str()))
+		{
+			std::wcout << "ERROR: Mip level could not be saved to: " << level_path << std::endl;
+			return false;
+		}
+	}
+
+	std::wstring extremes_path = name + L"_mips.txt";
+	FILE* file = _wfopen(extremes_path.c_str(), L"w");
+	if (file == nullptr)
+	{
+		std::wcout << "ERROR: Mip level extremes could not be saved to: " << extremes_path << std::endl;
+		return false;
+	}
+	fprintf(file, "# level resolution min max\n");
+	for (size_t k = 0; k < levels.size(); k++)
+		fprintf(file, "%d %lld %.7g %.7g\n", static_cast<int>(k), static_cast<long long>(levels[k].resolution), levels[k].level_min, levels[k].level_max);
+	fclose(file);
+
+	return true;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+
+// Filters for halving the resolution of a level, from the cheapest to the sharpest
+enum class MipFilter
+{
+	Box,
+	Triangle,
+	Kaiser
+};
+
+// Parses "box", "triangle" or "kaiser", returns false for anything else
+bool parse_mip_filter(const wchar_t* name, MipFilter& filter);
+const char* mip_filter_name(MipFilter filter);
+
+// One level of the pyramid, level k has resolution >> k pixels per side
+struct MipLevel
+{
+	int64_t resolution = 0;
+	std::vector<float> height;
+	// Bounds of the level 0 pixels each pixel covers, for culling
+	// With the Kaiser filter height may slightly overshoot them
+	std::vector<float> min;
+	std::vector<float> max;
+	// Extremes of the filtered heights of the level
+	float level_min = 0.0f;
+	float level_max = 0.0f;
+};
+
+// Builds all levels down to 1x1, level 0 is a copy of height
+// Every level is filtered from the one before it, resolution has to be a power of two
+std::vector<MipLevel> build_mip_pyramid(const std::vector<float>& height, int64_t resolution, MipFilter filter);
+
+// Saves levels 1 and above next to the heightmap as <name>_mip<k>.<extension>
+// and the extremes of every level to <name>_mips.txt
+bool save_mip_pyramid(const std::vector<MipLevel>& levels, const _TCHAR* heightmap_path);
+
+// Kernels
+// Weights of the separable filter for halving the resolution, the taps of output pixel x start at 2x + 1 - taps / 2
+std::vector<float> mip_filter_weights(MipFilter filter);
+// One output row: rows[t] is the source row under tap t, width is the source width and column_sums has width floats
+// Dispatches to the variant for g_simd_level
+void mip_row(const float* const* rows, const float* weights, int64_t taps, int64_t width, float* column_sums, float* out);
+void mip_row_scalar(const float* const* rows, const float* weights, int64_t taps, int64_t width, float* column_sums, float* out);
+void mip_row_sse2(const float* const* rows, const float* weights, int64_t taps, int64_t width, float* column_sums, float* out);
+void mip_row_avx2(const float* const* rows, const float* weights, int64_t taps, int64_t width, float* column_sums, float* out);
+// Combines 2x2 blocks of the bounds of two source rows into one output row of width / 2 pixels
+void min_max_row(const float* min_above, const float* min_below, const float* max_above, const float* max_below,
+	int64_t width, float* out_min, float* out_max);
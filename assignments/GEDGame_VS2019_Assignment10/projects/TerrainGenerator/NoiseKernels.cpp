@@ -0,0 +1,400 @@
+#include "HeightfieldSource.h"
+#include "Simd.h"
+
+#include <cmath>
+
+// The SIMD variants run the same operations in the same order as the scalar one,
+// so all of them give the same heights
+
+// Skew factors of the simplex grid, (sqrt(3) - 1) / 2 and (3 - sqrt(3)) / 6
+const float simplex_f2 = 0.36602540378f;
+const float simplex_g2 = 0.21132486541f;
+// Bring both bases to about [-1;1] with the gradients used here
+const float perlin_scale = 0.5f;
+const float simplex_scale = 45.0f;
+// Ridged multifractal parameters
+const float ridged_offset = 1.0f;
+const float ridged_gain = 2.0f;
+
+// Hash of a lattice point, the lowest three bits select the gradient
+inline uint32_t lattice_hash(int32_t x, int32_t y, uint32_t seed)
+{
+	uint32_t h = seed ^ (static_cast<uint32_t>(x) * 0x27D4EB2Du) ^ (static_cast<uint32_t>(y) * 0x165667B1u);
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	h *= 0x297A2D39u;
+	h ^= h >> 15;
+	return h;
+}
+
+// Dot product of (x, y) with one of the eight gradients (±1, ±2) and (±2, ±1)
+inline float gradient(uint32_t h, float x, float y)
+{
+	float u = (h & 4) ? y : x;
+	float v = (h & 4) ? x : y;
+	return ((h & 1) ? -u : u) + ((h & 2) ? -(v + v) : v + v);
+}
+
+inline float fade(float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+static float perlin(float x, float y, uint32_t seed)
+{
+	float floor_x = std::floor(x);
+	float floor_y = std::floor(y);
+	int32_t i = static_cast<int32_t>(floor_x);
+	int32_t j = static_cast<int32_t>(floor_y);
+	float dx = x - floor_x;
+	float dy = y - floor_y;
+
+	float n00 = gradient(lattice_hash(i, j, seed), dx, dy);
+	float n10 = gradient(lattice_hash(i + 1, j, seed), dx - 1.0f, dy);
+	float n01 = gradient(lattice_hash(i, j + 1, seed), dx, dy - 1.0f);
+	float n11 = gradient(lattice_hash(i + 1, j + 1, seed), dx - 1.0f, dy - 1.0f);
+
+	float u = fade(dx);
+	float v = fade(dy);
+	float top = n00 + u * (n10 - n00);
+	float bottom = n01 + u * (n11 - n01);
+	return (top + v * (bottom - top)) * perlin_scale;
+}
+
+// Contribution of one simplex corner at the offset (x, y)
+inline float simplex_corner(uint32_t h, float x, float y)
+{
+	float t = std::max(0.5f - x * x - y * y, 0.0f);
+	t = t * t;
+	return t * t * gradient(h, x, y);
+}
+
+static float simplex(float x, float y, uint32_t seed)
+{
+	// Skew to find the cell, then unskew to get the offsets to its three corners
+	float s = (x + y) * simplex_f2;
+	float floor_i = std::floor(x + s);
+	float floor_j = std::floor(y + s);
+	float t = (floor_i + floor_j) * simplex_g2;
+	float x0 = x - (floor_i - t);
+	float y0 = y - (floor_j - t);
+
+	// Lower or upper triangle of the cell
+	int32_t i1 = x0 > y0 ? 1 : 0;
+	int32_t j1 = 1 - i1;
+	float x1 = x0 - static_cast<float>(i1) + simplex_g2;
+	float y1 = y0 - static_cast<float>(j1) + simplex_g2;
+	float x2 = x0 - 1.0f + 2.0f * simplex_g2;
+	float y2 = y0 - 1.0f + 2.0f * simplex_g2;
+
+	int32_t i = static_cast<int32_t>(floor_i);
+	int32_t j = static_cast<int32_t>(floor_j);
+	float n0 = simplex_corner(lattice_hash(i, j, seed), x0, y0);
+	float n1 = simplex_corner(lattice_hash(i + i1, j + j1, seed), x1, y1);
+	float n2 = simplex_corner(lattice_hash(i + 1, j + 1, seed), x2, y2);
+	return (n0 + n1 + n2) * simplex_scale;
+}
+
+// Every octave has its own seed and is shifted, so the lattices of the octaves do not line up at the origin
+inline uint32_t octave_seed(uint32_t seed, int64_t octave)
+{
+	return seed + static_cast<uint32_t>(octave) * 0x9E3779B9u;
+}
+
+inline float octave_shift(int64_t octave)
+{
+	return 0.37f + 1.618f * static_cast<float>(octave);
+}
+
+static float noise_pixel(const NoiseSettings& settings, int64_t x, int64_t y)
+{
+	float noise_x = static_cast<float>(x) * settings.scale;
+	float noise_y = static_cast<float>(y) * settings.scale;
+
+	float sum = 0.0f;
+	float amplitude = 1.0f;
+	float frequency = 1.0f;
+	float weight = 1.0f;
+	for (int64_t octave = 0; octave < settings.octaves; octave++)
+	{
+		float shift = octave_shift(octave);
+		float octave_x = noise_x * frequency + shift;
+		float octave_y = noise_y * frequency + shift;
+		float noise = settings.basis == NoiseBasis::Perlin
+			? perlin(octave_x, octave_y, octave_seed(settings.seed, octave))
+			: simplex(octave_x, octave_y, octave_seed(settings.seed, octave));
+
+		if (settings.fractal == NoiseFractal::Fbm)
+			sum += noise * amplitude;
+		else
+		{
+			// Sharp ridges where the noise crosses zero, the weight damps the detail in the valleys
+			float signal = ridged_offset - std::abs(noise);
+			signal = signal * signal * weight;
+			weight = clamp(signal * ridged_gain);
+			sum += signal * amplitude;
+		}
+
+		amplitude *= 0.5f;
+		frequency *= 2.0f;
+	}
+	return sum;
+}
+
+static void noise_pixels(const NoiseSettings& settings, int64_t y, int64_t begin, int64_t end, float* out)
+{
+	for (int64_t x = begin; x < end; x++)
+		out[x] = noise_pixel(settings, x, y);
+}
+
+void noise_row_scalar(const NoiseSettings& settings, int64_t y, int64_t resolution, float* out)
+{
+	noise_pixels(settings, y, 0, resolution, out);
+}
+
+// Vector operations for the noise template, one struct per instruction set
+struct Sse2Ops
+{
+	typedef __m128 Float;
+	typedef __m128i Int;
+	static const int width = 4;
+
+	static Float set(float x) { return _mm_set1_ps(x); }
+	static Int set_int(uint32_t x) { return _mm_set1_epi32(static_cast<int>(x)); }
+	static Float lanes(float x) { return _mm_setr_ps(x, x + 1.0f, x + 2.0f, x + 3.0f); }
+	static void store(float* out, Float x) { _mm_storeu_ps(out, x); }
+	static Float add(Float a, Float b) { return _mm_add_ps(a, b); }
+	static Float sub(Float a, Float b) { return _mm_sub_ps(a, b); }
+	static Float mul(Float a, Float b) { return _mm_mul_ps(a, b); }
+	static Float max(Float a, Float b) { return _mm_max_ps(a, b); }
+	static Float min(Float a, Float b) { return _mm_min_ps(a, b); }
+	static Float abs(Float a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+	static Float greater(Float a, Float b) { return _mm_cmpgt_ps(a, b); }
+	static Float select(Float mask, Float a, Float b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+	static Float and_float(Float a, Float b) { return _mm_and_ps(a, b); }
+	static Float xor_float(Float a, Int b) { return _mm_xor_ps(a, _mm_castsi128_ps(b)); }
+
+	// SSE2 has no floor, truncation is off by one for negative fractions
+	static Float floor(Float x)
+	{
+		Float truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+		return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+	}
+	static Int to_int(Float x) { return _mm_cvttps_epi32(x); }
+	static Float to_float(Int x) { return _mm_cvtepi32_ps(x); }
+	static Int mask_to_int(Float mask) { return _mm_castps_si128(mask); }
+
+	static Int add_int(Int a, Int b) { return _mm_add_epi32(a, b); }
+	static Int sub_int(Int a, Int b) { return _mm_sub_epi32(a, b); }
+	static Int xor_int(Int a, Int b) { return _mm_xor_si128(a, b); }
+	static Int and_int(Int a, Int b) { return _mm_and_si128(a, b); }
+	static Int shift_right(Int a, int bits) { return _mm_srli_epi32(a, bits); }
+	static Int shift_left(Int a, int bits) { return _mm_slli_epi32(a, bits); }
+	static Float equal_int(Int a, Int b) { return _mm_castsi128_ps(_mm_cmpeq_epi32(a, b)); }
+	// SSE2 has no 32 bit multiply, the even and odd lanes are multiplied to 64 bit separately
+	static Int mul_int(Int a, Int b)
+	{
+		__m128i even = _mm_mul_epu32(a, b);
+		__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+};
+
+struct Avx2Ops
+{
+	typedef __m256 Float;
+	typedef __m256i Int;
+	static const int width = 8;
+
+	static Float set(float x) { return _mm256_set1_ps(x); }
+	static Int set_int(uint32_t x) { return _mm256_set1_epi32(static_cast<int>(x)); }
+	static Float lanes(float x) { return _mm256_setr_ps(x, x + 1.0f, x + 2.0f, x + 3.0f, x + 4.0f, x + 5.0f, x + 6.0f, x + 7.0f); }
+	static void store(float* out, Float x) { _mm256_storeu_ps(out, x); }
+	static Float add(Float a, Float b) { return _mm256_add_ps(a, b); }
+	static Float sub(Float a, Float b) { return _mm256_sub_ps(a, b); }
+	static Float mul(Float a, Float b) { return _mm256_mul_ps(a, b); }
+	static Float max(Float a, Float b) { return _mm256_max_ps(a, b); }
+	static Float min(Float a, Float b) { return _mm256_min_ps(a, b); }
+	static Float abs(Float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+	static Float greater(Float a, Float b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	static Float select(Float mask, Float a, Float b) { return _mm256_blendv_ps(b, a, mask); }
+	static Float and_float(Float a, Float b) { return _mm256_and_ps(a, b); }
+	static Float xor_float(Float a, Int b) { return _mm256_xor_ps(a, _mm256_castsi256_ps(b)); }
+
+	static Float floor(Float x) { return _mm256_floor_ps(x); }
+	static Int to_int(Float x) { return _mm256_cvttps_epi32(x); }
+	static Float to_float(Int x) { return _mm256_cvtepi32_ps(x); }
+	static Int mask_to_int(Float mask) { return _mm256_castps_si256(mask); }
+
+	static Int add_int(Int a, Int b) { return _mm256_add_epi32(a, b); }
+	static Int sub_int(Int a, Int b) { return _mm256_sub_epi32(a, b); }
+	static Int xor_int(Int a, Int b) { return _mm256_xor_si256(a, b); }
+	static Int and_int(Int a, Int b) { return _mm256_and_si256(a, b); }
+	static Int shift_right(Int a, int bits) { return _mm256_srli_epi32(a, bits); }
+	static Int shift_left(Int a, int bits) { return _mm256_slli_epi32(a, bits); }
+	static Float equal_int(Int a, Int b) { return _mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b)); }
+	static Int mul_int(Int a, Int b) { return _mm256_mullo_epi32(a, b); }
+};
+
+template <typename V>
+struct NoiseVector
+{
+	typedef typename V::Float Float;
+	typedef typename V::Int Int;
+
+	static Int lattice_hash(Int x, Int y, Int seed)
+	{
+		Int h = V::xor_int(V::xor_int(seed, V::mul_int(x, V::set_int(0x27D4EB2Du))), V::mul_int(y, V::set_int(0x165667B1u)));
+		h = V::xor_int(h, V::shift_right(h, 15));
+		h = V::mul_int(h, V::set_int(0x2C1B3C6Du));
+		h = V::xor_int(h, V::shift_right(h, 12));
+		h = V::mul_int(h, V::set_int(0x297A2D39u));
+		h = V::xor_int(h, V::shift_right(h, 15));
+		return h;
+	}
+
+	// The bits of the hash become masks and sign bits instead of branches
+	static Float gradient(Int h, Float x, Float y)
+	{
+		Float swap = V::equal_int(V::and_int(h, V::set_int(4)), V::set_int(4));
+		Float u = V::select(swap, y, x);
+		Float v = V::select(swap, x, y);
+		Int sign_u = V::shift_left(V::and_int(h, V::set_int(1)), 31);
+		Int sign_v = V::shift_left(V::and_int(h, V::set_int(2)), 30);
+		return V::add(V::xor_float(u, sign_u), V::xor_float(V::add(v, v), sign_v));
+	}
+
+	static Float fade(Float t)
+	{
+		Float inner = V::add(V::mul(t, V::sub(V::mul(t, V::set(6.0f)), V::set(15.0f))), V::set(10.0f));
+		return V::mul(V::mul(V::mul(t, t), t), inner);
+	}
+
+	static Float perlin(Float x, Float y, Int seed)
+	{
+		Float floor_x = V::floor(x);
+		Float floor_y = V::floor(y);
+		Int i = V::to_int(floor_x);
+		Int j = V::to_int(floor_y);
+		Int one = V::set_int(1);
+		Float dx = V::sub(x, floor_x);
+		Float dy = V::sub(y, floor_y);
+		Float dx1 = V::sub(dx, V::set(1.0f));
+		Float dy1 = V::sub(dy, V::set(1.0f));
+
+		Float n00 = gradient(lattice_hash(i, j, seed), dx, dy);
+		Float n10 = gradient(lattice_hash(V::add_int(i, one), j, seed), dx1, dy);
+		Float n01 = gradient(lattice_hash(i, V::add_int(j, one), seed), dx, dy1);
+		Float n11 = gradient(lattice_hash(V::add_int(i, one), V::add_int(j, one), seed), dx1, dy1);
+
+		Float u = fade(dx);
+		Float v = fade(dy);
+		Float top = V::add(n00, V::mul(u, V::sub(n10, n00)));
+		Float bottom = V::add(n01, V::mul(u, V::sub(n11, n01)));
+		return V::mul(V::add(top, V::mul(v, V::sub(bottom, top))), V::set(perlin_scale));
+	}
+
+	static Float simplex_corner(Int h, Float x, Float y)
+	{
+		Float t = V::max(V::sub(V::sub(V::set(0.5f), V::mul(x, x)), V::mul(y, y)), V::set(0.0f));
+		t = V::mul(t, t);
+		return V::mul(V::mul(t, t), gradient(h, x, y));
+	}
+
+	static Float simplex(Float x, Float y, Int seed)
+	{
+		Float g2 = V::set(simplex_g2);
+		Float s = V::mul(V::add(x, y), V::set(simplex_f2));
+		Float floor_i = V::floor(V::add(x, s));
+		Float floor_j = V::floor(V::add(y, s));
+		Float t = V::mul(V::add(floor_i, floor_j), g2);
+		Float x0 = V::sub(x, V::sub(floor_i, t));
+		Float y0 = V::sub(y, V::sub(floor_j, t));
+
+		// The comparison mask is -1 for the lower triangle, which steps along x first
+		Float lower = V::greater(x0, y0);
+		Float i1 = V::and_float(lower, V::set(1.0f));
+		Float j1 = V::sub(V::set(1.0f), i1);
+		Float x1 = V::add(V::sub(x0, i1), g2);
+		Float y1 = V::add(V::sub(y0, j1), g2);
+		Float x2 = V::add(V::sub(x0, V::set(1.0f)), V::set(2.0f * simplex_g2));
+		Float y2 = V::add(V::sub(y0, V::set(1.0f)), V::set(2.0f * simplex_g2));
+
+		Int i = V::to_int(floor_i);
+		Int j = V::to_int(floor_j);
+		Int one = V::set_int(1);
+		Int i_step = V::sub_int(i, V::mask_to_int(lower));
+		Int j_step = V::add_int(j, V::add_int(one, V::mask_to_int(lower)));
+		Float n0 = simplex_corner(lattice_hash(i, j, seed), x0, y0);
+		Float n1 = simplex_corner(lattice_hash(i_step, j_step, seed), x1, y1);
+		Float n2 = simplex_corner(lattice_hash(V::add_int(i, one), V::add_int(j, one), seed), x2, y2);
+		return V::mul(V::add(V::add(n0, n1), n2), V::set(simplex_scale));
+	}
+
+	static void row(const NoiseSettings& settings, int64_t y, int64_t resolution, float* out)
+	{
+		Float noise_y = V::set(static_cast<float>(y) * settings.scale);
+
+		int64_t x = 0;
+		for (; x + V::width <= resolution; x += V::width)
+		{
+			Float noise_x = V::mul(V::lanes(static_cast<float>(x)), V::set(settings.scale));
+
+			Float sum = V::set(0.0f);
+			Float weight = V::set(1.0f);
+			float amplitude = 1.0f;
+			float frequency = 1.0f;
+			for (int64_t octave = 0; octave < settings.octaves; octave++)
+			{
+				Float shift = V::set(octave_shift(octave));
+				Float octave_x = V::add(V::mul(noise_x, V::set(frequency)), shift);
+				Float octave_y = V::add(V::mul(noise_y, V::set(frequency)), shift);
+				Int seed = V::set_int(octave_seed(settings.seed, octave));
+				Float noise = settings.basis == NoiseBasis::Perlin ? perlin(octave_x, octave_y, seed) : simplex(octave_x, octave_y, seed);
+
+				if (settings.fractal == NoiseFractal::Fbm)
+					sum = V::add(sum, V::mul(noise, V::set(amplitude)));
+				else
+				{
+					Float signal = V::sub(V::set(ridged_offset), V::abs(noise));
+					signal = V::mul(V::mul(signal, signal), weight);
+					weight = V::min(V::max(V::set(0.0f), V::mul(signal, V::set(ridged_gain))), V::set(1.0f));
+					sum = V::add(sum, V::mul(signal, V::set(amplitude)));
+				}
+
+				amplitude *= 0.5f;
+				frequency *= 2.0f;
+			}
+			V::store(out + x, sum);
+		}
+
+		noise_pixels(settings, y, x, resolution, out);
+	}
+};
+
+void noise_row_sse2(const NoiseSettings& settings, int64_t y, int64_t resolution, float* out)
+{
+	NoiseVector<Sse2Ops>::row(settings, y, resolution, out);
+}
+
+void noise_row_avx2(const NoiseSettings& settings, int64_t y, int64_t resolution, float* out)
+{
+	NoiseVector<Avx2Ops>::row(settings, y, resolution, out);
+}
+
+void noise_row(const NoiseSettings& settings, int64_t y, int64_t resolution, float* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		noise_row_avx2(settings, y, resolution, out);
+		break;
+	case SimdLevel::SSE2:
+		noise_row_sse2(settings, y, resolution, out);
+		break;
+	default:
+		noise_row_scalar(settings, y, resolution, out);
+		break;
+	}
+}
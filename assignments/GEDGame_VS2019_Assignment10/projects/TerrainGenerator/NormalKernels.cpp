@@ -0,0 +1,154 @@
+#include "TerrainGenerator.h"
+#include "Simd.h"
+
+#include <cmath>
+
+// Normal of one pixel from its slopes, mapped from [-1;1] to [0;1]
+inline void normal_pixel(float n_x, float n_y, float n_z, GEDUtils::Vec3f& out)
+{
+	float length = sqrt(n_x * n_x + n_y * n_y + n_z * n_z);
+	n_x /= -length;
+	n_y /= -length;
+	n_z /= length;
+
+	out = GEDUtils::Vec3f(n_x * 0.5f + 0.5f, n_y * 0.5f + 0.5f, n_z * 0.5f + 0.5f);
+}
+
+// The SIMD versions only vectorize the interior columns, the border columns use one-sided differences
+inline void normal_border_columns(const float* above, const float* below, float y_scale, const float* height, int64_t resolution, GEDUtils::Vec3f* out)
+{
+	float n_z = 1.0f / resolution;
+	normal_pixel(height[1] - height[0], (below[0] - above[0]) * y_scale, n_z, out[0]);
+	normal_pixel(height[resolution - 1] - height[resolution - 2],
+		(below[resolution - 1] - above[resolution - 1]) * y_scale, n_z, out[resolution - 1]);
+}
+
+void normal_row_scalar(const float* above, const float* below, float y_scale, const float* height, int64_t resolution, GEDUtils::Vec3f* out)
+{
+	for (int64_t x = 0; x < resolution; x++)
+	{
+		float n_x;
+
+		// Compute X
+		if (x == 0)
+			n_x = height[x + 1] - height[x];
+		else if (x == resolution - 1)
+			n_x = height[x] - height[x - 1];
+		else
+			n_x = (height[x + 1] - height[x - 1]) / 2;
+
+		// Compute Y
+		float n_y = (below[x] - above[x]) * y_scale;
+
+		// Set Z
+		float n_z = 1.0f / resolution;
+
+		normal_pixel(n_x, n_y, n_z, out[x]);
+	}
+}
+
+// 1 / sqrt(x) with one Newton-Raphson step, rsqrt alone is only accurate to 12 bits
+inline __m128 rsqrt_nr(__m128 x)
+{
+	__m128 r = _mm_rsqrt_ps(x);
+	__m128 rr_x = _mm_mul_ps(_mm_mul_ps(r, r), x);
+	return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), r), _mm_sub_ps(_mm_set1_ps(3.0f), rr_x));
+}
+
+inline __m256 rsqrt_nr(__m256 x)
+{
+	__m256 r = _mm256_rsqrt_ps(x);
+	__m256 rr_x = _mm256_mul_ps(_mm256_mul_ps(r, r), x);
+	return _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), r), _mm256_sub_ps(_mm256_set1_ps(3.0f), rr_x));
+}
+
+void normal_row_sse2(const float* above, const float* below, float y_scale, const float* height, int64_t resolution, GEDUtils::Vec3f* out)
+{
+	if (resolution < 3)
+	{
+		normal_row_scalar(above, below, y_scale, height, resolution, out);
+		return;
+	}
+
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 scale = _mm_set1_ps(y_scale);
+	const __m128 n_z = _mm_set1_ps(1.0f / resolution);
+	const __m128 n_z2 = _mm_mul_ps(n_z, n_z);
+
+	int64_t x = 1;
+	for (; x + 4 <= resolution - 1; x += 4)
+	{
+		__m128 n_x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(height + x + 1), _mm_loadu_ps(height + x - 1)), half);
+		__m128 n_y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(below + x), _mm_loadu_ps(above + x)), scale);
+
+		// Scaling by 0.5 / length folds the mapping to [0;1] into the normalization
+		__m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n_x, n_x), _mm_mul_ps(n_y, n_y)), n_z2);
+		__m128 inverse = _mm_mul_ps(rsqrt_nr(length2), half);
+
+		store_vec3(reinterpret_cast<float*>(out + x),
+			_mm_sub_ps(half, _mm_mul_ps(n_x, inverse)),
+			_mm_sub_ps(half, _mm_mul_ps(n_y, inverse)),
+			_mm_add_ps(half, _mm_mul_ps(n_z, inverse)));
+	}
+
+	// Remaining interior pixels
+	for (; x < resolution - 1; x++)
+		normal_pixel((height[x + 1] - height[x - 1]) / 2, (below[x] - above[x]) * y_scale, 1.0f / resolution, out[x]);
+
+	normal_border_columns(above, below, y_scale, height, resolution, out);
+}
+
+void normal_row_avx2(const float* above, const float* below, float y_scale, const float* height, int64_t resolution, GEDUtils::Vec3f* out)
+{
+	if (resolution < 3)
+	{
+		normal_row_scalar(above, below, y_scale, height, resolution, out);
+		return;
+	}
+
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 scale = _mm256_set1_ps(y_scale);
+	const __m256 n_z = _mm256_set1_ps(1.0f / resolution);
+	const __m256 n_z2 = _mm256_mul_ps(n_z, n_z);
+
+	int64_t x = 1;
+	for (; x + 8 <= resolution - 1; x += 8)
+	{
+		__m256 n_x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(height + x + 1), _mm256_loadu_ps(height + x - 1)), half);
+		__m256 n_y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(below + x), _mm256_loadu_ps(above + x)), scale);
+
+		__m256 length2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n_x, n_x), _mm256_mul_ps(n_y, n_y)), n_z2);
+		__m256 inverse = _mm256_mul_ps(rsqrt_nr(length2), half);
+
+		__m256 r = _mm256_sub_ps(half, _mm256_mul_ps(n_x, inverse));
+		__m256 g = _mm256_sub_ps(half, _mm256_mul_ps(n_y, inverse));
+		__m256 b = _mm256_add_ps(half, _mm256_mul_ps(n_z, inverse));
+
+		// The interleaving works on 128 bit lanes, so both halves are stored separately
+		float* target = reinterpret_cast<float*>(out + x);
+		store_vec3(target, _mm256_castps256_ps128(r), _mm256_castps256_ps128(g), _mm256_castps256_ps128(b));
+		store_vec3(target + 12, _mm256_extractf128_ps(r, 1), _mm256_extractf128_ps(g, 1), _mm256_extractf128_ps(b, 1));
+	}
+
+	// Remaining interior pixels
+	for (; x < resolution - 1; x++)
+		normal_pixel((height[x + 1] - height[x - 1]) / 2, (below[x] - above[x]) * y_scale, 1.0f / resolution, out[x]);
+
+	normal_border_columns(above, below, y_scale, height, resolution, out);
+}
+
+void normal_row(const float* above, const float* below, float y_scale, const float* height, int64_t resolution, GEDUtils::Vec3f* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		normal_row_avx2(above, below, y_scale, height, resolution, out);
+		break;
+	case SimdLevel::SSE2:
+		normal_row_sse2(above, below, y_scale, height, resolution, out);
+		break;
+	default:
+		normal_row_scalar(above, below, y_scale, height, resolution, out);
+		break;
+	}
+}
@@ -0,0 +1,148 @@
+#include "PackedField.h"
+
+#include <cwchar>
+
+bool parse_field_storage(const wchar_t* name, FieldStorage& storage)
+{
+	if (_wcsicmp(name, L"float") == 0)
+		storage = FieldStorage::Float;
+	else if (_wcsicmp(name, L"unorm16") == 0)
+		storage = FieldStorage::Unorm16;
+	else if (_wcsicmp(name, L"half") == 0)
+		storage = FieldStorage::Half;
+	else
+		return false;
+	return true;
+}
+
+const char* field_storage_name(FieldStorage storage)
+{
+	switch (storage)
+	{
+	case FieldStorage::Unorm16:
+		return "unorm16";
+	case FieldStorage::Half:
+		return "half";
+	default:
+		return "float";
+	}
+}
+
+HeightStore::HeightStore(FieldStorage storage, std::vector<float>&& heights, int64_t width)
+	: storage(storage), width(width), height(static_cast<int64_t>(heights.size()) / width)
+{
+	if (storage == FieldStorage::Float)
+	{
+		floats = std::move(heights);
+		return;
+	}
+
+	words.resize(heights.size());
+	parallel_for(0, height, [&](int64_t row_begin, int64_t row_end)
+	{
+		const float* in = &heights[idx(0, row_begin, width)];
+		uint16_t* out = &words[idx(0, row_begin, width)];
+		if (storage == FieldStorage::Unorm16)
+			pack_unorm16_row(in, (row_end - row_begin) * width, out);
+		else
+			pack_half_row(in, (row_end - row_begin) * width, out);
+	});
+
+	// Frees the memory, clear() would keep the capacity
+	std::vector<float>().swap(heights);
+}
+
+const float* HeightStore::load_rows(int64_t y, int64_t count, float* scratch) const
+{
+	switch (storage)
+	{
+	case FieldStorage::Unorm16:
+		unpack_unorm16_row(&words[idx(0, y, width)], count * width, scratch);
+		return scratch;
+	case FieldStorage::Half:
+		unpack_half_row(&words[idx(0, y, width)], count * width, scratch);
+		return scratch;
+	default:
+		return &floats[idx(0, y, width)];
+	}
+}
+
+NormalStore::NormalStore(FieldStorage storage, int64_t width, int64_t height)
+	: storage(storage), width(width), height(height)
+{
+	// Both 16 bit formats store the normals the same way
+	if (storage == FieldStorage::Float)
+		vectors.resize(width * height);
+	else
+		octahedral.resize(width * height);
+}
+
+GEDUtils::Vec3f* NormalStore::begin_row(int64_t y, GEDUtils::Vec3f* scratch)
+{
+	return storage == FieldStorage::Float ? &vectors[idx(0, y, width)] : scratch;
+}
+
+void NormalStore::store_row(int64_t y, const GEDUtils::Vec3f* row)
+{
+	if (storage != FieldStorage::Float)
+		pack_octahedral_row(row, width, &octahedral[idx(0, y, width)]);
+}
+
+const GEDUtils::Vec3f* NormalStore::load_rows(int64_t y, int64_t count, GEDUtils::Vec3f* scratch) const
+{
+	if (storage == FieldStorage::Float)
+		return &vectors[idx(0, y, width)];
+
+	unpack_octahedral_row(&octahedral[idx(0, y, width)], count * width, scratch);
+	return scratch;
+}
+
+// The channels of a Vec3f are packed like a row of three times as many heights
+static_assert(sizeof(GEDUtils::Vec3f) == 3 * sizeof(float), "Vec3f has to consist of its three floats");
+
+ColorStore::ColorStore(FieldStorage storage, int64_t width, int64_t height)
+	: storage(storage), width(width), height(height)
+{
+	if (storage == FieldStorage::Float)
+		vectors.resize(width * height);
+	else
+		words.resize(width * height * 3);
+}
+
+GEDUtils::Vec3f* ColorStore::begin_row(int64_t y, GEDUtils::Vec3f* scratch)
+{
+	return storage == FieldStorage::Float ? &vectors[idx(0, y, width)] : scratch;
+}
+
+void ColorStore::store_row(int64_t y, const GEDUtils::Vec3f* row)
+{
+	if (storage != FieldStorage::Float)
+		pack_unorm16_row(&row->x, width * 3, &words[idx(0, y, width) * 3]);
+}
+
+const GEDUtils::Vec3f* ColorStore::load_rows(int64_t y, int64_t count, GEDUtils::Vec3f* scratch) const
+{
+	if (storage == FieldStorage::Float)
+		return &vectors[idx(0, y, width)];
+
+	unpack_unorm16_row(&words[idx(0, y, width) * 3], count * width * 3, &scratch->x);
+	return scratch;
+}
+
+HeightRows::HeightRows(const HeightStore& store)
+	: store(store), scratch(store.get_storage() == FieldStorage::Float ? 0 : ring_size * store.get_width())
+{
+	std::fill(rows, rows + ring_size, -1ll);
+	std::fill(pointers, pointers + ring_size, nullptr);
+}
+
+const float* HeightRows::row(int64_t y)
+{
+	int64_t slot = y % ring_size;
+	if (rows[slot] != y)
+	{
+		pointers[slot] = store.load_row(y, scratch.empty() ? nullptr : &scratch[idx(0, slot, store.get_width())]);
+		rows[slot] = y;
+	}
+	return pointers[slot];
+}
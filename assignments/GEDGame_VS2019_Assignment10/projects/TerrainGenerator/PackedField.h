@@ -0,0 +1,147 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+
+// Formats of the full size heightfield, normal map and color map between the stages, selected with -storage
+// The 16 bit formats are lossy, but the outputs are quantized to 16 bits anyway
+enum class FieldStorage
+{
+	Float,   // 32 bit float heights and 3 x 32 bit float normals and colors
+	Unorm16, // 16 bit fixed point heights, octahedral 2 x 16 bit normals, 3 x 16 bit fixed point colors
+	Half     // Half float heights (finer than unorm16 below 1/16, coarser above 1/4), normals and colors like unorm16
+};
+
+// Parses "float", "unorm16" or "half", returns false for anything else
+bool parse_field_storage(const wchar_t* name, FieldStorage& storage);
+const char* field_storage_name(FieldStorage storage);
+
+// Heights in [0;1] of a width x height field
+class HeightStore
+{
+public:
+	// Takes over the heights, 16 bit storage packs them in parallel and releases the floats
+	HeightStore(FieldStorage storage, std::vector<float>&& heights, int64_t width);
+
+	FieldStorage get_storage() const { return storage; }
+	int64_t get_width() const { return width; }
+	int64_t get_height() const { return height; }
+	int64_t get_bytes() const { return static_cast<int64_t>(floats.size() * sizeof(float) + words.size() * sizeof(uint16_t)); }
+
+	// Returns count rows starting at row y, float storage returns them in place, otherwise they are unpacked into scratch
+	// scratch has to hold count * width floats, thread safe
+	const float* load_rows(int64_t y, int64_t count, float* scratch) const;
+	const float* load_row(int64_t y, float* scratch) const { return load_rows(y, 1, scratch); }
+
+private:
+	FieldStorage storage;
+	int64_t width = 0;
+	int64_t height = 0;
+	std::vector<float> floats;
+	std::vector<uint16_t> words;
+};
+
+// Normals mapped to [0;1] like the normal map, of a width x height field
+class NormalStore
+{
+public:
+	NormalStore(FieldStorage storage, int64_t width, int64_t height);
+
+	FieldStorage get_storage() const { return storage; }
+	int64_t get_width() const { return width; }
+	int64_t get_height() const { return height; }
+	int64_t get_bytes() const { return static_cast<int64_t>(vectors.size() * sizeof(GEDUtils::Vec3f) + octahedral.size() * sizeof(uint32_t)); }
+	// The normals as they are stored, float or packed, for the stage cache
+	void* get_data() { return vectors.empty() ? static_cast<void*>(octahedral.data()) : static_cast<void*>(vectors.data()); }
+
+	// Where the normals of row y are generated: float storage writes them in place, otherwise to scratch
+	// Call store_row() with the returned row afterwards, scratch has to hold width normals
+	GEDUtils::Vec3f* begin_row(int64_t y, GEDUtils::Vec3f* scratch);
+	// Packs row y unless it was written in place, rows may be stored from several threads at the same time
+	void store_row(int64_t y, const GEDUtils::Vec3f* row);
+
+	// Same as HeightStore::load_rows
+	const GEDUtils::Vec3f* load_rows(int64_t y, int64_t count, GEDUtils::Vec3f* scratch) const;
+	const GEDUtils::Vec3f* load_row(int64_t y, GEDUtils::Vec3f* scratch) const { return load_rows(y, 1, scratch); }
+
+private:
+	FieldStorage storage;
+	int64_t width = 0;
+	int64_t height = 0;
+	std::vector<GEDUtils::Vec3f> vectors;
+	std::vector<uint32_t> octahedral;
+};
+
+// Colors in [0;1] of a width x height map, both 16 bit formats store three unorm16 channels, as in the color map
+// The float colors are quantized just like to_word() does when they are saved, so only DDS outputs change
+class ColorStore
+{
+public:
+	ColorStore(FieldStorage storage, int64_t width, int64_t height);
+
+	FieldStorage get_storage() const { return storage; }
+	int64_t get_width() const { return width; }
+	int64_t get_height() const { return height; }
+	int64_t get_bytes() const { return static_cast<int64_t>(vectors.size() * sizeof(GEDUtils::Vec3f) + words.size() * sizeof(uint16_t)); }
+	// The colors as they are stored, for the stage cache
+	void* get_data() { return vectors.empty() ? static_cast<void*>(words.data()) : static_cast<void*>(vectors.data()); }
+
+	// Same as NormalStore::begin_row, store_row and load_rows
+	GEDUtils::Vec3f* begin_row(int64_t y, GEDUtils::Vec3f* scratch);
+	void store_row(int64_t y, const GEDUtils::Vec3f* row);
+	const GEDUtils::Vec3f* load_rows(int64_t y, int64_t count, GEDUtils::Vec3f* scratch) const;
+	const GEDUtils::Vec3f* load_row(int64_t y, GEDUtils::Vec3f* scratch) const { return load_rows(y, 1, scratch); }
+
+private:
+	FieldStorage storage;
+	int64_t width = 0;
+	int64_t height = 0;
+	std::vector<GEDUtils::Vec3f> vectors;
+	std::vector<uint16_t> words;
+};
+
+// Rows of a HeightStore for the kernels which read the rows around the current one
+// The last ring_size rows stay unpacked, so every row is only unpacked once while walking down
+class HeightRows
+{
+public:
+	static const int64_t ring_size = 8;
+
+	explicit HeightRows(const HeightStore& store);
+
+	const float* row(int64_t y);
+
+private:
+	const HeightStore& store;
+	std::vector<float> scratch;
+	int64_t rows[ring_size];
+	const float* pointers[ring_size];
+};
+
+// Kernels, all variants give the same bits (apart from the payload of NaNs, see pack_half_row_avx2)
+// Heights in [0;1] as 16 bit fixed point, rounded like to_word()
+void pack_unorm16_row(const float* in, int64_t count, uint16_t* out);
+void pack_unorm16_row_scalar(const float* in, int64_t count, uint16_t* out);
+void pack_unorm16_row_sse2(const float* in, int64_t count, uint16_t* out);
+void pack_unorm16_row_avx2(const float* in, int64_t count, uint16_t* out);
+void unpack_unorm16_row(const uint16_t* in, int64_t count, float* out);
+void unpack_unorm16_row_scalar(const uint16_t* in, int64_t count, float* out);
+void unpack_unorm16_row_sse2(const uint16_t* in, int64_t count, float* out);
+void unpack_unorm16_row_avx2(const uint16_t* in, int64_t count, float* out);
+// IEEE half floats, rounded to nearest even, the AVX2 variants use F16C
+void pack_half_row(const float* in, int64_t count, uint16_t* out);
+void pack_half_row_scalar(const float* in, int64_t count, uint16_t* out);
+void pack_half_row_sse2(const float* in, int64_t count, uint16_t* out);
+void pack_half_row_avx2(const float* in, int64_t count, uint16_t* out);
+void unpack_half_row(const uint16_t* in, int64_t count, float* out);
+void unpack_half_row_scalar(const uint16_t* in, int64_t count, float* out);
+void unpack_half_row_sse2(const uint16_t* in, int64_t count, float* out);
+void unpack_half_row_avx2(const uint16_t* in, int64_t count, float* out);
+// Normals mapped to [0;1] as octahedral coordinates, two 16 bit snorm values per normal (x in the low half)
+void pack_octahedral_row(const GEDUtils::Vec3f* in, int64_t count, uint32_t* out);
+void pack_octahedral_row_scalar(const GEDUtils::Vec3f* in, int64_t count, uint32_t* out);
+void pack_octahedral_row_sse2(const GEDUtils::Vec3f* in, int64_t count, uint32_t* out);
+void pack_octahedral_row_avx2(const GEDUtils::Vec3f* in, int64_t count, uint32_t* out);
+void unpack_octahedral_row(const uint32_t* in, int64_t count, GEDUtils::Vec3f* out);
+void unpack_octahedral_row_scalar(const uint32_t* in, int64_t count, GEDUtils::Vec3f* out);
+void unpack_octahedral_row_sse2(const uint32_t* in, int64_t count, GEDUtils::Vec3f* out);
+void unpack_octahedral_row_avx2(const uint32_t* in, int64_t count, GEDUtils::Vec3f* out);
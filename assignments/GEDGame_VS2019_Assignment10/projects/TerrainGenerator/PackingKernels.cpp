@@ -0,0 +1,589 @@
+#include "PackedField.h"
+#include "Simd.h"
+
+#include <cmath>
+#include <cstring>
+
+// 16 bit fixed point
+
+void pack_unorm16_row_scalar(const float* in, int64_t count, uint16_t* out)
+{
+	for (int64_t i = 0; i < count; i++)
+		out[i] = static_cast<uint16_t>(clamp(in[i]) * 65535.0f + 0.5f);
+}
+
+void unpack_unorm16_row_scalar(const uint16_t* in, int64_t count, float* out)
+{
+	for (int64_t i = 0; i < count; i++)
+		out[i] = in[i] * (1.0f / 65535.0f);
+}
+
+// Truncates 32 bit lanes in [0;65535] to 16 bits
+// SSE2 only packs with signed saturation, so the lanes are sign extended from 16 bits first
+inline __m128i pack_words(__m128i low, __m128i high)
+{
+	low = _mm_srai_epi32(_mm_slli_epi32(low, 16), 16);
+	high = _mm_srai_epi32(_mm_slli_epi32(high, 16), 16);
+	return _mm_packs_epi32(low, high);
+}
+
+inline __m128i to_unorm16(__m128 x)
+{
+	x = _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	return _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(65535.0f)), _mm_set1_ps(0.5f)));
+}
+
+void pack_unorm16_row_sse2(const float* in, int64_t count, uint16_t* out)
+{
+	int64_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i words = pack_words(to_unorm16(_mm_loadu_ps(in + i)), to_unorm16(_mm_loadu_ps(in + i + 4)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), words);
+	}
+	pack_unorm16_row_scalar(in + i, count - i, out + i);
+}
+
+void unpack_unorm16_row_sse2(const uint16_t* in, int64_t count, float* out)
+{
+	const __m128 scale = _mm_set1_ps(1.0f / 65535.0f);
+
+	int64_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		__m128i low = _mm_unpacklo_epi16(words, _mm_setzero_si128());
+		__m128i high = _mm_unpackhi_epi16(words, _mm_setzero_si128());
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(low), scale));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(high), scale));
+	}
+	unpack_unorm16_row_scalar(in + i, count - i, out + i);
+}
+
+inline __m256i to_unorm16(__m256 x)
+{
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+	return _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(65535.0f)), _mm256_set1_ps(0.5f)));
+}
+
+void pack_unorm16_row_avx2(const float* in, int64_t count, uint16_t* out)
+{
+	int64_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		// The pack works within the 128 bit lanes: a0-3 b0-3 | a4-7 b4-7
+		__m256i words = _mm256_packus_epi32(to_unorm16(_mm256_loadu_ps(in + i)), to_unorm16(_mm256_loadu_ps(in + i + 8)));
+		words = _mm256_permute4x64_epi64(words, _MM_SHUFFLE(3, 1, 2, 0));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), words);
+	}
+	pack_unorm16_row_sse2(in + i, count - i, out + i);
+}
+
+void unpack_unorm16_row_avx2(const uint16_t* in, int64_t count, float* out)
+{
+	const __m256 scale = _mm256_set1_ps(1.0f / 65535.0f);
+
+	int64_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i words = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(words), scale));
+	}
+	unpack_unorm16_row_scalar(in + i, count - i, out + i);
+}
+
+// Half floats
+// Branch-free conversions after https://gist.github.com/rygorous/2156668 (float_to_half_fast3_rtne and half_to_float)
+
+static const uint32_t f32_infinity = 255u << 23;
+static const uint32_t f16_overflow = (127u + 16u) << 23; // Smallest float which rounds to infinity as a half
+static const uint32_t f16_min_normal = 113u << 23; // Smallest float which is a normal half
+static const uint32_t denormal_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+static const uint32_t rebias = static_cast<uint32_t>(15 - 127) << 23;
+
+inline uint32_t float_bits(float x)
+{
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return bits;
+}
+
+inline float bits_float(uint32_t bits)
+{
+	float x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+inline uint16_t float_to_half(float x)
+{
+	uint32_t bits = float_bits(x);
+	uint32_t sign = bits & 0x80000000u;
+	bits ^= sign;
+
+	uint32_t half;
+	if (bits >= f16_overflow)
+		half = bits > f32_infinity ? 0x7e00 : 0x7c00;
+	else if (bits < f16_min_normal)
+		// Adding the magic number aligns the 10 mantissa bits at the bottom, the addition rounds to nearest even
+		half = float_bits(bits_float(bits) + bits_float(denormal_magic)) - denormal_magic;
+	else
+	{
+		// Rounds to nearest even by adding just below half a unit, plus one if the result is odd
+		uint32_t odd = (bits >> 13) & 1;
+		half = (bits + rebias + 0xfff + odd) >> 13;
+	}
+
+	return static_cast<uint16_t>(half | (sign >> 16));
+}
+
+inline float half_to_float(uint16_t half)
+{
+	const uint32_t shifted_exponent = 0x7c00u << 13;
+
+	uint32_t bits = (half & 0x7fffu) << 13;
+	uint32_t exponent = bits & shifted_exponent;
+	bits += (127u - 15u) << 23;
+
+	if (exponent == shifted_exponent)
+		bits += (128u - 16u) << 23; // Infinity or NaN
+	else if (exponent == 0)
+		bits = float_bits(bits_float(bits + (1u << 23)) - bits_float(f16_min_normal)); // Zero or denormal
+
+	return bits_float(bits | ((half & 0x8000u) << 16));
+}
+
+void pack_half_row_scalar(const float* in, int64_t count, uint16_t* out)
+{
+	for (int64_t i = 0; i < count; i++)
+		out[i] = float_to_half(in[i]);
+}
+
+void unpack_half_row_scalar(const uint16_t* in, int64_t count, float* out)
+{
+	for (int64_t i = 0; i < count; i++)
+		out[i] = half_to_float(in[i]);
+}
+
+inline __m128i select_int(__m128i mask, __m128i a, __m128i b)
+{
+	return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+inline __m128i set_uint(uint32_t x)
+{
+	return _mm_set1_epi32(static_cast<int>(x));
+}
+
+// float_to_half for four lanes, the halves are in the low 16 bits
+inline __m128i float_to_half(__m128 x)
+{
+	__m128i bits = _mm_castps_si128(x);
+	__m128i sign = _mm_and_si128(bits, set_uint(0x80000000u));
+	bits = _mm_xor_si128(bits, sign);
+
+	// The sign bit is cleared, so the signed compares work
+	__m128i nan = _mm_and_si128(_mm_cmpgt_epi32(bits, set_uint(f32_infinity)), set_uint(0x0200));
+	__m128i overflow = _mm_cmpgt_epi32(bits, set_uint(f16_overflow - 1));
+	__m128i denormal = _mm_cmplt_epi32(bits, set_uint(f16_min_normal));
+
+	__m128 magic = _mm_castsi128_ps(set_uint(denormal_magic));
+	__m128i denormal_half = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(bits), magic)), set_uint(denormal_magic));
+	__m128i odd = _mm_and_si128(_mm_srli_epi32(bits, 13), set_uint(1));
+	__m128i normal_half = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(bits, set_uint(rebias + 0xfff)), odd), 13);
+
+	__m128i half = select_int(denormal, denormal_half, normal_half);
+	half = select_int(overflow, _mm_or_si128(set_uint(0x7c00), nan), half);
+	return _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+}
+
+// half_to_float for four lanes, the halves are in the low 16 bits
+inline __m128 half_to_float(__m128i half)
+{
+	const __m128i shifted_exponent = set_uint(0x7c00u << 13);
+
+	__m128i bits = _mm_slli_epi32(_mm_and_si128(half, set_uint(0x7fff)), 13);
+	__m128i exponent = _mm_and_si128(bits, shifted_exponent);
+	bits = _mm_add_epi32(bits, set_uint((127u - 15u) << 23));
+
+	__m128i special = _mm_cmpeq_epi32(exponent, shifted_exponent);
+	bits = _mm_add_epi32(bits, _mm_and_si128(special, set_uint((128u - 16u) << 23)));
+	__m128i denormal = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+	__m128 renormalized = _mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(bits, set_uint(1u << 23))), _mm_castsi128_ps(set_uint(f16_min_normal)));
+	bits = select_int(denormal, _mm_castps_si128(renormalized), bits);
+
+	return _mm_castsi128_ps(_mm_or_si128(bits, _mm_slli_epi32(_mm_and_si128(half, set_uint(0x8000)), 16)));
+}
+
+void pack_half_row_sse2(const float* in, int64_t count, uint16_t* out)
+{
+	int64_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i halves = pack_words(float_to_half(_mm_loadu_ps(in + i)), float_to_half(_mm_loadu_ps(in + i + 4)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), halves);
+	}
+	pack_half_row_scalar(in + i, count - i, out + i);
+}
+
+void unpack_half_row_sse2(const uint16_t* in, int64_t count, float* out)
+{
+	int64_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128i halves = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		_mm_storeu_ps(out + i, half_to_float(_mm_unpacklo_epi16(halves, _mm_setzero_si128())));
+		_mm_storeu_ps(out + i + 4, half_to_float(_mm_unpackhi_epi16(halves, _mm_setzero_si128())));
+	}
+	unpack_half_row_scalar(in + i, count - i, out + i);
+}
+
+// F16C rounds to nearest even as well, only the payload of NaNs can differ
+void pack_half_row_avx2(const float* in, int64_t count, uint16_t* out)
+{
+	int64_t i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+	pack_half_row_scalar(in + i, count - i, out + i);
+}
+
+void unpack_half_row_avx2(const uint16_t* in, int64_t count, float* out)
+{
+	int64_t i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i))));
+	unpack_half_row_scalar(in + i, count - i, out + i);
+}
+
+// Octahedral normals, see "A Survey of Efficient Representations for Independent Unit Vectors" (Cigolle et al. 2014)
+// The unit sphere is projected onto the octahedron |x| + |y| + |z| = 1, whose lower half is folded over the
+// diagonals into the corners of the square [-1;1]². The two coordinates are stored as 16 bit snorm values.
+
+// Keeps the projection of a degenerate normal finite
+static const float min_length = 1e-30f;
+
+inline uint32_t pack_octahedral(const GEDUtils::Vec3f& normal)
+{
+	// Back from [0;1] to [-1;1]
+	float x = normal.x * 2.0f - 1.0f;
+	float y = normal.y * 2.0f - 1.0f;
+	float z = normal.z * 2.0f - 1.0f;
+
+	float inverse = 1.0f / std::max(std::abs(x) + std::abs(y) + std::abs(z), min_length);
+	float u = x * inverse;
+	float v = y * inverse;
+	if (z < 0.0f)
+	{
+		float folded_u = (1.0f - std::abs(v)) * std::copysign(1.0f, u);
+		v = (1.0f - std::abs(u)) * std::copysign(1.0f, v);
+		u = folded_u;
+	}
+
+	// lrint rounds to nearest even like the SIMD conversions
+	uint32_t u_snorm = static_cast<uint32_t>(std::lrint(clamp(u, -1.0f, 1.0f) * 32767.0f));
+	uint32_t v_snorm = static_cast<uint32_t>(std::lrint(clamp(v, -1.0f, 1.0f) * 32767.0f));
+	return (u_snorm & 0xffffu) | (v_snorm << 16);
+}
+
+inline GEDUtils::Vec3f unpack_octahedral(uint32_t packed)
+{
+	float u = std::max(static_cast<int16_t>(packed & 0xffffu) * (1.0f / 32767.0f), -1.0f);
+	float v = std::max(static_cast<int16_t>(packed >> 16) * (1.0f / 32767.0f), -1.0f);
+	float z = 1.0f - std::abs(u) - std::abs(v);
+	if (z < 0.0f)
+	{
+		float unfolded_u = (1.0f - std::abs(v)) * std::copysign(1.0f, u);
+		v = (1.0f - std::abs(u)) * std::copysign(1.0f, v);
+		u = unfolded_u;
+	}
+
+	float inverse = 1.0f / std::sqrt(u * u + v * v + z * z);
+	return GEDUtils::Vec3f(u * inverse * 0.5f + 0.5f, v * inverse * 0.5f + 0.5f, z * inverse * 0.5f + 0.5f);
+}
+
+void pack_octahedral_row_scalar(const GEDUtils::Vec3f* in, int64_t count, uint32_t* out)
+{
+	for (int64_t i = 0; i < count; i++)
+		out[i] = pack_octahedral(in[i]);
+}
+
+void unpack_octahedral_row_scalar(const uint32_t* in, int64_t count, GEDUtils::Vec3f* out)
+{
+	for (int64_t i = 0; i < count; i++)
+		out[i] = unpack_octahedral(in[i]);
+}
+
+// The SIMD versions repeat the scalar operations in the same order and select instead of branching
+
+inline __m128 select(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128 magnitude(__m128 x)
+{
+	return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+}
+
+// copysign(1, x)
+inline __m128 sign(__m128 x)
+{
+	return _mm_or_ps(_mm_set1_ps(1.0f), _mm_and_ps(_mm_set1_ps(-0.0f), x));
+}
+
+inline __m128i to_snorm16(__m128 x)
+{
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+	return _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(32767.0f)));
+}
+
+inline __m128 from_snorm16(__m128i x)
+{
+	return _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(x), _mm_set1_ps(1.0f / 32767.0f)), _mm_set1_ps(-1.0f));
+}
+
+void pack_octahedral_row_sse2(const GEDUtils::Vec3f* in, int64_t count, uint32_t* out)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+
+	int64_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128 x, y, z;
+		load_vec3(reinterpret_cast<const float*>(in + i), x, y, z);
+		x = _mm_sub_ps(_mm_mul_ps(x, two), one);
+		y = _mm_sub_ps(_mm_mul_ps(y, two), one);
+		z = _mm_sub_ps(_mm_mul_ps(z, two), one);
+
+		__m128 inverse = _mm_div_ps(one, _mm_max_ps(_mm_add_ps(_mm_add_ps(magnitude(x), magnitude(y)), magnitude(z)), _mm_set1_ps(min_length)));
+		__m128 u = _mm_mul_ps(x, inverse);
+		__m128 v = _mm_mul_ps(y, inverse);
+		__m128 lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+		__m128 folded_u = _mm_mul_ps(_mm_sub_ps(one, magnitude(v)), sign(u));
+		__m128 folded_v = _mm_mul_ps(_mm_sub_ps(one, magnitude(u)), sign(v));
+		u = select(lower, folded_u, u);
+		v = select(lower, folded_v, v);
+
+		__m128i packed = _mm_or_si128(_mm_and_si128(to_snorm16(u), _mm_set1_epi32(0xffff)), _mm_slli_epi32(to_snorm16(v), 16));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+	}
+	pack_octahedral_row_scalar(in + i, count - i, out + i);
+}
+
+void unpack_octahedral_row_sse2(const uint32_t* in, int64_t count, GEDUtils::Vec3f* out)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 half = _mm_set1_ps(0.5f);
+
+	int64_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+		__m128 u = from_snorm16(_mm_srai_epi32(_mm_slli_epi32(packed, 16), 16));
+		__m128 v = from_snorm16(_mm_srai_epi32(packed, 16));
+		__m128 z = _mm_sub_ps(_mm_sub_ps(one, magnitude(u)), magnitude(v));
+		__m128 lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+		__m128 unfolded_u = _mm_mul_ps(_mm_sub_ps(one, magnitude(v)), sign(u));
+		__m128 unfolded_v = _mm_mul_ps(_mm_sub_ps(one, magnitude(u)), sign(v));
+		u = select(lower, unfolded_u, u);
+		v = select(lower, unfolded_v, v);
+
+		__m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v)), _mm_mul_ps(z, z));
+		__m128 inverse = _mm_div_ps(one, _mm_sqrt_ps(length2));
+		store_vec3(reinterpret_cast<float*>(out + i),
+			_mm_add_ps(_mm_mul_ps(_mm_mul_ps(u, inverse), half), half),
+			_mm_add_ps(_mm_mul_ps(_mm_mul_ps(v, inverse), half), half),
+			_mm_add_ps(_mm_mul_ps(_mm_mul_ps(z, inverse), half), half));
+	}
+	unpack_octahedral_row_scalar(in + i, count - i, out + i);
+}
+
+inline __m256 select(__m256 mask, __m256 a, __m256 b)
+{
+	return _mm256_blendv_ps(b, a, mask);
+}
+
+inline __m256 magnitude(__m256 x)
+{
+	return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+}
+
+inline __m256 sign(__m256 x)
+{
+	return _mm256_or_ps(_mm256_set1_ps(1.0f), _mm256_and_ps(_mm256_set1_ps(-0.0f), x));
+}
+
+inline __m256i to_snorm16(__m256 x)
+{
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+	return _mm256_cvtps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(32767.0f)));
+}
+
+inline __m256 from_snorm16(__m256i x)
+{
+	return _mm256_max_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(x), _mm256_set1_ps(1.0f / 32767.0f)), _mm256_set1_ps(-1.0f));
+}
+
+void pack_octahedral_row_avx2(const GEDUtils::Vec3f* in, int64_t count, uint32_t* out)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+
+	int64_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		// The interleaving works on 128 bit lanes, so both halves are loaded separately
+		__m128 x_low, y_low, z_low, x_high, y_high, z_high;
+		load_vec3(reinterpret_cast<const float*>(in + i), x_low, y_low, z_low);
+		load_vec3(reinterpret_cast<const float*>(in + i + 4), x_high, y_high, z_high);
+		__m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(x_low), x_high, 1);
+		__m256 y = _mm256_insertf128_ps(_mm256_castps128_ps256(y_low), y_high, 1);
+		__m256 z = _mm256_insertf128_ps(_mm256_castps128_ps256(z_low), z_high, 1);
+		x = _mm256_sub_ps(_mm256_mul_ps(x, two), one);
+		y = _mm256_sub_ps(_mm256_mul_ps(y, two), one);
+		z = _mm256_sub_ps(_mm256_mul_ps(z, two), one);
+
+		__m256 inverse = _mm256_div_ps(one, _mm256_max_ps(_mm256_add_ps(_mm256_add_ps(magnitude(x), magnitude(y)), magnitude(z)), _mm256_set1_ps(min_length)));
+		__m256 u = _mm256_mul_ps(x, inverse);
+		__m256 v = _mm256_mul_ps(y, inverse);
+		__m256 lower = _mm256_cmp_ps(z, _mm256_setzero_ps(), _CMP_LT_OQ);
+		__m256 folded_u = _mm256_mul_ps(_mm256_sub_ps(one, magnitude(v)), sign(u));
+		__m256 folded_v = _mm256_mul_ps(_mm256_sub_ps(one, magnitude(u)), sign(v));
+		u = select(lower, folded_u, u);
+		v = select(lower, folded_v, v);
+
+		__m256i packed = _mm256_or_si256(_mm256_and_si256(to_snorm16(u), _mm256_set1_epi32(0xffff)), _mm256_slli_epi32(to_snorm16(v), 16));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), packed);
+	}
+	pack_octahedral_row_sse2(in + i, count - i, out + i);
+}
+
+void unpack_octahedral_row_avx2(const uint32_t* in, int64_t count, GEDUtils::Vec3f* out)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 half = _mm256_set1_ps(0.5f);
+
+	int64_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m256i packed = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+		__m256 u = from_snorm16(_mm256_srai_epi32(_mm256_slli_epi32(packed, 16), 16));
+		__m256 v = from_snorm16(_mm256_srai_epi32(packed, 16));
+		__m256 z = _mm256_sub_ps(_mm256_sub_ps(one, magnitude(u)), magnitude(v));
+		__m256 lower = _mm256_cmp_ps(z, _mm256_setzero_ps(), _CMP_LT_OQ);
+		__m256 unfolded_u = _mm256_mul_ps(_mm256_sub_ps(one, magnitude(v)), sign(u));
+		__m256 unfolded_v = _mm256_mul_ps(_mm256_sub_ps(one, magnitude(u)), sign(v));
+		u = select(lower, unfolded_u, u);
+		v = select(lower, unfolded_v, v);
+
+		__m256 length2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(u, u), _mm256_mul_ps(v, v)), _mm256_mul_ps(z, z));
+		__m256 inverse = _mm256_div_ps(one, _mm256_sqrt_ps(length2));
+		__m256 r = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(u, inverse), half), half);
+		__m256 g = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(v, inverse), half), half);
+		__m256 b = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(z, inverse), half), half);
+
+		float* target = reinterpret_cast<float*>(out + i);
+		store_vec3(target, _mm256_castps256_ps128(r), _mm256_castps256_ps128(g), _mm256_castps256_ps128(b));
+		store_vec3(target + 12, _mm256_extractf128_ps(r, 1), _mm256_extractf128_ps(g, 1), _mm256_extractf128_ps(b, 1));
+	}
+	unpack_octahedral_row_sse2(in + i, count - i, out + i);
+}
+
+// Dispatchers
+
+void pack_unorm16_row(const float* in, int64_t count, uint16_t* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		pack_unorm16_row_avx2(in, count, out);
+		break;
+	case SimdLevel::SSE2:
+		pack_unorm16_row_sse2(in, count, out);
+		break;
+	default:
+		pack_unorm16_row_scalar(in, count, out);
+		break;
+	}
+}
+
+void unpack_unorm16_row(const uint16_t* in, int64_t count, float* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		unpack_unorm16_row_avx2(in, count, out);
+		break;
+	case SimdLevel::SSE2:
+		unpack_unorm16_row_sse2(in, count, out);
+		break;
+	default:
+		unpack_unorm16_row_scalar(in, count, out);
+		break;
+	}
+}
+
+void pack_half_row(const float* in, int64_t count, uint16_t* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		pack_half_row_avx2(in, count, out);
+		break;
+	case SimdLevel::SSE2:
+		pack_half_row_sse2(in, count, out);
+		break;
+	default:
+		pack_half_row_scalar(in, count, out);
+		break;
+	}
+}
+
+void unpack_half_row(const uint16_t* in, int64_t count, float* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		unpack_half_row_avx2(in, count, out);
+		break;
+	case SimdLevel::SSE2:
+		unpack_half_row_sse2(in, count, out);
+		break;
+	default:
+		unpack_half_row_scalar(in, count, out);
+		break;
+	}
+}
+
+void pack_octahedral_row(const GEDUtils::Vec3f* in, int64_t count, uint32_t* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		pack_octahedral_row_avx2(in, count, out);
+		break;
+	case SimdLevel::SSE2:
+		pack_octahedral_row_sse2(in, count, out);
+		break;
+	default:
+		pack_octahedral_row_scalar(in, count, out);
+		break;
+	}
+}
+
+void unpack_octahedral_row(const uint32_t* in, int64_t count, GEDUtils::Vec3f* out)
+{
+	switch (g_simd_level)
+	{
+	case SimdLevel::AVX2:
+		unpack_octahedral_row_avx2(in, count, out);
+		break;
+	case SimdLevel::SSE2:
+		unpack_octahedral_row_sse2(in, count, out);
+		break;
+	default:
+		unpack_octahedral_row_scalar(in, count, out);
+		break;
+	}
+}
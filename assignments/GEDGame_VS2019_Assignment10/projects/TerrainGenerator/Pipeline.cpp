@@ -0,0 +1,596 @@
+#include "TerrainGenerator.h"
+#include "HeightfieldSource.h"
+#include "Erosion.h"
+#include "PackedField.h"
+#include "ImageWriter.h"
+#include "MipPyramid.h"
+#include "DdsWriter.h"
+#include "StageCache.h"
+#include "TaskScheduler.h"
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <mutex>
+#include <memory>
+
+// Fused in-memory generator
+// After the heightfield source is normalized into the height storage, every thread walks down its own band of
+// rows and pushes each row through blur -> mix -> normals -> colors -> downsample right away. The intermediate
+// rows live in small ring buffers which stay in the cache, only the heights and the outputs are full size.
+// Erosion needs the whole mixed heightfield, so with erosion the bands stop after the mix and the
+// outputs are derived from the eroded field in a second pass.
+// With a stage cache the normalized source, the mixed (and eroded) heights and the final maps are cached,
+// a run starts after the last stage whose inputs did not change. The mixed heights are kept like with erosion,
+// except for packed storage without erosion, whose fused pass reads them at full precision.
+
+typedef std::chrono::high_resolution_clock Clock;
+
+enum PipelineStage
+{
+	StageSource,
+	StageMinMax,
+	StageNormalize,
+	StageBlurRows,
+	StageBlurColumns,
+	StageMix,
+	StageErosion,
+	StageNormals,
+	StageColors,
+	StageDownsample,
+	StageSave,
+	StageMips,
+	StageCacheFiles,
+	StageCount
+};
+
+static const char* const stage_names[StageCount] = {
+	"Heightfield source", "Min/max", "Normalize + pack", "Blur rows", "Blur columns", "Mix", "Erosion", "Normals", "Colors", "Downsample", "Save", "Mip pyramid", "Stage cache" };
+
+// Time and memory traffic of the stages
+// Only accesses of full size arrays are counted, the ring buffers are assumed to stay in the cache
+struct PipelineStats
+{
+	double ms[StageCount] = {};
+	int64_t bytes[StageCount] = {};
+
+	void add(PipelineStage stage, Clock::time_point start, int64_t stage_bytes)
+	{
+		ms[stage] += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+		bytes[stage] += stage_bytes;
+	}
+
+	void add(const PipelineStats& other)
+	{
+		for (int stage = 0; stage < StageCount; stage++)
+		{
+			ms[stage] += other.ms[stage];
+			bytes[stage] += other.bytes[stage];
+		}
+	}
+};
+
+// Rows of an intermediate map, row y is kept until row y + ring_size is written
+class RowRing
+{
+public:
+	static const int64_t ring_size = 8;
+
+	explicit RowRing(int64_t resolution) : resolution(resolution), data(ring_size * resolution) {}
+
+	float* row(int64_t y) { return &data[idx(0, y % ring_size, resolution)]; }
+
+private:
+	int64_t resolution;
+	std::vector<float> data;
+};
+
+// TIFF and DDS outputs which are written while the maps are generated, nullptr for the outputs which are saved afterwards
+// The color and normal map have strips of 4 rows, the heightmap strips of 1 row
+// The DDS maps are block compressed in the same strips, so their encoding overlaps with the other bands
+struct StripOutputs
+{
+	TiffWriter* height = nullptr;
+	TiffWriter* color = nullptr;
+	TiffWriter* normal = nullptr;
+	DdsStripWriter* color_dds = nullptr;
+	DdsStripWriter* normal_dds = nullptr;
+};
+
+// Normals, colors and the downsampled heightmap of row o, mixed has to hold the rows around it
+// normal_rows and color_rows have room for 4 rows, the normals and colors are generated there unless their stores hold floats
+// Every fourth row completes a block of the heightmap and the strips of the block are written
+template <typename Rows>
+static void output_row(Rows& mixed, int64_t o, int64_t resolution, const TerrainTextures& textures, const StripOutputs& outputs,
+	NormalStore& normal, std::vector<GEDUtils::Vec3f>& normal_rows, ColorStore& color, std::vector<GEDUtils::Vec3f>& color_rows,
+	std::vector<float>& height_small, PipelineStats& stats)
+{
+	int64_t row_bytes = resolution * sizeof(float);
+	GEDUtils::Vec3f* normal_out = normal.begin_row(o, &normal_rows[idx(0, o % 4, resolution)]);
+
+	auto start = Clock::now();
+	if (o == 0)
+		normal_row(mixed.row(o), mixed.row(o + 1), 1.0f, mixed.row(o), resolution, normal_out);
+	else if (o == resolution - 1)
+		normal_row(mixed.row(o - 1), mixed.row(o), 1.0f, mixed.row(o), resolution, normal_out);
+	else
+		normal_row(mixed.row(o - 1), mixed.row(o + 1), 0.5f, mixed.row(o), resolution, normal_out);
+	stats.add(StageNormals, start, 0);
+
+	start = Clock::now();
+	normal.store_row(o, normal_out);
+	// The colors use the normals as they are stored, like generate_colors and the cached normal map
+	// Packed normals are unpacked over the ones just stored, float normals are read in place
+	const GEDUtils::Vec3f* stored_normal = normal.load_row(o, &normal_rows[idx(0, o % 4, resolution)]);
+	stats.add(StageNormals, start, normal.get_bytes() / resolution);
+
+	start = Clock::now();
+	// The normal row was just written and is read back from the cache
+	GEDUtils::Vec3f* color_out = color.begin_row(o, &color_rows[idx(0, o % 4, resolution)]);
+	color_row(mixed.row(o), stored_normal, o, resolution, textures, color_out);
+	color.store_row(o, color_out);
+	stats.add(StageColors, start, color.get_bytes() / resolution);
+
+	if (o % 4 == 3)
+	{
+		start = Clock::now();
+		const float* rows[4] = { mixed.row(o - 3), mixed.row(o - 2), mixed.row(o - 1), mixed.row(o) };
+		downsample_row(rows, resolution, &height_small[idx(0, o / 4, resolution / 4)]);
+		stats.add(StageDownsample, start, row_bytes / 4);
+
+		// The last 4 rows are complete, so their strips can be written right away
+		start = Clock::now();
+		if (outputs.height)
+			outputs.height->write_strip(o / 4, &height_small[idx(0, o / 4, resolution / 4)]);
+		// The colors and normals are read back from their stores, so packed ones are saved like from the cache or unfused maps
+		// Packed rows are unpacked over the ones in color_rows and normal_rows, which are already stored
+		if (outputs.color || outputs.color_dds)
+		{
+			const GEDUtils::Vec3f* stored = color.load_rows(o - 3, 4, color_rows.data());
+			if (outputs.color)
+				outputs.color->write_strip(o / 4, stored);
+			if (outputs.color_dds)
+				outputs.color_dds->write_block_row(o / 4, stored);
+		}
+		if (outputs.normal || outputs.normal_dds)
+		{
+			const GEDUtils::Vec3f* stored = normal.load_rows(o - 3, 4, normal_rows.data());
+			if (outputs.normal)
+				outputs.normal->write_strip(o / 4, stored);
+			if (outputs.normal_dds)
+				outputs.normal_dds->write_block_row(o / 4, stored);
+		}
+		stats.add(StageSave, start, 0);
+	}
+}
+
+// Generates the rows [band_begin; band_end) of all three maps, band_begin has to be a multiple of 4
+// With a mixed_field, the band only stores its mixed rows there and the outputs are left to the caller
+static void fused_band(const HeightStore& heights, int64_t resolution, int64_t kernel_size,
+	int64_t band_begin, int64_t band_end, const TerrainTextures& textures, const StripOutputs& outputs,
+	NormalStore& normal, ColorStore& color, std::vector<float>& height_small,
+	std::vector<float>* mixed_field, PipelineStats& stats)
+{
+	int64_t row_bytes = resolution * sizeof(float);
+	int64_t height_row_bytes = heights.get_bytes() / resolution;
+
+	// Normals need the mixed rows next to the band, the mix needs two smoothed rows on each side at the border
+	int64_t mixed_begin = mixed_field ? band_begin : std::max(band_begin - 1, 0ll);
+	int64_t mixed_end = mixed_field ? band_end : std::min(band_end + 1, resolution);
+	int64_t smoothed_begin = std::max(mixed_begin - 2, 0ll);
+	int64_t smoothed_end = std::min(mixed_end + 2, resolution);
+
+	// The column sums are kept in 32.32 fixed point. Integer sums are exact, so every band arrives at the same
+	// sums for a row no matter where it started, and the heights do not depend on the bands and thus on -threads
+	const double fixed_point = 4294967296.0;
+
+	std::vector<float> unpacked(resolution); // Height row unpacked from 16 bit storage
+	std::vector<float> blurred(resolution);
+	std::vector<int64_t> sums(resolution, 0);
+	std::vector<GEDUtils::Vec3f> normal_rows(4 * resolution);
+	std::vector<GEDUtils::Vec3f> color_rows(4 * resolution);
+	RowRing smoothed(resolution);
+	RowRing mixed(resolution);
+	double normalize = 1.0 / ((kernel_size * 2 + 1) * fixed_point);
+
+	// Blurs row y of the heights horizontally into blurred
+	auto blur_source_row = [&](int64_t y)
+	{
+		auto start = Clock::now();
+		const float* source = heights.load_row(std::min(std::max(y, 0ll), resolution - 1), unpacked.data());
+		blur_row(source, blurred.data(), resolution, kernel_size);
+		stats.add(StageBlurRows, start, height_row_bytes);
+	};
+
+	// Adds (sign = 1) or removes (sign = -1) a blurred row from the running column sums
+	// The blurred heights are not negative, so adding 0.5 before the truncation rounds to nearest
+	auto accumulate = [&](int64_t sign)
+	{
+		auto start = Clock::now();
+		for (int64_t x = 0; x < resolution; x++)
+			sums[x] += sign * static_cast<int64_t>(blurred[x] * fixed_point + 0.5);
+		stats.add(StageBlurColumns, start, 0);
+	};
+
+	// Sums of the taps around the first smoothed row
+	for (int64_t k = -kernel_size; k <= kernel_size; k++)
+	{
+		blur_source_row(smoothed_begin + k);
+		accumulate(1);
+	}
+
+	int64_t next_mixed = mixed_begin;
+	int64_t next_output = band_begin;
+	for (int64_t y = smoothed_begin; y < smoothed_end; y++)
+	{
+		// Smoothed row y, then slide the column windows down by one row
+		auto start = Clock::now();
+		float* smoothed_row = smoothed.row(y);
+		for (int64_t x = 0; x < resolution; x++)
+			smoothed_row[x] = static_cast<float>(sums[x] * normalize);
+		stats.add(StageBlurColumns, start, 0);
+
+		if (y + 1 < smoothed_end)
+		{
+			blur_source_row(y + kernel_size + 1);
+			accumulate(1);
+			blur_source_row(y - kernel_size);
+			accumulate(-1);
+		}
+
+		// Mix every row whose smoothed neighbours are complete
+		for (; next_mixed < mixed_end && std::min(next_mixed + 2, resolution - 1) <= y; next_mixed++)
+		{
+			int64_t m = next_mixed;
+			start = Clock::now();
+			const float* source = heights.load_row(m, unpacked.data());
+
+			if (m == 0)
+				mix_row(source, smoothed.row(m), smoothed.row(m), smoothed.row(m + 2), resolution, mixed.row(m));
+			else if (m == resolution - 1)
+				mix_row(source, smoothed.row(m), smoothed.row(m - 2), smoothed.row(m), resolution, mixed.row(m));
+			else
+				mix_row(source, smoothed.row(m), smoothed.row(m - 1), smoothed.row(m + 1), resolution, mixed.row(m));
+			if (mixed_field)
+			{
+				std::copy(mixed.row(m), mixed.row(m) + resolution, &(*mixed_field)[idx(0, m, resolution)]);
+				stats.add(StageMix, start, height_row_bytes + row_bytes);
+				continue;
+			}
+			stats.add(StageMix, start, height_row_bytes);
+
+			// Normals, colors and the downsampled heightmap of every row whose mixed neighbours are complete
+			for (; next_output < band_end && std::min(next_output + 1, resolution - 1) <= m; next_output++)
+				output_row(mixed, next_output, resolution, textures, outputs, normal, normal_rows, color, color_rows, height_small, stats);
+		}
+	}
+}
+
+// Normalized heights of the source, from the cache if possible
+static std::vector<float> normalized_source(const HeightfieldSource& source, int64_t resolution, const StageCache* cache, const StageKey& key,
+	PipelineStats& stats)
+{
+	std::vector<float> field(resolution * resolution);
+	auto start = Clock::now();
+	if (cache && cache->load(key, { cache_span(field) }))
+	{
+		stats.add(StageCacheFiles, start, field.size() * sizeof(float));
+		std::cout << "Loaded the heightfield from the stage cache" << std::endl;
+		return field;
+	}
+
+	std::cout << "Generating heightfield (" << source.get_name() << ")" << std::endl;
+	start = Clock::now();
+	field = generate_source_field(source, resolution);
+	stats.add(StageSource, start, resolution * resolution * sizeof(float));
+
+	// Extremes of the heightfield
+	start = Clock::now();
+	float min = field[0];
+	float max = field[0];
+	std::mutex min_max_mutex;
+	parallel_for(0, resolution, [&](int64_t row_begin, int64_t row_end)
+	{
+		float local_min = field[idx(0, row_begin, resolution)];
+		float local_max = local_min;
+		for (int64_t y = row_begin; y < row_end; y++)
+		{
+			const float* row = &field[idx(0, y, resolution)];
+			local_min = std::min(local_min, *std::min_element(row, row + resolution));
+			local_max = std::max(local_max, *std::max_element(row, row + resolution));
+		}
+
+		std::lock_guard<std::mutex> lock(min_max_mutex);
+		min = std::min(min, local_min);
+		max = std::max(max, local_max);
+	});
+	stats.add(StageMinMax, start, resolution * resolution * sizeof(float));
+
+	// Compress heights to [0;1]
+	start = Clock::now();
+	parallel_for(0, resolution * resolution, [&](int64_t begin, int64_t end)
+	{
+		for (int64_t i = begin; i < end; i++)
+			field[i] = clamp(map_range(field[i], min, max));
+	});
+	stats.add(StageNormalize, start, resolution * resolution * sizeof(float) * 2);
+
+	if (cache)
+	{
+		start = Clock::now();
+		cache->store(key, { cache_span(field) });
+		stats.add(StageCacheFiles, start, field.size() * sizeof(float));
+	}
+	return field;
+}
+
+bool generate_fused(const HeightfieldSource& source, int64_t resolution, _TCHAR* heightmap_path, _TCHAR* color_path, _TCHAR* normalmap_path,
+	bool save_mips, MipFilter mip_filter, const ErosionSettings& erosion, FieldStorage storage, const StageCache* cache)
+{
+	int64_t kernel_size = std::max(resolution / 40ll, 1ll);
+	PipelineStats stats;
+
+	// Every key starts with the key of the stage before it
+	StageKey source_key("source");
+	source_key.add(std::string(source.get_name())).add(source.get_parameters()).add(resolution);
+	StageKey pretty_key("pretty");
+	pretty_key.add(source_key).add(static_cast<int64_t>(storage)).add(kernel_size).add(erosion.iterations).add(static_cast<double>(erosion.rain))
+		.add(static_cast<double>(erosion.evaporation)).add(static_cast<double>(erosion.capacity)).add(static_cast<double>(erosion.dissolve_rate))
+		.add(static_cast<double>(erosion.deposit_rate)).add(static_cast<double>(erosion.talus)).add(static_cast<double>(erosion.thermal_rate));
+	StageKey maps_key("maps");
+	maps_key.add(pretty_key);
+	for (const wchar_t* path : TerrainTextures::paths)
+		maps_key.add_file(path);
+	// With a time budget the number of erosion iterations depends on the machine, so only the source is cached
+	const StageCache* maps_cache = erosion.time_budget_ms > 0.0 ? nullptr : cache;
+	// Keeping the mixed heights would quantize them once more, the cache must not change the output
+	const StageCache* pretty_cache = erosion.enabled() || storage == FieldStorage::Float ? maps_cache : nullptr;
+
+	// The maps are allocated once the source is packed, so they do not add to the float source while it is generated
+	NormalStore normal(storage, 0, 0);
+	ColorStore color(storage, 0, 0);
+	std::vector<float> height_small;
+	int64_t maps_bytes = 0;
+	auto allocate_maps = [&]()
+	{
+		normal = NormalStore(storage, resolution, resolution);
+		color = ColorStore(storage, resolution, resolution);
+		height_small.resize(resolution * resolution / 16);
+		maps_bytes = normal.get_bytes() + color.get_bytes() + height_small.size() * sizeof(float);
+	};
+
+	auto start = Clock::now();
+	bool maps_cached = false;
+	if (maps_cache)
+	{
+		allocate_maps();
+		maps_cached = maps_cache->load(maps_key, { CacheSpan{ color.get_data(), color.get_bytes() }, CacheSpan{ normal.get_data(), normal.get_bytes() },
+			cache_span(height_small) });
+		if (!maps_cached)
+		{
+			normal = NormalStore(storage, 0, 0);
+			color = ColorStore(storage, 0, 0);
+			std::vector<float>().swap(height_small);
+		}
+	}
+	if (maps_cached)
+	{
+		stats.add(StageCacheFiles, start, maps_bytes);
+		std::cout << "Loaded the normalmap, colormap and heightmap from the stage cache" << std::endl;
+	}
+
+	// TIFF and DDS files are written strip by strip from the bands, the other formats are saved at the end
+	std::unique_ptr<TiffWriter> height_writer;
+	std::unique_ptr<TiffWriter> color_writer;
+	std::unique_ptr<TiffWriter> normal_writer;
+	std::unique_ptr<DdsStripWriter> color_dds_writer;
+	std::unique_ptr<DdsStripWriter> normal_dds_writer;
+	StripOutputs outputs;
+	if (resolution % 4 == 0 && !maps_cached)
+	{
+		if (is_tiff_path(heightmap_path))
+		{
+			height_writer.reset(new TiffWriter(heightmap_path, resolution / 4, resolution / 4, 1, 1));
+			outputs.height = height_writer.get();
+		}
+		if (is_tiff_path(color_path))
+		{
+			color_writer.reset(new TiffWriter(color_path, resolution, resolution, 3, 4));
+			outputs.color = color_writer.get();
+		}
+		if (is_tiff_path(normalmap_path))
+		{
+			normal_writer.reset(new TiffWriter(normalmap_path, resolution, resolution, 3, 4));
+			outputs.normal = normal_writer.get();
+		}
+		if (is_dds_path(color_path))
+		{
+			color_dds_writer.reset(new DdsStripWriter(color_path, resolution, resolution, g_dds_color_format));
+			outputs.color_dds = color_dds_writer.get();
+		}
+		if (is_dds_path(normalmap_path))
+		{
+			normal_dds_writer.reset(new DdsStripWriter(normalmap_path, resolution, resolution, BlockFormat::BC5));
+			outputs.normal_dds = normal_dds_writer.get();
+		}
+	}
+
+	// A file which can not be created would otherwise only be noticed once the whole terrain is generated
+	bool height_valid = !height_writer || height_writer->is_valid();
+	bool color_valid = (!color_writer || color_writer->is_valid()) && (!color_dds_writer || color_dds_writer->is_valid());
+	bool normal_valid = (!normal_writer || normal_writer->is_valid()) && (!normal_dds_writer || normal_dds_writer->is_valid());
+	if (!height_valid)
+		std::wcout << "ERROR: Heightmap could not be created: " << heightmap_path << std::endl;
+	if (!color_valid)
+		std::wcout << "ERROR: Colormap could not be created: " << color_path << std::endl;
+	if (!normal_valid)
+		std::wcout << "ERROR: Normalmap could not be created: " << normalmap_path << std::endl;
+	if (!height_valid || !color_valid || !normal_valid)
+		return false;
+
+	if (!maps_cached)
+	{
+		TerrainTextures textures;
+		std::mutex stats_mutex;
+
+		// The mixed heights are kept for the erosion and the cache, the outputs follow in a second pass
+		bool split = erosion.enabled() || pretty_cache;
+		std::vector<float> pretty(split ? resolution * resolution : 0);
+		start = Clock::now();
+		bool pretty_cached = pretty_cache && pretty_cache->load(pretty_key, { cache_span(pretty) });
+		if (pretty_cached)
+		{
+			allocate_maps();
+			stats.add(StageCacheFiles, start, pretty.size() * sizeof(float));
+			std::cout << "Loaded the smoothed heightfield from the stage cache" << std::endl;
+			std::cout << "Generating normalmap, colormap and heightmap" << std::endl;
+		}
+		else
+		{
+			// The source field is released after packing
+			std::vector<float> field = normalized_source(source, resolution, cache, source_key, stats);
+			start = Clock::now();
+			HeightStore heights(storage, std::move(field), resolution);
+			stats.add(StageNormalize, start, heights.get_bytes());
+			allocate_maps();
+
+			std::cout << "Generating normalmap, colormap and heightmap" << std::endl;
+			std::cout << "Storing heights, normals and colors as " << field_storage_name(storage) << " ("
+				<< (heights.get_bytes() + normal.get_bytes() + color.get_bytes()) / (1024 * 1024) << " MB)" << std::endl;
+
+			// The bands consist of whole blocks of 4 rows for the downsampling, the last block may be shorter
+			parallel_for(0, (resolution + 3) / 4, [&](int64_t block_begin, int64_t block_end)
+			{
+				PipelineStats band_stats;
+				fused_band(heights, resolution, kernel_size, block_begin * 4, std::min(block_end * 4, resolution),
+					textures, outputs, normal, color, height_small, split ? &pretty : nullptr, band_stats);
+
+				std::lock_guard<std::mutex> lock(stats_mutex);
+				stats.add(band_stats);
+			});
+
+			if (erosion.enabled())
+			{
+				start = Clock::now();
+				int64_t iterations = erode_heightfield(pretty, resolution, erosion);
+				// Every iteration reads and writes height, water and sediment
+				stats.add(StageErosion, start, iterations * resolution * resolution * sizeof(float) * 6);
+				std::cout << "Eroded the heightfield in " << iterations << " iterations" << std::endl;
+			}
+
+			if (pretty_cache)
+			{
+				start = Clock::now();
+				pretty_cache->store(pretty_key, { cache_span(pretty) });
+				stats.add(StageCacheFiles, start, pretty.size() * sizeof(float));
+			}
+		}
+
+		if (split)
+		{
+			// Second pass over the mixed or eroded field
+			start = Clock::now();
+			HeightStore eroded(storage, std::move(pretty), resolution);
+			stats.add(erosion.enabled() ? StageErosion : StageNormalize, start, resolution * resolution * sizeof(float) + eroded.get_bytes());
+			parallel_for(0, (resolution + 3) / 4, [&](int64_t block_begin, int64_t block_end)
+			{
+				PipelineStats band_stats;
+				HeightRows rows(eroded);
+				std::vector<GEDUtils::Vec3f> normal_rows(4 * resolution);
+				std::vector<GEDUtils::Vec3f> color_rows(4 * resolution);
+				for (int64_t o = block_begin * 4; o < std::min(block_end * 4, resolution); o++)
+					output_row(rows, o, resolution, textures, outputs, normal, normal_rows, color, color_rows, height_small, band_stats);
+
+				std::lock_guard<std::mutex> lock(stats_mutex);
+				stats.add(band_stats);
+			});
+		}
+
+		if (maps_cache)
+		{
+			start = Clock::now();
+			maps_cache->store(maps_key, { CacheSpan{ color.get_data(), color.get_bytes() }, CacheSpan{ normal.get_data(), normal.get_bytes() },
+				cache_span(height_small) });
+			stats.add(StageCacheFiles, start, maps_bytes);
+		}
+	}
+
+	std::cout << "Saving Images" << std::endl;
+	if (save_mips)
+		std::cout << "Saving " << mip_filter_name(mip_filter) << " filtered mip levels" << std::endl;
+	start = Clock::now();
+
+	// Finishes the streamed TIFF files and saves the other maps, all three at the same time
+	// The mip pyramid is built meanwhile and saved once it is complete
+	bool height_saved = false;
+	bool color_saved = false;
+	bool normal_saved = false;
+	bool mips_saved = true;
+	std::vector<MipLevel> levels;
+	PipelineStats mip_stats;
+	TaskGroup save;
+	save.add([&]()
+	{
+		height_saved = height_writer ? height_writer->finish() : save_image(height_small, resolution / 4, heightmap_path);
+	});
+	save.add([&]()
+	{
+		if (color_writer)
+			color_saved = color_writer->finish();
+		else
+			color_saved = color_dds_writer ? color_dds_writer->finish() : save_image(color, color_path);
+	});
+	save.add([&]()
+	{
+		if (normal_writer)
+			normal_saved = normal_writer->finish();
+		else
+			normal_saved = normal_dds_writer ? normal_dds_writer->finish() : save_image(normal, normalmap_path);
+	});
+	if (save_mips)
+	{
+		Task* build = save.add([&]()
+		{
+			auto mip_start = Clock::now();
+			levels = build_mip_pyramid(height_small, resolution / 4, mip_filter);
+			// Every level is read once to build the next one, about a third of the heightmap
+			mip_stats.add(StageMips, mip_start, height_small.size() * sizeof(float) * 4 / 3);
+		});
+		save.add([&]()
+		{
+			auto mip_start = Clock::now();
+			mips_saved = save_mip_pyramid(levels, heightmap_path);
+			mip_stats.add(StageMips, mip_start, 0);
+		}, { build });
+	}
+	save.wait();
+
+	if (!height_saved)
+		std::wcout << "ERROR: Heightmap could not be saved to: " << heightmap_path << std::endl;
+	if (!color_saved)
+		std::wcout << "ERROR: Colormap could not be saved to: " << color_path << std::endl;
+	if (!normal_saved)
+		std::wcout << "ERROR: Normalmap could not be saved to: " << normalmap_path << std::endl;
+	bool saved = height_saved && color_saved && normal_saved && mips_saved;
+	// The save time includes the overlapping mip pyramid, which is also listed on its own
+	stats.add(StageSave, start, maps_bytes);
+	stats.add(mip_stats);
+
+	// The stages after min/max run interleaved on all threads, their times are summed over the threads
+	double total_ms = 0.0;
+	int64_t total_bytes = 0;
+	std::cout << std::left << std::setw(24) << "Stage" << std::right << std::setw(12) << "Time (ms)" << std::setw(15) << "Traffic (MB)" << std::endl;
+	std::cout << std::fixed << std::setprecision(1);
+	for (int stage = 0; stage < StageCount; stage++)
+	{
+		std::cout << std::left << std::setw(24) << stage_names[stage] << std::right
+			<< std::setw(12) << stats.ms[stage] << std::setw(15) << stats.bytes[stage] / (1024.0 * 1024.0) << std::endl;
+		total_ms += stats.ms[stage];
+		total_bytes += stats.bytes[stage];
+	}
+	std::cout << std::left << std::setw(24) << "Total" << std::right
+		<< std::setw(12) << total_ms << std::setw(15) << total_bytes / (1024.0 * 1024.0) << std::endl;
+	std::cout.unsetf(std::ios::floatfield);
+
+	return saved;
+}
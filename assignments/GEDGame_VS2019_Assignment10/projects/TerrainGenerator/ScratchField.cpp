@@ -0,0 +1,82 @@
+#include "ScratchField.h"
+
+#include <stdexcept>
+#include <algorithm>
+
+// Blocks are at least this large, so that a band of small rows does not need one view per row
+const int64_t min_block_bytes = 256 * 1024;
+
+ScratchField::ScratchField(const std::wstring& directory, int64_t width, int64_t height)
+	: width(width), height(height), row_bytes(width * sizeof(float))
+{
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	granularity = info.dwAllocationGranularity;
+
+	rows_per_block = std::max(min_block_bytes / row_bytes, 1ll);
+	block_bytes = rows_per_block * row_bytes;
+	blocks.resize((height + rows_per_block - 1) / rows_per_block);
+
+	WCHAR path[MAX_PATH];
+	if (GetTempFileNameW(directory.c_str(), L"ter", 0, path) == 0)
+		throw std::runtime_error("Could not create a scratch file name");
+
+	// The file only lives as long as the field
+	file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		throw std::runtime_error("Could not create the scratch file");
+
+	// Creating the mapping also grows the file to its full size
+	LARGE_INTEGER size;
+	size.QuadPart = row_bytes * height;
+	mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, size.HighPart, size.LowPart, nullptr);
+	if (mapping == nullptr)
+	{
+		CloseHandle(file);
+		throw std::runtime_error("Could not map the scratch file, is there enough disk space?");
+	}
+}
+
+ScratchField::~ScratchField()
+{
+	unmap_all();
+	CloseHandle(mapping);
+	CloseHandle(file);
+}
+
+float* ScratchField::row(int64_t y)
+{
+	Block& block = blocks[y / rows_per_block];
+
+	if (block.view == nullptr)
+	{
+		// Views have to start at a multiple of the allocation granularity
+		int64_t first_row = (y / rows_per_block) * rows_per_block;
+		int64_t last_row = std::min(first_row + rows_per_block, height);
+		block.offset = first_row * row_bytes - (first_row * row_bytes) % granularity;
+		int64_t size = last_row * row_bytes - block.offset;
+
+		LARGE_INTEGER offset;
+		offset.QuadPart = block.offset;
+		block.view = static_cast<BYTE*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, offset.HighPart, offset.LowPart, static_cast<SIZE_T>(size)));
+		if (block.view == nullptr)
+			throw std::runtime_error("Could not map a view of the scratch file");
+
+		mapped_bytes += size;
+		mapped_blocks.push_back(y / rows_per_block);
+	}
+
+	return reinterpret_cast<float*>(block.view + (y * row_bytes - block.offset));
+}
+
+void ScratchField::unmap_all()
+{
+	for (int64_t b : mapped_blocks)
+	{
+		UnmapViewOfFile(blocks[b].view);
+		blocks[b].view = nullptr;
+	}
+	mapped_blocks.clear();
+	mapped_bytes = 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#define NOMINMAX // prevents overlap of Windows.h with the std
+
+#include <Windows.h>
+#include <string>
+#include <vector>
+
+// A float field of width * height values which lives in a temporary, memory mapped file
+// instead of RAM. Rows are mapped in blocks on demand, so only the rows which were touched
+// since the last unmap_all() occupy memory. The file is deleted when the field is destroyed.
+class ScratchField
+{
+public:
+	// Creates the scratch file in the given directory
+	// Throws std::runtime_error if the file cannot be created
+	ScratchField(const std::wstring& directory, int64_t width, int64_t height);
+	~ScratchField();
+
+	int64_t get_width() const { return width; }
+	int64_t get_height() const { return height; }
+
+	// Returns a pointer to row y, mapping its block if necessary
+	// The pointer stays valid until the next call of unmap_all()
+	// Not thread safe, map all rows of a band before handing them to the workers
+	float* row(int64_t y);
+
+	// Unmaps all blocks, modified rows are written back to the file by the OS
+	void unmap_all();
+
+	// Upper bound of mapped bytes per touched row (one block each), used to size the bands
+	int64_t get_bytes_per_row() const { return block_bytes + granularity; }
+	// Bytes which are mapped at the moment
+	int64_t get_mapped_bytes() const { return mapped_bytes; }
+
+private:
+	ScratchField(const ScratchField&);
+	void operator=(const ScratchField&);
+
+	struct Block
+	{
+		BYTE* view = nullptr; // Start of the mapped view
+		int64_t offset = 0; // File offset of the view, aligned to the allocation granularity
+	};
+
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+	int64_t width = 0;
+	int64_t height = 0;
+	int64_t row_bytes = 0;
+	int64_t rows_per_block = 1;
+	int64_t block_bytes = 0;
+	int64_t granularity = 0;
+	int64_t mapped_bytes = 0;
+	std::vector<Block> blocks;
+	std::vector<int64_t> mapped_blocks; // Indices of the blocks which are mapped at the moment
+};
@@ -0,0 +1,57 @@
+#include "Simd.h"
+
+#include <intrin.h>
+#include <immintrin.h>
+#include <cwchar>
+
+SimdLevel g_simd_level = detect_simd_level();
+
+SimdLevel detect_simd_level()
+{
+	// See the Intel Software Developer's Manual, CPUID leaves 1 and 7
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	bool f16c = (info[2] & (1 << 29)) != 0;
+
+	// AVX also needs the OS to save the upper halves of the ymm registers on a context switch
+	if (max_leaf >= 7 && osxsave && avx && f16c && (_xgetbv(0) & 6) == 6)
+	{
+		__cpuidex(info, 7, 0);
+		if ((info[1] & (1 << 5)) != 0)
+			return SimdLevel::AVX2;
+	}
+
+	return sse2 ? SimdLevel::SSE2 : SimdLevel::Scalar;
+}
+
+bool parse_simd_level(const wchar_t* name, SimdLevel& level)
+{
+	if (_wcsicmp(name, L"scalar") == 0)
+		level = SimdLevel::Scalar;
+	else if (_wcsicmp(name, L"sse2") == 0)
+		level = SimdLevel::SSE2;
+	else if (_wcsicmp(name, L"avx2") == 0)
+		level = SimdLevel::AVX2;
+	else
+		return false;
+	return true;
+}
+
+const char* simd_level_name(SimdLevel level)
+{
+	switch (level)
+	{
+	case SimdLevel::AVX2:
+		return "AVX2";
+	case SimdLevel::SSE2:
+		return "SSE2";
+	default:
+		return "scalar";
+	}
+}
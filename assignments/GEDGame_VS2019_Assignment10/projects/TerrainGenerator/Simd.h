@@ -0,0 +1,53 @@
+#pragma once
+
+#include <immintrin.h>
+
+// Instruction sets the kernels can use, ordered from the oldest to the newest
+enum class SimdLevel
+{
+	Scalar,
+	SSE2,
+	AVX2 // Together with F16C, which every CPU with AVX2 has
+};
+
+// Best instruction set supported by the CPU and the operating system
+SimdLevel detect_simd_level();
+
+// Parses "scalar", "sse2" or "avx2", returns false for anything else
+bool parse_simd_level(const wchar_t* name, SimdLevel& level);
+const char* simd_level_name(SimdLevel level);
+
+// Instruction set used by the kernels, detected at startup and can be lowered with -simd
+extern SimdLevel g_simd_level;
+
+// Writes four pixels given as x, y and z registers to an array of Vec3f
+//   x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+inline void store_vec3(float* out, __m128 x, __m128 y, __m128 z)
+{
+	__m128 xy_low = _mm_unpacklo_ps(x, y); // x0 y0 x1 y1
+	__m128 xy_high = _mm_unpackhi_ps(x, y); // x2 y2 x3 y3
+	__m128 z0_x1 = _mm_shuffle_ps(z, xy_low, _MM_SHUFFLE(2, 2, 0, 0)); // z0 z0 x1 x1
+	__m128 y1_z1 = _mm_shuffle_ps(xy_low, z, _MM_SHUFFLE(1, 1, 3, 3)); // y1 y1 z1 z1
+	__m128 z2_x3 = _mm_shuffle_ps(z, xy_high, _MM_SHUFFLE(3, 2, 3, 2)); // z2 z3 x3 y3
+
+	_mm_storeu_ps(out + 0, _mm_shuffle_ps(xy_low, z0_x1, _MM_SHUFFLE(2, 0, 1, 0)));
+	_mm_storeu_ps(out + 4, _mm_shuffle_ps(y1_z1, xy_high, _MM_SHUFFLE(1, 0, 2, 0)));
+	_mm_storeu_ps(out + 8, _mm_shuffle_ps(z2_x3, z2_x3, _MM_SHUFFLE(1, 3, 2, 0)));
+}
+
+// Reads four pixels of an array of Vec3f into x, y and z registers, the reverse of store_vec3
+inline void load_vec3(const float* in, __m128& x, __m128& y, __m128& z)
+{
+	__m128 a = _mm_loadu_ps(in + 0); // x0 y0 z0 x1
+	__m128 b = _mm_loadu_ps(in + 4); // y1 z1 x2 y2
+	__m128 c = _mm_loadu_ps(in + 8); // z2 x3 y3 z3
+	__m128 x2_x3 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)); // x2 x2 x3 x3
+	__m128 y0_y1 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)); // y0 y0 y1 y1
+	__m128 y2_y3 = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)); // y2 y2 y3 y3
+	__m128 z0_z1 = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)); // z0 z0 z1 z1
+	__m128 z2_z3 = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)); // z2 z2 z3 z3
+
+	x = _mm_shuffle_ps(a, x2_x3, _MM_SHUFFLE(2, 0, 3, 0));
+	y = _mm_shuffle_ps(y0_y1, y2_y3, _MM_SHUFFLE(2, 0, 2, 0));
+	z = _mm_shuffle_ps(z0_z1, z2_z3, _MM_SHUFFLE(2, 0, 2, 0));
+}
@@ -0,0 +1,179 @@
+#include "StageCache.h"
+
+#include <cstring>
+#include <cstdio>
+
+// Changes whenever a stage computes different results for the same parameters, which invalidates all entries
+const uint32_t cache_version = 1;
+
+StageKey::StageKey(const char* stage)
+	: stage(stage), value(0xCBF29CE484222325ull)
+{
+	add(this->stage);
+	add(static_cast<int64_t>(cache_version));
+}
+
+StageKey& StageKey::add(const void* data, size_t bytes)
+{
+	const BYTE* input = static_cast<const BYTE*>(data);
+	for (size_t i = 0; i < bytes; i++)
+	{
+		value ^= input[i];
+		value *= 0x100000001B3ull;
+	}
+	return *this;
+}
+
+StageKey& StageKey::add_file(const wchar_t* path)
+{
+	add(path, wcslen(path) * sizeof(wchar_t));
+
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExW(path, GetFileExInfoStandard, &attributes))
+		return add(static_cast<int64_t>(-1));
+
+	add(static_cast<int64_t>((static_cast<uint64_t>(attributes.nFileSizeHigh) << 32) | attributes.nFileSizeLow));
+	return add(static_cast<int64_t>((static_cast<uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime));
+}
+
+// Start of every entry, the arrays follow at a cache line aligned offset
+struct CacheHeader
+{
+	static const int max_spans = 5;
+
+	char magic[4]; // "TGSC"
+	uint32_t version;
+	uint64_t key;
+	uint64_t span_count;
+	uint64_t span_bytes[max_spans];
+};
+
+static_assert(sizeof(CacheHeader) == 64, "The arrays should start at a cache line");
+
+// Copies the spans from or to the mapped file on all threads, which also reads or writes its pages in parallel
+static void copy_spans(BYTE* file_data, std::initializer_list<CacheSpan> spans, bool to_file)
+{
+	const int64_t chunk_bytes = 1024 * 1024;
+	int64_t offset = 0;
+	for (const CacheSpan& span : spans)
+	{
+		BYTE* memory = static_cast<BYTE*>(span.data);
+		BYTE* file = file_data + offset;
+		parallel_for(0, (span.bytes + chunk_bytes - 1) / chunk_bytes, [&](int64_t chunk_begin, int64_t chunk_end)
+		{
+			int64_t begin = chunk_begin * chunk_bytes;
+			int64_t bytes = std::min(chunk_end * chunk_bytes, span.bytes) - begin;
+			if (to_file)
+				memcpy(file + begin, memory + begin, bytes);
+			else
+				memcpy(memory + begin, file + begin, bytes);
+		});
+		offset += span.bytes;
+	}
+}
+
+StageCache::StageCache(const std::wstring& directory)
+	: directory(directory)
+{
+	if (!this->directory.empty() && this->directory.back() != L'\\' && this->directory.back() != L'/')
+		this->directory += L'\\';
+	// Fails if it already exists, a missing directory shows up when the first entry is stored
+	CreateDirectoryW(this->directory.c_str(), nullptr);
+}
+
+std::wstring StageCache::get_path(const StageKey& key) const
+{
+	wchar_t name[64];
+	swprintf(name, 64, L"%hs_%016llx.cache", key.get_stage().c_str(), static_cast<unsigned long long>(key.get_value()));
+	return directory + name;
+}
+
+bool StageCache::load(const StageKey& key, std::initializer_list<CacheSpan> spans) const
+{
+	if (spans.size() > CacheHeader::max_spans)
+		return false;
+
+	HANDLE file = CreateFileW(get_path(key).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	int64_t expected_bytes = sizeof(CacheHeader);
+	for (const CacheSpan& span : spans)
+		expected_bytes += span.bytes;
+
+	// A truncated or foreign file is treated as a miss
+	LARGE_INTEGER size;
+	HANDLE mapping = nullptr;
+	if (GetFileSizeEx(file, &size) && size.QuadPart == expected_bytes)
+		mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	BYTE* view = mapping ? static_cast<BYTE*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(expected_bytes))) : nullptr;
+
+	bool loaded = false;
+	if (view != nullptr)
+	{
+		const CacheHeader* header = reinterpret_cast<const CacheHeader*>(view);
+		loaded = memcmp(header->magic, "TGSC", 4) == 0 && header->version == cache_version && header->key == key.get_value()
+			&& header->span_count == spans.size();
+		int span = 0;
+		for (auto it = spans.begin(); loaded && it != spans.end(); ++it, span++)
+			loaded = header->span_bytes[span] == static_cast<uint64_t>(it->bytes);
+
+		if (loaded)
+			copy_spans(view + sizeof(CacheHeader), spans, false);
+		UnmapViewOfFile(view);
+	}
+
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+	return loaded;
+}
+
+bool StageCache::store(const StageKey& key, std::initializer_list<CacheSpan> spans) const
+{
+	if (spans.size() > CacheHeader::max_spans)
+		return false;
+
+	CacheHeader header = {};
+	memcpy(header.magic, "TGSC", 4);
+	header.version = cache_version;
+	header.key = key.get_value();
+	header.span_count = spans.size();
+	int64_t total_bytes = sizeof(CacheHeader);
+	int span = 0;
+	for (const CacheSpan& s : spans)
+	{
+		header.span_bytes[span++] = s.bytes;
+		total_bytes += s.bytes;
+	}
+
+	// A crash while writing leaves a temporary file behind instead of a broken entry
+	std::wstring path = get_path(key);
+	std::wstring temporary_path = path + L".tmp";
+	HANDLE file = CreateFileW(temporary_path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+
+	// Creating the mapping also grows the file to its full size
+	LARGE_INTEGER size;
+	size.QuadPart = total_bytes;
+	HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READWRITE, size.HighPart, size.LowPart, nullptr);
+	BYTE* view = mapping ? static_cast<BYTE*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, static_cast<SIZE_T>(total_bytes))) : nullptr;
+	if (view != nullptr)
+	{
+		memcpy(view, &header, sizeof(header));
+		copy_spans(view + sizeof(CacheHeader), spans, true);
+		UnmapViewOfFile(view);
+	}
+
+	if (mapping)
+		CloseHandle(mapping);
+	CloseHandle(file);
+
+	if (view == nullptr || !MoveFileExW(temporary_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileW(temporary_path.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+
+#include <initializer_list>
+
+// Hash of everything the result of a stage depends on, FNV-1a over the parameters
+// Keys of later stages start with the key of the stage they read, so a change invalidates everything downstream
+class StageKey
+{
+public:
+	// Starts with the stage name and the cache version
+	explicit StageKey(const char* stage);
+
+	const std::string& get_stage() const { return stage; }
+	uint64_t get_value() const { return value; }
+
+	StageKey& add(const void* data, size_t bytes);
+	StageKey& add(int64_t number) { return add(&number, sizeof(number)); }
+	StageKey& add(double number) { return add(&number, sizeof(number)); }
+	StageKey& add(const std::string& text) { return add(text.data(), text.size()).add(static_cast<int64_t>(text.size())); }
+	StageKey& add(const StageKey& input) { return add(static_cast<int64_t>(input.get_value())); }
+	// Path, size and time of the last change of a file the stage reads, a missing file hashes as such
+	StageKey& add_file(const wchar_t* path);
+
+private:
+	std::string stage;
+	uint64_t value;
+};
+
+// Memory the arrays of a cache entry are loaded into or stored from
+struct CacheSpan
+{
+	void* data;
+	int64_t bytes;
+};
+
+template <typename T>
+CacheSpan cache_span(std::vector<T>& array)
+{
+	return CacheSpan{ array.data(), static_cast<int64_t>(array.size() * sizeof(T)) };
+}
+
+// Results of the pipeline stages in a directory, one memory mapped file per entry named after the stage and its key
+// Entries are never evicted, the directory can be deleted at any time
+class StageCache
+{
+public:
+	// Creates the directory if necessary
+	explicit StageCache(const std::wstring& directory);
+
+	// Copies the arrays of the entry into the spans, whose sizes have to match the stored ones
+	// Returns false if there is no entry for the key or it does not match, the spans may be overwritten then
+	bool load(const StageKey& key, std::initializer_list<CacheSpan> spans) const;
+	// Writes the entry to a temporary file which replaces the old entry once it is complete
+	bool store(const StageKey& key, std::initializer_list<CacheSpan> spans) const;
+
+private:
+	std::wstring get_path(const StageKey& key) const;
+
+	std::wstring directory;
+};
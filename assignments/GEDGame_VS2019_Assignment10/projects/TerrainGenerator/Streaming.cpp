@@ -0,0 +1,282 @@
+// Out-of-core version of the generator
+// All full resolution fields live in memory mapped scratch files and are processed in bands of rows.
+// A band only maps the rows it needs (plus the halo of the kernel), the band size follows from the memory budget.
+// Every map is written to its image as soon as a band is finished.
+
+#include "TerrainGenerator.h"
+#include "HeightfieldSource.h"
+#include "ScratchField.h"
+#include "StripImageWriter.h"
+
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+
+// Number of items per band when every item needs bytes_per_item of memory
+static int64_t band_size(int64_t budget, int64_t bytes_per_item)
+{
+	return std::max(budget / bytes_per_item, 1ll);
+}
+
+// Fills the field band by band from the source, the bands follow the alignment of the source
+static void stream_source(const HeightfieldSource& source, ScratchField& field, int64_t resolution, std::vector<float*>& rows, int64_t budget, int64_t& peak_bytes)
+{
+	int64_t alignment = source.get_band_alignment(resolution);
+	int64_t band = std::max(band_size(budget, field.get_bytes_per_row()) / alignment, 1ll) * alignment;
+
+	for (int64_t begin = 0; begin < resolution; begin += band)
+	{
+		int64_t end = std::min(begin + band, resolution);
+		for (int64_t y = begin; y < end; y++)
+			rows[y] = field.row(y);
+		peak_bytes = std::max(peak_bytes, field.get_mapped_bytes());
+
+		source.generate_rows(resolution, begin, end, rows.data());
+		field.unmap_all();
+	}
+}
+
+// Finds the extremes of the resolution² heightfield
+static void stream_min_max(ScratchField& field, int64_t resolution, std::vector<float*>& rows, int64_t budget, int64_t& peak_bytes, float& min, float& max)
+{
+	min = max = field.row(0)[0];
+	std::mutex merge_mutex;
+
+	int64_t band = band_size(budget, field.get_bytes_per_row());
+	for (int64_t begin = 0; begin < resolution; begin += band)
+	{
+		int64_t end = std::min(begin + band, resolution);
+		for (int64_t y = begin; y < end; y++)
+			rows[y] = field.row(y);
+		peak_bytes = std::max(peak_bytes, field.get_mapped_bytes());
+
+		parallel_for(begin, end, [&](int64_t row_begin, int64_t row_end)
+		{
+			float local_min = rows[row_begin][0];
+			float local_max = rows[row_begin][0];
+			for (int64_t y = row_begin; y < row_end; y++)
+			{
+				local_min = std::min(local_min, *std::min_element(rows[y], rows[y] + resolution));
+				local_max = std::max(local_max, *std::max_element(rows[y], rows[y] + resolution));
+			}
+
+			std::lock_guard<std::mutex> lock(merge_mutex);
+			min = std::min(min, local_min);
+			max = std::max(max, local_max);
+		});
+		field.unmap_all();
+	}
+}
+
+// Compresses the heights to [0;1] in place and blurs every row horizontally into blurred
+static void stream_normalize_blur_rows(ScratchField& field, ScratchField& blurred, int64_t resolution, int64_t kernel_size, float min, float max,
+	std::vector<float*>& rows, std::vector<float*>& blurred_rows, int64_t budget, int64_t& peak_bytes)
+{
+	int64_t band = band_size(budget, field.get_bytes_per_row() + blurred.get_bytes_per_row());
+	for (int64_t begin = 0; begin < resolution; begin += band)
+	{
+		int64_t end = std::min(begin + band, resolution);
+		for (int64_t y = begin; y < end; y++)
+		{
+			rows[y] = field.row(y);
+			blurred_rows[y] = blurred.row(y);
+		}
+		peak_bytes = std::max(peak_bytes, field.get_mapped_bytes() + blurred.get_mapped_bytes());
+
+		parallel_for(begin, end, [&](int64_t row_begin, int64_t row_end)
+		{
+			for (int64_t y = row_begin; y < row_end; y++)
+			{
+				for (int64_t x = 0; x < resolution; x++)
+					rows[y][x] = clamp(map_range(rows[y][x], min, max));
+				blur_row(rows[y], blurred_rows[y], resolution, kernel_size);
+			}
+		});
+		field.unmap_all();
+		blurred.unmap_all();
+	}
+}
+
+// Blurs the columns of in into out, using one running sum per column
+static void stream_blur_columns(ScratchField& in, ScratchField& out, int64_t resolution, int64_t kernel_size,
+	std::vector<float*>& in_rows, std::vector<float*>& out_rows, int64_t budget, int64_t& peak_bytes)
+{
+	// Every band reads kernel_size rows above and below its own rows
+	int64_t halo = 2 * kernel_size + 1;
+	int64_t budget_rows = budget / std::max(in.get_bytes_per_row(), out.get_bytes_per_row());
+	if (budget_rows < halo + 2)
+		std::cout << "WARNING: The memory budget is too small for the smoothing kernel and will be exceeded" << std::endl;
+	int64_t band = std::max((budget_rows - halo) / 2, 1ll);
+
+	for (int64_t begin = 0; begin < resolution; begin += band)
+	{
+		int64_t end = std::min(begin + band, resolution);
+		for (int64_t y = std::max(begin - kernel_size, 0ll); y < std::min(end + kernel_size + 1, resolution); y++)
+			in_rows[y] = in.row(y);
+		for (int64_t y = begin; y < end; y++)
+			out_rows[y] = out.row(y);
+		peak_bytes = std::max(peak_bytes, in.get_mapped_bytes() + out.get_mapped_bytes());
+
+		// The threads split the columns, every thread slides its windows down the band
+		parallel_for(0, resolution, [&](int64_t column_begin, int64_t column_end)
+		{
+			blur_columns(in_rows.data(), out_rows.data(), resolution, kernel_size, begin, end, column_begin, column_end);
+		});
+		in.unmap_all();
+		out.unmap_all();
+	}
+}
+
+// Mixes the heightfield with its smoothed version in place (see make_pretty)
+static void stream_mix(ScratchField& field, ScratchField& smoothed, int64_t resolution,
+	std::vector<float*>& rows, std::vector<float*>& smoothed_rows, int64_t budget, int64_t& peak_bytes)
+{
+	int64_t band = band_size(budget, field.get_bytes_per_row() + smoothed.get_bytes_per_row());
+	for (int64_t begin = 0; begin < resolution; begin += band)
+	{
+		int64_t end = std::min(begin + band, resolution);
+		// The slope needs up to two smoothed rows above and below
+		for (int64_t y = std::max(begin - 2, 0ll); y < std::min(end + 2, resolution); y++)
+			smoothed_rows[y] = smoothed.row(y);
+		for (int64_t y = begin; y < end; y++)
+			rows[y] = field.row(y);
+		peak_bytes = std::max(peak_bytes, field.get_mapped_bytes() + smoothed.get_mapped_bytes());
+
+		parallel_for(begin, end, [&](int64_t row_begin, int64_t row_end)
+		{
+			for (int64_t y = row_begin; y < row_end; y++)
+			{
+				if (y == 0)
+					mix_row(rows[y], smoothed_rows[y], smoothed_rows[y], smoothed_rows[y + 2], resolution, rows[y]);
+				else if (y == resolution - 1)
+					mix_row(rows[y], smoothed_rows[y], smoothed_rows[y - 2], smoothed_rows[y], resolution, rows[y]);
+				else
+					mix_row(rows[y], smoothed_rows[y], smoothed_rows[y - 1], smoothed_rows[y + 1], resolution, rows[y]);
+			}
+		});
+		field.unmap_all();
+		smoothed.unmap_all();
+	}
+}
+
+// Derives normals, colors and the downsampled heightmap band by band and writes them to the images
+// Returns false if any of the images could not be saved
+static bool stream_outputs(ScratchField& field, int64_t resolution, std::vector<float*>& rows, int64_t budget, int64_t& peak_bytes,
+	StripImageWriter& heightmap, StripImageWriter& colormap, StripImageWriter& normalmap,
+	_TCHAR* heightmap_path, _TCHAR* color_path, _TCHAR* normalmap_path)
+{
+	TerrainTextures textures;
+
+	// Every row needs its height row, a normal and a color row, bands are a multiple of four rows for the heightmap
+	int64_t row_bytes = field.get_bytes_per_row() + 2 * resolution * sizeof(GEDUtils::Vec3f);
+	int64_t band = std::max(band_size(budget, row_bytes) / 4 * 4, 4ll);
+
+	std::vector<GEDUtils::Vec3f> normal(band * resolution);
+	std::vector<GEDUtils::Vec3f> color(band * resolution);
+	std::vector<float> height_small(band / 4 * (resolution / 4));
+
+	for (int64_t begin = 0; begin < resolution; begin += band)
+	{
+		int64_t end = std::min(begin + band, resolution);
+		// Normals need a one pixel halo
+		for (int64_t y = std::max(begin - 1, 0ll); y < std::min(end + 1, resolution); y++)
+			rows[y] = field.row(y);
+		peak_bytes = std::max(peak_bytes, field.get_mapped_bytes() + static_cast<int64_t>((normal.size() + color.size()) * sizeof(GEDUtils::Vec3f) + height_small.size() * sizeof(float)));
+
+		parallel_for(begin, end, [&](int64_t row_begin, int64_t row_end)
+		{
+			for (int64_t y = row_begin; y < row_end; y++)
+			{
+				GEDUtils::Vec3f* normal_out = &normal[idx(0, y - begin, resolution)];
+				if (y == 0)
+					normal_row(rows[y], rows[y + 1], 1.0f, rows[y], resolution, normal_out);
+				else if (y == resolution - 1)
+					normal_row(rows[y - 1], rows[y], 1.0f, rows[y], resolution, normal_out);
+				else
+					normal_row(rows[y - 1], rows[y + 1], 0.5f, rows[y], resolution, normal_out);
+
+				color_row(rows[y], normal_out, y, resolution, textures, &color[idx(0, y - begin, resolution)]);
+			}
+		});
+
+		parallel_for(begin / 4, end / 4, [&](int64_t row_begin, int64_t row_end)
+		{
+			for (int64_t y = row_begin; y < row_end; y++)
+				downsample_row(&rows[y * 4], resolution, &height_small[idx(0, y - begin / 4, resolution / 4)]);
+		});
+
+		normalmap.write_rows(normal.data(), end - begin);
+		colormap.write_rows(color.data(), end - begin);
+		heightmap.write_rows(height_small.data(), end / 4 - begin / 4);
+		field.unmap_all();
+	}
+
+	bool height_saved = heightmap.finish();
+	bool color_saved = colormap.finish();
+	bool normal_saved = normalmap.finish();
+	if (!height_saved)
+		std::wcout << "ERROR: Heightmap could not be saved to: " << heightmap_path << std::endl;
+	if (!color_saved)
+		std::wcout << "ERROR: Colormap could not be saved to: " << color_path << std::endl;
+	if (!normal_saved)
+		std::wcout << "ERROR: Normalmap could not be saved to: " << normalmap_path << std::endl;
+	return height_saved && color_saved && normal_saved;
+}
+
+bool generate_streaming(const HeightfieldSource& source, int64_t resolution, int64_t memory_budget, const std::wstring& scratch_directory,
+	_TCHAR* heightmap_path, _TCHAR* color_path, _TCHAR* normalmap_path)
+{
+	try
+	{
+		// A file which can not be created would otherwise only be noticed once the whole field is generated
+		StripImageWriter heightmap(heightmap_path, resolution / 4, resolution / 4, StripImageWriter::Format::Gray16);
+		StripImageWriter colormap(color_path, resolution, resolution, StripImageWriter::Format::RGB48);
+		StripImageWriter normalmap(normalmap_path, resolution, resolution, StripImageWriter::Format::RGB48);
+		if (!heightmap.is_valid())
+			std::wcout << "ERROR: Heightmap could not be created: " << heightmap_path << std::endl;
+		if (!colormap.is_valid())
+			std::wcout << "ERROR: Colormap could not be created: " << color_path << std::endl;
+		if (!normalmap.is_valid())
+			std::wcout << "ERROR: Normalmap could not be created: " << normalmap_path << std::endl;
+		if (!heightmap.is_valid() || !colormap.is_valid() || !normalmap.is_valid())
+			return false;
+
+		int64_t kernel_size = std::max(resolution / 40ll, 1ll);
+		int64_t peak_bytes = 0;
+
+		ScratchField height(scratch_directory, resolution, resolution);
+		ScratchField blurred(scratch_directory, resolution, resolution);
+		ScratchField smoothed(scratch_directory, resolution, resolution);
+
+		// Row tables of the fields, only the entries of the current band are valid
+		std::vector<float*> height_rows(resolution);
+		std::vector<float*> blurred_rows(resolution);
+		std::vector<float*> smoothed_rows(resolution);
+
+		std::cout << "Generating heightfield (" << source.get_name() << ")" << std::endl;
+		stream_source(source, height, resolution, height_rows, memory_budget, peak_bytes);
+
+		float min, max;
+		stream_min_max(height, resolution, height_rows, memory_budget, peak_bytes, min, max);
+
+		std::cout << "Smoothing heightfield" << std::endl;
+		stream_normalize_blur_rows(height, blurred, resolution, kernel_size, min, max, height_rows, blurred_rows, memory_budget, peak_bytes);
+		stream_blur_columns(blurred, smoothed, resolution, kernel_size, blurred_rows, smoothed_rows, memory_budget, peak_bytes);
+		stream_mix(height, smoothed, resolution, height_rows, smoothed_rows, memory_budget, peak_bytes);
+
+		std::cout << "Generating and saving normalmap, colormap and heightmap" << std::endl;
+		if (!stream_outputs(height, resolution, height_rows, memory_budget, peak_bytes, heightmap, colormap, normalmap,
+			heightmap_path, color_path, normalmap_path))
+			return false;
+
+		std::cout << "Peak mapped memory " << peak_bytes / (1024 * 1024) << " MB of " << memory_budget / (1024 * 1024) << " MB budget, "
+			<< 3 * resolution * resolution * sizeof(float) / (1024 * 1024) << " MB of scratch files." << std::endl;
+	}
+	catch (const std::exception& e)
+	{
+		std::cout << "ERROR: " << e.what() << std::endl;
+		return false;
+	}
+
+	return true;
+}
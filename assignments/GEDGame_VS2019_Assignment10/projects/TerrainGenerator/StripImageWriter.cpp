@@ -0,0 +1,100 @@
+#include "StripImageWriter.h"
+#include "ImageWriter.h"
+
+StripImageWriter::StripImageWriter(const wchar_t* path, int64_t width, int64_t height, Format format)
+	: width(width), height(height), format(format)
+{
+	// WIC needs COM, RPC_E_CHANGED_MODE means it is already initialized on this thread
+	HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+	com_initialized = SUCCEEDED(hr);
+	if (FAILED(hr) && hr != RPC_E_CHANGED_MODE)
+		return;
+
+	if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))))
+		return;
+	if (FAILED(factory->CreateStream(&stream)) || FAILED(stream->InitializeFromFilename(path, GENERIC_WRITE)))
+		return;
+
+	GUID container = is_tiff_path(path) ? GUID_ContainerFormatTiff : GUID_ContainerFormatPng;
+	if (FAILED(factory->CreateEncoder(container, nullptr, &encoder)) || FAILED(encoder->Initialize(stream, WICBitmapEncoderNoCache)))
+		return;
+
+	ComPtr<IPropertyBag2> properties;
+	if (FAILED(encoder->CreateNewFrame(&frame, &properties)) || FAILED(frame->Initialize(properties)))
+		return;
+	if (FAILED(frame->SetSize(static_cast<UINT>(width), static_cast<UINT>(height))))
+		return;
+
+	// The encoder may choose a different format if it does not support the requested one
+	WICPixelFormatGUID requested = (format == Format::Gray16) ? GUID_WICPixelFormat16bppGray : GUID_WICPixelFormat48bppRGB;
+	WICPixelFormatGUID pixel_format = requested;
+	if (FAILED(frame->SetPixelFormat(&pixel_format)) || pixel_format != requested)
+		return;
+
+	valid = true;
+}
+
+StripImageWriter::~StripImageWriter()
+{
+	// The COM objects have to be released before COM is deinitialized
+	frame = nullptr;
+	encoder = nullptr;
+	stream = nullptr;
+	factory = nullptr;
+	if (com_initialized)
+		CoUninitialize();
+}
+
+bool StripImageWriter::write_rows(const float* data, int64_t row_count)
+{
+	if (!valid || format != Format::Gray16)
+		return false;
+
+	buffer.resize(width * row_count);
+	for (int64_t i = 0; i < width * row_count; i++)
+		buffer[i] = to_word(data[i]);
+
+	return write_converted(row_count);
+}
+
+bool StripImageWriter::write_rows(const GEDUtils::Vec3f* data, int64_t row_count)
+{
+	if (!valid || format != Format::RGB48)
+		return false;
+
+	buffer.resize(width * row_count * 3);
+	for (int64_t i = 0; i < width * row_count; i++)
+	{
+		buffer[i * 3 + 0] = to_word(data[i].x);
+		buffer[i * 3 + 1] = to_word(data[i].y);
+		buffer[i * 3 + 2] = to_word(data[i].z);
+	}
+
+	return write_converted(row_count);
+}
+
+bool StripImageWriter::write_converted(int64_t row_count)
+{
+	if (rows_written + row_count > height)
+		return false;
+
+	UINT stride = static_cast<UINT>(buffer.size() / row_count * sizeof(WORD));
+	UINT size = static_cast<UINT>(buffer.size() * sizeof(WORD));
+	if (FAILED(frame->WritePixels(static_cast<UINT>(row_count), stride, size, reinterpret_cast<BYTE*>(buffer.data()))))
+	{
+		valid = false;
+		return false;
+	}
+
+	rows_written += row_count;
+	return true;
+}
+
+bool StripImageWriter::finish()
+{
+	if (!valid || rows_written != height)
+		return false;
+
+	valid = false;
+	return SUCCEEDED(frame->Commit()) && SUCCEEDED(encoder->Commit());
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+
+// Writes an image in strips of rows through WIC, so the whole image never has to be in memory
+// The container format is chosen by the file extension (.tif/.tiff, PNG otherwise)
+class StripImageWriter
+{
+public:
+	enum class Format
+	{
+		Gray16, // 16 bit greyscale, e.g. the heightmap
+		RGB48   // 16 bit per channel RGB, e.g. the color and normal map
+	};
+
+	// Opens the file and starts a single frame, check is_valid() afterwards
+	StripImageWriter(const wchar_t* path, int64_t width, int64_t height, Format format);
+	~StripImageWriter();
+
+	bool is_valid() const { return valid; }
+
+	// Appends row_count rows, rows have to be written top to bottom
+	// Values must lie in [0;1]
+	bool write_rows(const float* data, int64_t row_count);
+	bool write_rows(const GEDUtils::Vec3f* data, int64_t row_count);
+
+	// Finishes the file after all rows were written
+	bool finish();
+
+private:
+	StripImageWriter(const StripImageWriter&);
+	void operator=(const StripImageWriter&);
+
+	bool write_converted(int64_t row_count);
+
+	bool valid = false;
+	bool com_initialized = false;
+	int64_t width = 0;
+	int64_t height = 0;
+	int64_t rows_written = 0;
+	Format format;
+	std::vector<WORD> buffer; // Rows converted to the pixel format of the file
+
+	ComPtr<IWICImagingFactory> factory;
+	ComPtr<IWICStream> stream;
+	ComPtr<IWICBitmapEncoder> encoder;
+	ComPtr<IWICBitmapFrameEncode> frame;
+};
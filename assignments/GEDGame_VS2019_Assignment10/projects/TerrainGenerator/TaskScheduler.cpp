@@ -0,0 +1,279 @@
+#include "TaskScheduler.h"
+
+// Every thread of the pool owns a deque: it pushes and pops the tasks it creates at the bottom, so nested
+// work stays on the thread which has its data in the cache. A thread without work steals the oldest task
+// from the top of another deque. Threads waiting for a group run queued tasks instead of blocking, so a
+// task may itself call parallel_for. Tasks are only queued once their dependencies have finished.
+
+// Worker index of the calling thread, -1 outside of the pool
+static thread_local int64_t current_worker = -1;
+
+// Failed searches for work before an idle worker goes to sleep
+static const int64_t idle_spins = 64;
+
+TaskDeque::TaskDeque()
+	: tasks(new std::atomic<Task*>[capacity])
+{
+}
+
+bool TaskDeque::push(Task* task)
+{
+	int64_t b = bottom.load(std::memory_order_relaxed);
+	int64_t t = top.load(std::memory_order_acquire);
+	if (b - t >= capacity)
+		return false;
+
+	tasks[b & (capacity - 1)].store(task, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	bottom.store(b + 1, std::memory_order_relaxed);
+	return true;
+}
+
+Task* TaskDeque::pop()
+{
+	int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		// Empty
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	Task* task = tasks[b & (capacity - 1)].load(std::memory_order_relaxed);
+	if (t == b)
+	{
+		// The last task, a thief may take it at the same time
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			task = nullptr;
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	return task;
+}
+
+Task* TaskDeque::steal()
+{
+	int64_t t = top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return nullptr;
+
+	Task* task = tasks[t & (capacity - 1)].load(std::memory_order_relaxed);
+	// Lost against the owner or another thief
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr;
+	return task;
+}
+
+TaskScheduler& TaskScheduler::get()
+{
+	static TaskScheduler scheduler(g_thread_count);
+	return scheduler;
+}
+
+TaskScheduler::TaskScheduler(int64_t thread_count)
+{
+	thread_count = std::max(thread_count, 1ll);
+	for (int64_t i = 0; i < thread_count; i++)
+		deques.emplace_back(new TaskDeque());
+
+	current_worker = 0;
+	for (int64_t i = 1; i < thread_count; i++)
+		workers.emplace_back(&TaskScheduler::work, this, i);
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto& worker : workers)
+		worker.join();
+}
+
+int64_t TaskScheduler::get_worker_index() const
+{
+	return current_worker;
+}
+
+void TaskScheduler::submit(Task* task)
+{
+	int64_t index = get_worker_index();
+	queued.fetch_add(1);
+	if (index < 0)
+	{
+		std::lock_guard<std::mutex> lock(injected_mutex);
+		injected.push_back(task);
+	}
+	else if (!deques[index]->push(task))
+	{
+		queued.fetch_sub(1);
+		execute(task);
+		return;
+	}
+
+	// Taking the lock orders the notification after a worker which is about to sleep has checked queued
+	if (sleeping.load() > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex);
+		wake.notify_one();
+	}
+}
+
+Task* TaskScheduler::find_task(int64_t index)
+{
+	Task* task = deques[index]->pop();
+
+	int64_t count = get_thread_count();
+	for (int64_t k = 1; task == nullptr && k < count; k++)
+		task = deques[(index + k) % count]->steal();
+
+	if (task == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(injected_mutex);
+		if (!injected.empty())
+		{
+			task = injected.front();
+			injected.pop_front();
+		}
+	}
+
+	if (task != nullptr)
+		queued.fetch_sub(1);
+	return task;
+}
+
+void TaskScheduler::execute(Task* task)
+{
+	task->job();
+
+	for (Task* successor : task->successors)
+		if (successor->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			submit(successor);
+
+	// The group may be destroyed as soon as its last task is counted
+	TaskGroup* group = task->group;
+	group->remaining.fetch_sub(1, std::memory_order_release);
+}
+
+void TaskScheduler::work(int64_t index)
+{
+	current_worker = index;
+	int64_t idle = 0;
+	while (!stopping.load())
+	{
+		Task* task = find_task(index);
+		if (task != nullptr)
+		{
+			execute(task);
+			idle = 0;
+			continue;
+		}
+
+		if (++idle < idle_spins)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(sleep_mutex);
+		sleeping.fetch_add(1);
+		wake.wait(lock, [&]() { return queued.load() > 0 || stopping.load(); });
+		sleeping.fetch_sub(1);
+		idle = 0;
+	}
+}
+
+void TaskScheduler::wait(const TaskGroup& group)
+{
+	int64_t index = get_worker_index();
+	while (!group.finished())
+	{
+		Task* task = index >= 0 ? find_task(index) : nullptr;
+		if (task != nullptr)
+			execute(task);
+		else
+			std::this_thread::yield();
+	}
+}
+
+Task* TaskGroup::add(std::function<void()> job, std::initializer_list<Task*> dependencies)
+{
+	tasks.emplace_back();
+	Task* task = &tasks.back();
+	task->job = std::move(job);
+	task->group = this;
+	task->pending.store(static_cast<int64_t>(dependencies.size()), std::memory_order_relaxed);
+	for (Task* dependency : dependencies)
+		dependency->successors.push_back(task);
+	return task;
+}
+
+void TaskGroup::wait()
+{
+	if (tasks.empty())
+		return;
+	remaining.store(static_cast<int64_t>(tasks.size()), std::memory_order_relaxed);
+
+	// Collected first, a running task may already queue its successors
+	std::vector<Task*> ready;
+	for (Task& task : tasks)
+		if (task.pending.load(std::memory_order_relaxed) == 0)
+			ready.push_back(&task);
+
+	TaskScheduler& scheduler = TaskScheduler::get();
+	for (Task* task : ready)
+		scheduler.submit(task);
+	scheduler.wait(*this);
+}
+
+// Runs body(band_begin, band_end) for one contiguous band of [begin; end) per thread
+// The bands do not depend on how the pool schedules them, so results which depend on the bands stay the same
+void parallel_for(int64_t begin, int64_t end, const std::function<void(int64_t, int64_t)>& body)
+{
+	int64_t count = std::min(static_cast<int64_t>(g_thread_count), end - begin);
+	if (count <= 1)
+	{
+		if (end > begin)
+			body(begin, end);
+		return;
+	}
+
+	TaskGroup group;
+	for (int64_t i = 0; i < count; i++)
+	{
+		int64_t band_begin = begin + (end - begin) * i / count;
+		int64_t band_end = begin + (end - begin) * (i + 1) / count;
+		group.add([&body, band_begin, band_end]() { body(band_begin, band_end); });
+	}
+	group.wait();
+}
+
+// One task per tile, idle threads steal tiles instead of waiting for the slowest band
+void parallel_for_2d(int64_t width, int64_t height, int64_t tile_size,
+	const std::function<void(int64_t, int64_t, int64_t, int64_t)>& body)
+{
+	int64_t tiles_x = (width + tile_size - 1) / tile_size;
+	int64_t tiles_y = (height + tile_size - 1) / tile_size;
+
+	TaskGroup group;
+	for (int64_t tile_y = 0; tile_y < tiles_y; tile_y++)
+		for (int64_t tile_x = 0; tile_x < tiles_x; tile_x++)
+		{
+			int64_t x_begin = tile_x * tile_size;
+			int64_t y_begin = tile_y * tile_size;
+			int64_t x_end = std::min(x_begin + tile_size, width);
+			int64_t y_end = std::min(y_begin + tile_size, height);
+			if (g_thread_count <= 1)
+				body(x_begin, y_begin, x_end, y_end);
+			else
+				group.add([&body, x_begin, y_begin, x_end, y_end]() { body(x_begin, y_begin, x_end, y_end); });
+		}
+	group.wait();
+}
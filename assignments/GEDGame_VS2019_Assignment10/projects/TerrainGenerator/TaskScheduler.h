@@ -0,0 +1,113 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// All parallel work of the generator runs as tasks on one pool of g_thread_count threads, see TaskScheduler.cpp
+// parallel_for and parallel_for_2d are built on it, stages with dependencies between them use a TaskGroup
+
+class TaskGroup;
+
+struct Task
+{
+	std::function<void()> job;
+	TaskGroup* group = nullptr;
+	std::vector<Task*> successors;
+	// Dependencies which have not finished yet, the task is queued when this drops to 0
+	std::atomic<int64_t> pending{ 0 };
+};
+
+// Fixed size work-stealing deque after Chase and Lev, see https://fzn.fr/readings/ppopp13.pdf
+// Only the owning thread pushes and pops at the bottom, any thread steals from the top
+class TaskDeque
+{
+public:
+	static const int64_t capacity = 4096;
+
+	TaskDeque();
+
+	// False if the deque is full, the caller runs the task itself then
+	bool push(Task* task);
+	Task* pop();
+	Task* steal();
+
+private:
+	// top and bottom on their own cache lines, the thieves hammer top
+	// The deques come from new, which aligns to 16 bytes only in C++14, so the lines are kept apart by padding
+	char padding_before[64];
+	std::atomic<int64_t> top{ 0 };
+	char padding_top[64 - sizeof(std::atomic<int64_t>)];
+	std::atomic<int64_t> bottom{ 0 };
+	char padding_bottom[64 - sizeof(std::atomic<int64_t>)];
+	std::unique_ptr<std::atomic<Task*>[]> tasks;
+};
+
+class TaskScheduler
+{
+public:
+	// The pool is started with g_thread_count - 1 workers on first use, the calling thread becomes worker 0
+	// main() does this right after the thread count is known
+	static TaskScheduler& get();
+
+	explicit TaskScheduler(int64_t thread_count);
+	~TaskScheduler();
+
+	int64_t get_thread_count() const { return static_cast<int64_t>(deques.size()); }
+	// Index of the calling thread in [0; get_thread_count()), -1 for threads outside of the pool
+	int64_t get_worker_index() const;
+
+	// Queues a task whose dependencies have finished
+	void submit(Task* task);
+	// Runs tasks until the group has finished, threads outside of the pool only wait
+	void wait(const TaskGroup& group);
+
+private:
+	void work(int64_t index);
+	Task* find_task(int64_t index);
+	void execute(Task* task);
+
+	std::vector<std::unique_ptr<TaskDeque>> deques;
+	std::vector<std::thread> workers;
+
+	// Tasks from threads outside of the pool
+	std::mutex injected_mutex;
+	std::deque<Task*> injected;
+
+	// Idle workers sleep until a task is queued
+	std::atomic<int64_t> queued{ 0 };
+	std::atomic<int64_t> sleeping{ 0 };
+	std::atomic<bool> stopping{ false };
+	std::mutex sleep_mutex;
+	std::condition_variable wake;
+};
+
+// Tasks and the dependencies between them, which start when wait() is called
+// Tasks run on any thread in any order which respects the dependencies, the group must outlive wait()
+class TaskGroup
+{
+public:
+	TaskGroup() = default;
+	TaskGroup(const TaskGroup&) = delete;
+	TaskGroup& operator=(const TaskGroup&) = delete;
+
+	// The task starts after all dependencies have finished, they have to be tasks of this group
+	Task* add(std::function<void()> job, std::initializer_list<Task*> dependencies = {});
+	// Starts the tasks and returns once all of them have finished, the calling thread helps with any queued task
+	void wait();
+
+	bool finished() const { return remaining.load(std::memory_order_acquire) == 0; }
+
+private:
+	friend class TaskScheduler;
+
+	// std::deque keeps the addresses of the tasks while more are added
+	std::deque<Task> tasks;
+	std::atomic<int64_t> remaining{ 0 };
+};
@@ -1,78 +1,205 @@
-#define NOMINMAX // prevents overlap of Windows.h with the std
+#include "TerrainGenerator.h"
+#include "Simd.h"
+#include "ImageWriter.h"
+#include "MipPyramid.h"
+#include "HeightfieldSource.h"
+#include "Erosion.h"
+#include "PackedField.h"
+#include "DdsWriter.h"
+#include "StageCache.h"
+#include "TaskScheduler.h"
 
-#include <Windows.h>
-#include <tchar.h>
 #include <iostream>
 #include <memory>
-#include <random>
+#include <cmath>
 #include <time.h>
 #include <chrono>
-#include <SimpleImage.h>
-#include <TextureGenerator.h>
+#include <thread>
+
+unsigned int g_thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+uint64_t g_terrain_seed = 4u;
 
 // Main Functions
-bool interpret_arguments(int argc, _TCHAR* argv[], int64_t& resolution, _TCHAR*& heightmap_path, _TCHAR*& color_path, _TCHAR*& normalmap_path);
-// Generators
-std::vector<float> generate_heightfield(int64_t resolution);
-std::vector<GEDUtils::Vec3f> generate_normals(std::vector<float>& height, int64_t resolution);
-std::vector<GEDUtils::Vec3f> generate_colors(std::vector<float>& height, std::vector<GEDUtils::Vec3f>& normal, int64_t resolution);
-std::vector<float> resize_heightfield(std::vector<float>& height, int64_t resolution);
-// Other
-void smooth_heightfield(std::vector<float>& height, int64_t resolution, int64_t iterations, int64_t kernel_size);
-void make_pretty(std::vector<float>& height, int64_t resolution);
-bool save_image(std::vector<float>& data, int64_t resolution, _TCHAR* path);
-bool save_image(std::vector<GEDUtils::Vec3f>& data, int64_t resolution, _TCHAR* path);
-// Helpers
-int64_t idx(int64_t x, int64_t y, int64_t size);
-float smoothstep(float x);
-float clamp(float x, float min = 0.0f, float max = 1.0f);
-float map_range(float x, float from_low, float from_high, float to_low = 0.0f, float to_high = 1.0f);
-GEDUtils::Vec3f blend(GEDUtils::Vec3f& a, GEDUtils::Vec3f& b, float alpha);
-GEDUtils::Vec3f texture(GEDUtils::SimpleImage& tex, UINT u, UINT v);
+bool interpret_arguments(int argc, _TCHAR* argv[], int64_t& resolution, int64_t& thread_count, int64_t& memory_budget, _TCHAR*& scratch_directory,
+	_TCHAR*& cache_directory, SimdLevel& simd_level, std::unique_ptr<HeightfieldSource>& source, ErosionSettings& erosion, FieldStorage& storage, bool& benchmark,
+	bool& benchmark_sources, bool& benchmark_packing, bool& benchmark_colors, BenchmarkOptions& benchmark_options, bool& unfused, bool& save_mips, MipFilter& mip_filter,
+	_TCHAR*& heightmap_path, _TCHAR*& color_path, _TCHAR*& normalmap_path);
 
 int _tmain(int argc, _TCHAR* argv[])
 {
 	// Command line parameters
 	int64_t resolution = 0;
+	int64_t thread_count = g_thread_count;
+	int64_t memory_budget = 0;
+	_TCHAR* scratch_directory = nullptr;
+	_TCHAR* cache_directory = nullptr;
+	SimdLevel simd_level = g_simd_level;
+	std::unique_ptr<HeightfieldSource> source;
+	ErosionSettings erosion;
+	FieldStorage storage = FieldStorage::Float;
+	bool benchmark = false;
+	bool benchmark_source = false;
+	bool benchmark_pack = false;
+	bool benchmark_color = false;
+	BenchmarkOptions benchmark_options;
+	bool unfused = false;
+	bool save_mips = false;
+	MipFilter mip_filter = MipFilter::Box;
 	_TCHAR* heightmap_path = nullptr;
 	_TCHAR* color_path = nullptr;
 	_TCHAR* normalmap_path = nullptr;
 
-	if (!interpret_arguments(argc, argv, resolution, heightmap_path, color_path, normalmap_path))
+	if (!interpret_arguments(argc, argv, resolution, thread_count, memory_budget, scratch_directory, cache_directory, simd_level, source, erosion, storage, benchmark, benchmark_source,
+		benchmark_pack, benchmark_color, benchmark_options, unfused, save_mips, mip_filter, heightmap_path, color_path, normalmap_path))
 		return EXIT_FAILURE;
 
+	g_thread_count = static_cast<unsigned int>(thread_count);
+	std::cout << "Using " << g_thread_count << " threads" << std::endl;
+	// Every stage runs on this pool, started before anything can change g_thread_count
+	TaskScheduler::get();
+
+	// Instruction sets the CPU does not support cannot be forced
+	if (simd_level > g_simd_level)
+		std::cout << "WARNING: " << simd_level_name(simd_level) << " is not supported, using " << simd_level_name(g_simd_level) << std::endl;
+	else
+		g_simd_level = simd_level;
+	std::cout << "Using " << simd_level_name(g_simd_level) << " kernels" << std::endl;
+
+	if (benchmark)
+	{
+		benchmark_normals();
+		return EXIT_SUCCESS;
+	}
+	if (benchmark_source)
+	{
+		benchmark_sources();
+		return EXIT_SUCCESS;
+	}
+	if (benchmark_pack)
+	{
+		benchmark_packing();
+		return EXIT_SUCCESS;
+	}
+	if (benchmark_color)
+		return benchmark_colors() ? EXIT_SUCCESS : EXIT_FAILURE;
+
+	// Scratch files of the streaming generator and the benchmark
+	std::wstring scratch;
+	if (scratch_directory != nullptr)
+		scratch = scratch_directory;
+	else
+	{
+		WCHAR temp_path[MAX_PATH];
+		GetTempPathW(MAX_PATH, temp_path);
+		scratch = temp_path;
+	}
+
+	if (benchmark_options.enabled)
+	{
+		benchmark_options.scratch_directory = scratch;
+		if (!scratch.empty() && scratch.back() != L'\\' && scratch.back() != L'/')
+			benchmark_options.scratch_directory += L'\\';
+		return benchmark_pipeline(*source, benchmark_options) ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	// With a memory budget the maps are generated in bands through disk backed scratch files
+	if (memory_budget > 0)
+	{
+		// The streaming generator never holds the whole heightmap
+		if (save_mips)
+			std::cout << "WARNING: -mips is not supported together with -memory_budget (will be ignored)" << std::endl;
+		if (erosion.enabled())
+			std::cout << "WARNING: -erosion is not supported together with -memory_budget (will be ignored)" << std::endl;
+		if (storage != FieldStorage::Float)
+			std::cout << "WARNING: -storage is not supported together with -memory_budget (will be ignored)" << std::endl;
+		if (cache_directory != nullptr)
+			std::cout << "WARNING: -cache is not supported together with -memory_budget (will be ignored)" << std::endl;
+
+		auto stream_start_time = std::chrono::high_resolution_clock::now();
+		if (!generate_streaming(*source, resolution, memory_budget * 1024 * 1024, scratch, heightmap_path, color_path, normalmap_path))
+			return EXIT_FAILURE;
+		auto stream_end_time = std::chrono::high_resolution_clock::now();
+
+		auto stream_ms = std::chrono::duration_cast<std::chrono::milliseconds>(stream_end_time - stream_start_time).count();
+		std::cout << "Generated and saved in " << stream_ms << " milliseconds";
+		std::cout << " (" << static_cast<double>(resolution * resolution) / (std::max(stream_ms, 1ll) * 1000.0) << " MPixel/s)." << std::endl;
+
+		return EXIT_SUCCESS;
+	}
+
+	// By default all post-processing stages run fused, -unfused runs them one after another over the whole field
+	if (!unfused)
+	{
+		// Stages whose inputs did not change since an earlier run are loaded from the cache
+		std::unique_ptr<StageCache> cache;
+		if (cache_directory != nullptr)
+			cache.reset(new StageCache(cache_directory));
+
+		auto fused_start_time = std::chrono::high_resolution_clock::now();
+		bool saved = generate_fused(*source, resolution, heightmap_path, color_path, normalmap_path, save_mips, mip_filter, erosion, storage, cache.get());
+		auto fused_end_time = std::chrono::high_resolution_clock::now();
+
+		auto fused_ms = std::chrono::duration_cast<std::chrono::milliseconds>(fused_end_time - fused_start_time).count();
+		std::cout << "Generated and saved in " << fused_ms << " milliseconds";
+		std::cout << " (" << static_cast<double>(resolution * resolution) / (std::max(fused_ms, 1ll) * 1000.0) << " MPixel/s)." << std::endl;
+
+		return saved ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+
+	if (cache_directory != nullptr)
+		std::cout << "WARNING: -cache is not supported together with -unfused (will be ignored)" << std::endl;
+
 	// auto lets the compiler determine the type from context
 	auto start_time = std::chrono::high_resolution_clock::now();
 
-	std::cout << "Generating heightfield" << std::endl;
-	auto height = generate_heightfield(resolution);
+	std::cout << "Generating heightfield (" << source->get_name() << ")" << std::endl;
+	auto height = generate_heightfield(*source, resolution);
 	make_pretty(height, resolution);
+	if (erosion.enabled())
+	{
+		std::cout << "Eroding heightfield" << std::endl;
+		int64_t iterations = erode_heightfield(height, resolution, erosion);
+		std::cout << "Eroded the heightfield in " << iterations << " iterations" << std::endl;
+	}
+	// The float heights are released once they are packed
+	HeightStore height_store(storage, std::move(height), resolution);
 	std::cout << "Generating normalmap" << std::endl;
-	auto normal = generate_normals(height, resolution);
+	auto normal = generate_normals(height_store, resolution);
 	std::cout << "Generating colormap" << std::endl;
-	auto color = generate_colors(height, normal, resolution);
+	auto color = generate_colors(height_store, normal, resolution);
 
 	auto mid_time = std::chrono::high_resolution_clock::now();
 
 	std::cout << "Saving Images" << std::endl;
-	auto height_small = resize_heightfield(height, resolution);
+	auto height_small = resize_heightfield(height_store, resolution);
 	if (!save_image(height_small, resolution / 4, heightmap_path))
 		std::wcout << "ERROR: Heightmap could not be saved to: " << heightmap_path << std::endl;
 	if (!save_image(color, resolution, color_path))
 		std::wcout << "ERROR: Colormap could not be saved to: " << color_path << std::endl;
-	if (!save_image(normal, resolution, normalmap_path))
+	if (!save_image(normal, normalmap_path))
 		std::wcout << "ERROR: Normalmap could not be saved to: " << normalmap_path << std::endl;
+	if (save_mips)
+		save_mip_pyramid(build_mip_pyramid(height_small, resolution / 4, mip_filter), heightmap_path);
 
 	auto end_time = std::chrono::high_resolution_clock::now();
 
-	std::cout << "Generated in " << std::chrono::duration_cast<std::chrono::milliseconds>(mid_time - start_time).count() << " milliseconds." << std::endl;
+	auto generation_ms = std::chrono::duration_cast<std::chrono::milliseconds>(mid_time - start_time).count();
+	std::cout << "Generated in " << generation_ms << " milliseconds";
+	// Throughput in megapixels per second of the full resolution maps
+	std::cout << " (" << static_cast<double>(resolution * resolution) / (std::max(generation_ms, 1ll) * 1000.0) << " MPixel/s)." << std::endl;
 	std::cout << "Saved in " << std::chrono::duration_cast<std::chrono::milliseconds>(end_time - mid_time).count() << " milliseconds." << std::endl;
 
 	return EXIT_SUCCESS;
 }
 
-bool interpret_arguments(int argc, _TCHAR* argv[], int64_t& resolution, _TCHAR*& heightmap_path, _TCHAR*& color_path, _TCHAR*& normalmap_path)
+bool interpret_arguments(int argc, _TCHAR* argv[], int64_t& resolution, int64_t& thread_count, int64_t& memory_budget, _TCHAR*& scratch_directory,
+	_TCHAR*& cache_directory, SimdLevel& simd_level, std::unique_ptr<HeightfieldSource>& source, ErosionSettings& erosion, FieldStorage& storage, bool& benchmark,
+	bool& benchmark_sources, bool& benchmark_packing, bool& benchmark_colors, BenchmarkOptions& benchmark_options, bool& unfused, bool& save_mips, MipFilter& mip_filter,
+	_TCHAR*& heightmap_path, _TCHAR*& color_path, _TCHAR*& normalmap_path)
 {
+	// The source is created after all arguments are read, since -seed may follow -source
+	_TCHAR* source_name = nullptr;
+
 	// Interpret the command line arguments, similiar to the config parser
 	// Start with 1 since the first argument is the current path
 	for (int i = 1; i < argc; i++)
@@ -85,6 +212,192 @@ bool interpret_arguments(int argc, _TCHAR* argv[], int64_t& resolution, _TCHAR*&
 			else
 				std::cout << "ERROR: Terrain resolution parameter missing." << std::endl;
 		}
+		else if (_tcscmp(TEXT("-threads"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				thread_count = _tstoi64(argv[i]);
+			else
+				std::cout << "ERROR: Thread count parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-memory_budget"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				memory_budget = _tstoi64(argv[i]);
+			else
+				std::cout << "ERROR: Memory budget parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-scratch"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				scratch_directory = argv[i];
+			else
+				std::cout << "ERROR: Scratch directory parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-cache"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				cache_directory = argv[i];
+			else
+				std::cout << "ERROR: Cache directory parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-seed"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				g_terrain_seed = static_cast<uint64_t>(_tstoi64(argv[i]));
+			else
+				std::cout << "ERROR: Seed parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-source"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				source_name = argv[i];
+			else
+				std::cout << "ERROR: Heightfield source parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-erosion"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				erosion.iterations = _tstoi64(argv[i]);
+			else
+				std::cout << "ERROR: Erosion iteration count parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-erosion_ms"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				erosion.time_budget_ms = _tstof(argv[i]);
+			else
+				std::cout << "ERROR: Erosion time budget parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-erosion_rain"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				erosion.rain = static_cast<float>(_tstof(argv[i]));
+			else
+				std::cout << "ERROR: Erosion rain parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-erosion_capacity"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				erosion.capacity = static_cast<float>(_tstof(argv[i]));
+			else
+				std::cout << "ERROR: Erosion sediment capacity parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-erosion_talus"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				erosion.talus = static_cast<float>(_tstof(argv[i]));
+			else
+				std::cout << "ERROR: Erosion talus slope parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-storage"), argv[i]) == 0)
+		{
+			i++;
+			if (i >= argc)
+				std::cout << "ERROR: Storage format parameter missing." << std::endl;
+			else if (!parse_field_storage(argv[i], storage))
+				std::wcout << "WARNING: Unknown storage format (will be ignored): " << argv[i] << std::endl;
+		}
+		else if (_tcscmp(TEXT("-dds_color"), argv[i]) == 0)
+		{
+			i++;
+			if (i >= argc)
+				std::cout << "ERROR: DDS color format parameter missing." << std::endl;
+			else if (!parse_color_block_format(argv[i], g_dds_color_format))
+				std::wcout << "WARNING: Unknown DDS color format (will be ignored): " << argv[i] << std::endl;
+		}
+		else if (_tcscmp(TEXT("-simd"), argv[i]) == 0)
+		{
+			i++;
+			if (i >= argc)
+				std::cout << "ERROR: SIMD instruction set parameter missing." << std::endl;
+			else if (!parse_simd_level(argv[i], simd_level))
+				std::wcout << "WARNING: Unknown SIMD instruction set (will be ignored): " << argv[i] << std::endl;
+		}
+		else if (_tcscmp(TEXT("-benchmark_normals"), argv[i]) == 0)
+		{
+			benchmark = true;
+		}
+		else if (_tcscmp(TEXT("-benchmark_sources"), argv[i]) == 0)
+		{
+			benchmark_sources = true;
+		}
+		else if (_tcscmp(TEXT("-benchmark_packing"), argv[i]) == 0)
+		{
+			benchmark_packing = true;
+		}
+		else if (_tcscmp(TEXT("-benchmark_colors"), argv[i]) == 0)
+		{
+			benchmark_colors = true;
+		}
+		else if (_tcscmp(TEXT("-benchmark"), argv[i]) == 0)
+		{
+			benchmark_options.enabled = true;
+		}
+		else if (_tcscmp(TEXT("-benchmark_runs"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				benchmark_options.runs = _tstoi64(argv[i]);
+			else
+				std::cout << "ERROR: Benchmark run count parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-benchmark_warmup"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				benchmark_options.warmup_runs = _tstoi64(argv[i]);
+			else
+				std::cout << "ERROR: Benchmark warmup run count parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-benchmark_json"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				benchmark_options.json_path = argv[i];
+			else
+				std::cout << "ERROR: Benchmark result path missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-benchmark_baseline"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				benchmark_options.baseline_path = argv[i];
+			else
+				std::cout << "ERROR: Benchmark baseline path missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-benchmark_tolerance"), argv[i]) == 0)
+		{
+			i++;
+			if (i < argc)
+				benchmark_options.tolerance = _tstof(argv[i]) / 100.0;
+			else
+				std::cout << "ERROR: Benchmark tolerance parameter missing." << std::endl;
+		}
+		else if (_tcscmp(TEXT("-mips"), argv[i]) == 0)
+		{
+			i++;
+			if (i >= argc)
+				std::cout << "ERROR: Mip filter parameter missing." << std::endl;
+			else if (parse_mip_filter(argv[i], mip_filter))
+				save_mips = true;
+			else
+				std::wcout << "WARNING: Unknown mip filter (will be ignored): " << argv[i] << std::endl;
+		}
+		else if (_tcscmp(TEXT("-unfused"), argv[i]) == 0)
+		{
+			unfused = true;
+		}
 		else if (_tcscmp(TEXT("-o_height"), argv[i]) == 0)
 		{
 			i++;
@@ -114,16 +427,68 @@ bool interpret_arguments(int argc, _TCHAR* argv[], int64_t& resolution, _TCHAR*&
 			std::cout << "WARNING: Unknown parameter (will be ignored): " << argv[i] << std::endl;
 		}
 	}
+	if (thread_count <= 0)
+	{
+		std::cout << "ERROR: Thread count must be greater than 0" << std::endl;
+		return false;
+	}
+	// The benchmarks use their own resolutions and do not write any files
+	if (benchmark || benchmark_sources || benchmark_packing || benchmark_colors)
+		return true;
+
+	if (source_name != nullptr)
+	{
+		source = create_heightfield_source(source_name, g_terrain_seed);
+		if (!source)
+			std::wcout << "WARNING: Unknown heightfield source (will be ignored): " << source_name << std::endl;
+	}
+	if (!source)
+		source = create_heightfield_source(L"diamond_square", g_terrain_seed);
+
+	// The benchmark suite sweeps the resolutions up to -r, without output paths
+	if (benchmark_options.enabled)
+	{
+		if (resolution != 0)
+			benchmark_options.max_resolution = resolution;
+		if (benchmark_options.max_resolution < 4 || (benchmark_options.max_resolution & (benchmark_options.max_resolution - 1)) != 0)
+		{
+			std::cout << "ERROR: Resolution must be a power of two of at least 4" << std::endl;
+			return false;
+		}
+		if (benchmark_options.runs <= 0 || benchmark_options.warmup_runs < 0)
+		{
+			std::cout << "ERROR: Benchmark needs at least one run and a non-negative number of warmup runs" << std::endl;
+			return false;
+		}
+		if (benchmark_options.tolerance < 0.0)
+		{
+			std::cout << "ERROR: Benchmark tolerance must not be negative" << std::endl;
+			return false;
+		}
+		return true;
+	}
+
 	// Check if all necessary parameters are set
 	// We cannot check here if the paths are valid
-	if (resolution <= 0)
+	// The heightmap is a quarter of the resolution, so it needs at least 4 pixels
+	if (resolution < 4)
 	{
-		std::cout << "ERROR: Resolution must be greater than 0" << std::endl;
+		std::cout << "ERROR: Resolution must be at least 4" << std::endl;
 		return false;
 	}
-	else if ((resolution & (resolution - 1)) != 0) // using https://iq.opengenus.org/detect-if-a-number-is-power-of-2-using-bitwise-operators/
+	else if (!source->supports_resolution(resolution))
 	{
-		std::cout << "ERROR: Resolution must be a power of two" << std::endl;
+		std::cout << "ERROR: Resolution is not supported by " << source->get_name() << ", Diamond-Square needs a power of two" << std::endl;
+		return false;
+	}
+	if (memory_budget < 0)
+	{
+		std::cout << "ERROR: Memory budget must not be negative" << std::endl;
+		return false;
+	}
+	if (erosion.iterations < 0 || erosion.time_budget_ms < 0.0 || erosion.rain < 0.0f || erosion.capacity < 0.0f || erosion.talus < 0.0f)
+	{
+		std::cout << "ERROR: Erosion parameters must not be negative" << std::endl;
 		return false;
 	}
 	if (heightmap_path == nullptr)
@@ -141,246 +506,238 @@ bool interpret_arguments(int argc, _TCHAR* argv[], int64_t& resolution, _TCHAR*&
 		std::cout << "ERROR: Please provide a path for the normalmap using -o_normal" << std::endl;
 		return false;
 	}
+	// The game reads the heights on the CPU, so only the textures are block compressed
+	if (is_dds_path(heightmap_path))
+	{
+		std::cout << "ERROR: The heightmap cannot be saved as DDS, please use PNG or TIFF" << std::endl;
+		return false;
+	}
+	// The mip chain needs the whole next level, which does not fit the streaming generator
+	if (memory_budget > 0 && (is_dds_path(color_path) || is_dds_path(normalmap_path)))
+	{
+		std::cout << "ERROR: DDS output is not supported together with -memory_budget" << std::endl;
+		return false;
+	}
 
 	return true;
 }
 
-std::vector<float> generate_heightfield(int64_t resolution)
+std::vector<float> generate_heightfield(const HeightfieldSource& source, int64_t resolution)
 {
-	std::default_random_engine rand(4u);
-	std::normal_distribution<float> dist(0.0f, 1.f);
-
-	int64_t ds_res = resolution + 1;
-	std::vector<float> ds_field(ds_res * ds_res);
+	std::vector<float> heightfield = generate_source_field(source, resolution);
 
-	// Initialize corners
-	ds_field[0] = dist(rand);
-	ds_field[ds_res - 1] = dist(rand);
-	ds_field[(ds_res - 1) * ds_res] = dist(rand);
-	ds_field[ds_res - 1 + (ds_res - 1) * ds_res] = dist(rand);
-
-	float step = 1;
-	for (int64_t distance = ds_res - 1; distance >= 1; distance = distance / 2)
+	// Compress heights to [0;1]
+	// Every band computes its own extremes, which are combined afterwards
+	std::vector<float> band_min(g_thread_count, heightfield[0]);
+	std::vector<float> band_max(g_thread_count, heightfield[0]);
+	parallel_for(0, g_thread_count, [&](int64_t band_begin, int64_t band_end)
 	{
-		dist = std::normal_distribution<float>(0, pow(0.56f, step));
-
-		// Diamond
-		for (int64_t y = 0; y < ds_res - 1; y += distance)
-			for (int64_t x = 0; x < ds_res - 1; x += distance)
-			{
-				//  1   2
-				//    # 
-				//  3   4
-				float sum = 0;
-				sum += ds_field[idx(x, y, ds_res)]; // 1
-				sum += ds_field[idx(x + distance, y, ds_res)]; // 2
-				sum += ds_field[idx(x, y + distance, ds_res)]; // 3
-				sum += ds_field[idx(x + distance, y + distance, ds_res)]; // 4
-				ds_field[idx(x + distance / 2, y + distance / 2, ds_res)] = sum / 4.0f + dist(rand);
-			}
-
-		step++;
-
-		// Square
-		for (int64_t y = 0; y < ds_res - 1; y += distance)
-			for (int64_t x = 0; x < ds_res - 1; x += distance)
-			{
-				float sum;
-				float count;
-
-				//    4
-				//  1 # 2
-				//    3
-				//  X   X
-				//  
-				sum = 0.0f;
-				sum += ds_field[idx(x, y, ds_res)]; // 1
-				sum += ds_field[idx(x + distance, y, ds_res)]; // 2
-				sum += ds_field[idx(x + distance / 2, y + distance / 2, ds_res)]; // 3
-				if (y >= distance)
-				{
-					sum += ds_field[idx(x + distance / 2, y - distance / 2, ds_res)]; // 4
-					count = 4.0f;
-				}
-				else
-					count = 3.0f;
-				ds_field[idx(x + distance / 2, y, ds_res)] = sum / count + dist(rand);
-
-				//     
-				//  1 X X
-				//4 # 3
-				//  2   X
-				// 
-				sum = 0.0f;
-				sum += ds_field[idx(x, y, ds_res)]; // 1
-				sum += ds_field[idx(x, y + distance, ds_res)]; // 2
-				sum += ds_field[idx(x + distance / 2, y + distance / 2, ds_res)]; // 3
-				if (x >= distance)
-				{
-					sum += ds_field[idx(x - distance / 2, y + distance / 2, ds_res)]; // 4
-					count = 4.0f;
-				}
-				else
-					count = 3.0f;
-				ds_field[idx(x, y + distance / 2, ds_res)] = sum / count + dist(rand);
-
-				//     
-				//  X X 1
-				//  X 3 # 4
-				//  X   2
-				// 
-				sum = 0.0f;
-				sum += ds_field[idx(x + distance, y, ds_res)]; // 1
-				sum += ds_field[idx(x + distance, y + distance, ds_res)]; // 2
-				sum += ds_field[idx(x + distance / 2, y + distance / 2, ds_res)]; // 3
-				if (x + distance > ds_res)
-				{
-					sum += ds_field[idx(x + distance + distance / 2, y + distance / 2, ds_res)]; // 4
-					count = 4.0f;
-				}
-				else
-					count = 3.0f;
-				ds_field[idx(x + distance, y + distance / 2, ds_res)] = sum / count + dist(rand);
-
-				//    
-				//  X X X
-				//  X 3 X
-				//  1 # 2
-				//    4
-				sum = 0.0f;
-				sum += ds_field[idx(x, y + distance, ds_res)]; // 1
-				sum += ds_field[idx(x + distance, y + distance, ds_res)]; // 2
-				sum += ds_field[idx(x + distance / 2, y + distance / 2, ds_res)]; // 3
-				if (y + distance > ds_res)
-				{
-					sum += ds_field[idx(x + distance / 2, y + distance + distance / 2, ds_res)]; // 4
-					count = 4.0f;
-				}
-				else
-					count = 3.0f;
-				ds_field[idx(x + distance / 2, y + distance, ds_res)] = sum / count + dist(rand);
-			}
-	}
-
-	// Copy the temporary array to the output row by row due to the different row lengths
-	std::vector<float> heightfield(resolution * resolution);
-	for (int64_t y = 0; y < resolution; y++)
-		std::copy(&ds_field[idx(0, y, ds_res)], &ds_field[idx(resolution, y, ds_res)], &heightfield[idx(0, y, resolution)]);
+		for (int64_t band = band_begin; band < band_end; band++)
+		{
+			auto first = heightfield.begin() + resolution * resolution * band / g_thread_count;
+			auto last = heightfield.begin() + resolution * resolution * (band + 1) / g_thread_count;
+			if (first == last)
+				continue;
+			band_min[band] = *std::min_element(first, last);
+			band_max[band] = *std::max_element(first, last);
+		}
+	});
+	float max = *std::max_element(band_max.begin(), band_max.end());
+	float min = *std::min_element(band_min.begin(), band_min.end());
 
-	// Compress heights to [0;1]
-	float max = *std::max_element(heightfield.begin(), heightfield.end());
-	float min = *std::min_element(heightfield.begin(), heightfield.end());
-	for (auto& value : heightfield)
-		value = clamp(map_range(value, min, max));
+	parallel_for(0, resolution * resolution, [&](int64_t begin, int64_t end)
+	{
+		for (int64_t i = begin; i < end; i++)
+			heightfield[i] = clamp(map_range(heightfield[i], min, max));
+	});
 
 	return heightfield;
 }
 
-std::vector<GEDUtils::Vec3f> generate_normals(std::vector<float>& height, int64_t resolution)
+NormalStore generate_normals(const HeightStore& height, int64_t resolution)
 {
-	std::vector<GEDUtils::Vec3f> normal(resolution * resolution);
+	NormalStore normal(height.get_storage(), resolution, resolution);
 
-	for (int64_t y = 0; y < resolution; y++)
-		for (int64_t x = 0; x < resolution; x++)
+	parallel_for(0, resolution, [&](int64_t row_begin, int64_t row_end)
+	{
+		HeightRows rows(height);
+		std::vector<GEDUtils::Vec3f> scratch(resolution);
+		for (int64_t y = row_begin; y < row_end; y++)
 		{
-			float n_x, n_y, n_z;
-
-			// Compute X
-			if (x == 0)
-				n_x = height[idx(x + 1, y, resolution)] - height[idx(x, y, resolution)];
-			else if (x == resolution - 1)
-				n_x = height[idx(x, y, resolution)] - height[idx(x - 1, y, resolution)];
-			else
-				n_x = (height[idx(x + 1, y, resolution)] - height[idx(x - 1, y, resolution)]) / 2;
+			GEDUtils::Vec3f* out = normal.begin_row(y, scratch.data());
 
 			// Compute Y
 			if (y == 0)
-				n_y = height[idx(x, y + 1, resolution)] - height[idx(x, y, resolution)];
+				normal_row(rows.row(y), rows.row(y + 1), 1.0f, rows.row(y), resolution, out);
 			else if (y == resolution - 1)
-				n_y = height[idx(x, y, resolution)] - height[idx(x, y - 1, resolution)];
+				normal_row(rows.row(y - 1), rows.row(y), 1.0f, rows.row(y), resolution, out);
 			else
-				n_y = (height[idx(x, y + 1, resolution)] - height[idx(x, y - 1, resolution)]) / 2;
-
-			// Set Z
-			n_z = 1.0f / resolution;
+				normal_row(rows.row(y - 1), rows.row(y + 1), 0.5f, rows.row(y), resolution, out);
 
-			// Normalize
-			float length = sqrt(n_x * n_x + n_y * n_y + n_z * n_z);
-			n_x /= -length;
-			n_y /= -length;
-			n_z /= length;
-
-			normal[idx(x, y, resolution)] = GEDUtils::Vec3f(n_x * 0.5f + 0.5f, n_y * 0.5f + 0.5f, n_z * 0.5f + 0.5f);
+			normal.store_row(y, out);
 		}
+	});
 
 	return normal;
 }
 
-std::vector<GEDUtils::Vec3f> generate_colors(std::vector<float>& height, std::vector<GEDUtils::Vec3f>& normal, int64_t resolution)
+std::vector<GEDUtils::Vec3f> generate_colors(const HeightStore& height, const NormalStore& normal, int64_t resolution)
 {
-	GEDUtils::SimpleImage tex_low_flat(L"../../../../external/textures/mud02.jpg");
-	GEDUtils::SimpleImage tex_low_steep(L"../../../../external/textures/rock3.jpg");
-	GEDUtils::SimpleImage tex_high_flat(L"../../../../external/textures/gras15.jpg");
-	GEDUtils::SimpleImage tex_high_steep(L"../../../../external/textures/rock3.jpg");
+	TerrainTextures textures;
 
 	std::vector<GEDUtils::Vec3f> color(resolution * resolution);
 
-	for (int64_t y = 0; y < resolution; y++)
-		for (int64_t x = 0; x < resolution; x++)
-		{
-			// Compute texture coordinates
-			UINT u = static_cast<UINT>(x);
-			UINT v = static_cast<UINT>(y);
-
-			// Compute alpha
-			float alpha_slope = smoothstep(clamp(map_range(1.0f - normal[idx(x, y, resolution)].z, 0.1f, 0.2f)));
-			float alpha_height = smoothstep(clamp(map_range(height[idx(x, y, resolution)], 0.3f, 0.32f)));
-
-			// Sample textures
-			GEDUtils::Vec3f low_flat = texture(tex_low_flat, u, v);
-			GEDUtils::Vec3f low_steep = texture(tex_low_steep, u, v);
-			GEDUtils::Vec3f high_flat = texture(tex_high_flat, u, v);
-			GEDUtils::Vec3f high_steep = texture(tex_high_steep, u, v);
-
-			// Blend
-			GEDUtils::Vec3f low = blend(low_flat, low_steep, alpha_slope);
-			GEDUtils::Vec3f high = blend(high_flat, high_steep, alpha_slope);
-
-			color[idx(x, y, resolution)] = blend(low, high, alpha_height);
-		}
+	parallel_for(0, resolution, [&](int64_t row_begin, int64_t row_end)
+	{
+		std::vector<float> height_scratch(resolution);
+		std::vector<GEDUtils::Vec3f> normal_scratch(resolution);
+		for (int64_t y = row_begin; y < row_end; y++)
+			color_row(height.load_row(y, height_scratch.data()), normal.load_row(y, normal_scratch.data()), y, resolution, textures,
+				&color[idx(0, y, resolution)]);
+	});
 
 	return color;
 }
 
 void smooth_heightfield(std::vector<float>& height, int64_t resolution, int64_t iterations, int64_t kernel_size)
+{
+	smooth_heightfield(height.data(), resolution, iterations, kernel_size, nullptr);
+}
+
+bool smooth_heightfield(float* height, int64_t resolution, int64_t iterations, int64_t kernel_size, const ProgressCallback& progress)
 {
 	// Nothing to do
 	if (iterations <= 0)
-		return;
+		return true;
 
-	std::vector<float> tmp_field(resolution * resolution);
+	std::vector<float*> rows(resolution);
+	for (int64_t y = 0; y < resolution; y++)
+		rows[y] = &height[idx(0, y, resolution)];
+
+	// Column blocks of the vertical pass, as wide as the cache blocks of blur_columns
+	const int64_t block_size = 256;
+	int64_t blocks = (resolution + block_size - 1) / block_size;
 
-	// Two pass smoothing
+	// Two pass smoothing with sliding windows, so the cost does not depend on the kernel size
 	for (int64_t i = 0; i < iterations; i++)
 	{
-		// Horizontal
-		for (int64_t y = 0; y < resolution; y++)
-			for (int64_t x = 0; x < resolution; x++)
+		// Horizontal, every row is blurred into a scratch row and copied back
+		parallel_for(0, resolution, [&](int64_t row_begin, int64_t row_end)
+		{
+			std::vector<float> blurred(resolution);
+			for (int64_t y = row_begin; y < row_end; y++)
 			{
-				float smoothed = 0.0f;
-				for (int64_t k = -kernel_size; k <= kernel_size; k++)
-					smoothed += height[idx(std::min(std::max(x + k, 0ll), resolution - 1), y, resolution)];
-				tmp_field[idx(x, y, resolution)] = smoothed / (kernel_size * 2 + 1);
+				blur_row(rows[y], blurred.data(), resolution, kernel_size);
+				std::copy(blurred.begin(), blurred.end(), rows[y]);
 			}
+		});
+		if (progress && !progress((2.0 * i + 1.0) / (2.0 * iterations)))
+			return false;
+
 		// Vertical
-		for (int64_t y = 0; y < resolution; y++)
-			for (int64_t x = 0; x < resolution; x++)
+		parallel_for(0, blocks, [&](int64_t block_begin, int64_t block_end)
+		{
+			std::vector<float> ring((kernel_size + 2) * block_size);
+			for (int64_t block = block_begin; block < block_end; block++)
+				blur_columns_in_place(rows.data(), resolution, kernel_size, block * block_size,
+					std::min((block + 1) * block_size, resolution), ring.data());
+		});
+		if (progress && !progress((2.0 * i + 2.0) / (2.0 * iterations)))
+			return false;
+	}
+	return true;
+}
+
+void blur_row(const float* in, float* out, int64_t resolution, int64_t kernel_size)
+{
+	// Sum of the taps around x = 0, the taps left of the border repeat the first pixel
+	// Accumulating in double keeps the running sum from drifting on long rows
+	double sum = 0.0;
+	for (int64_t k = -kernel_size; k <= kernel_size; k++)
+		sum += in[std::min(std::max(k, 0ll), resolution - 1)];
+
+	double normalize = 1.0 / (kernel_size * 2 + 1);
+	for (int64_t x = 0; x < resolution; x++)
+	{
+		out[x] = static_cast<float>(sum * normalize);
+		// Slide the window by one pixel
+		sum += in[std::min(x + kernel_size + 1, resolution - 1)] - in[std::max(x - kernel_size, 0ll)];
+	}
+}
+
+void blur_columns(const float* const* in, float* const* out, int64_t resolution, int64_t kernel_size,
+	int64_t row_begin, int64_t row_end, int64_t column_begin, int64_t column_end)
+{
+	// Blocks of columns keep the running sums and the touched part of each row in the L1 cache
+	const int64_t block_size = 256;
+	double sums[block_size];
+	double normalize = 1.0 / (kernel_size * 2 + 1);
+
+	for (int64_t block_begin = column_begin; block_begin < column_end; block_begin += block_size)
+	{
+		int64_t block_end = std::min(block_begin + block_size, column_end);
+		int64_t width = block_end - block_begin;
+
+		// Sums of the taps around the first row, taps outside of the field repeat the border row
+		std::fill(sums, sums + width, 0.0);
+		for (int64_t k = -kernel_size; k <= kernel_size; k++)
+		{
+			const float* row = in[std::min(std::max(row_begin + k, 0ll), resolution - 1)] + block_begin;
+			for (int64_t x = 0; x < width; x++)
+				sums[x] += row[x];
+		}
+
+		for (int64_t y = row_begin; y < row_end; y++)
+		{
+			const float* entering = in[std::min(y + kernel_size + 1, resolution - 1)] + block_begin;
+			const float* leaving = in[std::max(y - kernel_size, 0ll)] + block_begin;
+			float* target = out[y] + block_begin;
+			for (int64_t x = 0; x < width; x++)
 			{
-				float smoothed = 0.0f;
-				for (int64_t k = -kernel_size; k <= kernel_size; k++)
-					smoothed += tmp_field[idx( x, std::min(std::max(y + k, 0ll), resolution - 1), resolution)];
-				height[idx(x, y, resolution)] = smoothed / (kernel_size * 2 + 1);
+				target[x] = static_cast<float>(sums[x] * normalize);
+				// Slide the window down by one row
+				sums[x] += entering[x] - leaving[x];
 			}
+		}
+	}
+}
+
+void blur_columns_in_place(float* const* rows, int64_t resolution, int64_t kernel_size, int64_t column_begin, int64_t column_end, float* ring)
+{
+	int64_t width = column_end - column_begin;
+	double normalize = 1.0 / (kernel_size * 2 + 1);
+
+	// The window leaves row y - kernel_size after row y was overwritten, so the original rows
+	// [y - kernel_size; y] are kept in a ring, and row 0 on its own for the taps above the field
+	float* first = ring + (kernel_size + 1) * width;
+	auto original = [&](int64_t y) { return y <= 0 ? first : ring + y % (kernel_size + 1) * width; };
+	std::copy(rows[0] + column_begin, rows[0] + column_end, first);
+
+	// Sums of the taps around the first row, taps outside of the field repeat the border row
+	std::vector<double> sums(width, 0.0);
+	for (int64_t k = -kernel_size; k <= kernel_size; k++)
+	{
+		const float* row = rows[std::min(std::max(k, 0ll), resolution - 1)] + column_begin;
+		for (int64_t x = 0; x < width; x++)
+			sums[x] += row[x];
+	}
+
+	for (int64_t y = 0; y < resolution; y++)
+	{
+		float* target = rows[y] + column_begin;
+		if (y > 0)
+			std::copy(target, target + width, original(y));
+		const float* entering = rows[std::min(y + kernel_size + 1, resolution - 1)] + column_begin;
+		const float* leaving = original(y - kernel_size);
+
+		// In the last step the entering row is the target itself, so it is read before it is written
+		for (int64_t x = 0; x < width; x++)
+		{
+			float value = static_cast<float>(sums[x] * normalize);
+			// Slide the window down by one row, same order of operations as blur_columns
+			sums[x] += entering[x] - leaving[x];
+			target[x] = value;
+		}
 	}
 }
 
@@ -392,113 +749,112 @@ void make_pretty(std::vector<float>& height, int64_t resolution)
 	smooth_heightfield(smoothed, resolution, 1, std::max(resolution / 40ll, 1ll));
 
 	for (int64_t y = 0; y < resolution; y++)
-		for (int64_t x = 0; x < resolution; x++)
-		{
-			// Compute mix factor from terrain slope
-			float mix = 0;
-			if (x == 0)
-				mix += abs(smoothed[idx(x + 2, y, resolution)] - smoothed[idx(x, y, resolution)]);
-			else if (x == resolution - 1)
-				mix += abs(smoothed[idx(x, y, resolution)] - smoothed[idx(x - 2, y, resolution)]);
-			else
-				mix += abs(smoothed[idx(x + 1, y, resolution)] - smoothed[idx(x - 1, y, resolution)]);
-			if (y == 0)
-				mix += abs(smoothed[idx(x, y + 2, resolution)] - smoothed[idx(x, y, resolution)]);
-			else if (y == resolution - 1)
-				mix += abs(smoothed[idx(x, y, resolution)] - smoothed[idx(x, y - 2, resolution)]);
-			else
-				mix += abs(smoothed[idx(x, y + 1, resolution)] - smoothed[idx(x, y - 1, resolution)]);
+	{
+		if (y == 0)
+			mix_row(&height[idx(0, y, resolution)], &smoothed[idx(0, y, resolution)], &smoothed[idx(0, y, resolution)], &smoothed[idx(0, y + 2, resolution)], resolution, &height[idx(0, y, resolution)]);
+		else if (y == resolution - 1)
+			mix_row(&height[idx(0, y, resolution)], &smoothed[idx(0, y, resolution)], &smoothed[idx(0, y - 2, resolution)], &smoothed[idx(0, y, resolution)], resolution, &height[idx(0, y, resolution)]);
+		else
+			mix_row(&height[idx(0, y, resolution)], &smoothed[idx(0, y, resolution)], &smoothed[idx(0, y - 1, resolution)], &smoothed[idx(0, y + 1, resolution)], resolution, &height[idx(0, y, resolution)]);
+	}
+}
 
-			mix = smoothstep(smoothstep(clamp(mix * (resolution / 8))));
+void mix_row(const float* height, const float* smoothed, const float* smoothed_above, const float* smoothed_below, int64_t resolution, float* out)
+{
+	for (int64_t x = 0; x < resolution; x++)
+	{
+		// Compute mix factor from terrain slope
+		float mix = 0;
+		if (x == 0)
+			mix += std::abs(smoothed[x + 2] - smoothed[x]);
+		else if (x == resolution - 1)
+			mix += std::abs(smoothed[x] - smoothed[x - 2]);
+		else
+			mix += std::abs(smoothed[x + 1] - smoothed[x - 1]);
+		mix += std::abs(smoothed_below[x] - smoothed_above[x]);
 
-			// Mix original and smoothed heightfield
-			float value = height[idx(x, y, resolution)] * mix + smoothed[idx(x, y, resolution)] * (1.0f - mix);
-			height[idx(x, y, resolution)] = value * value;
-		}
+		mix = smoothstep(smoothstep(clamp(mix * (resolution / 8))));
+
+		// Mix original and smoothed heightfield
+		float value = height[x] * mix + smoothed[x] * (1.0f - mix);
+		out[x] = value * value;
+	}
 }
 
 bool save_image(std::vector<float>& data, int64_t resolution, _TCHAR* path)
 {
-	GEDUtils::SimpleImage image(static_cast<UINT>(resolution), static_cast<UINT>(resolution));
-
-	for (int64_t y = 0; y < resolution; y++)
-		for (int64_t x = 0; x < resolution; x++)
-			image.setPixel(static_cast<UINT>(x), static_cast<UINT>(y), data[idx(x, y, resolution)]);
-
-	return image.save(path);
+	return write_image(data.data(), resolution, resolution, path);
 }
 
 bool save_image(std::vector<GEDUtils::Vec3f>& data, int64_t resolution, _TCHAR* path)
 {
-	GEDUtils::SimpleImage image(static_cast<UINT>(resolution), static_cast<UINT>(resolution));
+	return write_image(data.data(), resolution, resolution, path);
+}
 
-	for (int64_t y = 0; y < resolution; y++)
-		for (int64_t x = 0; x < resolution; x++)
-			image.setPixel(static_cast<UINT>(x), static_cast<UINT>(y),
-				data[idx(x, y, resolution)].x,
-				data[idx(x, y, resolution)].y,
-				data[idx(x, y, resolution)].z);
+bool save_image(const NormalStore& data, _TCHAR* path)
+{
+	return write_image(data, path);
+}
 
-	return image.save(path);
+bool save_image(const ColorStore& data, _TCHAR* path)
+{
+	return write_image(data, path);
 }
 
-std::vector<float> resize_heightfield(std::vector<float>& height, int64_t resolution)
+std::vector<float> resize_heightfield(const HeightStore& height, int64_t resolution)
 {
 	std::vector<float> output(resolution * resolution / 16);
+	std::vector<float> scratch(4 * resolution);
 
 	for (int64_t y = 0; y < resolution / 4; y++)
-		for (int64_t x = 0; x < resolution / 4; x++)
-		{
-			float sum = 0;
-
-			for (int64_t y_loc = y * 4; y_loc < (y * 4) + 4; y_loc++)
-				for (int64_t x_loc = x * 4; x_loc < (x * 4) + 4; x_loc++)
-					sum += height[idx(x_loc, y_loc, resolution)];
-
-			output[idx(x, y, resolution / 4)] = sum / 16;
-		}
+	{
+		const float* block = height.load_rows(y * 4, 4, scratch.data());
+		const float* rows[4] = {
+			&block[idx(0, 0, resolution)],
+			&block[idx(0, 1, resolution)],
+			&block[idx(0, 2, resolution)],
+			&block[idx(0, 3, resolution)] };
+		downsample_row(rows, resolution, &output[idx(0, y, resolution / 4)]);
+	}
 
 	return output;
 }
 
-// Grants access to a flattened array
-// inline tells the compiler to replace the method call with the method body
-inline int64_t idx(int64_t x, int64_t y, int64_t size)
+void downsample_row(const float* const* rows, int64_t resolution, float* out)
 {
-	return x + y * size;
-}
+	for (int64_t x = 0; x < resolution / 4; x++)
+	{
+		float sum = 0;
 
-// Smoothstep from https://en.wikipedia.org/wiki/Smoothstep
-inline float smoothstep(float x)
-{
-	return x * x * (3.0f - 2.0f * x);
-}
+		for (int64_t y_loc = 0; y_loc < 4; y_loc++)
+			for (int64_t x_loc = x * 4; x_loc < (x * 4) + 4; x_loc++)
+				sum += rows[y_loc][x_loc];
 
-// std::clamp is only available in C++ 17+
-inline float clamp(float x, float min, float max)
-{
-	return std::min(std::max(min, x), max);
+		out[x] = sum / 16;
+	}
 }
 
-inline float map_range(float x, float from_low, float from_high, float to_low, float to_high)
+// Counter based random number: the value only depends on its key (seed, x, y, level)
+// and not on the order in which the cells are visited, so any number of threads gives the same terrain
+// Mixing function is the SplitMix64 finalizer, see http://prng.di.unimi.it/splitmix64.c
+inline uint64_t mix64(uint64_t z)
 {
-	return ((x - from_low) / (from_high - from_low)) * (to_high - to_low) + to_low;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
 }
 
-inline GEDUtils::Vec3f blend(GEDUtils::Vec3f& a, GEDUtils::Vec3f& b, float alpha)
+// Standard normal distributed value for the given key (Box-Muller transform)
+float random_normal(uint64_t seed, int64_t x, int64_t y, int64_t level)
 {
-	GEDUtils::Vec3f result;
-	result.x = a.x * (1.0f - alpha) + b.x * alpha;
-	result.y = a.y * (1.0f - alpha) + b.y * alpha;
-	result.z = a.z * (1.0f - alpha) + b.z * alpha;
-	return result;
+	uint64_t h = mix64(seed + 0x9E3779B97F4A7C15ull);
+	h = mix64(h ^ static_cast<uint64_t>(level));
+	h = mix64(h ^ static_cast<uint64_t>(y));
+	h = mix64(h ^ static_cast<uint64_t>(x));
+	uint64_t h2 = mix64(h + 0x9E3779B97F4A7C15ull);
+
+	// Uniform values in (0;1] and [0;1) with 53 bit precision
+	double u1 = ((h >> 11) + 1) * (1.0 / 9007199254740992.0);
+	double u2 = (h2 >> 11) * (1.0 / 9007199254740992.0);
+	return static_cast<float>(sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2));
 }
-
-// Texture lookup with repeat
-// u and v still have to be positive
-inline GEDUtils::Vec3f texture(GEDUtils::SimpleImage& tex, UINT u, UINT v)
-{
-	GEDUtils::Vec3f result;
-	tex.getPixel(u % tex.getWidth(), v % tex.getHeight(), result.x, result.y, result.z);
-	return result;
-}
\ No newline at end of file
@@ -0,0 +1,192 @@
+#pragma once
+
+#define NOMINMAX // prevents overlap of Windows.h with the std
+
+#include <Windows.h>
+#include <tchar.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <SimpleImage.h>
+#include <TextureGenerator.h>
+
+// Seed of the heightfield source, can be changed with -seed
+extern uint64_t g_terrain_seed;
+
+// Number of threads used by parallel_for, can be changed with -threads
+extern unsigned int g_thread_count;
+
+// Called with the share of the work which is done, in [0;1], returning false cancels the work
+// Lets a running program generate terrain on demand without blocking for the whole field
+typedef std::function<bool(double done)> ProgressCallback;
+
+// Texture decoded once into planar float and byte channels
+// Every row is followed by a copy of its first texels, so a vector load starting at any
+// texel of the row wraps around the right border without a modulo per pixel
+struct TextureAtlas
+{
+	static const int64_t padding = 16;
+
+	explicit TextureAtlas(const wchar_t* path);
+
+	// Row v of the given channel (0 = red, 1 = green, 2 = blue), v has to be in [0; height)
+	const float* row(int64_t channel, int64_t v) const { return &texels[(channel * height + v) * stride]; }
+	const uint8_t* byte_row(int64_t channel, int64_t v) const { return &bytes[(channel * height + v) * stride]; }
+
+	int64_t width = 0;
+	int64_t height = 0;
+	int64_t stride = 0; // width + padding
+	std::vector<float> texels;
+	std::vector<uint8_t> bytes; // The texels rounded to 8 bits, exact for the 8 bit textures
+};
+
+// Source textures which are blended by the color generator
+struct TerrainTextures
+{
+	// Files of the textures in the order low flat, low steep, high flat, high steep
+	static const wchar_t* const paths[4];
+
+	TerrainTextures();
+
+	TextureAtlas low_flat;
+	TextureAtlas low_steep;
+	TextureAtlas high_flat;
+	TextureAtlas high_steep;
+};
+
+// Filter of the heightmap mip levels, see MipPyramid.h
+enum class MipFilter;
+// Generator of the raw heights, see HeightfieldSource.h
+class HeightfieldSource;
+// Settings of the erosion after make_pretty, see Erosion.h
+struct ErosionSettings;
+// Formats of the full size heightfield and normal map, see PackedField.h
+enum class FieldStorage;
+class HeightStore;
+class NormalStore;
+class ColorStore;
+// Results of the pipeline stages on disk, see StageCache.h
+class StageCache;
+
+// Generators
+// Heights of the source compressed to [0;1]
+std::vector<float> generate_heightfield(const HeightfieldSource& source, int64_t resolution);
+// The normals are stored in the format of the heights
+NormalStore generate_normals(const HeightStore& height, int64_t resolution);
+std::vector<GEDUtils::Vec3f> generate_colors(const HeightStore& height, const NormalStore& normal, int64_t resolution);
+std::vector<float> resize_heightfield(const HeightStore& height, int64_t resolution);
+// Generates and saves all three maps in one pass over the rows and prints the cost of every stage, see Pipeline.cpp
+// With save_mips, the mip levels of the heightmap are saved next to it
+// The heightfield and the normal map are kept in the given storage format between the stages
+// With a cache, the stages whose inputs did not change since an earlier run are loaded instead, nullptr disables it
+bool generate_fused(const HeightfieldSource& source, int64_t resolution, _TCHAR* heightmap_path, _TCHAR* color_path, _TCHAR* normalmap_path,
+	bool save_mips, MipFilter mip_filter, const ErosionSettings& erosion, FieldStorage storage, const StageCache* cache);
+// Generates all three maps without keeping a full resolution map in memory, see Streaming.cpp
+bool generate_streaming(const HeightfieldSource& source, int64_t resolution, int64_t memory_budget, const std::wstring& scratch_directory,
+	_TCHAR* heightmap_path, _TCHAR* color_path, _TCHAR* normalmap_path);
+// Times the kernels against each other, see Benchmark.cpp
+void benchmark_normals();
+// Single thread throughput of every heightfield source and kernel variant
+void benchmark_sources();
+// Single thread throughput and error of the pack and unpack kernels of the 16 bit storage formats
+void benchmark_packing();
+// Single thread throughput of the float and the 8 bit color kernels, returns false if a variant differs from the scalar one
+bool benchmark_colors();
+// Settings of the -benchmark suite
+struct BenchmarkOptions
+{
+	bool enabled = false;
+	int64_t max_resolution = 2048; // The sweep doubles the resolution from 256 up to this
+	int64_t warmup_runs = 2;
+	int64_t runs = 10;
+	double tolerance = 0.1; // A stage regresses if its median is slower than the baseline by more than this fraction
+	_TCHAR* json_path = nullptr;
+	_TCHAR* baseline_path = nullptr;
+	std::wstring scratch_directory; // save_image writes its files here
+};
+// Times every stage over a sweep of resolutions, returns false if a stage regressed against the baseline
+bool benchmark_pipeline(const HeightfieldSource& source, const BenchmarkOptions& options);
+// Other
+void smooth_heightfield(std::vector<float>& height, int64_t resolution, int64_t iterations, int64_t kernel_size);
+// Box filters the resolution² heights in place, without a second field, and returns false if progress cancelled it
+// Only rows within kernel_size of a column block are buffered, the columns are split over the threads
+bool smooth_heightfield(float* height, int64_t resolution, int64_t iterations, int64_t kernel_size, const ProgressCallback& progress);
+void make_pretty(std::vector<float>& height, int64_t resolution);
+bool save_image(std::vector<float>& data, int64_t resolution, _TCHAR* path);
+bool save_image(std::vector<GEDUtils::Vec3f>& data, int64_t resolution, _TCHAR* path);
+bool save_image(const NormalStore& data, _TCHAR* path);
+bool save_image(const ColorStore& data, _TCHAR* path);
+
+// Kernels, shared by the in-memory and the streaming generator
+// Box filter of one row with clamped borders, using a running sum
+void blur_row(const float* in, float* out, int64_t resolution, int64_t kernel_size);
+// Box filter of the columns [column_begin; column_end) for the rows [row_begin; row_end), with clamped borders
+// in[y] has to be valid for the rows within kernel_size of the range, out[y] for the range itself
+void blur_columns(const float* const* in, float* const* out, int64_t resolution, int64_t kernel_size,
+	int64_t row_begin, int64_t row_end, int64_t column_begin, int64_t column_end);
+// Same for all rows, writing the result over the input
+// ring has to hold (kernel_size + 2) * (column_end - column_begin) floats for the original rows still in the window
+void blur_columns_in_place(float* const* rows, int64_t resolution, int64_t kernel_size, int64_t column_begin, int64_t column_end, float* ring);
+// Mixes a row of the original and the smoothed heightfield (see make_pretty)
+// smoothed_above and smoothed_below are the neighbouring rows used for the slope, height and out may be the same row
+void mix_row(const float* height, const float* smoothed, const float* smoothed_above, const float* smoothed_below, int64_t resolution, float* out);
+// Normals of one row, y_scale is 0.5 for central and 1 for one-sided differences at the border
+// Dispatches to the variant for g_simd_level, see NormalKernels.cpp
+void normal_row(const float* above, const float* below, float y_scale, const float* height, int64_t resolution, GEDUtils::Vec3f* out);
+void normal_row_scalar(const float* above, const float* below, float y_scale, const float* height, int64_t resolution, GEDUtils::Vec3f* out);
+void normal_row_sse2(const float* above, const float* below, float y_scale, const float* height, int64_t resolution, GEDUtils::Vec3f* out);
+void normal_row_avx2(const float* above, const float* below, float y_scale, const float* height, int64_t resolution, GEDUtils::Vec3f* out);
+// Dispatches to the variant for g_simd_level, see ColorKernels.cpp
+void color_row(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, GEDUtils::Vec3f* out);
+void color_row_scalar(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, GEDUtils::Vec3f* out);
+void color_row_sse2(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, GEDUtils::Vec3f* out);
+void color_row_avx2(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, GEDUtils::Vec3f* out);
+// Same colors as R8G8B8A8 with an alpha of 255, blended in 8 bit fixed point from the byte texels
+// The blend factors are rounded to 1/256 and every blend rounds to the nearest byte, all variants give the same bits
+void color_row_unorm8(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, uint32_t* out);
+void color_row_unorm8_scalar(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, uint32_t* out);
+void color_row_unorm8_sse2(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, uint32_t* out);
+void color_row_unorm8_avx2(const float* height, const GEDUtils::Vec3f* normal, int64_t y, int64_t resolution, const TerrainTextures& textures, uint32_t* out);
+// Averages 4x4 blocks of the four given rows into one output row of resolution / 4 pixels
+void downsample_row(const float* const* rows, int64_t resolution, float* out);
+
+// Helpers
+// Both run on the task pool of TaskScheduler.h
+void parallel_for(int64_t begin, int64_t end, const std::function<void(int64_t, int64_t)>& body);
+// Runs body(x_begin, y_begin, x_end, y_end) for every tile of a width x height field, in any order
+void parallel_for_2d(int64_t width, int64_t height, int64_t tile_size, const std::function<void(int64_t, int64_t, int64_t, int64_t)>& body);
+float random_normal(uint64_t seed, int64_t x, int64_t y, int64_t level);
+
+// Grants access to a flattened array
+// inline tells the compiler to replace the method call with the method body
+inline int64_t idx(int64_t x, int64_t y, int64_t size)
+{
+	return x + y * size;
+}
+
+// Smoothstep from https://en.wikipedia.org/wiki/Smoothstep
+inline float smoothstep(float x)
+{
+	return x * x * (3.0f - 2.0f * x);
+}
+
+// std::clamp is only available in C++ 17+
+inline float clamp(float x, float min = 0.0f, float max = 1.0f)
+{
+	return std::min(std::max(min, x), max);
+}
+
+inline float map_range(float x, float from_low, float from_high, float to_low = 0.0f, float to_high = 1.0f)
+{
+	return ((x - from_low) / (from_high - from_low)) * (to_high - to_low) + to_low;
+}
+
+inline GEDUtils::Vec3f blend(GEDUtils::Vec3f& a, GEDUtils::Vec3f& b, float alpha)
+{
+	GEDUtils::Vec3f result;
+	result.x = a.x * (1.0f - alpha) + b.x * alpha;
+	result.y = a.y * (1.0f - alpha) + b.y * alpha;
+	result.z = a.z * (1.0f - alpha) + b.z * alpha;
+	return result;
+}
@@ -0,0 +1,161 @@
+#include "TerrainTile.h"
+
+#include <cmath>
+#include <memory>
+
+// Inclusive rectangle of world coordinates
+struct Region
+{
+	int64_t x_begin;
+	int64_t y_begin;
+	int64_t x_end;
+	int64_t y_end;
+};
+
+// Grows the region by margin on every side, rounds it outwards to multiples of align and clips it to the world
+static Region expand(const Region& region, int64_t margin, int64_t align, int64_t world_resolution)
+{
+	Region result;
+	result.x_begin = std::max(region.x_begin - margin, 0ll) / align * align;
+	result.y_begin = std::max(region.y_begin - margin, 0ll) / align * align;
+	result.x_end = std::min((region.x_end + margin + align - 1) / align * align, world_resolution);
+	result.y_end = std::min((region.y_end + margin + align - 1) / align * align, world_resolution);
+	return result;
+}
+
+// First value >= begin which is offset modulo distance
+inline int64_t first_at(int64_t begin, int64_t distance, int64_t offset)
+{
+	return (begin + distance - offset - 1) / distance * distance + offset;
+}
+
+// Samples of one Diamond-Square level which lie in a region, the samples are 2^shift apart
+class Lattice
+{
+public:
+	Lattice(const Region& region, int64_t shift)
+		: region(region), shift(shift),
+		width(((region.x_end - region.x_begin) >> shift) + 1),
+		values(width * (((region.y_end - region.y_begin) >> shift) + 1))
+	{
+	}
+
+	// x and y are world coordinates of a sample in the region
+	float& at(int64_t x, int64_t y) { return values[idx((x - region.x_begin) >> shift, (y - region.y_begin) >> shift, width)]; }
+
+	const Region region;
+	const int64_t shift;
+
+private:
+	int64_t width;
+	std::vector<float> values;
+};
+
+int64_t tile_count(int64_t world_resolution, int64_t tile_size, int64_t lod)
+{
+	if (world_resolution <= 0 || tile_size <= 0 || lod < 0 || lod >= 62)
+		return 0;
+	return world_resolution / (tile_size << lod);
+}
+
+std::vector<float> generate_tile(const TileKey& key, int64_t world_resolution, int64_t tile_size)
+{
+	int64_t tiles = tile_count(world_resolution, tile_size, key.lod);
+	if (tiles <= 0 || key.tile_x < 0 || key.tile_x >= tiles || key.tile_y < 0 || key.tile_y >= tiles)
+		return std::vector<float>();
+
+	// The samples of the tile are those of the Diamond-Square level with this spacing
+	int64_t step = 1ll << key.lod;
+	Region target;
+	target.x_begin = key.tile_x * tile_size * step;
+	target.y_begin = key.tile_y * tile_size * step;
+	target.x_end = target.x_begin + tile_size * step;
+	target.y_end = target.y_begin + tile_size * step;
+
+	// Going up the levels, the samples of a level need the coarser samples within the coarser distance,
+	// so regions[i] is the part of the level with spacing step << i which has to be computed
+	std::vector<Region> regions(1, target);
+	for (int64_t spacing = step; spacing < world_resolution; spacing *= 2)
+		regions.push_back(expand(regions.back(), spacing * 2, spacing * 2, world_resolution));
+
+	// Initialize corners, the coarsest level always covers the whole world
+	int64_t shift = 0;
+	while ((1ll << shift) < world_resolution)
+		shift++;
+	std::unique_ptr<Lattice> coarse(new Lattice(regions.back(), shift));
+	coarse->at(0, 0) = random_normal(key.seed, 0, 0, 0);
+	coarse->at(world_resolution, 0) = random_normal(key.seed, world_resolution, 0, 0);
+	coarse->at(0, world_resolution) = random_normal(key.seed, 0, world_resolution, 0);
+	coarse->at(world_resolution, world_resolution) = random_normal(key.seed, world_resolution, world_resolution, 0);
+
+	// Same levels, order of the additions and random numbers as Diamond-Square over the whole field in one piece
+	int64_t level = 1;
+	for (int64_t distance = world_resolution; distance > step; distance = distance / 2, level++)
+	{
+		int64_t half = distance / 2;
+		float deviation = pow(0.56f, static_cast<float>(level));
+		const Region& region = regions[regions.size() - 1 - level];
+
+		// The squares at the border of the region read the diamond centers around it
+		shift--;
+		std::unique_ptr<Lattice> fine(new Lattice(expand(region, half, half, world_resolution), shift));
+		const Region& extended = fine->region;
+
+		// Samples of the coarser levels
+		for (int64_t y = first_at(extended.y_begin, distance, 0); y <= extended.y_end; y += distance)
+			for (int64_t x = first_at(extended.x_begin, distance, 0); x <= extended.x_end; x += distance)
+				fine->at(x, y) = coarse->at(x, y);
+
+		// Diamond
+		for (int64_t y = first_at(extended.y_begin, distance, half); y <= extended.y_end; y += distance)
+			for (int64_t x = first_at(extended.x_begin, distance, half); x <= extended.x_end; x += distance)
+			{
+				float sum = 0;
+				sum += coarse->at(x - half, y - half); // 1
+				sum += coarse->at(x + half, y - half); // 2
+				sum += coarse->at(x - half, y + half); // 3
+				sum += coarse->at(x + half, y + half); // 4
+				fine->at(x, y) = sum / 4.0f + deviation * random_normal(key.seed, x, y, level);
+			}
+
+		// Square, only within the region itself
+		// Rows through the corners have their midpoints between the corners,
+		// rows through the centers start at the left border
+		for (int64_t y = first_at(region.y_begin, half, 0); y <= region.y_end; y += half)
+			for (int64_t x = first_at(region.x_begin, distance, (y % distance == 0) ? half : 0); x <= region.x_end; x += distance)
+			{
+				float sum = 0.0f;
+				float count = 0.0f;
+				if (x >= half)
+				{
+					sum += fine->at(x - half, y); // 1
+					count++;
+				}
+				if (x + half <= world_resolution)
+				{
+					sum += fine->at(x + half, y); // 2
+					count++;
+				}
+				if (y + half <= world_resolution)
+				{
+					sum += fine->at(x, y + half); // 3
+					count++;
+				}
+				if (y >= half)
+				{
+					sum += fine->at(x, y - half); // 4
+					count++;
+				}
+				fine->at(x, y) = sum / count + deviation * random_normal(key.seed, x, y, level);
+			}
+
+		coarse = std::move(fine);
+	}
+
+	std::vector<float> tile((tile_size + 1) * (tile_size + 1));
+	for (int64_t y = 0; y <= tile_size; y++)
+		for (int64_t x = 0; x <= tile_size; x++)
+			tile[idx(x, y, tile_size + 1)] = coarse->at(target.x_begin + x * step, target.y_begin + y * step);
+
+	return tile;
+}
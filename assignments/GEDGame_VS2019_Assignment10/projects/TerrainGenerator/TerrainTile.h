@@ -0,0 +1,26 @@
+#pragma once
+
+#include "TerrainGenerator.h"
+
+// Chunk addressable Diamond-Square
+// The world is one (world_resolution + 1)² Diamond-Square field. Every sample only depends on its random
+// numbers and on coarser samples close to it, so any part of the field can be computed on its own.
+// A tile holds (tile_size + 1)² samples, neighbouring tiles share their border samples.
+// At lod k the samples are 2^k world pixels apart, which are exactly the samples of the coarser
+// Diamond-Square levels, so the lods are subsets of each other as well.
+
+// Address of a tile, tile_x and tile_y count tiles of the given lod from the upper left corner
+struct TileKey
+{
+	uint64_t seed = 0;
+	int64_t tile_x = 0;
+	int64_t tile_y = 0;
+	int64_t lod = 0;
+};
+
+// Number of tiles of the lod along one side of the world, 0 if the tile size does not fit
+int64_t tile_count(int64_t world_resolution, int64_t tile_size, int64_t lod);
+
+// Unnormalized Diamond-Square samples of the tile, row by row, bit-identical to the same samples of the whole field
+// world_resolution and tile_size have to be powers of two, returns an empty vector for a tile outside of the world
+std::vector<float> generate_tile(const TileKey& key, int64_t world_resolution, int64_t tile_size);
@@ -9,6 +9,9 @@
 
 #include <DirectXTex.h>
 
+#include <assert.h>
+#include <stdint.h>
+
 namespace GEDUtils
 {
     /// Utility struct: A 2-dimensional float vector
@@ -49,26 +52,21 @@ namespace GEDUtils
 
 
     // Utility structs for type conversion below
+    //
+    // Every supported type specializes ImageFormatUtils with
+    // - SUPPORTED = true and the DXGI FORMAT the type is stored as
+    // - StorageType, one pixel in the memory of the image, PIXEL_SIZE bytes
+    // - convert() for one pixel and convertRow() for count consecutive pixels. The row versions are plain
+    //   loops without aliasing or per-pixel format checks, which the compiler can vectorize
+    // Writing rounds to the nearest stored value, so reading a pixel and writing it back does not change it.
+    // All members are static, the format is fixed at compile time.
 
     template<typename T>
     class ImageFormatUtils
     {
     public:
-        bool isFormatCompatible(DXGI_FORMAT format)
-        {
-            assert(false && "Not implemented for this data type");
-        }
-
-        void convert(const uint8_t* from, T& to)
-        {
-            assert(false && "Not implemented for this data type");
-        }
-
-        void convert(const T& from, uint8_t* to)
-        {
-            assert(false && "Not implemented for this data type");
-        }
-
+        /// False for types without a specialization, SimpleImage<T> fails to compile for them
+        static const bool SUPPORTED = false;
         static const DXGI_FORMAT FORMAT = DXGI_FORMAT_UNKNOWN;
     };
 
@@ -77,12 +75,18 @@ namespace GEDUtils
     class ImageFormatUtils<Color4f>
     {
     public:
-        bool isFormatCompatible(DXGI_FORMAT format)
+        static const bool SUPPORTED = true;
+        static const DXGI_FORMAT FORMAT = DXGI_FORMAT_R8G8B8A8_UNORM;
+        /// Packed RGBA with R in the lowest byte
+        typedef uint32_t StorageType;
+        static const size_t PIXEL_SIZE = sizeof(StorageType);
+
+        static bool isFormatCompatible(DXGI_FORMAT format)
         {
             return format == DXGI_FORMAT_R8G8B8A8_UNORM || format == DXGI_FORMAT_R8G8B8A8_UNORM_SRGB;
         }
 
-        void convert(const uint8_t* from, Color4f& to)
+        static void convert(const uint8_t* from, Color4f& to)
         {
             to.r = float(from[0]) / 255.0f;
             to.g = float(from[1]) / 255.0f;
@@ -90,20 +94,40 @@ namespace GEDUtils
             to.a = float(from[3]) / 255.0f;
         }
 
-        void convert(const Color4f& from, uint8_t* to)
+        static void convert(const Color4f& from, uint8_t* to)
         {
             assert(from.r <= 1.0f && "Invalid R color value, must be between 0 and 1");
             assert(from.g <= 1.0f && "Invalid G color value, must be between 0 and 1");
             assert(from.b <= 1.0f && "Invalid B color value, must be between 0 and 1");
             assert(from.a <= 1.0f && "Invalid A color value, must be between 0 and 1");
 
-            to[0] = uint8_t(from.r * 255.0f);
-            to[1] = uint8_t(from.g * 255.0f);
-            to[2] = uint8_t(from.b * 255.0f);
-            to[3] = uint8_t(from.a * 255.0f);
+            to[0] = uint8_t(from.r * 255.0f + 0.5f);
+            to[1] = uint8_t(from.g * 255.0f + 0.5f);
+            to[2] = uint8_t(from.b * 255.0f + 0.5f);
+            to[3] = uint8_t(from.a * 255.0f + 0.5f);
         }
 
-        static const DXGI_FORMAT FORMAT = DXGI_FORMAT_R8G8B8A8_UNORM;
+        static void convertRow(const uint8_t* __restrict from, Color4f* __restrict to, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                to[i].r = float(from[4 * i + 0]) / 255.0f;
+                to[i].g = float(from[4 * i + 1]) / 255.0f;
+                to[i].b = float(from[4 * i + 2]) / 255.0f;
+                to[i].a = float(from[4 * i + 3]) / 255.0f;
+            }
+        }
+
+        static void convertRow(const Color4f* __restrict from, uint8_t* __restrict to, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                to[4 * i + 0] = uint8_t(from[i].r * 255.0f + 0.5f);
+                to[4 * i + 1] = uint8_t(from[i].g * 255.0f + 0.5f);
+                to[4 * i + 2] = uint8_t(from[i].b * 255.0f + 0.5f);
+                to[4 * i + 3] = uint8_t(from[i].a * 255.0f + 0.5f);
+            }
+        }
     };
 
 
@@ -111,23 +135,40 @@ namespace GEDUtils
     class ImageFormatUtils<float>
     {
     public:
-        bool isFormatCompatible(DXGI_FORMAT format)
+        static const bool SUPPORTED = true;
+        static const DXGI_FORMAT FORMAT = DXGI_FORMAT_R16_UNORM;
+        typedef uint16_t StorageType;
+        static const size_t PIXEL_SIZE = sizeof(StorageType);
+
+        static bool isFormatCompatible(DXGI_FORMAT format)
         {
             return format == DXGI_FORMAT_R16_UNORM;
         }
 
-        void convert(const uint8_t* from, float& to)
+        static void convert(const uint8_t* from, float& to)
         {
             to = float(*(const uint16_t*)from) / 0xFFFF;
         }
 
-        void convert(const float& from, uint8_t* to)
+        static void convert(const float& from, uint8_t* to)
         {
             assert(from >= 0 && from <= 1.0f && "Invalid float value, must be between 0 and 1");
-            *(uint16_t*)to = uint16_t(from * 0xFFFF);
+            *(uint16_t*)to = uint16_t(from * 0xFFFF + 0.5f);
         }
 
-        static const DXGI_FORMAT FORMAT = DXGI_FORMAT_R16_UNORM;
+        static void convertRow(const uint8_t* __restrict from, float* __restrict to, size_t count)
+        {
+            const uint16_t* values = (const uint16_t*)from;
+            for (size_t i = 0; i < count; i++)
+                to[i] = float(values[i]) / 0xFFFF;
+        }
+
+        static void convertRow(const float* __restrict from, uint8_t* __restrict to, size_t count)
+        {
+            uint16_t* values = (uint16_t*)to;
+            for (size_t i = 0; i < count; i++)
+                values[i] = uint16_t(from[i] * 0xFFFF + 0.5f);
+        }
     };
 
 
@@ -135,30 +176,55 @@ namespace GEDUtils
     class ImageFormatUtils<Vec3f>
     {
     public:
-        bool isFormatCompatible(DXGI_FORMAT format)
+        static const bool SUPPORTED = true;
+        static const DXGI_FORMAT FORMAT = DXGI_FORMAT_R8G8B8A8_UNORM;
+        /// Packed RGBA with X in the lowest byte and A = 255, the components map [-1, 1] to [0, 255]
+        typedef uint32_t StorageType;
+        static const size_t PIXEL_SIZE = sizeof(StorageType);
+
+        static bool isFormatCompatible(DXGI_FORMAT format)
         {
             return format == DXGI_FORMAT_R8G8B8A8_UNORM;
         }
 
-        void convert(const uint8_t* from, Vec3f& to)
+        static void convert(const uint8_t* from, Vec3f& to)
         {
-            to.x = float(from[0]) / 255.0f;
-            to.y = float(from[1]) / 255.0f;
-            to.z = float(from[2]) / 255.0f;
+            to.x = float(from[0]) / 127.5f - 1.0f;
+            to.y = float(from[1]) / 127.5f - 1.0f;
+            to.z = float(from[2]) / 127.5f - 1.0f;
         }
 
-        void convert(const Vec3f& from, uint8_t* to)
+        static void convert(const Vec3f& from, uint8_t* to)
         {
             assert(from.x >= -1.0f && from.x <= 1.0f && "Invalid X normal value, must be between -1 and 1");
             assert(from.y >= -1.0f && from.y <= 1.0f && "Invalid Y normal value, must be between -1 and 1");
             assert(from.z >= -1.0f && from.z <= 1.0f && "Invalid Z normal value, must be between -1 and 1");
 
-            to[0] = uint8_t((from.x * 0.5f + 0.5f) * 255.0f);
-            to[1] = uint8_t((from.y * 0.5f + 0.5f) * 255.0f);
-            to[2] = uint8_t((from.z * 0.5f + 0.5f) * 255.0f);
+            to[0] = uint8_t(from.x * 127.5f + 128.0f);
+            to[1] = uint8_t(from.y * 127.5f + 128.0f);
+            to[2] = uint8_t(from.z * 127.5f + 128.0f);
             to[3] = 255;
         }
 
-        static const DXGI_FORMAT FORMAT = DXGI_FORMAT_R8G8B8A8_UNORM;
+        static void convertRow(const uint8_t* __restrict from, Vec3f* __restrict to, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                to[i].x = float(from[4 * i + 0]) / 127.5f - 1.0f;
+                to[i].y = float(from[4 * i + 1]) / 127.5f - 1.0f;
+                to[i].z = float(from[4 * i + 2]) / 127.5f - 1.0f;
+            }
+        }
+
+        static void convertRow(const Vec3f* __restrict from, uint8_t* __restrict to, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                to[4 * i + 0] = uint8_t(from[i].x * 127.5f + 128.0f);
+                to[4 * i + 1] = uint8_t(from[i].y * 127.5f + 128.0f);
+                to[4 * i + 2] = uint8_t(from[i].z * 127.5f + 128.0f);
+                to[4 * i + 3] = 255;
+            }
+        }
     };
 }
\ No newline at end of file
@@ -12,6 +12,7 @@
 #include <assert.h>
 #include <exception>
 
+#include <algorithm>
 #include <vector>
 
 #include <wincodec.h>
@@ -25,6 +26,30 @@ namespace GEDUtils
     /// Decrease the Windows Imaging Components reference counter and deinitialize WIC if this is the last call
     void WICUnref();
 
+
+    /**
+    Contiguous view of count elements starting at data, in the style of C++20 std::span.
+    SimpleImage hands out its rows as ImageSpan of the stored pixel type, which points directly into the
+    memory of the DirectX::ScratchImage; the view is valid as long as the image is alive and not moved.
+    **/
+    template<typename S>
+    class ImageSpan
+    {
+    public:
+        ImageSpan(S* data, size_t count): m_data(data), m_count(count) {}
+
+        S* data() const { return m_data; }
+        size_t size() const { return m_count; }
+        bool empty() const { return m_count == 0; }
+        S& operator[](size_t i) const { assert(i < m_count && "Index out of bounds"); return m_data[i]; }
+        S* begin() const { return m_data; }
+        S* end() const { return m_data + m_count; }
+
+    private:
+        S*      m_data;
+        size_t  m_count;
+    };
+
     
     /**
     Simple image utility class.
@@ -40,19 +65,28 @@ namespace GEDUtils
 
     Supported types are:
     - GEDUtils::Color4f, mapped to a rgba-image with 8 bits per pixel (DXGI_FORMAT_R8G8B8A8_UNORM)
-    - GEDUtils::Vec3f, mapped to a 4-component 32-bit floating point image (DXGI_FORMAT_R32G32B32A32_FLOAT)
-    - float, mapped to a greyscale 32-bit floating point image
+    - GEDUtils::Vec3f, mapped to the same rgba-image, with each component in [-1, 1] (DXGI_FORMAT_R8G8B8A8_UNORM)
+    - float, mapped to a greyscale image with 16 bits per pixel (DXGI_FORMAT_R16_UNORM)
 
     The methods getPixel() and setPixel() provide automatic type conversion to the mapped type.
-    Instantiating this class with a template parameter other than the supported types will result
-    in a runtime exception.
+    readRow(), writeRow(), fill() and transform() convert whole rows at once, and getRow() returns
+    the stored pixels of a row without any conversion. Prefer them over getPixel() and setPixel() when
+    a large part of the image is accessed.
+    Instantiating this class with a template parameter other than the supported types will fail
+    to compile.
 
     For a more sophisticated format support, you need to use the DirectXTex library!
     **/
     template<typename T>
     class SimpleImage
     {
+        static_assert(ImageFormatUtils<T>::SUPPORTED, "SimpleImage supports only Color4f, Vec3f and float, see ImageFormats.h");
+
     public:
+        typedef ImageFormatUtils<T> FormatUtils;
+        /// One pixel as it is stored in the image
+        typedef typename FormatUtils::StorageType StorageType;
+
         /// Constructor, loads an image from disk
         SimpleImage(const std::wstring& filename);
         /** 
@@ -70,10 +104,32 @@ namespace GEDUtils
         ~SimpleImage();
 
 
+        unsigned int getWidth() const { return (unsigned int)m_image.GetMetadata().width; }
+        unsigned int getHeight() const { return (unsigned int)m_image.GetMetadata().height; }
+
         /// Get the pixel value at position x, y (converted to the specified type)
-        T getPixel(unsigned int x, unsigned int y);
+        T getPixel(unsigned int x, unsigned int y) const;
         /// Set the pixel value at position x, y (converted from the specified type)
         void setPixel(unsigned int x, unsigned int y, const T& value);
+
+        /// Stored pixels of row y, without conversion
+        ImageSpan<StorageType> getRow(unsigned int y);
+        /// Stored pixels of row y, without conversion, const version
+        ImageSpan<const StorageType> getRow(unsigned int y) const;
+
+        /// Convert the getWidth() pixels of row y into out
+        void readRow(unsigned int y, T* out) const;
+        /// Convert getWidth() pixels from in into row y, unlike setPixel() the values are not range checked
+        void writeRow(unsigned int y, const T* in);
+
+        /// Set every pixel to value, which is converted only once
+        void fill(const T& value);
+        /**
+        Replace every pixel p by f(p). The image is converted row by row into a buffer of T, f is applied
+        to the whole row and the row is converted back, so f can be inlined into a loop over the row.
+        **/
+        template<typename F>
+        void transform(F f);
         
         /// Get the underlying DirectX::ScratchImage itself
         DirectX::ScratchImage& getImage() { return m_image; }
@@ -85,14 +141,16 @@ namespace GEDUtils
 
 
     private:
+        const uint8_t* rowPointer(unsigned int y) const;
+        uint8_t* rowPointer(unsigned int y);
+
         DirectX::ScratchImage       m_image;
-        ImageFormatUtils<T>         m_formatUtils;
     };
 
 
     typedef SimpleImage<Color4f> SimpleColorImage;      ///< 8bit rgba color image
-    typedef SimpleImage<float> SimpleFloatImage;        ///< 32bit greyscale image
-    typedef SimpleImage<Vec3f> SimpleNormalImage;       ///< 32bit rgba image
+    typedef SimpleImage<float> SimpleFloatImage;        ///< 16bit greyscale image
+    typedef SimpleImage<Vec3f> SimpleNormalImage;       ///< 8bit rgba image
 
 
 
@@ -124,7 +182,7 @@ namespace GEDUtils
             
 
         // Check for matching formats
-        if (!m_formatUtils.isFormatCompatible(m_image.GetMetadata().format))
+        if (!FormatUtils::isFormatCompatible(m_image.GetMetadata().format))
         {
             std::wstringstream ss;
             ss << "Image does not contain compatible data: \"" << filename << "\"";
@@ -136,13 +194,15 @@ namespace GEDUtils
 
 
     template<typename T>
-    SimpleImage<T>::SimpleImage(const SimpleImage<T>& copy): m_image(copy.m_image)
+    SimpleImage<T>::SimpleImage(const SimpleImage<T>& copy)
     {
         WICRef();
+        // ScratchImage cannot be copied, only its first image is used
+        m_image.InitializeFromImage(*copy.m_image.GetImage(0, 0, 0));
     }
         
     template<typename T>
-    SimpleImage<T>::SimpleImage(SimpleImage<T>&& copy): m_image(copy.m_image)
+    SimpleImage<T>::SimpleImage(SimpleImage<T>&& copy): m_image(std::move(copy.m_image))
     {
         WICRef();
     }
@@ -159,18 +219,34 @@ namespace GEDUtils
     SimpleImage<T>::SimpleImage(unsigned int width, unsigned int height)
     {
         WICRef();
-        m_image.Initialize2D(ImageFormatUtils<T>::FORMAT, width, height, 1, 1);
+        m_image.Initialize2D(FormatUtils::FORMAT, width, height, 1, 1);
     }
 
 
     template<typename T>
-    T SimpleImage<T>::getPixel(unsigned int x, unsigned int y)
+    const uint8_t* SimpleImage<T>::rowPointer(unsigned int y) const
     {
-        assert(x < m_image.GetMetadata().width && y < m_image.GetMetadata().height && "Pixel out of bounds");
+        assert(y < m_image.GetMetadata().height && "Row out of bounds");
+        const DirectX::Image* image = m_image.GetImage(0, 0, 0);
+        return image->pixels + y * image->rowPitch;
+    }
+
+
+    template<typename T>
+    uint8_t* SimpleImage<T>::rowPointer(unsigned int y)
+    {
+        assert(y < m_image.GetMetadata().height && "Row out of bounds");
+        const DirectX::Image* image = m_image.GetImage(0, 0, 0);
+        return image->pixels + y * image->rowPitch;
+    }
+
+
+    template<typename T>
+    T SimpleImage<T>::getPixel(unsigned int x, unsigned int y) const
+    {
+        assert(x < m_image.GetMetadata().width && "Pixel out of bounds");
         T result;
-        const uint8_t* pPixel = m_image.GetImage(0, 0, 0)->pixels + y * m_image.GetImage(0, 0, 0)->rowPitch + x * DirectX::BitsPerPixel(m_image.GetMetadata().format) / 8;
-            
-        m_formatUtils.convert(pPixel, result);
+        FormatUtils::convert(rowPointer(y) + x * FormatUtils::PIXEL_SIZE, result);
         return result;
     }
 
@@ -178,10 +254,66 @@ namespace GEDUtils
     template<typename T>
     void SimpleImage<T>::setPixel(unsigned int x, unsigned int y, const T& value)
     {
-        assert(x < m_image.GetMetadata().width && y < m_image.GetMetadata().height && "Pixel out of bounds");
-        uint8_t* pPixel = m_image.GetImage(0, 0, 0)->pixels + y * m_image.GetImage(0, 0, 0)->rowPitch + x * DirectX::BitsPerPixel(m_image.GetMetadata().format) / 8;
-            
-        m_formatUtils.convert(value, pPixel);
+        assert(x < m_image.GetMetadata().width && "Pixel out of bounds");
+        FormatUtils::convert(value, rowPointer(y) + x * FormatUtils::PIXEL_SIZE);
+    }
+
+
+    template<typename T>
+    ImageSpan<typename SimpleImage<T>::StorageType> SimpleImage<T>::getRow(unsigned int y)
+    {
+        return ImageSpan<StorageType>(reinterpret_cast<StorageType*>(rowPointer(y)), getWidth());
+    }
+
+
+    template<typename T>
+    ImageSpan<const typename SimpleImage<T>::StorageType> SimpleImage<T>::getRow(unsigned int y) const
+    {
+        return ImageSpan<const StorageType>(reinterpret_cast<const StorageType*>(rowPointer(y)), getWidth());
+    }
+
+
+    template<typename T>
+    void SimpleImage<T>::readRow(unsigned int y, T* out) const
+    {
+        FormatUtils::convertRow(rowPointer(y), out, getWidth());
+    }
+
+
+    template<typename T>
+    void SimpleImage<T>::writeRow(unsigned int y, const T* in)
+    {
+        FormatUtils::convertRow(in, rowPointer(y), getWidth());
+    }
+
+
+    template<typename T>
+    void SimpleImage<T>::fill(const T& value)
+    {
+        StorageType stored;
+        FormatUtils::convert(value, reinterpret_cast<uint8_t*>(&stored));
+
+        for (unsigned int y = 0; y < getHeight(); y++)
+        {
+            ImageSpan<StorageType> row = getRow(y);
+            std::fill(row.begin(), row.end(), stored);
+        }
+    }
+
+
+    template<typename T>
+    template<typename F>
+    void SimpleImage<T>::transform(F f)
+    {
+        std::vector<T> row(getWidth());
+
+        for (unsigned int y = 0; y < getHeight(); y++)
+        {
+            readRow(y, row.data());
+            for (T& pixel : row)
+                pixel = f(pixel);
+            writeRow(y, row.data());
+        }
     }
 
 